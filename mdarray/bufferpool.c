@@ -0,0 +1,132 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "bufferpool.h"
+#include <pthread.h>
+#include <stddef.h>
+
+
+
+/* Size of the buffer is stored just before the data */
+typedef union {
+	size_t size;
+	max_align_t align;
+} PoolHeader;
+
+typedef struct {
+	size_t size;
+	int count;
+	void *items[POOL_DEPTH];
+} PoolClass;
+
+static PoolClass poolClasses[POOL_CLASSES];
+static long pooledBytes = 0;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/* Buffer of the given size, taken from the pool if possible; *
+ * returns NULL and sets errno if out of memory.              */
+void *poolAlloc(size_t size) {
+	PoolHeader *header = NULL;
+	PoolClass *cls;
+	int i;
+
+	pthread_mutex_lock(&poolLock);
+	for (i = 0; i < POOL_CLASSES; i++) {
+		cls = poolClasses + i;
+		if (cls->size != size || cls->count == 0) continue;
+		cls->count -= 1;
+		header = (PoolHeader*) cls->items[cls->count];
+		pooledBytes -= size;
+		break;
+	}
+	pthread_mutex_unlock(&poolLock);
+
+	if (header == NULL) {
+		header = (PoolHeader*) malloc(sizeof(PoolHeader) + size);
+		if (header == NULL) return NULL;
+		header->size = size;
+	}
+	return header + 1;
+}
+
+
+/* Return a buffer obtained from poolAlloc; it is freed if the pool is full */
+void poolFree(void *ptr) {
+	PoolHeader *header;
+	PoolClass *cls = NULL, *empty = NULL;
+	int i;
+
+	if (ptr == NULL) return;
+	header = (PoolHeader*) ptr - 1;
+
+	pthread_mutex_lock(&poolLock);
+	for (i = 0; i < POOL_CLASSES; i++) {
+		if (poolClasses[i].size == header->size) {
+			cls = poolClasses + i;
+			break; }
+		if (empty == NULL && poolClasses[i].count == 0) empty = poolClasses + i;
+	}
+	// Sizes not used any more give way to the new ones
+	if (cls == NULL && empty != NULL) {
+		cls = empty;
+		cls->size = header->size;
+	}
+	if (cls != NULL && cls->count < POOL_DEPTH
+			&& pooledBytes + (long)header->size <= POOL_MAX_BYTES) {
+		cls->items[cls->count++] = header;
+		pooledBytes += header->size;
+		header = NULL;
+	}
+	pthread_mutex_unlock(&poolLock);
+
+	free(header);
+}
+
+
+static void releaseBuffer(PyObject *capsule) {
+	poolFree(PyCapsule_GetPointer(capsule, "mdarray.buffer"));
+}
+
+
+/* Create an array over data from poolAlloc; the buffer goes back to *
+ * the pool together with the array. On failure, the data is still   *
+ * owned by the caller.                                              */
+PyObject *poolArray(int nd, npy_intp *dims, int type, void *data) {
+	PyObject *py_arr, *capsule;
+
+	py_arr = PyArray_SimpleNewFromData(nd, dims, type, data);
+	if (py_arr == NULL) return NULL;
+	if ((capsule = PyCapsule_New(data, "mdarray.buffer", NULL)) == NULL) {
+		Py_DECREF(py_arr);
+		return NULL; }
+	// The reference to capsule is stolen, even on failure
+	if (PyArray_SetBaseObject((PyArrayObject*)py_arr, capsule) == -1) {
+		Py_DECREF(py_arr);
+		return NULL; }
+	// Only now the array is responsible for the memory
+	PyCapsule_SetDestructor(capsule, releaseBuffer);
+	return py_arr;
+}
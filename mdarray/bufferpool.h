@@ -0,0 +1,45 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+#ifndef __BUFFERPOOL_H__
+#define __BUFFERPOOL_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Buffers of frame data are recycled: when an array created by     *
+ * poolArray is deallocated, its memory goes back to the pool and   *
+ * is reused for the next frame of the same size. The pool is       *
+ * protected by a mutex, so the GIL is not needed.                  */
+#define POOL_CLASSES 8                /* number of different sizes kept */
+#define POOL_DEPTH 8                  /* buffers kept of each size */
+#define POOL_MAX_BYTES (256L << 20)   /* memory kept in the pool */
+
+void *poolAlloc(size_t size);
+void poolFree(void *ptr);
+PyObject *poolArray(int nd, npy_intp *dims, int type, void *data);
+
+#endif /* __BUFFERPOOL_H__ */
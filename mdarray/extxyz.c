@@ -0,0 +1,416 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "extxyz.h"
+#include "bufferpool.h"
+#include "utils.h"
+#include <ctype.h>
+#include <errno.h>
+#include <strings.h>
+
+
+
+void extPlanInit(ExtPlan *plan) {
+	plan->source = NULL;
+	plan->version = 0;
+	plan->nColumns = 0;
+	plan->nFields = 0;
+	plan->species = -1;
+}
+
+
+void extPlanFree(ExtPlan *plan) {
+	free(plan->source);
+	plan->source = NULL;
+	plan->nColumns = 0;
+}
+
+
+/* Compile Properties into the plan; returns -1 and sets errno to  *
+ * EINVAL, if the description is incorrect (the plan is not changed) */
+int extCompilePlan(ExtPlan *plan, const char *properties) {
+	ExtColumn columns[EXT_MAX_COLUMNS], *col;
+	const char *ptr = properties, *sep;
+	char *end, *source;
+	int n = 0, first = 0, species = -1, havePos = 0, haveVel = 0;
+	long width;
+
+	while (*ptr) {
+		if (n == EXT_MAX_COLUMNS) goto invalid;
+		col = columns + n;
+
+		// Name
+		if ((sep = strchr(ptr, ':')) == NULL || sep == ptr
+				|| sep - ptr >= EXT_NAME_SIZE) goto invalid;
+		memcpy(col->name, ptr, sep - ptr);
+		col->name[sep - ptr] = '\0';
+		ptr = sep + 1;
+
+		// Type
+		col->type = toupper((unsigned char)*ptr);
+		if (!col->type || strchr("SRIL", col->type) == NULL || ptr[1] != ':')
+			goto invalid;
+		ptr += 2;
+
+		// Number of columns
+		width = strtol(ptr, &end, 10);
+		if (end == ptr || width < 1 || width > 1024) goto invalid;
+		ptr = end;
+		if (*ptr == ':') ptr++;
+		else if (*ptr) goto invalid;
+		col->width = width;
+		col->first = first;
+		first += width;
+
+		// Columns that go to the usual fields of the frame
+		col->role = EXT_OTHER;
+		if (!strcmp(col->name, "species") && col->type == 'S'
+				&& width == 1 && species < 0) {
+			col->role = EXT_SPECIES;
+			species = n;
+		} else if ((!strcmp(col->name, "pos") || !strcmp(col->name, "positions"))
+				&& col->type == 'R' && width == 3 && !havePos) {
+			col->role = EXT_POS;
+			havePos = 1;
+		} else if ((!strcmp(col->name, "velo") || !strcmp(col->name, "vel")
+				|| !strcmp(col->name, "velocities"))
+				&& col->type == 'R' && width == 3 && !haveVel) {
+			col->role = EXT_VEL;
+			haveVel = 1;
+		}
+		n++;
+	}
+	if (!havePos) goto invalid;
+
+	if ((source = strdup(properties)) == NULL) return -1;
+	free(plan->source);
+	plan->source = source;
+	plan->version += 1;
+	plan->nColumns = n;
+	plan->nFields = first;
+	plan->species = species;
+	memcpy(plan->columns, columns, n * sizeof(ExtColumn));
+	return 0;
+
+	invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+
+/* Size of a single cell of a column of the given type */
+size_t extCellSize(char type) {
+	switch (type) {
+		case 'R': return sizeof(ARRAY_REAL);
+		case 'I': return sizeof(long);
+		case 'L': return sizeof(npy_bool);
+		default:  return EXT_STRING_SIZE;
+	}
+}
+
+
+void extFrameFree(ExtFrame *ext) {
+	int i;
+
+	for (i = 0; i < EXT_MAX_COLUMNS; i++) {
+		poolFree(ext->columns[i]);
+		ext->columns[i] = NULL;
+	}
+	free(ext->info);
+	ext->info = NULL;
+	ext->infoSize = 0;
+	ext->nInfo = 0;
+	ext->nReal = 0;
+}
+
+
+
+/* Copy a key or a value, which may be quoted ("..."), or put in *
+ * braces or brackets; returns the position after it.           */
+static const char *copyToken(const char *ptr, char **out, int key) {
+	char *dst = *out, close;
+
+	if (*ptr == '"') {
+		for (ptr++; *ptr && *ptr != '"'; ptr++) {
+			if (*ptr == '\\' && ptr[1]) {
+				ptr++;
+				*dst++ = (*ptr == 'n') ? '\n' : *ptr;
+			} else
+				*dst++ = *ptr;
+		}
+		if (*ptr) ptr++;
+	} else if (!key && (*ptr == '{' || *ptr == '[')) {
+		close = (*ptr == '{') ? '}' : ']';
+		for (ptr++; *ptr && *ptr != close; ptr++)
+			*dst++ = *ptr;
+		if (*ptr) ptr++;
+	} else {
+		while (*ptr && !isspace((unsigned char)*ptr) && !(key && *ptr == '='))
+			*dst++ = *ptr++;
+	}
+	*dst++ = '\0';
+	*out = dst;
+	return ptr;
+}
+
+
+/* Split the comment into key=value pairs; a key without a value *
+ * stands for T (true). Returns the number of pairs or -1.        */
+int extParseComment(ExtFrame *ext, const char *comment) {
+	const char *ptr = comment;
+	char *out, *tmp;
+	size_t need;
+
+	// Each pair is never longer than twice its text
+	need = 2 * strlen(comment) + 4;
+	if (ext->infoSize < need) {
+		if ((tmp = (char*) realloc(ext->info, need)) == NULL) return -1;
+		ext->info = tmp;
+		ext->infoSize = need;
+	}
+
+	out = ext->info;
+	ext->nInfo = 0;
+	ext->nReal = 0;
+	while (1) {
+		while (isspace((unsigned char)*ptr)) ptr++;
+		if (!*ptr) break;
+		ptr = copyToken(ptr, &out, 1);
+		if (*ptr == '=')
+			ptr = copyToken(ptr + 1, &out, 0);
+		else {
+			*out++ = 'T';
+			*out++ = '\0';
+		}
+		ext->nInfo += 1;
+	}
+
+	return ext->nInfo;
+}
+
+
+/* Vector of up to 9 reals given by the reader, in place of info */
+void extSetReal(ExtFrame *ext, const char *key, const double *values, int n) {
+	int i;
+
+	ext->nInfo = 0;
+	snprintf(ext->realKey, EXT_NAME_SIZE, "%s", key);
+	for (i = 0; i < n && i < 9; i++) ext->real[i] = values[i];
+	ext->nReal = i;
+}
+
+
+/* Value of the key (case is ignored) or NULL */
+const char *extFind(const ExtFrame *ext, const char *key) {
+	const char *ptr = ext->info;
+	int i;
+
+	for (i = 0; i < ext->nInfo; i++) {
+		if (!strcasecmp(ptr, key)) return ptr + strlen(ptr) + 1;
+		ptr += strlen(ptr) + 1;
+		ptr += strlen(ptr) + 1;
+	}
+	return NULL;
+}
+
+
+/* Next item of a list separated with blanks or commas */
+static const char *nextItem(const char *ptr, const char **end) {
+
+	while (*ptr && (isspace((unsigned char)*ptr) || *ptr == ',')) ptr++;
+	if (!*ptr) return NULL;
+	*end = ptr;
+	while (**end && !isspace((unsigned char)**end) && **end != ',') (*end)++;
+	return ptr;
+}
+
+
+/* Parse exactly n numbers; returns -1 if there is something else */
+int extParseNumbers(const char *value, double *numbers, int n) {
+	const char *item, *end, *stop;
+	int i = 0;
+
+	while ((item = nextItem(value, &end)) != NULL) {
+		if (i == n) return -1;
+		numbers[i++] = parseFloat(item, end, &stop);
+		if (stop != end) return -1;
+		value = end;
+	}
+	return i == n ? 0 : -1;
+}
+
+
+#define ITEM_INT   1
+#define ITEM_FLOAT 2
+#define ITEM_BOOL  4
+
+static int itemKind(const char *item, const char *end, long *ival, double *fval) {
+	static const char *trueWords[] = { "T", "True", "true", "TRUE", NULL };
+	static const char *falseWords[] = { "F", "False", "false", "FALSE", NULL };
+	size_t len = end - item;
+	const char *fstop;
+	char *stop;
+	int i;
+
+	*ival = strtol(item, &stop, 10);
+	if (stop == end) {
+		*fval = *ival;
+		return ITEM_INT | ITEM_FLOAT; }
+	*fval = parseFloat(item, end, &fstop);
+	if (fstop == end) return ITEM_FLOAT;
+	for (i = 0; trueWords[i] != NULL; i++)
+		if (strlen(trueWords[i]) == len && !strncmp(item, trueWords[i], len)) {
+			*ival = 1;
+			return ITEM_BOOL; }
+	for (i = 0; falseWords[i] != NULL; i++)
+		if (strlen(falseWords[i]) == len && !strncmp(item, falseWords[i], len)) {
+			*ival = 0;
+			return ITEM_BOOL; }
+	return 0;
+}
+
+
+/* Python object of a value: int, float, bool, an array of them or str */
+static PyObject *valueObject(const char *value) {
+	const char *item, *end, *ptr;
+	PyArrayObject *array;
+	npy_intp n = 0, i;
+	int kinds = ITEM_INT | ITEM_FLOAT | ITEM_BOOL, type;
+	long ival;
+	double fval;
+
+	for (ptr = value; (item = nextItem(ptr, &end)) != NULL; ptr = end) {
+		kinds &= itemKind(item, end, &ival, &fval);
+		n++;
+	}
+	if (n == 0 || kinds == 0) return PyUnicode_FromString(value);
+
+	if (n == 1) {
+		if (kinds & ITEM_INT) return PyLong_FromLong(ival);
+		if (kinds & ITEM_FLOAT) return PyFloat_FromDouble(fval);
+		return PyBool_FromLong(ival);
+	}
+
+	if (kinds & ITEM_INT)        type = NPY_LONG;
+	else if (kinds & ITEM_FLOAT) type = NPY_DOUBLE;
+	else                         type = NPY_BOOL;
+	array = (PyArrayObject*) PyArray_SimpleNew(1, &n, type);
+	if (array == NULL) return NULL;
+	for (i = 0, ptr = value; (item = nextItem(ptr, &end)) != NULL; ptr = end, i++) {
+		itemKind(item, end, &ival, &fval);
+		if (type == NPY_LONG)        ((long*)PyArray_DATA(array))[i] = ival;
+		else if (type == NPY_DOUBLE) ((double*)PyArray_DATA(array))[i] = fval;
+		else                         ((npy_bool*)PyArray_DATA(array))[i] = ival;
+	}
+	return (PyObject*) array;
+}
+
+
+/* Object of a column: an array, or a list for strings. The memory of *
+ * arrays is taken over from ext.                                     */
+static PyObject *columnObject(ExtFrame *ext, const ExtColumn *col, int idx, int nAtoms) {
+	PyObject *value, *item;
+	const char *cell;
+	npy_intp dims[2], i, n;
+	int type;
+
+	dims[0] = nAtoms;
+	dims[1] = col->width;
+	if (col->type == 'S') {
+		n = (npy_intp)nAtoms * col->width;
+		if ((value = PyList_New(n)) == NULL) return NULL;
+		for (i = 0; i < n; i++) {
+			cell = (const char*)ext->columns[idx] + i * EXT_STRING_SIZE;
+			if ((item = PyUnicode_FromString(cell)) == NULL) {
+				Py_DECREF(value);
+				return NULL; }
+			PyList_SET_ITEM(value, i, item);
+		}
+		return value;
+	}
+
+	switch (col->type) {
+		case 'R': type = NPY_ARRAY_REAL; break;
+		case 'I': type = NPY_LONG; break;
+		default:  type = NPY_BOOL; break;
+	}
+	value = poolArray(col->width > 1 ? 2 : 1, dims, type, ext->columns[idx]);
+	if (value != NULL) ext->columns[idx] = NULL;
+	return value;
+}
+
+
+/* Dictionary of the data that does not fit the usual fields of a     *
+ * frame: values from the comment and columns not used otherwise.     *
+ * Lattice and Properties are left out, as well as time and step      *
+ * given as plain numbers, since they go to the frame itself.         */
+PyObject *extInfoObject(ExtFrame *ext, const ExtPlan *plan, int nAtoms) {
+	PyObject *dict, *value;
+	const char *key, *val;
+	double number;
+	npy_intp dims;
+	int i;
+
+	if ((dict = PyDict_New()) == NULL) return NULL;
+
+	key = ext->info;
+	for (i = 0; i < ext->nInfo; i++) {
+		val = key + strlen(key) + 1;
+		if (strcasecmp(key, "Lattice") && strcasecmp(key, "Properties")
+				&& !((!strcasecmp(key, "time") || !strcasecmp(key, "step"))
+					&& !extParseNumbers(val, &number, 1))) {
+			if ((value = valueObject(val)) == NULL) goto fail;
+			if (PyDict_SetItemString(dict, key, value) == -1) {
+				Py_DECREF(value);
+				goto fail; }
+			Py_DECREF(value);
+		}
+		key = val + strlen(val) + 1;
+	}
+
+	if (ext->nReal > 0) {
+		dims = ext->nReal;
+		if ((value = PyArray_SimpleNew(1, &dims, NPY_DOUBLE)) == NULL) goto fail;
+		memcpy(PyArray_DATA((PyArrayObject*)value), ext->real, dims * sizeof(double));
+		if (PyDict_SetItemString(dict, ext->realKey, value) == -1) {
+			Py_DECREF(value);
+			goto fail; }
+		Py_DECREF(value);
+	}
+
+	for (i = 0; i < plan->nColumns; i++) {
+		if (plan->columns[i].role != EXT_OTHER || ext->columns[i] == NULL) continue;
+		if ((value = columnObject(ext, plan->columns + i, i, nAtoms)) == NULL) goto fail;
+		if (PyDict_SetItemString(dict, plan->columns[i].name, value) == -1) {
+			Py_DECREF(value);
+			goto fail; }
+		Py_DECREF(value);
+	}
+
+	return dict;
+
+	fail:
+	Py_DECREF(dict);
+	return NULL;
+}
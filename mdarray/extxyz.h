@@ -0,0 +1,90 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#ifndef __EXTXYZ_H__
+#define __EXTXYZ_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Extended XYZ files keep key=value pairs in the comment line. The    *
+ * Properties key describes the columns of atom lines, for instance    *
+ * species:S:1:pos:R:3:forces:R:3 - name, type (S, R, I or L for       *
+ * string, real, integer and logical) and number of columns. It is     *
+ * compiled into a plan, which is reused while the Properties are the  *
+ * same.                                                               */
+#define EXT_MAX_COLUMNS 32
+#define EXT_NAME_SIZE 64
+#define EXT_STRING_SIZE 32   /* size of the cells of string columns */
+
+/* What the columns are used for */
+enum { EXT_SPECIES, EXT_POS, EXT_VEL, EXT_OTHER };
+
+typedef struct {
+	char name[EXT_NAME_SIZE];
+	char type;       /* S, R, I or L */
+	int width;       /* number of columns */
+	int first;       /* index of the first column in the line */
+	int role;
+} ExtColumn;
+
+typedef struct {
+	char *source;    /* Properties the plan was compiled from */
+	int version;     /* changed each time the plan is compiled */
+	int nColumns;
+	int nFields;     /* fields needed in every atom line */
+	int species;     /* index of the species column, -1 if missing */
+	ExtColumn columns[EXT_MAX_COLUMNS];
+} ExtPlan;
+
+/* Data of a frame that does not fit the usual fields: key=value pairs *
+ * of the comment (stored as "key\0value\0...") and EXT_OTHER columns, *
+ * allocated from the buffer pool. Readers of other formats may also   *
+ * give a vector of reals, kept in double precision.                   */
+typedef struct {
+	int version;                     /* plan used for the columns */
+	void *columns[EXT_MAX_COLUMNS];
+	char *info;
+	size_t infoSize;
+	int nInfo;
+	char realKey[EXT_NAME_SIZE];
+	double real[9];
+	int nReal;                       /* 0 if there is no such vector */
+} ExtFrame;
+
+void extPlanInit(ExtPlan *plan);
+void extPlanFree(ExtPlan *plan);
+int extCompilePlan(ExtPlan *plan, const char *properties);
+size_t extCellSize(char type);
+void extFrameFree(ExtFrame *ext);
+int extParseComment(ExtFrame *ext, const char *comment);
+void extSetReal(ExtFrame *ext, const char *key, const double *values, int n);
+const char *extFind(const ExtFrame *ext, const char *key);
+int extParseNumbers(const char *value, double *numbers, int n);
+PyObject *extInfoObject(ExtFrame *ext, const ExtPlan *plan, int nAtoms);
+
+#endif /* __EXTXYZ_H__ */
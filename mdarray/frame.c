@@ -0,0 +1,584 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "frame.h"
+#include "bufferpool.h"
+
+
+
+/* Keys of the fields, interned in frameTypeReady */
+static const char *fieldNameStrings[FRAME_NFIELDS] = {
+	"comment", "step", "time", "coordinates", "velocities", "extra", "box" };
+static PyObject *fieldNames[FRAME_NFIELDS];
+
+
+
+Frame *frameNew(int nAtoms) {
+	Frame *frame;
+
+	frame = (Frame*) FrameType.tp_alloc(&FrameType, 0);
+	if (frame == NULL) return NULL;
+	frame->nAtoms = nAtoms;
+	return frame;
+}
+
+
+/* Index of the field named by key or -1 */
+static int fieldIndex(PyObject *key) {
+	int i;
+
+	for (i = 0; i < FRAME_NFIELDS; i++)
+		if (key == fieldNames[i]) return i;
+	if (!PyUnicode_Check(key)) return -1;
+	for (i = 0; i < FRAME_NFIELDS; i++)
+		if (!PyUnicode_Compare(key, fieldNames[i])) return i;
+	return -1;
+}
+
+
+/* Release the raw data of the field, if still owned by the frame */
+static void dropRawData(Frame *self, int field) {
+	ARRAY_REAL **data = NULL;
+
+	switch (field) {
+		case FRAME_COMMENT:
+			free(self->comment);
+			self->comment = NULL;
+			return;
+		case FRAME_COORDINATES: data = &(self->xyz); break;
+		case FRAME_VELOCITIES:  data = &(self->vel); break;
+		case FRAME_EXTRA:       data = &(self->extra); break;
+		default: return;
+	}
+	poolFree(*data);
+	*data = NULL;
+}
+
+
+/* Return the object of a field present in the frame (borrowed  *
+ * reference), creating it on the first access.                 */
+static PyObject *getField(Frame *self, int field) {
+	PyObject *value = NULL;
+	ARRAY_REAL **data = NULL, *box;
+	npy_intp dims[2];
+
+	if (self->fields[field] != NULL) return self->fields[field];
+
+	dims[0] = self->nAtoms;
+	dims[1] = 3;
+	switch (field) {
+		case FRAME_COMMENT:
+			value = PyUnicode_FromString(self->comment);
+			break;
+		case FRAME_STEP:
+			value = PyLong_FromLong(self->step);
+			break;
+		case FRAME_TIME:
+			value = PyFloat_FromDouble(self->time);
+			break;
+		case FRAME_COORDINATES:
+			data = &(self->xyz);
+			value = poolArray(2, dims, NPY_ARRAY_REAL, self->xyz);
+			break;
+		case FRAME_VELOCITIES:
+			data = &(self->vel);
+			value = poolArray(2, dims, NPY_ARRAY_REAL, self->vel);
+			break;
+		case FRAME_EXTRA:
+			data = &(self->extra);
+			value = poolArray(1, dims, NPY_ARRAY_REAL, self->extra);
+			break;
+		case FRAME_BOX:
+			box = (ARRAY_REAL*) poolAlloc(9 * sizeof(ARRAY_REAL));
+			if (box == NULL) {
+				PyErr_SetFromErrno(PyExc_MemoryError);
+				return NULL; }
+			memcpy(box, self->box, 9 * sizeof(ARRAY_REAL));
+			dims[0] = 3;
+			if ((value = poolArray(2, dims, NPY_ARRAY_REAL, box)) == NULL) poolFree(box);
+			break;
+	}
+	if (value == NULL) return NULL;
+
+	// The array owns the memory now
+	if (data != NULL) *data = NULL;
+	self->fields[field] = value;
+	return value;
+}
+
+
+/* Make the array read-only and count its size */
+static long shareValue(PyObject *value) {
+
+	if (!PyArray_Check(value)) return 0;
+	PyArray_CLEARFLAGS((PyArrayObject*)value, NPY_ARRAY_WRITEABLE);
+	return PyArray_NBYTES((PyArrayObject*)value);
+}
+
+
+/* Make sure that all objects exist and make the arrays read-only, so *
+ * that the frame can be shared; returns the size of the arrays.      */
+long frameShare(Frame *self) {
+	PyObject *value, *key;
+	Py_ssize_t pos = 0;
+	long bytes = 0;
+	int i;
+
+	for (i = 0; i < FRAME_NFIELDS; i++) {
+		if (!FRAME_HAS(self, i)) continue;
+		if ((value = getField(self, i)) == NULL) return -1;
+		bytes += shareValue(value);
+	}
+	while (self->info != NULL && PyDict_Next(self->info, &pos, &key, &value))
+		bytes += shareValue(value);
+	return bytes;
+}
+
+
+/* Shallow copy; objects are shared with the original frame */
+PyObject *frameCopy(Frame *self) {
+	Frame *copy;
+	PyObject *value;
+	int i;
+
+	if ((copy = frameNew(self->nAtoms)) == NULL) return NULL;
+	for (i = 0; i < FRAME_NFIELDS; i++) {
+		if (!FRAME_HAS(self, i)) continue;
+		if ((value = getField(self, i)) == NULL) {
+			Py_DECREF(copy);
+			return NULL; }
+		Py_INCREF(value);
+		copy->fields[i] = value;
+	}
+	copy->present = self->present;
+	if (self->info != NULL && (copy->info = PyDict_Copy(self->info)) == NULL) {
+		Py_DECREF(copy);
+		return NULL; }
+	return (PyObject*) copy;
+}
+
+
+
+static int Frame_traverse(Frame *self, visitproc visit, void *arg) {
+	int i;
+
+	for (i = 0; i < FRAME_NFIELDS; i++)
+		Py_VISIT(self->fields[i]);
+	Py_VISIT(self->info);
+	return 0;
+}
+
+
+static int Frame_clear(Frame *self) {
+	int i;
+
+	for (i = 0; i < FRAME_NFIELDS; i++)
+		Py_CLEAR(self->fields[i]);
+	Py_CLEAR(self->info);
+	return 0;
+}
+
+
+static void Frame_dealloc(Frame *self) {
+	PyObject_GC_UnTrack(self);
+	Frame_clear(self);
+	poolFree(self->xyz);
+	poolFree(self->vel);
+	poolFree(self->extra);
+	free(self->comment);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+
+/* Mapping interface, for compatibility with dictionaries returned *
+ * by earlier versions of read()                                   */
+
+static Py_ssize_t Frame_length(Frame *self) {
+	Py_ssize_t n = 0;
+	int i;
+
+	for (i = 0; i < FRAME_NFIELDS; i++)
+		if (FRAME_HAS(self, i)) n++;
+	if (self->info != NULL) n += PyDict_Size(self->info);
+	return n;
+}
+
+
+static PyObject *Frame_subscript(Frame *self, PyObject *key) {
+	PyObject *value;
+	int field;
+
+	field = fieldIndex(key);
+	if (field < 0 && self->info != NULL) {
+		if ((value = PyDict_GetItemWithError(self->info, key)) != NULL) {
+			Py_INCREF(value);
+			return value; }
+		if (PyErr_Occurred()) return NULL;
+	}
+	if (field < 0 || !FRAME_HAS(self, field)) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return NULL; }
+	if ((value = getField(self, field)) == NULL) return NULL;
+	Py_INCREF(value);
+	return value;
+}
+
+
+static int Frame_assSubscript(Frame *self, PyObject *key, PyObject *value) {
+	int field;
+
+	field = fieldIndex(key);
+	// Items of info can be changed, but not added
+	if (field < 0 && self->info != NULL && PyDict_Contains(self->info, key) == 1) {
+		if (value == NULL) return PyDict_DelItem(self->info, key);
+		return PyDict_SetItem(self->info, key, value); }
+	if (field < 0 || (value == NULL && !FRAME_HAS(self, field))) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return -1; }
+
+	dropRawData(self, field);
+	Py_XINCREF(value);
+	Py_XSETREF(self->fields[field], value);
+	if (value != NULL) self->present |= 1u << field;
+	else               self->present &= ~(1u << field);
+	return 0;
+}
+
+
+static int Frame_contains(Frame *self, PyObject *key) {
+	int field = fieldIndex(key);
+
+	if (field < 0 && self->info != NULL) return PyDict_Contains(self->info, key);
+	return field >= 0 && FRAME_HAS(self, field);
+}
+
+
+static PyMappingMethods Frame_as_mapping = {
+	(lenfunc)Frame_length,              /* mp_length */
+	(binaryfunc)Frame_subscript,        /* mp_subscript */
+	(objobjargproc)Frame_assSubscript,  /* mp_ass_subscript */
+};
+
+
+static PySequenceMethods Frame_as_sequence = {
+	0,                                  /* sq_length */
+	0,                                  /* sq_concat */
+	0,                                  /* sq_repeat */
+	0,                                  /* sq_item */
+	0,                                  /* was_sq_slice */
+	0,                                  /* sq_ass_item */
+	0,                                  /* was_sq_ass_slice */
+	(objobjproc)Frame_contains,         /* sq_contains */
+};
+
+
+
+/* List of keys, values or (key, value) pairs of the fields present */
+#define LIST_KEYS   0
+#define LIST_VALUES 1
+#define LIST_ITEMS  2
+static PyObject *listFields(Frame *self, int what) {
+	PyObject *list, *value, *item, *key;
+	Py_ssize_t pos = 0;
+	int i;
+
+	if ((list = PyList_New(0)) == NULL) return NULL;
+	for (i = 0; i < FRAME_NFIELDS; i++) {
+		if (!FRAME_HAS(self, i)) continue;
+		value = NULL;
+		if (what != LIST_KEYS && (value = getField(self, i)) == NULL) goto fail;
+		if (what == LIST_KEYS) {
+			item = fieldNames[i];
+			Py_INCREF(item);
+		} else if (what == LIST_VALUES) {
+			item = value;
+			Py_INCREF(item);
+		} else if ((item = PyTuple_Pack(2, fieldNames[i], value)) == NULL)
+			goto fail;
+		if (PyList_Append(list, item) == -1) {
+			Py_DECREF(item);
+			goto fail; }
+		Py_DECREF(item);
+	}
+	while (self->info != NULL && PyDict_Next(self->info, &pos, &key, &value)) {
+		if (what == LIST_KEYS) {
+			item = key;
+			Py_INCREF(item);
+		} else if (what == LIST_VALUES) {
+			item = value;
+			Py_INCREF(item);
+		} else if ((item = PyTuple_Pack(2, key, value)) == NULL)
+			goto fail;
+		if (PyList_Append(list, item) == -1) {
+			Py_DECREF(item);
+			goto fail; }
+		Py_DECREF(item);
+	}
+	return list;
+
+	fail:
+	Py_DECREF(list);
+	return NULL;
+}
+
+
+static PyObject *Frame_keys(Frame *self) {
+	return listFields(self, LIST_KEYS);
+}
+
+
+static PyObject *Frame_values(Frame *self) {
+	return listFields(self, LIST_VALUES);
+}
+
+
+static PyObject *Frame_items(Frame *self) {
+	return listFields(self, LIST_ITEMS);
+}
+
+
+static PyObject *Frame_get(Frame *self, PyObject *args) {
+	PyObject *key, *value = Py_None, *item;
+	int field;
+
+	if (!PyArg_ParseTuple(args, "O|O", &key, &value)) return NULL;
+
+	field = fieldIndex(key);
+	if (field >= 0 && FRAME_HAS(self, field)) {
+		if ((value = getField(self, field)) == NULL) return NULL;
+	} else if (field < 0 && self->info != NULL) {
+		if ((item = PyDict_GetItemWithError(self->info, key)) != NULL) value = item;
+		else if (PyErr_Occurred()) return NULL;
+	}
+	Py_INCREF(value);
+	return value;
+}
+
+
+static PyObject *Frame_toDict(Frame *self) {
+	PyObject *dict, *value;
+	int i;
+
+	if ((dict = PyDict_New()) == NULL) return NULL;
+	for (i = 0; i < FRAME_NFIELDS; i++) {
+		if (!FRAME_HAS(self, i)) continue;
+		if ((value = getField(self, i)) == NULL
+				|| PyDict_SetItem(dict, fieldNames[i], value) == -1) {
+			Py_DECREF(dict);
+			return NULL; }
+	}
+	if (self->info != NULL && PyDict_Update(dict, self->info) == -1) {
+		Py_DECREF(dict);
+		return NULL; }
+	return dict;
+}
+
+
+static PyObject *Frame_iter(Frame *self) {
+	PyObject *keys, *iter;
+
+	if ((keys = listFields(self, LIST_KEYS)) == NULL) return NULL;
+	iter = PyObject_GetIter(keys);
+	Py_DECREF(keys);
+	return iter;
+}
+
+
+static PyObject *Frame_repr(Frame *self) {
+	PyObject *dict, *repr;
+
+	if ((dict = Frame_toDict(self)) == NULL) return NULL;
+	repr = PyUnicode_FromFormat("Frame(%R)", dict);
+	Py_DECREF(dict);
+	return repr;
+}
+
+
+/* Attributes, with None for the fields that are missing */
+static PyObject *Frame_getAttr(Frame *self, void *closure) {
+	PyObject *value;
+	int field = (int)(intptr_t)closure;
+
+	if (!FRAME_HAS(self, field)) Py_RETURN_NONE;
+	if ((value = getField(self, field)) == NULL) return NULL;
+	Py_INCREF(value);
+	return value;
+}
+
+
+static PyObject *Frame_getInfo(Frame *self, void *closure) {
+
+	if (self->info == NULL) Py_RETURN_NONE;
+	Py_INCREF(self->info);
+	return self->info;
+}
+
+
+/* Items of info are available as attributes, too */
+static PyObject *Frame_getattro(Frame *self, PyObject *name) {
+	PyObject *value;
+
+	value = PyObject_GenericGetAttr((PyObject*)self, name);
+	if (value != NULL || self->info == NULL
+			|| !PyErr_ExceptionMatches(PyExc_AttributeError)) return value;
+	PyErr_Clear();
+	if ((value = PyDict_GetItemWithError(self->info, name)) == NULL) {
+		if (!PyErr_Occurred())
+			PyErr_Format(PyExc_AttributeError,
+				"'mdarray.Frame' object has no attribute '%U'", name);
+		return NULL; }
+	Py_INCREF(value);
+	return value;
+}
+
+
+
+static PyMemberDef Frame_members[] = {
+	{"nAtoms", T_INT, offsetof(Frame, nAtoms), READONLY,
+		"Number of atoms"},
+	{NULL}  /* Sentinel */
+};
+
+
+static PyGetSetDef Frame_getset[] = {
+	{"comment", (getter)Frame_getAttr, NULL,
+		"Comment (title) of the frame", (void*)FRAME_COMMENT},
+	{"step", (getter)Frame_getAttr, NULL,
+		"Simulation step", (void*)FRAME_STEP},
+	{"time", (getter)Frame_getAttr, NULL,
+		"Simulation time", (void*)FRAME_TIME},
+	{"coordinates", (getter)Frame_getAttr, NULL,
+		"Coordinates, (nAtoms, 3) ndarray", (void*)FRAME_COORDINATES},
+	{"velocities", (getter)Frame_getAttr, NULL,
+		"Velocities, (nAtoms, 3) ndarray", (void*)FRAME_VELOCITIES},
+	{"extra", (getter)Frame_getAttr, NULL,
+		"Extra data (like charges) for each atom", (void*)FRAME_EXTRA},
+	{"box", (getter)Frame_getAttr, NULL,
+		"Box vectors, (3, 3) ndarray", (void*)FRAME_BOX},
+	{"info", (getter)Frame_getInfo, NULL,
+		"Other data of the frame, like key=value pairs and columns of "
+		"extended XYZ files, as a dictionary", NULL},
+	{NULL}  /* Sentinel */
+};
+
+
+static PyMethodDef Frame_methods[] = {
+	{"keys", (PyCFunction)Frame_keys, METH_NOARGS,
+		"\n"
+		"Frame.keys()\n"
+		"\n"
+		"List of the fields present in the frame.\n"
+		"\n" },
+	{"values", (PyCFunction)Frame_values, METH_NOARGS,
+		"\n"
+		"Frame.values()\n"
+		"\n"
+		"List of the values of the fields present in the frame.\n"
+		"\n" },
+	{"items", (PyCFunction)Frame_items, METH_NOARGS,
+		"\n"
+		"Frame.items()\n"
+		"\n"
+		"List of (key, value) pairs, as for dictionaries.\n"
+		"\n" },
+	{"get", (PyCFunction)Frame_get, METH_VARARGS,
+		"\n"
+		"Frame.get(key, default=None)\n"
+		"\n"
+		"Value of the field or default, if it is not present.\n"
+		"\n" },
+	{"toDict", (PyCFunction)Frame_toDict, METH_NOARGS,
+		"\n"
+		"Frame.toDict()\n"
+		"\n"
+		"Return the fields as a dictionary.\n"
+		"\n" },
+	{NULL}  /* Sentinel */
+};
+
+
+PyTypeObject FrameType = {
+
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "mdarray.Frame",                /*tp_name*/
+    sizeof(Frame),                  /*tp_basicsize*/
+    0,                              /*tp_itemsize*/
+
+    /* Methods to implement standard operations */
+    (destructor)Frame_dealloc,      /*tp_dealloc*/
+    0,                              /*tp_print*/
+    0,                              /*tp_getattr*/
+    0,                              /*tp_setattr*/
+	 0,                              /* tp_reserved */
+    (reprfunc)Frame_repr,           /*tp_repr*/
+
+    /* Method suites for standard classes */
+    0,                         /*tp_as_number*/
+    &Frame_as_sequence,        /*tp_as_sequence*/
+    &Frame_as_mapping,         /*tp_as_mapping*/
+
+    /* More standard operations (here for binary compatibility) */
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    (getattrofunc)Frame_getattro, /*tp_getattro*/
+    0,                         /*tp_setattro*/
+
+    /* Functions to access object as input/output buffer */
+    0,                         /*tp_as_buffer*/
+
+    /* Flags to define presence of optional/expanded features */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
+
+    /* Documentation string */
+    "Frame read from a trajectory. Fields are available as attributes "
+	 "(None if missing) or by key, like in a dictionary:\n"
+    "  frame = traj.read()\n"
+    "  frame.coordinates\n"
+    "  frame['coordinates']\n"
+    "Keys include: comment, step, time, coordinates, velocities, extra and "
+	 "box, depending on the file format, followed by the keys of info. "
+	 "Arrays are created on the first access.\n",              /* tp_doc */
+
+    (traverseproc)Frame_traverse, /* tp_traverse */
+    (inquiry)Frame_clear,      /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    (getiterfunc)Frame_iter,   /* tp_iter */
+    0,                         /* tp_iternext */
+    Frame_methods,             /* tp_methods */
+    Frame_members,             /* tp_members */
+    Frame_getset,              /* tp_getset */
+};
+
+
+int frameTypeReady(void) {
+	int i;
+
+	for (i = 0; i < FRAME_NFIELDS; i++)
+		if ((fieldNames[i] = PyUnicode_InternFromString(fieldNameStrings[i])) == NULL)
+			return -1;
+	return PyType_Ready(&FrameType);
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Fields of a frame, in the order they are listed */
+enum {
+	FRAME_COMMENT, FRAME_STEP, FRAME_TIME, FRAME_COORDINATES,
+	FRAME_VELOCITIES, FRAME_EXTRA, FRAME_BOX, FRAME_NFIELDS };
+
+/* Frame returned by Trajectory.read(). The data is kept in C arrays *
+ * and Python objects are created only when a field is accessed.     *
+ * Frames can be used like dictionaries with the keys listed above,  *
+ * followed by the keys of info (like forces in extended XYZ).       */
+typedef struct {
+
+	PyObject_HEAD
+
+	int nAtoms;
+	unsigned int present;             /* bit mask of fields present */
+	PyObject *fields[FRAME_NFIELDS];  /* objects created so far */
+	PyObject *info;                   /* dict of other data or NULL */
+
+	/* Raw data from the buffer pool, owned by the frame until *
+	 * passed to an array                                      */
+	ARRAY_REAL *xyz;
+	ARRAY_REAL *vel;
+	ARRAY_REAL *extra;
+	ARRAY_REAL box[9];
+	double time;
+	long step;
+	char *comment;
+
+} Frame;
+
+#define FRAME_HAS(frame, field) ((frame)->present & (1u << (field)))
+
+extern PyTypeObject FrameType;
+
+int frameTypeReady(void);
+Frame *frameNew(int nAtoms);
+long frameShare(Frame *frame);
+PyObject *frameCopy(Frame *frame);
+
+#endif /* __FRAME_H__ */
@@ -0,0 +1,212 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "frame.h"
+#include "framecache.h"
+
+
+
+static unsigned int hashKey(long key) {
+	unsigned long h = (unsigned long)key * 0x9E3779B97F4A7C15UL;
+	return (unsigned int)(h >> 32);
+}
+
+
+FrameCache *frameCacheNew(long maxFrames, long maxBytes) {
+	FrameCache *cache;
+
+	cache = (FrameCache*) malloc(sizeof(FrameCache));
+	if (cache == NULL) {
+		PyErr_NoMemory();
+		return NULL; }
+
+	cache->maxFrames = maxFrames;
+	cache->maxBytes = maxBytes;
+	cache->nFrames = 0;
+	cache->bytes = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->nBuckets = 64;
+	cache->head = NULL;
+	cache->tail = NULL;
+	cache->buckets = (CacheEntry**) calloc(cache->nBuckets, sizeof(CacheEntry*));
+	if (cache->buckets == NULL) {
+		free(cache);
+		PyErr_NoMemory();
+		return NULL; }
+
+	return cache;
+}
+
+
+void frameCacheClear(FrameCache *cache) {
+	CacheEntry *entry, *next;
+
+	for (entry = cache->head; entry != NULL; entry = next) {
+		next = entry->next;
+		Py_DECREF(entry->frame);
+		free(entry);
+	}
+	memset(cache->buckets, 0, cache->nBuckets * sizeof(CacheEntry*));
+	cache->head = NULL;
+	cache->tail = NULL;
+	cache->nFrames = 0;
+	cache->bytes = 0;
+}
+
+
+void frameCacheFree(FrameCache *cache) {
+
+	if (cache == NULL) return;
+	frameCacheClear(cache);
+	free(cache->buckets);
+	free(cache);
+}
+
+
+static void unlinkEntry(FrameCache *cache, CacheEntry *entry) {
+
+	if (entry->prev != NULL) entry->prev->next = entry->next;
+	else cache->head = entry->next;
+	if (entry->next != NULL) entry->next->prev = entry->prev;
+	else cache->tail = entry->prev;
+}
+
+
+static void pushFront(FrameCache *cache, CacheEntry *entry) {
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head != NULL) cache->head->prev = entry;
+	cache->head = entry;
+	if (cache->tail == NULL) cache->tail = entry;
+}
+
+
+/* Remove the least recently used entry */
+static void evict(FrameCache *cache) {
+	CacheEntry *entry, **link;
+
+	entry = cache->tail;
+	link = cache->buckets + (hashKey(entry->key) & (cache->nBuckets-1));
+	while (*link != entry) link = &((*link)->chain);
+	*link = entry->chain;
+
+	unlinkEntry(cache, entry);
+	cache->nFrames -= 1;
+	cache->bytes -= entry->bytes;
+	Py_DECREF(entry->frame);
+	free(entry);
+}
+
+
+static int rehash(FrameCache *cache) {
+	CacheEntry **buckets, *entry;
+	int newSize, slot;
+
+	newSize = 2 * cache->nBuckets;
+	buckets = (CacheEntry**) calloc(newSize, sizeof(CacheEntry*));
+	if (buckets == NULL) {
+		PyErr_NoMemory();
+		return -1; }
+	for (entry = cache->head; entry != NULL; entry = entry->next) {
+		slot = hashKey(entry->key) & (newSize-1);
+		entry->chain = buckets[slot];
+		buckets[slot] = entry;
+	}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->nBuckets = newSize;
+
+	return 0;
+}
+
+
+/* Return the frame stored under key (new reference), or NULL if it *
+ * is not in the cache; no exception is set in the latter case.      */
+PyObject *frameCacheGet(FrameCache *cache, long key) {
+	CacheEntry *entry;
+
+	entry = cache->buckets[hashKey(key) & (cache->nBuckets-1)];
+	while (entry != NULL && entry->key != key) entry = entry->chain;
+	if (entry == NULL) {
+		cache->misses += 1;
+		return NULL; }
+
+	cache->hits += 1;
+	if (entry != cache->head) {
+		unlinkEntry(cache, entry);
+		pushFront(cache, entry);
+	}
+	Py_INCREF(entry->frame);
+	return entry->frame;
+}
+
+
+/* Store the frame (a Frame object) under key. Arrays in the frame are *
+ * made read-only, since they are shared by all users of the frame.    */
+int frameCachePut(FrameCache *cache, long key, PyObject *frame) {
+	CacheEntry *entry;
+	long bytes;
+	int slot;
+
+	if ((bytes = frameShare((Frame*)frame)) == -1) return -1;
+
+	// A frame that does not fit is not stored at all
+	if (cache->maxBytes > 0 && bytes > cache->maxBytes) return 0;
+
+	entry = (CacheEntry*) malloc(sizeof(CacheEntry));
+	if (entry == NULL) {
+		PyErr_NoMemory();
+		return -1; }
+	entry->key = key;
+	entry->frame = frame;
+	Py_INCREF(frame);
+	entry->bytes = bytes;
+
+	slot = hashKey(key) & (cache->nBuckets-1);
+	entry->chain = cache->buckets[slot];
+	cache->buckets[slot] = entry;
+	pushFront(cache, entry);
+	cache->nFrames += 1;
+	cache->bytes += bytes;
+
+	while ((cache->maxFrames > 0 && cache->nFrames > cache->maxFrames)
+			|| (cache->maxBytes > 0 && cache->bytes > cache->maxBytes))
+		evict(cache);
+
+	if (cache->nFrames > cache->nBuckets)
+		if (rehash(cache) == -1) return -1;
+
+	return 0;
+}
+
+
+/* Statistics, in the spirit of functools.lru_cache().cache_info() */
+PyObject *frameCacheInfo(FrameCache *cache) {
+	return Py_BuildValue("{s:l,s:l,s:l,s:l,s:l,s:l}",
+			"hits", cache->hits, "misses", cache->misses,
+			"frames", cache->nFrames, "bytes", cache->bytes,
+			"maxFrames", cache->maxFrames, "maxBytes", cache->maxBytes);
+}
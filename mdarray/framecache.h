@@ -0,0 +1,63 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+#ifndef __FRAMECACHE_H__
+#define __FRAMECACHE_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Frames kept in memory for repeated random access, keyed by the *
+ * frame index. The least recently used frames are dropped when   *
+ * either of the limits is exceeded (zero means no limit).        */
+typedef struct __cacheEntry {
+	long key;
+	PyObject *frame;
+	long bytes;
+	struct __cacheEntry *prev, *next; /* LRU list, most recent first */
+	struct __cacheEntry *chain;       /* next entry in the hash bucket */
+} CacheEntry;
+
+typedef struct {
+	long maxFrames;
+	long maxBytes;
+	long nFrames;
+	long bytes;
+	long hits;
+	long misses;
+	int nBuckets;          /* power of two */
+	CacheEntry **buckets;
+	CacheEntry *head, *tail;
+} FrameCache;
+
+FrameCache *frameCacheNew(long maxFrames, long maxBytes);
+void frameCacheFree(FrameCache *cache);
+void frameCacheClear(FrameCache *cache);
+PyObject *frameCacheGet(FrameCache *cache, long key);
+int frameCachePut(FrameCache *cache, long key, PyObject *frame);
+PyObject *frameCacheInfo(FrameCache *cache);
+
+#endif /* __FRAMECACHE_H__ */
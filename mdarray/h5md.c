@@ -0,0 +1,803 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "h5md.h"
+
+#ifdef HAVE_HDF5
+
+#include <strings.h>
+#include <pthread.h>
+
+/* The HDF5 library need not be thread-safe; all calls are made under *
+ * this lock, so that the callers can release the GIL.                */
+static pthread_mutex_t h5Lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Size of the chunks of datasets written, in bytes */
+#define H5MD_CHUNK_BYTES (1L << 20)
+
+#define H5MD_NAME_SIZE 256
+
+
+
+/* Length of a unit, like "nm" or "nm ps-1" of velocities, in Angstrom; *
+ * 0 if it is not known                                                 */
+static double unitFactor(const char *unit) {
+	size_t len = strcspn(unit, " ");
+
+	if (len == 2 && !strncmp(unit, "nm", 2)) return 10.0;
+	if (len == 2 && !strncmp(unit, "pm", 2)) return 0.01;
+	if ((len == 1 && unit[0] == 'A') || (len == 8 && !strncasecmp(unit, "angstrom", 8)))
+		return 1.0;
+	return 0.0;
+}
+
+
+/* Strings of an attribute, fixed or variable length. Returns 1 if it *
+ * is missing; the strings are malloc'ed.                             */
+static int readStrings(hid_t obj, const char *name, char ***strings, int *n) {
+	hid_t attr, type, mem = -1, space = -1;
+	hssize_t count;
+	size_t len;
+	char **ptrs = NULL, *buffer = NULL;
+	int i, status = -1;
+
+	*strings = NULL;
+	*n = 0;
+	if (H5Aexists(obj, name) <= 0) return 1;
+	if ((attr = H5Aopen(obj, name, H5P_DEFAULT)) < 0) return -1;
+	type = H5Aget_type(attr);
+	space = H5Aget_space(attr);
+	count = H5Sget_simple_extent_npoints(space);
+	if (type < 0 || count <= 0 || H5Tget_class(type) != H5T_STRING) goto end;
+	if ((*strings = (char**) calloc(count, sizeof(char*))) == NULL) goto end;
+	// Strings are not converted between ASCII and UTF-8
+	mem = H5Tcopy(H5T_C_S1);
+	H5Tset_cset(mem, H5Tget_cset(type));
+
+	if (H5Tis_variable_str(type) > 0) {
+		H5Tset_size(mem, H5T_VARIABLE);
+		if ((ptrs = (char**) calloc(count, sizeof(char*))) == NULL) goto end;
+		if (H5Aread(attr, mem, ptrs) < 0) goto end;
+		for (i = 0; i < count; i++)
+			(*strings)[i] = strdup(ptrs[i] != NULL ? ptrs[i] : "");
+		H5Dvlen_reclaim(mem, space, H5P_DEFAULT, ptrs);
+	} else {
+		len = H5Tget_size(type) + 1;
+		H5Tset_size(mem, len);
+		H5Tset_strpad(mem, H5T_STR_NULLTERM);
+		if ((buffer = (char*) malloc(count * len)) == NULL) goto end;
+		if (H5Aread(attr, mem, buffer) < 0) goto end;
+		for (i = 0; i < count; i++)
+			(*strings)[i] = strdup(buffer + i * len);
+	}
+	*n = count;
+	status = 0;
+	for (i = 0; i < count; i++)
+		if ((*strings)[i] == NULL) status = -1;
+
+	end:
+	if (status == -1 && *strings != NULL) {
+		for (i = 0; i < count; i++) free((*strings)[i]);
+		free(*strings);
+		*strings = NULL;
+		*n = 0;
+	}
+	free(ptrs);
+	free(buffer);
+	if (mem >= 0) H5Tclose(mem);
+	if (space >= 0) H5Sclose(space);
+	if (type >= 0) H5Tclose(type);
+	H5Aclose(attr);
+	return status;
+}
+
+
+/* Factor of the unit attribute of the object, 0 if it is missing */
+static double readUnit(hid_t obj) {
+	char **strings;
+	double factor = 0.0;
+	int n, i;
+
+	if (readStrings(obj, "unit", &strings, &n) || n < 1) return 0.0;
+	factor = unitFactor(strings[0]);
+	for (i = 0; i < n; i++) free(strings[i]);
+	free(strings);
+	return factor;
+}
+
+
+/* Attribute with fixed-length strings */
+static int writeStrings(hid_t obj, const char *name, const char **strings, int n) {
+	hid_t attr, type, space;
+	hsize_t dims[1];
+	size_t len = 1;
+	char *buffer;
+	int i, status = -1;
+
+	for (i = 0; i < n; i++)
+		if (strlen(strings[i]) + 1 > len) len = strlen(strings[i]) + 1;
+	if ((buffer = (char*) calloc(n, len)) == NULL) return -1;
+	for (i = 0; i < n; i++) memcpy(buffer + i * len, strings[i], strlen(strings[i]));
+
+	dims[0] = n;
+	type = H5Tcopy(H5T_C_S1);
+	H5Tset_size(type, len);
+	H5Tset_strpad(type, H5T_STR_NULLTERM);
+	// A single string is a scalar, like the units
+	space = n == 1 ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, dims, NULL);
+	attr = H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	if (attr >= 0 && H5Awrite(attr, type, buffer) >= 0) status = 0;
+	if (attr >= 0) H5Aclose(attr);
+	H5Sclose(space);
+	H5Tclose(type);
+	free(buffer);
+	return status;
+}
+
+
+static int writeInts(hid_t obj, const char *name, const int *values, int n) {
+	hid_t attr, space;
+	hsize_t dims[1];
+	int status = -1;
+
+	dims[0] = n;
+	space = H5Screate_simple(1, dims, NULL);
+	attr = H5Acreate2(obj, name, H5T_STD_I32LE, space, H5P_DEFAULT, H5P_DEFAULT);
+	if (attr >= 0 && H5Awrite(attr, H5T_NATIVE_INT, values) >= 0) status = 0;
+	if (attr >= 0) H5Aclose(attr);
+	H5Sclose(space);
+	return status;
+}
+
+
+static void elementInit(H5mdElement *el) {
+	memset(el, 0, sizeof(H5mdElement));
+	el->value = el->step = el->time = -1;
+}
+
+
+static void elementClose(H5mdElement *el) {
+	if (el->value >= 0) H5Dclose(el->value);
+	if (el->step >= 0) H5Dclose(el->step);
+	if (el->time >= 0) H5Dclose(el->time);
+	elementInit(el);
+}
+
+
+/* Step or time of an element; a scalar dataset is the interval */
+static int openInterval(hid_t group, const char *name, hid_t memType, hid_t *dset,
+                        int *fixed, void *interval, void *offset) {
+	hid_t space, attr;
+	int rank, status = 0;
+
+	if (H5Lexists(group, name, H5P_DEFAULT) <= 0) return 0;
+	if ((*dset = H5Dopen2(group, name, H5P_DEFAULT)) < 0) return -1;
+	space = H5Dget_space(*dset);
+	rank = H5Sget_simple_extent_ndims(space);
+	H5Sclose(space);
+	if (rank == 0) {
+		*fixed = 1;
+		if (H5Dread(*dset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, interval) < 0)
+			status = -1;
+		if (H5Aexists(*dset, "offset") > 0) {
+			attr = H5Aopen(*dset, "offset", H5P_DEFAULT);
+			if (attr < 0 || H5Aread(attr, memType, offset) < 0) status = -1;
+			if (attr >= 0) H5Aclose(attr);
+		}
+	} else if (rank != 1)
+		status = -1;
+	return status;
+}
+
+
+/* Open a time-dependent element of the group. The chunk cache is made *
+ * large enough for chunks of all atoms, so that reading frame by      *
+ * frame decompresses every chunk only once. Returns 1 if missing.     */
+static int openElement(hid_t group, const char *name, H5mdElement *el) {
+	hid_t grp, space, plist, type, dapl;
+	size_t nChunks = 1, chunkBytes;
+	int k, status = -1;
+
+	elementInit(el);
+	if (H5Lexists(group, name, H5P_DEFAULT) <= 0) return 1;
+	if ((grp = H5Gopen2(group, name, H5P_DEFAULT)) < 0) return -1;
+	if ((el->value = H5Dopen2(grp, "value", H5P_DEFAULT)) < 0) goto end;
+
+	space = H5Dget_space(el->value);
+	el->rank = H5Sget_simple_extent_ndims(space);
+	if (el->rank >= 1 && el->rank <= 3) H5Sget_simple_extent_dims(space, el->dims, NULL);
+	H5Sclose(space);
+	if (el->rank < 1 || el->rank > 3) goto end;
+
+	plist = H5Dget_create_plist(el->value);
+	if (H5Pget_layout(plist) != H5D_CHUNKED
+			|| H5Pget_chunk(plist, el->rank, el->chunk) != el->rank)
+		for (k = 0; k < el->rank; k++) el->chunk[k] = el->dims[k];
+	H5Pclose(plist);
+	if (el->chunk[0] == 0) el->chunk[0] = 1;
+
+	type = H5Dget_type(el->value);
+	chunkBytes = H5Tget_size(type);
+	H5Tclose(type);
+	for (k = 0; k < el->rank; k++) chunkBytes *= el->chunk[k];
+	for (k = 1; k < el->rank; k++)
+		nChunks *= (el->dims[k] + el->chunk[k] - 1) / (el->chunk[k] ? el->chunk[k] : 1);
+	if (chunkBytes * nChunks > H5MD_CHUNK_BYTES) {
+		H5Dclose(el->value);
+		dapl = H5Pcreate(H5P_DATASET_ACCESS);
+		H5Pset_chunk_cache(dapl, 100 * nChunks + 1, chunkBytes * nChunks, 1.0);
+		el->value = H5Dopen2(grp, "value", dapl);
+		H5Pclose(dapl);
+		if (el->value < 0) goto end;
+	}
+	el->factor = readUnit(el->value);
+
+	el->stepInterval = 1;
+	if (openInterval(grp, "step", H5T_NATIVE_LONG, &(el->step), &(el->stepFixed),
+	                 &(el->stepInterval), &(el->stepOffset))) goto end;
+	if (openInterval(grp, "time", H5T_NATIVE_DOUBLE, &(el->time), &(el->timeFixed),
+	                 &(el->timeInterval), &(el->timeOffset))) goto end;
+	status = 0;
+
+	end:
+	H5Gclose(grp);
+	if (status) elementClose(el);
+	return status;
+}
+
+
+/* Box of the particles: fixed edges (a dataset of 3 lengths or 3 *
+ * vectors) or time-dependent ones (an element)                   */
+static int openBox(H5mdFile *h5) {
+	hid_t box, edges, space;
+	hsize_t dims[2];
+	ARRAY_REAL values[9];
+	int rank, k, status = 0;
+
+	if (H5Lexists(h5->group, "box", H5P_DEFAULT) <= 0) return 0;
+	if ((box = H5Gopen2(h5->group, "box", H5P_DEFAULT)) < 0) return -1;
+	if (H5Lexists(box, "edges", H5P_DEFAULT) <= 0) {
+		H5Gclose(box);
+		return 0; }
+
+	if ((edges = H5Oopen(box, "edges", H5P_DEFAULT)) < 0) status = -1;
+	else if (H5Iget_type(edges) == H5I_DATASET) {
+		space = H5Dget_space(edges);
+		rank = H5Sget_simple_extent_ndims(space);
+		if (rank == 1 || rank == 2) H5Sget_simple_extent_dims(space, dims, NULL);
+		H5Sclose(space);
+		if ((rank == 1 && dims[0] == 3) || (rank == 2 && dims[0] == 3 && dims[1] == 3)) {
+			status = H5Dread(edges, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
+			                 H5P_DEFAULT, values) < 0 ? -1 : 0;
+			memset(h5->fixedBox, 0, 9 * sizeof(ARRAY_REAL));
+			for (k = 0; k < 9; k++)
+				if (rank == 2) h5->fixedBox[k] = values[k];
+				else if (k < 3) h5->fixedBox[4*k] = values[k];
+			h5->boxFactor = readUnit(edges);
+			h5->hasBox = 1;
+		}
+		H5Oclose(edges);
+	} else {
+		H5Oclose(edges);
+		if (openElement(box, "edges", &(h5->box)) == 0) {
+			if ((h5->box.rank == 2 && h5->box.dims[1] == 3) || (h5->box.rank == 3
+					&& h5->box.dims[1] == 3 && h5->box.dims[2] == 3)) {
+				h5->boxFactor = h5->box.factor;
+				h5->hasBox = 2;
+			} else
+				elementClose(&(h5->box));
+		}
+	}
+
+	H5Gclose(box);
+	return status;
+}
+
+
+void h5mdInit(H5mdFile *h5) {
+	memset(h5, 0, sizeof(H5mdFile));
+	h5->file = h5->group = -1;
+	elementInit(&(h5->position));
+	elementInit(&(h5->velocity));
+	elementInit(&(h5->box));
+}
+
+
+/* Open an H5MD file for reading (mode 'r') or appending ('a') */
+int h5mdOpen(H5mdFile *h5, const char *name, char mode) {
+	char group[H5MD_NAME_SIZE] = "all";
+	hid_t particles;
+	H5G_info_t info;
+	hsize_t i;
+
+	pthread_mutex_lock(&h5Lock);
+	// Errors are reported through the return values
+	H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+	h5->file = H5Fopen(name, mode == 'r' ? H5F_ACC_RDONLY : H5F_ACC_RDWR, H5P_DEFAULT);
+	if (h5->file < 0) {
+		h5->error = "Could not open the HDF5 file";
+		goto fail; }
+	if (H5Lexists(h5->file, "particles", H5P_DEFAULT) <= 0
+			|| (particles = H5Gopen2(h5->file, "particles", H5P_DEFAULT)) < 0) {
+		h5->error = "No particles in the H5MD file";
+		goto fail; }
+
+	// The group 'all' or the first one
+	if (H5Lexists(particles, group, H5P_DEFAULT) <= 0 && H5Gget_info(particles, &info) >= 0)
+		for (i = 0; i < info.nlinks; i++) {
+			if (H5Lget_name_by_idx(particles, ".", H5_INDEX_NAME, H5_ITER_INC, i,
+			                       group, H5MD_NAME_SIZE, H5P_DEFAULT) < 0) continue;
+			if ((h5->group = H5Gopen2(particles, group, H5P_DEFAULT)) >= 0) break;
+		}
+	else
+		h5->group = H5Gopen2(particles, group, H5P_DEFAULT);
+	H5Gclose(particles);
+	if (h5->group < 0) {
+		h5->error = "No particles in the H5MD file";
+		goto fail; }
+
+	if (openElement(h5->group, "position", &(h5->position))
+			|| h5->position.rank != 3 || h5->position.dims[2] != 3) {
+		h5->error = "No positions in the H5MD file";
+		goto fail; }
+	h5->nAtoms = h5->position.dims[1];
+	h5->nFrames = h5->position.dims[0];
+
+	// Velocities of other shape are not used
+	if (openElement(h5->group, "velocity", &(h5->velocity)) == 0
+			&& (h5->velocity.rank != 3 || h5->velocity.dims[1] != h5->position.dims[1]
+			    || h5->velocity.dims[2] != 3))
+		elementClose(&(h5->velocity));
+
+	if (openBox(h5)) {
+		h5->error = "Error reading the box of the H5MD file";
+		goto fail; }
+
+	pthread_mutex_unlock(&h5Lock);
+	return 0;
+
+	fail:
+	pthread_mutex_unlock(&h5Lock);
+	return -1;
+}
+
+
+/* Create an H5MD file with the given particles; elements are created *
+ * when the first frame is written. species are codes of names.       */
+int h5mdCreate(H5mdFile *h5, const char *name, int nAtoms, const int *species,
+               char **names, int nNames) {
+	const int version[2] = { 1, 1 };
+	const char *none[3] = { "none", "none", "none" };
+	const char *author = getenv("USER");
+	hid_t h5md, sub, particles, box, space, dset;
+	hsize_t dims[1];
+	int dimension = 3;
+	int status = -1;
+
+	pthread_mutex_lock(&h5Lock);
+	H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+	h5->file = H5Fcreate(name, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
+	if (h5->file < 0) {
+		h5->error = "Could not create the HDF5 file";
+		goto end; }
+	h5->error = "Could not write to the H5MD file";
+
+	h5md = H5Gcreate2(h5->file, "h5md", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if (h5md < 0 || writeInts(h5md, "version", version, 2)) goto end;
+	sub = H5Gcreate2(h5md, "author", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if (author == NULL) author = "unknown";
+	if (sub < 0 || writeStrings(sub, "name", &author, 1)) goto end;
+	H5Gclose(sub);
+	sub = H5Gcreate2(h5md, "creator", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	author = "mdarray";
+	if (sub < 0 || writeStrings(sub, "name", &author, 1)) goto end;
+	author = "0.1.2";
+	if (writeStrings(sub, "version", &author, 1)) goto end;
+	H5Gclose(sub);
+	H5Gclose(h5md);
+
+	particles = H5Gcreate2(h5->file, "particles", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if (particles < 0) goto end;
+	h5->group = H5Gcreate2(particles, "all", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Gclose(particles);
+	if (h5->group < 0) goto end;
+	h5->nAtoms = nAtoms;
+
+	// Species are codes of the names kept in their attribute
+	if (species != NULL) {
+		dims[0] = nAtoms;
+		space = H5Screate_simple(1, dims, NULL);
+		dset = H5Dcreate2(h5->group, "species", H5T_STD_I32LE, space,
+		                  H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+		H5Sclose(space);
+		if (dset < 0) goto end;
+		if (H5Dwrite(dset, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, species) < 0
+				|| writeStrings(dset, "names", (const char**) names, nNames)) {
+			H5Dclose(dset);
+			goto end; }
+		H5Dclose(dset);
+	}
+
+	// Boundaries become periodic with the first box written
+	box = H5Gcreate2(h5->group, "box", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if (box < 0) goto end;
+	if (writeInts(box, "dimension", &dimension, 1) == 0
+			&& writeStrings(box, "boundary", none, 3) == 0) status = 0;
+	H5Gclose(box);
+
+	end:
+	pthread_mutex_unlock(&h5Lock);
+	return status;
+}
+
+
+/* Species of the particles; names are those of the 'names' attribute, *
+ * if given. Returns 1 if there are no species.                        */
+int h5mdSpecies(H5mdFile *h5, int **codes, char ***names, int *nNames) {
+	hid_t dset, space;
+	int status = 1;
+
+	*codes = NULL;
+	*names = NULL;
+	*nNames = 0;
+	pthread_mutex_lock(&h5Lock);
+	if (H5Lexists(h5->group, "species", H5P_DEFAULT) <= 0
+			|| (dset = H5Dopen2(h5->group, "species", H5P_DEFAULT)) < 0) goto end;
+	space = H5Dget_space(dset);
+	if (H5Sget_simple_extent_ndims(space) == 1
+			&& H5Sget_simple_extent_npoints(space) == h5->nAtoms) {
+		status = -1;
+		if ((*codes = (int*) malloc(h5->nAtoms * sizeof(int))) != NULL
+				&& H5Dread(dset, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, *codes) >= 0
+				&& readStrings(dset, "names", names, nNames) >= 0)
+			status = 0;
+	}
+	H5Sclose(space);
+	H5Dclose(dset);
+	if (status == -1) {
+		free(*codes);
+		*codes = NULL;
+		h5->error = "Error reading species of the H5MD file";
+	}
+
+	end:
+	pthread_mutex_unlock(&h5Lock);
+	return status;
+}
+
+
+/* Read count frames of the element from start, multiplied by factor.   *
+ * runs are nRuns pairs of the first atom and the number of atoms to be *
+ * read (all if runs is NULL), in increasing order. Frames are read in  *
+ * blocks aligned with the chunks, so that no chunk is read twice. The  *
+ * lock must be held.                                                   */
+static int readSlab(H5mdElement *el, long start, long count, const hsize_t *runs,
+                    int nRuns, ARRAY_REAL *dst) {
+	hsize_t offset[3] = { 0, 0, 0 }, block[3], run[3], first, last;
+	hid_t fileSpace, memSpace;
+	long width = 1;
+	int k, r, status = 0;
+
+	for (k = 1; k < el->rank; k++) block[k] = run[k] = el->dims[k];
+	if (runs != NULL)
+		for (r = 0, block[1] = 0; r < nRuns; r++) block[1] += runs[2*r+1];
+	for (k = 1; k < el->rank; k++) width *= block[k];
+
+	fileSpace = H5Dget_space(el->value);
+	for (first = start; first < (hsize_t)(start + count) && status == 0; first = last) {
+		last = (first / el->chunk[0] + 1) * el->chunk[0];
+		if (last > (hsize_t)(start + count)) last = start + count;
+		offset[0] = first;
+		block[0] = run[0] = last - first;
+		if (runs == NULL)
+			H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset, NULL, block, NULL);
+		else
+			for (r = 0; r < nRuns; r++) {
+				offset[1] = runs[2*r];
+				run[1] = runs[2*r+1];
+				H5Sselect_hyperslab(fileSpace, r ? H5S_SELECT_OR : H5S_SELECT_SET,
+				                    offset, NULL, run, NULL);
+			}
+		memSpace = H5Screate_simple(el->rank, block, NULL);
+		if (H5Dread(el->value, H5T_NATIVE_DOUBLE, memSpace, fileSpace, H5P_DEFAULT,
+		            dst + (first - start) * width) < 0) status = -1;
+		H5Sclose(memSpace);
+	}
+	H5Sclose(fileSpace);
+	return status;
+}
+
+
+static void scale(ARRAY_REAL *values, long n, double factor) {
+	long i;
+
+	if (factor != 1.0)
+		for (i = 0; i < n; i++) values[i] *= factor;
+}
+
+
+/* Read count frames of a (frames, atoms, 3) element, see readSlab */
+int h5mdRead(H5mdFile *h5, H5mdElement *el, long start, long count,
+             const hsize_t *runs, int nRuns, double factor, ARRAY_REAL *dst) {
+	long nSelected = el->dims[1];
+	int r, status;
+
+	if (start < 0 || count < 0 || start + count > (long)el->dims[0]) {
+		h5->error = "Frames out of range";
+		return -1; }
+	if (count == 0) return 0;
+	if (runs != NULL)
+		for (r = 0, nSelected = 0; r < nRuns; r++) nSelected += runs[2*r+1];
+
+	pthread_mutex_lock(&h5Lock);
+	status = readSlab(el, start, count, runs, nRuns, dst);
+	pthread_mutex_unlock(&h5Lock);
+	if (status) {
+		h5->error = "Error reading the H5MD file";
+		return -1; }
+	scale(dst, count * nSelected * 3, factor);
+	return 0;
+}
+
+
+/* Box of the frame; returns 1 if there is none */
+int h5mdReadBox(H5mdFile *h5, long frame, double factor, ARRAY_REAL *box) {
+	ARRAY_REAL edges[9];
+	int k, status;
+
+	if (h5->hasBox == 1) {
+		memcpy(box, h5->fixedBox, 9 * sizeof(ARRAY_REAL));
+		scale(box, 9, factor);
+		return 0; }
+	if (h5->hasBox == 0 || frame >= (long)h5->box.dims[0]) return 1;
+
+	pthread_mutex_lock(&h5Lock);
+	status = readSlab(&(h5->box), frame, 1, NULL, 0, edges);
+	pthread_mutex_unlock(&h5Lock);
+	if (status) {
+		h5->error = "Error reading the box of the H5MD file";
+		return -1; }
+	// Edges of rectangular boxes are only the lengths
+	if (h5->box.rank == 2) {
+		memset(box, 0, 9 * sizeof(ARRAY_REAL));
+		for (k = 0; k < 3; k++) box[4*k] = edges[k];
+	} else
+		memcpy(box, edges, 9 * sizeof(ARRAY_REAL));
+	scale(box, 9, factor);
+	return 0;
+}
+
+
+/* Single value of a step or time dataset */
+static int readValue(hid_t dset, long frame, hid_t memType, void *value) {
+	hsize_t offset[1], count[1] = { 1 };
+	hid_t fileSpace, memSpace;
+	int status;
+
+	offset[0] = frame;
+	fileSpace = H5Dget_space(dset);
+	if (H5Sget_simple_extent_npoints(fileSpace) <= frame) {
+		H5Sclose(fileSpace);
+		return 1; }
+	H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset, NULL, count, NULL);
+	memSpace = H5Screate_simple(1, count, NULL);
+	status = H5Dread(dset, memType, memSpace, fileSpace, H5P_DEFAULT, value) < 0 ? -1 : 0;
+	H5Sclose(memSpace);
+	H5Sclose(fileSpace);
+	return status;
+}
+
+
+/* Step and time of the frame of the element. Returns a bit mask: 1 if *
+ * the step is known, 2 if the time is known; -1 on error.             */
+int h5mdStepTime(H5mdFile *h5, H5mdElement *el, long frame, long *step, double *time) {
+	int known = 0, status = 0;
+
+	pthread_mutex_lock(&h5Lock);
+	if (el->stepFixed) {
+		*step = el->stepOffset + frame * el->stepInterval;
+		known |= 1;
+	} else if (el->step >= 0 && (status = readValue(el->step, frame, H5T_NATIVE_LONG, step)) == 0)
+		known |= 1;
+	if (status != -1) {
+		if (el->timeFixed) {
+			*time = el->timeOffset + frame * el->timeInterval;
+			known |= 2;
+		} else if (el->time >= 0 && (status = readValue(el->time, frame, H5T_NATIVE_DOUBLE, time)) == 0)
+			known |= 2;
+	}
+	pthread_mutex_unlock(&h5Lock);
+
+	if (status == -1) {
+		h5->error = "Error reading the H5MD file";
+		return -1; }
+	return known;
+}
+
+
+/* Time-dependent element written frame by frame: value extended along *
+ * the frames, in chunks of about H5MD_CHUNK_BYTES, and the step given *
+ * as the interval between frames.                                     */
+static int createElement(hid_t group, const char *name, int rank, const hsize_t *dims,
+                         hid_t type, const char *unit, H5mdElement *el) {
+	hid_t grp, space, plist, step;
+	hsize_t maxDims[3], current[3];
+	const long interval = 1;
+	size_t frameBytes;
+	int k, status = -1;
+
+	elementInit(el);
+	if ((grp = H5Gcreate2(group, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) < 0)
+		return -1;
+	el->rank = rank;
+	frameBytes = H5Tget_size(type);
+	for (k = 0; k < rank; k++) {
+		el->dims[k] = current[k] = maxDims[k] = k ? dims[k] : 0;
+		el->chunk[k] = dims[k];
+		if (k) frameBytes *= dims[k];
+	}
+	maxDims[0] = H5S_UNLIMITED;
+	// Large frames are split into chunks of atoms
+	if (frameBytes >= H5MD_CHUNK_BYTES) {
+		el->chunk[0] = 1;
+		el->chunk[1] = H5MD_CHUNK_BYTES / (frameBytes / dims[1]);
+		if (el->chunk[1] < 1) el->chunk[1] = 1;
+	} else
+		el->chunk[0] = H5MD_CHUNK_BYTES / frameBytes;
+
+	space = H5Screate_simple(rank, current, maxDims);
+	plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(plist, rank, el->chunk);
+	el->value = H5Dcreate2(grp, "value", type, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+	H5Pclose(plist);
+	H5Sclose(space);
+	if (el->value < 0 || writeStrings(el->value, "unit", &unit, 1)) goto end;
+
+	space = H5Screate(H5S_SCALAR);
+	step = H5Dcreate2(grp, "step", H5T_STD_I64LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Sclose(space);
+	if (step < 0) goto end;
+	if (H5Dwrite(step, H5T_NATIVE_LONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &interval) >= 0)
+		status = 0;
+	H5Dclose(step);
+	el->stepFixed = 1;
+	el->stepInterval = interval;
+
+	end:
+	H5Gclose(grp);
+	return status;
+}
+
+
+/* Add count frames of data to the element */
+static int appendElement(H5mdElement *el, long count, const double *data) {
+	hsize_t offset[3] = { 0, 0, 0 }, block[3];
+	hid_t fileSpace, memSpace;
+	int k, status = -1;
+
+	for (k = 0; k < el->rank; k++) block[k] = el->dims[k];
+	block[0] = el->dims[0] + count;
+	if (H5Dset_extent(el->value, block) < 0) return -1;
+	offset[0] = el->dims[0];
+	block[0] = count;
+
+	fileSpace = H5Dget_space(el->value);
+	H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset, NULL, block, NULL);
+	memSpace = H5Screate_simple(el->rank, block, NULL);
+	if (H5Dwrite(el->value, H5T_NATIVE_DOUBLE, memSpace, fileSpace, H5P_DEFAULT, data) >= 0) {
+		el->dims[0] += count;
+		status = 0; }
+	H5Sclose(memSpace);
+	H5Sclose(fileSpace);
+	return status;
+}
+
+
+/* Write count frames, in Angstrom. The box is given for every frame *
+ * (boxStride 9) or for all of them (boxStride 0); velocities and box *
+ * have to be given for all frames of the file or for none.           */
+int h5mdAppend(H5mdFile *h5, long count, const double *xyz, const double *vel,
+               const double *box, long boxStride) {
+	const char *periodic[3] = { "periodic", "periodic", "periodic" };
+	hsize_t dims[3];
+	hid_t group;
+	double *boxes = NULL;
+	long i;
+	int status = -1;
+
+	pthread_mutex_lock(&h5Lock);
+	h5->error = "Could not write to the H5MD file";
+	dims[1] = h5->nAtoms;
+	dims[2] = 3;
+
+	// The first frames decide which elements are written
+	if (h5->position.value < 0) {
+		if (createElement(h5->group, "position", 3, dims, H5T_IEEE_F32LE,
+		                  "Angstrom", &(h5->position))) goto end;
+		if (vel != NULL && createElement(h5->group, "velocity", 3, dims,
+		                  H5T_IEEE_F32LE, "Angstrom ps-1", &(h5->velocity))) goto end;
+		if (box != NULL) {
+			if ((group = H5Gopen2(h5->group, "box", H5P_DEFAULT)) < 0) goto end;
+			dims[1] = 3;
+			if (H5Aexists(group, "boundary") > 0) H5Adelete(group, "boundary");
+			if (writeStrings(group, "boundary", periodic, 3)
+					|| createElement(group, "edges", 3, dims, H5T_IEEE_F64LE,
+					                 "Angstrom", &(h5->box))) {
+				H5Gclose(group);
+				goto end; }
+			H5Gclose(group);
+			h5->hasBox = 2;
+		}
+	} else if ((vel != NULL) != (h5->velocity.value >= 0)
+			|| (box != NULL) != (h5->hasBox == 2 && h5->box.rank == 3)) {
+		h5->error = "Velocities and box must be given for all frames of H5MD files or for none";
+		goto end;
+	}
+
+	if (appendElement(&(h5->position), count, xyz)) goto end;
+	if (vel != NULL && appendElement(&(h5->velocity), count, vel)) goto end;
+	if (box != NULL) {
+		// The same box is written for every frame
+		if (boxStride == 0) {
+			if ((boxes = (double*) malloc(count * 9 * sizeof(double))) == NULL) goto end;
+			for (i = 0; i < count; i++) memcpy(boxes + 9 * i, box, 9 * sizeof(double));
+			box = boxes;
+		}
+		if (appendElement(&(h5->box), count, box)) goto end;
+	}
+	h5->nFrames += count;
+	status = 0;
+
+	end:
+	pthread_mutex_unlock(&h5Lock);
+	free(boxes);
+	return status;
+}
+
+
+int h5mdFlush(H5mdFile *h5) {
+	int status;
+
+	pthread_mutex_lock(&h5Lock);
+	status = H5Fflush(h5->file, H5F_SCOPE_LOCAL) < 0 ? -1 : 0;
+	pthread_mutex_unlock(&h5Lock);
+	return status;
+}
+
+
+int h5mdClose(H5mdFile *h5) {
+	int status = 0;
+
+	pthread_mutex_lock(&h5Lock);
+	elementClose(&(h5->position));
+	elementClose(&(h5->velocity));
+	elementClose(&(h5->box));
+	if (h5->group >= 0) H5Gclose(h5->group);
+	if (h5->file >= 0 && H5Fclose(h5->file) < 0) status = -1;
+	pthread_mutex_unlock(&h5Lock);
+	h5mdInit(h5);
+	return status;
+}
+
+#endif /* HAVE_HDF5 */
@@ -0,0 +1,82 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#ifndef __H5MD_H__
+#define __H5MD_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+#ifdef HAVE_HDF5
+
+#include <hdf5.h>
+
+/* H5MD files (HDF5 with the layout of the H5MD specification). The   *
+ * particles of the first group under /particles ('all' if present)   *
+ * are used. Time-dependent elements are groups with a value dataset, *
+ * frame index first, and step and time given for every frame or as   *
+ * a fixed interval (scalar datasets with an optional offset).        */
+typedef struct {
+	hid_t value, step, time;     /* datasets, or -1 if missing */
+	int rank;                    /* of value */
+	hsize_t dims[3];             /* of value */
+	hsize_t chunk[3];            /* chunks of value; dims if contiguous */
+	int stepFixed, timeFixed;    /* step or time is a scalar interval */
+	long stepInterval, stepOffset;
+	double timeInterval, timeOffset;
+	double factor;               /* unit attribute, in Angstrom; 0 if unknown */
+} H5mdElement;
+
+typedef struct {
+	hid_t file;
+	hid_t group;                 /* /particles/<name> */
+	H5mdElement position, velocity, box;
+	int hasBox;                  /* 0 - none, 1 - fixed edges, 2 - time-dependent */
+	ARRAY_REAL fixedBox[9];
+	double boxFactor;
+	int nAtoms;
+	long nFrames;                /* of position */
+	const char *error;           /* message of the last error */
+} H5mdFile;
+
+void h5mdInit(H5mdFile *h5);
+int h5mdOpen(H5mdFile *h5, const char *name, char mode);
+int h5mdCreate(H5mdFile *h5, const char *name, int nAtoms, const int *species,
+               char **names, int nNames);
+int h5mdSpecies(H5mdFile *h5, int **codes, char ***names, int *nNames);
+int h5mdRead(H5mdFile *h5, H5mdElement *el, long start, long count,
+             const hsize_t *runs, int nRuns, double factor, ARRAY_REAL *dst);
+int h5mdReadBox(H5mdFile *h5, long frame, double factor, ARRAY_REAL *box);
+int h5mdStepTime(H5mdFile *h5, H5mdElement *el, long frame, long *step, double *time);
+int h5mdAppend(H5mdFile *h5, long count, const double *xyz, const double *vel,
+               const double *box, long boxStride);
+int h5mdFlush(H5mdFile *h5);
+int h5mdClose(H5mdFile *h5);
+
+#endif /* HAVE_HDF5 */
+
+#endif /* __H5MD_H__ */
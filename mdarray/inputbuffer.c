@@ -0,0 +1,180 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "inputbuffer.h"
+#include <unistd.h>
+#include <errno.h>
+
+
+
+void inputInit(InputBuffer *in) {
+	in->fd = NULL;
+	in->data = NULL;
+	in->size = 0;
+	in->start = 0;
+	in->end = 0;
+	in->offset = 0;
+	in->mark = -1;
+	in->eof = 0;
+}
+
+
+/* Start reading from the current position of the file. From now on *
+ * the file is read only through the buffer.                         */
+void inputAttach(InputBuffer *in, FILE *fd) {
+	in->fd = fd;
+	in->start = 0;
+	in->end = 0;
+	in->mark = -1;
+	in->eof = 0;
+	// Pipes have no position; count from the point they are attached
+	in->offset = lseek(fileno(fd), 0, SEEK_CUR);
+	if (in->offset == -1) in->offset = 0;
+}
+
+
+/* The file itself is owned (and closed) by the caller */
+void inputFree(InputBuffer *in) {
+	free(in->data);
+	inputInit(in);
+}
+
+
+/* Make sure that at least need bytes are available, unless the end *
+ * of file comes first. Returns the number of bytes available or -1 *
+ * if reading failed.                                               */
+long inputFill(InputBuffer *in, size_t need) {
+	size_t keep, want;
+	ssize_t got;
+	char *tmp;
+
+	while (in->end - in->start < need && !in->eof) {
+
+		// Drop the data already consumed, unless it is marked
+		keep = in->start;
+		if (in->mark >= 0) {
+			if (in->mark <= in->offset) keep = 0;
+			else if ((size_t)(in->mark - in->offset) < keep)
+				keep = in->mark - in->offset;
+		}
+		if (keep > 0) {
+			memmove(in->data, in->data + keep, in->end - keep);
+			in->offset += keep;
+			in->start -= keep;
+			in->end -= keep;
+		}
+
+		// Always read a large chunk, so that short lines are cheap
+		want = in->start + need;
+		if (want < in->end + INPUT_CHUNK) want = in->end + INPUT_CHUNK;
+		if (want > in->size) {
+			if (want < 2 * in->size) want = 2 * in->size;
+			if ((tmp = (char*) realloc(in->data, want)) == NULL) return -1;
+			in->data = tmp;
+			in->size = want;
+		}
+
+		// Unlike fread, read returns what a pipe has at the moment
+		got = read(fileno(in->fd), in->data + in->end, in->size - in->end);
+		if (got == -1) {
+			if (errno == EINTR) continue;
+			return -1; }
+		if (got == 0) in->eof = 1;
+		in->end += got;
+	}
+
+	return in->end - in->start;
+}
+
+
+/* Next line, including the newline character (absent at the end of *
+ * some files), without consuming it. The line is valid until the    *
+ * next call. Returns NULL at the end of file (errno is 0) or on      *
+ * error.                                                            */
+const char *inputPeekLine(InputBuffer *in, size_t *len) {
+	size_t scanned = 0;
+	char *found;
+
+	while (1) {
+		if (in->end > in->start + scanned) {
+			found = memchr(in->data + in->start + scanned, '\n',
+			               in->end - in->start - scanned);
+			if (found != NULL) {
+				*len = found - (in->data + in->start) + 1;
+				return in->data + in->start; }
+			scanned = in->end - in->start;
+		}
+		if (in->eof) {
+			errno = 0;
+			if (scanned == 0) return NULL;
+			*len = scanned;
+			return in->data + in->start;
+		}
+		if (inputFill(in, scanned + 1) == -1) return NULL;
+	}
+}
+
+
+/* Works like getline, but the data comes from the buffer */
+ssize_t inputGetLine(InputBuffer *in, char **line, size_t *size) {
+	const char *ptr;
+	size_t len;
+	char *tmp;
+
+	if ((ptr = inputPeekLine(in, &len)) == NULL) return -1;
+	if (*line == NULL || *size < len + 1) {
+		if ((tmp = (char*) realloc(*line, len + 1)) == NULL) return -1;
+		*line = tmp;
+		*size = len + 1;
+	}
+	memcpy(*line, ptr, len);
+	(*line)[len] = '\0';
+	in->start += len;
+
+	return len;
+}
+
+
+/* Position of the next byte to be consumed */
+long inputTell(InputBuffer *in) {
+	return in->offset + in->start;
+}
+
+
+/* Go to the given position; positions still in the buffer are *
+ * reached without a system call, which also works for pipes.  */
+int inputSeek(InputBuffer *in, long position) {
+
+	if (position >= in->offset && position <= in->offset + (long)in->end) {
+		in->start = position - in->offset;
+		return 0; }
+
+	if (lseek(fileno(in->fd), position, SEEK_SET) == -1) return -1;
+	in->offset = position;
+	in->start = 0;
+	in->end = 0;
+	in->eof = 0;
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#ifndef __INPUTBUFFER_H__
+#define __INPUTBUFFER_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Look-ahead buffer of the text readers. Data is read from the file   *
+ * descriptor in large chunks and handed out as lines or blocks, which *
+ * can be examined before they are consumed, so that no seeking back   *
+ * is needed and pipes can be read as well. Nothing here needs the GIL; *
+ * errors are reported with -1 and errno.                              */
+typedef struct {
+	FILE *fd;
+	char *data;
+	size_t size;    /* allocated size of data */
+	size_t start;   /* first byte not consumed yet */
+	size_t end;     /* end of the data read */
+	long offset;    /* position of data[0] in the file */
+	long mark;      /* data from this position on is kept, -1 if none */
+	int eof;
+} InputBuffer;
+
+#define INPUT_CHUNK 65536
+
+void inputInit(InputBuffer *in);
+void inputAttach(InputBuffer *in, FILE *fd);
+void inputFree(InputBuffer *in);
+long inputFill(InputBuffer *in, size_t need);
+const char *inputPeekLine(InputBuffer *in, size_t *len);
+ssize_t inputGetLine(InputBuffer *in, char **line, size_t *size);
+long inputTell(InputBuffer *in);
+int inputSeek(InputBuffer *in, long position);
+
+/* Data available without reading and its beginning */
+#define inputAvailable(in) ((in)->end - (in)->start)
+#define inputData(in) ((in)->data + (in)->start)
+#define inputConsume(in, n) ((in)->start += (n))
+
+#endif /* __INPUTBUFFER_H__ */
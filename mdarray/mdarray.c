@@ -25,8 +25,15 @@
 #include "mdarray.h"
 #include "constants.h"
 #include "topology.h"
+#include "utils.h"
+#include "frame.h"
+#include "measure.h"
+#include "whole.h"
+#include "unwrap.h"
 
 
+/* Defined in trajectory.c, which has access to the readers and writers */
+PyObject *convert_trajectory(PyObject *self, PyObject *args, PyObject *kwds);
 
 
 static PyMethodDef mdarrayMethods[] = {
@@ -49,6 +56,62 @@ static PyMethodDef mdarrayMethods[] = {
 		"Given a list of bonds as tuples, find sets of topologically\n"
 		"connected atoms (molecules).\n"
 		"\n" },
+	{"symbolsToNumbers", (PyCFunction)symbols_to_numbers, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"symbolsToNumbers(symbols)\n"
+		"\n"
+		"Resolve atomic symbols (a list of strings or a 'U'/'S' ndarray)\n"
+		"and return a tuple of three ndarrays: atomic numbers, masses and\n"
+		"covalent radii. Unknown symbols give number -1, mass 0 and\n"
+		"radius -1.\n"
+		"\n" },
+	{"convert", (PyCFunction)convert_trajectory, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"convert(src, dst, stride=1, atoms=None, units=None, topology=None,\n"
+		"        nAtoms=0, format=None)\n"
+		"\n"
+		"Convert the trajectory 'src' (a file name, a list of files or a\n"
+		"glob pattern) into a new file 'dst', in XYZ, GRO or PDB format. Every\n"
+		"'stride'-th frame is kept; 'atoms' is a sequence of atom indices to\n"
+		"be written; 'units', 'nAtoms' (needed for MDCRD) and 'format' are\n"
+		"those of the source, as in Trajectory. Atom and residue names are\n"
+		"taken from the source or from the 'topology' file, if given (needed\n"
+		"for XTC and MDCRD). Frames are read by a separate thread, no Python\n"
+		"objects are created per frame.\n"
+		"Returns the number of frames written.\n"
+		"\n" },
+	{"wrap", (PyCFunction)wrap_coordinates, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"wrap(coordinates, box)\n"
+		"\n"
+		"Wrap 'coordinates' (a C-contiguous float64 array of shape (..., 3))\n"
+		"in place into the box, given as three lengths or as a 3x3 matrix\n"
+		"whose rows are the cell vectors. Triclinic boxes are wrapped into\n"
+		"the unit cell, 0 <= s < 1 in fractional coordinates. Returns the\n"
+		"same array.\n"
+		"\n" },
+	{"minimumImage", (PyCFunction)minimum_image, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"minimumImage(vectors, box)\n"
+		"\n"
+		"Replace displacement 'vectors' (a C-contiguous float64 array of\n"
+		"shape (..., 3)) in place by their shortest periodic images in the\n"
+		"box, orthorhombic or triclinic, given as for wrap(). Returns the\n"
+		"same array.\n"
+		"\n" },
+	{"makeWhole", (PyCFunction)make_whole, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"makeWhole(coordinates, box, bonds)\n"
+		"\n"
+		"Make molecules split by periodic boundaries whole again, in place.\n"
+		"'coordinates' is a C-contiguous float64 array of shape (atoms, 3)\n"
+		"or (frames, atoms, 3), 'box' as for wrap() and 'bonds' a list of\n"
+		"pairs of atoms, as returned by findBonds, or of molecules, as\n"
+		"returned by findMolecules (then molecules must be smaller than half\n"
+		"of the box). Atoms are moved to the nearest image of their bonded\n"
+		"neighbours, starting from the lowest index of each molecule.\n"
+		"Returns the same array.\n"
+		"\n" },
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
@@ -85,6 +148,15 @@ static PyObject* collectConfig(void) {
 #else
     PyDict_SetItem(dict, key, Py_False);
 #endif
+	Py_DECREF(key);
+
+	key = PyUnicode_FromString("hdf5");
+#ifdef HAVE_HDF5
+    PyDict_SetItem(dict, key, Py_True);
+#else
+    PyDict_SetItem(dict, key, Py_False);
+#endif
+	Py_DECREF(key);
 
 	return dict;
 }
@@ -99,18 +171,24 @@ PyMODINIT_FUNC PyInit_mdarray(void)
 	PyObject *exposed_atom_masses, *exposed_symbol2number;
 	PyObject *exposed_covalentradii;
 
-	/* Use system-wide locale, but make sure that decimal point is a point! */
-	setlocale(LC_ALL, "");
-	setlocale(LC_NUMERIC, "C");
+	initElementLookup();
 
 	if (PyType_Ready(&TrajectoryType) < 0)
 		return NULL;
+	if (frameTypeReady() < 0)
+		return NULL;
+	if (PyType_Ready(&UnwrapperType) < 0)
+		return NULL;
 
 	md = PyModule_Create(&mdarrayModule);
 	if (md == NULL) return NULL;
 
 	Py_INCREF(&TrajectoryType);
 	PyModule_AddObject(md, "Trajectory", (PyObject *)&TrajectoryType);
+	Py_INCREF(&FrameType);
+	PyModule_AddObject(md, "Frame", (PyObject *)&FrameType);
+	Py_INCREF(&UnwrapperType);
+	PyModule_AddObject(md, "Unwrapper", (PyObject *)&UnwrapperType);
 
 	if( build_tables(&exposed_atom_symbols, &exposed_atom_names,
 		&exposed_atom_masses, &exposed_symbol2number,
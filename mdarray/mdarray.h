@@ -30,8 +30,12 @@
 
 /* To make sure that Python and Numpy stuff is declared everywhere, *
  * put this here, in the header                                     */
-#include <locale.h>
 #include <Python.h>
+/* After Python.h, so that feature macros (strtod_l) are in effect */
+#include <locale.h>
+#ifdef __APPLE__
+	#include <xlocale.h>
+#endif
 #include <structmember.h>
 #include <numpy/arrayobject.h>
 #include <numpy/npy_math.h>
@@ -40,6 +44,7 @@
 #ifdef HAVE_GROMACS
 	#include <gromacs/utility/smalloc.h>
 	#include <gromacs/fileio/xtcio.h>
+	#include <gromacs/fileio/gmxfio.h>
 #endif
 
 #define BOHRTOANGS 0.529177209
@@ -21,24 +21,79 @@
  ***************************************************************************/
 
 
+#if defined(__AVX512F__) || defined(__AVX2__)
+	#include <immintrin.h>
+#endif
 #include "measure.h"
 
 
 
+/* Coordinates are wrapped as x - L floor(x / L), with the division  *
+ * replaced by a product with the inverse box computed once. Vector   *
+ * kernels take 8 (AVX-512) or 4 (AVX2) atoms at a time; the box is   *
+ * laid out to follow the x, y, z interleaving of the coordinates.    */
+
+static inline void wrapScalar(ARRAY_REAL *xyz, long n, const ARRAY_REAL box[3],
+			const ARRAY_REAL inv[3]) {
+	long i;
+	int k;
+
+	for (i = 0; i < n; i++, xyz += 3)
+		for (k = 0; k < 3; k++)
+			xyz[k] -= box[k] * floor(xyz[k] * inv[k]);
+}
+
+
 // Wrap atoms in a contiguous array of size n
 //
-void wrapPBC(ARRAY_REAL *xyz, const int n, const ARRAY_REAL box[3]) {
-	int idx, i, nt;
-	ARRAY_REAL v;
-
-	for (idx = 0; idx < n*3; ) {
-		for (i = 0; i < 3; i++, idx++) {
-			v = xyz[idx];
-			nt = (int)(v/box[i]);
-			xyz[idx] -= box[i]*nt;
-			if (v < 0) xyz[idx] += box[i];
-		}
+void wrapPBC(ARRAY_REAL *xyz, const long n, const ARRAY_REAL box[3]) {
+	const ARRAY_REAL inv[3] = { 1.0 / box[0], 1.0 / box[1], 1.0 / box[2] };
+	long i = 0;
+#if defined(__AVX512F__)
+	const __m512d b0 = _mm512_setr_pd(box[0], box[1], box[2], box[0], box[1], box[2], box[0], box[1]);
+	const __m512d b1 = _mm512_setr_pd(box[2], box[0], box[1], box[2], box[0], box[1], box[2], box[0]);
+	const __m512d b2 = _mm512_setr_pd(box[1], box[2], box[0], box[1], box[2], box[0], box[1], box[2]);
+	const __m512d i0 = _mm512_setr_pd(inv[0], inv[1], inv[2], inv[0], inv[1], inv[2], inv[0], inv[1]);
+	const __m512d i1 = _mm512_setr_pd(inv[2], inv[0], inv[1], inv[2], inv[0], inv[1], inv[2], inv[0]);
+	const __m512d i2 = _mm512_setr_pd(inv[1], inv[2], inv[0], inv[1], inv[2], inv[0], inv[1], inv[2]);
+	__m512d v0, v1, v2;
+
+	for (; i + 8 <= n; i += 8) {
+		v0 = _mm512_loadu_pd(xyz + 3*i);
+		v1 = _mm512_loadu_pd(xyz + 3*i + 8);
+		v2 = _mm512_loadu_pd(xyz + 3*i + 16);
+		v0 = _mm512_fnmadd_pd(b0, _mm512_roundscale_pd(_mm512_mul_pd(v0, i0),
+					_MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC), v0);
+		v1 = _mm512_fnmadd_pd(b1, _mm512_roundscale_pd(_mm512_mul_pd(v1, i1),
+					_MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC), v1);
+		v2 = _mm512_fnmadd_pd(b2, _mm512_roundscale_pd(_mm512_mul_pd(v2, i2),
+					_MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC), v2);
+		_mm512_storeu_pd(xyz + 3*i, v0);
+		_mm512_storeu_pd(xyz + 3*i + 8, v1);
+		_mm512_storeu_pd(xyz + 3*i + 16, v2);
 	}
+#elif defined(__AVX2__)
+	const __m256d b0 = _mm256_setr_pd(box[0], box[1], box[2], box[0]);
+	const __m256d b1 = _mm256_setr_pd(box[1], box[2], box[0], box[1]);
+	const __m256d b2 = _mm256_setr_pd(box[2], box[0], box[1], box[2]);
+	const __m256d i0 = _mm256_setr_pd(inv[0], inv[1], inv[2], inv[0]);
+	const __m256d i1 = _mm256_setr_pd(inv[1], inv[2], inv[0], inv[1]);
+	const __m256d i2 = _mm256_setr_pd(inv[2], inv[0], inv[1], inv[2]);
+	__m256d v0, v1, v2;
+
+	for (; i + 4 <= n; i += 4) {
+		v0 = _mm256_loadu_pd(xyz + 3*i);
+		v1 = _mm256_loadu_pd(xyz + 3*i + 4);
+		v2 = _mm256_loadu_pd(xyz + 3*i + 8);
+		v0 = _mm256_sub_pd(v0, _mm256_mul_pd(b0, _mm256_floor_pd(_mm256_mul_pd(v0, i0))));
+		v1 = _mm256_sub_pd(v1, _mm256_mul_pd(b1, _mm256_floor_pd(_mm256_mul_pd(v1, i1))));
+		v2 = _mm256_sub_pd(v2, _mm256_mul_pd(b2, _mm256_floor_pd(_mm256_mul_pd(v2, i2))));
+		_mm256_storeu_pd(xyz + 3*i, v0);
+		_mm256_storeu_pd(xyz + 3*i + 4, v1);
+		_mm256_storeu_pd(xyz + 3*i + 8, v2);
+	}
+#endif
+	wrapScalar(xyz + 3*i, n - i, box, inv);
 }
 
 
@@ -46,15 +101,274 @@ void wrapPBC(ARRAY_REAL *xyz, const int n, const ARRAY_REAL box[3]) {
 // Wrap a single atom
 //
 void wrapPBCsingle(ARRAY_REAL *xyz, const ARRAY_REAL box[3]) {
-	int i, nt;
-	ARRAY_REAL v;
-
-	for (i = 0; i < 3; i++) {
-		v = xyz[i];
-		nt = (int)(v/box[i]);
-		xyz[i] -= box[i]*nt;
-		if (v < 0) xyz[i] += box[i];
+	const ARRAY_REAL inv[3] = { 1.0 / box[0], 1.0 / box[1], 1.0 / box[2] };
+
+	wrapScalar(xyz, 1, box, inv);
+}
+
+
+
+/* Triclinic boxes: rows of the box matrix H are the cell vectors and *
+ * x = s H for fractional coordinates s = x H^-1. Atoms are reduced to *
+ * the unit cell (s - floor(s)) or, for displacements, to the nearest *
+ * image (s - round(s)). Vector kernels gather x, y and z of 8 or 4    *
+ * atoms into separate registers.                                      */
+
+// Inverse of the box matrix, fails if the box is singular
+//
+int invertBox(const ARRAY_REAL box[9], ARRAY_REAL inv[9]) {
+	double det;
+	int i, j;
+
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			inv[3*j + i] = box[3*((i+1)%3) + (j+1)%3] * box[3*((i+2)%3) + (j+2)%3]
+						 - box[3*((i+1)%3) + (j+2)%3] * box[3*((i+2)%3) + (j+1)%3];
+	det = box[0] * inv[0] + box[1] * inv[3] + box[2] * inv[6];
+	if (fabs(det) < 1e-12) return -1;
+	for (i = 0; i < 9; i++) inv[i] /= det;
+
+	return 0;
+}
+
+
+int boxIsDiagonal(const ARRAY_REAL box[9]) {
+	return box[1] == 0.0 && box[2] == 0.0 && box[3] == 0.0
+		&& box[5] == 0.0 && box[6] == 0.0 && box[7] == 0.0;
+}
+
+
+static inline void reduceScalar(ARRAY_REAL *xyz, long n, const ARRAY_REAL h[9],
+			const ARRAY_REAL inv[9], const int nearest) {
+	ARRAY_REAL s[3];
+	long i;
+	int k;
+
+	for (i = 0; i < n; i++, xyz += 3) {
+		for (k = 0; k < 3; k++) {
+			s[k] = xyz[0] * inv[k] + xyz[1] * inv[3+k] + xyz[2] * inv[6+k];
+			s[k] -= nearest ? nearbyint(s[k]) : floor(s[k]);
+		}
+		for (k = 0; k < 3; k++)
+			xyz[k] = s[0] * h[k] + s[1] * h[3+k] + s[2] * h[6+k];
+	}
+}
+
+
+static void reduceTriclinic(ARRAY_REAL *xyz, const long n, const ARRAY_REAL h[9],
+			const ARRAY_REAL inv[9], const int nearest) {
+	long i = 0;
+#if defined(__AVX512F__)
+	const __m512i idx = _mm512_setr_epi64(0, 3, 6, 9, 12, 15, 18, 21);
+	__m512d hv[9], iv[9], r[3], s[3];
+	int k;
+
+	for (k = 0; k < 9; k++) {
+		hv[k] = _mm512_set1_pd(h[k]);
+		iv[k] = _mm512_set1_pd(inv[k]);
+	}
+	for (; i + 8 <= n; i += 8) {
+		for (k = 0; k < 3; k++)
+			r[k] = _mm512_i64gather_pd(idx, xyz + 3*i + k, 8);
+		for (k = 0; k < 3; k++) {
+			s[k] = _mm512_fmadd_pd(r[0], iv[k], _mm512_fmadd_pd(r[1], iv[3+k],
+						_mm512_mul_pd(r[2], iv[6+k])));
+			s[k] = _mm512_sub_pd(s[k], nearest
+				? _mm512_roundscale_pd(s[k], _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+				: _mm512_roundscale_pd(s[k], _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+		}
+		for (k = 0; k < 3; k++)
+			_mm512_i64scatter_pd(xyz + 3*i + k, idx,
+				_mm512_fmadd_pd(s[0], hv[k], _mm512_fmadd_pd(s[1], hv[3+k],
+					_mm512_mul_pd(s[2], hv[6+k]))), 8);
 	}
+#elif defined(__AVX2__)
+	const __m256i idx = _mm256_setr_epi64x(0, 3, 6, 9);
+	__m256d hv[9], iv[9], r[3], s[3];
+	double out[3][4];
+	int j, k;
+
+	for (k = 0; k < 9; k++) {
+		hv[k] = _mm256_set1_pd(h[k]);
+		iv[k] = _mm256_set1_pd(inv[k]);
+	}
+	for (; i + 4 <= n; i += 4) {
+		for (k = 0; k < 3; k++)
+			r[k] = _mm256_i64gather_pd(xyz + 3*i + k, idx, 8);
+		for (k = 0; k < 3; k++) {
+			s[k] = _mm256_add_pd(_mm256_mul_pd(r[0], iv[k]), _mm256_add_pd(
+						_mm256_mul_pd(r[1], iv[3+k]), _mm256_mul_pd(r[2], iv[6+k])));
+			s[k] = _mm256_sub_pd(s[k], nearest
+				? _mm256_round_pd(s[k], _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+				: _mm256_floor_pd(s[k]));
+		}
+		for (k = 0; k < 3; k++)
+			_mm256_storeu_pd(out[k], _mm256_add_pd(_mm256_mul_pd(s[0], hv[k]),
+				_mm256_add_pd(_mm256_mul_pd(s[1], hv[3+k]), _mm256_mul_pd(s[2], hv[6+k]))));
+		for (j = 0; j < 4; j++)
+			for (k = 0; k < 3; k++) xyz[3*(i+j) + k] = out[k][j];
+	}
+#endif
+	reduceScalar(xyz + 3*i, n - i, h, inv, nearest);
+}
+
+
+// Wrap atoms into the unit cell of a general (triclinic) box
+//
+void wrapTriclinic(ARRAY_REAL *xyz, const long n, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]) {
+	reduceTriclinic(xyz, n, box, inv, 0);
+}
+
+
+// Replace displacement vectors by their shortest periodic images. In
+// skewed boxes, rounding fractional coordinates may miss the shortest
+// image of long vectors, so the neighbouring images of those are tried.
+//
+void minimumImage(ARRAY_REAL *d, const long n, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]) {
+	ARRAY_REAL t[3], best[3], r2, r2best, width, r2safe = -1.0;
+	long i;
+	int a, b, c, k;
+
+	reduceTriclinic(d, n, box, inv, 1);
+	if (boxIsDiagonal(box)) return;
+
+	// Vectors shorter than half of the narrowest width are already minimal
+	for (k = 0; k < 3; k++) {
+		width = 1.0 / sqrt(inv[k] * inv[k] + inv[3+k] * inv[3+k] + inv[6+k] * inv[6+k]);
+		if (r2safe < 0.0 || 0.25 * width * width < r2safe) r2safe = 0.25 * width * width;
+	}
+
+	for (i = 0; i < n; i++, d += 3) {
+		r2best = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		if (r2best <= r2safe) continue;
+		for (k = 0; k < 3; k++) best[k] = d[k];
+		for (a = -1; a <= 1; a++)
+			for (b = -1; b <= 1; b++)
+				for (c = -1; c <= 1; c++) {
+					for (k = 0; k < 3; k++)
+						t[k] = d[k] + a * box[k] + b * box[3+k] + c * box[6+k];
+					r2 = t[0] * t[0] + t[1] * t[1] + t[2] * t[2];
+					if (r2 < r2best) {
+						r2best = r2;
+						for (k = 0; k < 3; k++) best[k] = t[k];
+					}
+				}
+		for (k = 0; k < 3; k++) d[k] = best[k];
+	}
+}
+
+
+
+/* Box matrix from three lengths or nine values, and its inverse. *
+ * Fails if the box is singular or has non-positive lengths.       */
+int boxFromValues(const ARRAY_REAL *b, int size, ARRAY_REAL box[9], ARRAY_REAL inv[9]) {
+	int k;
+
+	if (size == 3) {
+		for (k = 0; k < 9; k++) box[k] = 0.0;
+		for (k = 0; k < 3; k++) box[4*k] = b[k];
+	} else
+		for (k = 0; k < 9; k++) box[k] = b[k];
+
+	if (invertBox(box, inv) == -1 || (boxIsDiagonal(box)
+				&& !(box[0] > 0.0 && box[4] > 0.0 && box[8] > 0.0)))
+		return -1;
+	return 0;
+}
+
+
+/* Box of Python arguments: three lengths or a 3x3 matrix. Fills *
+ * the full matrix and its inverse.                               */
+int boxFromObject(PyObject *obj, ARRAY_REAL box[9], ARRAY_REAL inv[9]) {
+	PyArrayObject *py_box;
+	npy_intp size;
+	int status;
+
+	py_box = (PyArrayObject*) PyArray_FROM_OTF(obj, NPY_ARRAY_REAL, NPY_ARRAY_IN_ARRAY);
+	if (py_box == NULL) return -1;
+	size = PyArray_SIZE(py_box);
+	if (size != 3 && size != 9) {
+		Py_DECREF(py_box);
+		PyErr_SetString(PyExc_ValueError, "Box must have three lengths or be a 3x3 matrix");
+		return -1; }
+	status = boxFromValues((const ARRAY_REAL*) PyArray_DATA(py_box), (int)size, box, inv);
+	Py_DECREF(py_box);
+	if (status == -1) {
+		PyErr_SetString(PyExc_ValueError, "Box is singular or has non-positive lengths");
+		return -1; }
+
+	return 0;
+}
+
+
+/* Arguments of the Python interface: an array of shape (..., 3)  *
+ * modified in place, and the box                                 */
+static PyArrayObject *parse_vectors_box(PyObject *args, PyObject *kwds,
+			char **kwlist, ARRAY_REAL box[9], ARRAY_REAL inv[9]) {
+	PyArrayObject *py_coords;
+	PyObject *py_box;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!O", kwlist,
+			&PyArray_Type, &py_coords, &py_box))
+		return NULL;
+
+	if (PyArray_TYPE(py_coords) != NPY_ARRAY_REAL || !PyArray_IS_C_CONTIGUOUS(py_coords)
+			|| !PyArray_ISWRITEABLE(py_coords) || PyArray_NDIM(py_coords) < 1
+			|| PyArray_DIM(py_coords, PyArray_NDIM(py_coords) - 1) != 3) {
+		PyErr_SetString(PyExc_ValueError,
+			"Array must be writeable, C-contiguous float64 of shape (..., 3)");
+		return NULL; }
+	if (boxFromObject(py_box, box, inv) == -1) return NULL;
+
+	return py_coords;
+}
+
+
+/* Python interface: wrap(coordinates, box)                      */
+PyObject *wrap_coordinates(PyObject *self, PyObject *args, PyObject *kwds) {
+	PyArrayObject *py_coords;
+	ARRAY_REAL box[9], inv[9], lengths[3];
+	ARRAY_REAL *xyz;
+	long n;
+
+	static char *kwlist[] = { "coordinates", "box", NULL };
+
+	if ((py_coords = parse_vectors_box(args, kwds, kwlist, box, inv)) == NULL)
+		return NULL;
+
+	xyz = (ARRAY_REAL*) PyArray_DATA(py_coords);
+	n = PyArray_SIZE(py_coords) / 3;
+	lengths[0] = box[0];
+	lengths[1] = box[4];
+	lengths[2] = box[8];
+	Py_BEGIN_ALLOW_THREADS
+	if (boxIsDiagonal(box)) wrapPBC(xyz, n, lengths);
+	else wrapTriclinic(xyz, n, box, inv);
+	Py_END_ALLOW_THREADS
+
+	Py_INCREF(py_coords);
+	return (PyObject*) py_coords;
+}
+
+
+/* Python interface: minimumImage(vectors, box)                  */
+PyObject *minimum_image(PyObject *self, PyObject *args, PyObject *kwds) {
+	PyArrayObject *py_vectors;
+	ARRAY_REAL box[9], inv[9];
+
+	static char *kwlist[] = { "vectors", "box", NULL };
+
+	if ((py_vectors = parse_vectors_box(args, kwds, kwlist, box, inv)) == NULL)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	minimumImage((ARRAY_REAL*) PyArray_DATA(py_vectors), PyArray_SIZE(py_vectors) / 3, box, inv);
+	Py_END_ALLOW_THREADS
+
+	Py_INCREF(py_vectors);
+	return (PyObject*) py_vectors;
 }
 
 
@@ -33,8 +33,18 @@
 
 
 
-void wrapPBC(ARRAY_REAL *xyz, const int n, const ARRAY_REAL box[3]);
+void wrapPBC(ARRAY_REAL *xyz, const long n, const ARRAY_REAL box[3]);
 void wrapPBCsingle(ARRAY_REAL *xyz, const ARRAY_REAL box[3]);
+int invertBox(const ARRAY_REAL box[9], ARRAY_REAL inv[9]);
+int boxIsDiagonal(const ARRAY_REAL box[9]);
+void wrapTriclinic(ARRAY_REAL *xyz, const long n, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]);
+void minimumImage(ARRAY_REAL *d, const long n, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]);
+int boxFromValues(const ARRAY_REAL *b, int size, ARRAY_REAL box[9], ARRAY_REAL inv[9]);
+int boxFromObject(PyObject *obj, ARRAY_REAL box[9], ARRAY_REAL inv[9]);
+PyObject *wrap_coordinates(PyObject *self, PyObject *args, PyObject *kwds);
+PyObject *minimum_image(PyObject *self, PyObject *args, PyObject *kwds);
 //PyObject *findHBonds(PyObject *self, PyObject *args, PyObject *kwds);
 //PyObject *measureAngleCosine(PyObject *self, PyObject *args, PyObject *kwds);
 //PyObject *distanceMatrix(PyObject *self, PyObject *args, PyObject *kwds);
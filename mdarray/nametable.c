@@ -0,0 +1,316 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#include "nametable.h"
+
+
+
+/* FNV-1a hash of a span of characters */
+static unsigned int hashName(const char *name, int len) {
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/* Double the size of the hash and re-insert all names */
+static int rehash(NameTable *table) {
+	int *newHash;
+	int newSize, i, slot;
+
+	newSize = table->hashSize * 2;
+	newHash = (int*) malloc(newSize * sizeof(int));
+	if (newHash == NULL) {
+		PyErr_NoMemory();
+		return -1; }
+	for (i = 0; i < newSize; i++) newHash[i] = -1;
+
+	for (i = 0; i < table->size; i++) {
+		slot = hashName(table->names[i], strlen(table->names[i])) & (newSize-1);
+		while (newHash[slot] != -1) slot = (slot + 1) & (newSize-1);
+		newHash[slot] = i;
+	}
+	free(table->hash);
+	table->hash = newHash;
+	table->hashSize = newSize;
+
+	return 0;
+}
+
+
+NameTable *nameTableNew(void) {
+	NameTable *table;
+	int i;
+
+	table = (NameTable*) malloc(sizeof(NameTable));
+	if (table == NULL) {
+		PyErr_NoMemory();
+		return NULL; }
+
+	table->size = 0;
+	table->capacity = 16;
+	table->maxLength = 0;
+	table->hashSize = 64;
+	table->names = (char**) malloc(table->capacity * sizeof(char*));
+	table->lengths = (int*) malloc(table->capacity * sizeof(int));
+	table->pyNames = (PyObject**) malloc(table->capacity * sizeof(PyObject*));
+	table->hash = (int*) malloc(table->hashSize * sizeof(int));
+	if (table->names == NULL || table->lengths == NULL
+			|| table->pyNames == NULL || table->hash == NULL) {
+		free(table->names);
+		free(table->lengths);
+		free(table->pyNames);
+		free(table->hash);
+		free(table);
+		PyErr_NoMemory();
+		return NULL; }
+	for (i = 0; i < table->hashSize; i++) table->hash[i] = -1;
+
+	return table;
+}
+
+
+void nameTableFree(NameTable *table) {
+	int i;
+
+	if (table == NULL) return;
+	for (i = 0; i < table->size; i++) {
+		free(table->names[i]);
+		Py_XDECREF(table->pyNames[i]);
+	}
+	free(table->names);
+	free(table->lengths);
+	free(table->pyNames);
+	free(table->hash);
+	free(table);
+}
+
+
+/* Return the code of the name given as a span of len characters *
+ * (or NUL-terminated, if len < 0), adding it to the table if it  *
+ * is not there yet. Returns -1 on error.                         */
+int nameTableIntern(NameTable *table, const char *name, int len) {
+	int slot, code, capacity;
+	char *copy;
+	void *tmp;
+
+	if (len < 0) len = strlen(name);
+
+	slot = hashName(name, len) & (table->hashSize-1);
+	while ((code = table->hash[slot]) != -1) {
+		if (!strncmp(table->names[code], name, len)
+				&& table->names[code][len] == '\0')
+			return code;
+		slot = (slot + 1) & (table->hashSize-1);
+	}
+
+	// Arrays already grown are kept if a later one cannot be
+	if (table->size == table->capacity) {
+		capacity = 2 * table->capacity;
+		if ((tmp = realloc(table->names, capacity * sizeof(char*))) == NULL)
+			goto nomem;
+		table->names = (char**) tmp;
+		if ((tmp = realloc(table->lengths, capacity * sizeof(int))) == NULL)
+			goto nomem;
+		table->lengths = (int*) tmp;
+		if ((tmp = realloc(table->pyNames, capacity * sizeof(PyObject*))) == NULL)
+			goto nomem;
+		table->pyNames = (PyObject**) tmp;
+		table->capacity = capacity;
+	}
+
+	copy = (char*) malloc((len+1) * sizeof(char));
+	if (copy == NULL) goto nomem;
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+
+	code = table->size++;
+	table->names[code] = copy;
+	table->lengths[code] = len;
+	table->pyNames[code] = NULL;
+	table->hash[slot] = code;
+	if (len > table->maxLength) table->maxLength = len;
+
+	// Keep the load factor below 1/2
+	if (2 * table->size > table->hashSize)
+		if (rehash(table) == -1) return -1;
+
+	return code;
+
+	nomem:
+	PyErr_NoMemory();
+	return -1;
+}
+
+
+/* Same as nameTableIntern, but blanks on both sides of the span *
+ * are ignored; used with fixed-column formats.                 */
+int nameTableInternStripped(NameTable *table, const char *name, int len) {
+
+	while (len > 0 && isspace((unsigned char)name[0])) {
+		name++;
+		len--;
+	}
+	while (len > 0 && isspace((unsigned char)name[len-1])) len--;
+
+	return nameTableIntern(table, name, len);
+}
+
+
+const char *nameTableGet(const NameTable *table, int code) {
+	return table->names[code];
+}
+
+
+int nameTableLength(const NameTable *table, int code) {
+	return table->lengths[code];
+}
+
+
+/* Return Python string for the given code (new reference); the *
+ * string is created only once and shared between all atoms.    */
+PyObject *nameTableItem(NameTable *table, int code) {
+	PyObject *str;
+
+	str = table->pyNames[code];
+	if (str == NULL) {
+		str = PyUnicode_FromString(table->names[code]);
+		if (str == NULL) return NULL;
+		PyUnicode_InternInPlace(&str);
+		table->pyNames[code] = str;
+	}
+	Py_INCREF(str);
+	return str;
+}
+
+
+/* Tuple of unique names; position in the tuple equals the code */
+PyObject *nameTableNames(NameTable *table) {
+	PyObject *tuple, *str;
+	int i;
+
+	tuple = PyTuple_New(table->size);
+	if (tuple == NULL) return NULL;
+	for (i = 0; i < table->size; i++) {
+		if ((str = nameTableItem(table, i)) == NULL) {
+			Py_DECREF(tuple);
+			return NULL; }
+		PyTuple_SET_ITEM(tuple, i, str);
+	}
+	return tuple;
+}
+
+
+/* Expand the codes into a list of Python strings */
+PyObject *nameTableList(NameTable *table, const int *codes, int n) {
+	PyObject *list, *str;
+	int i;
+
+	list = PyList_New(n);
+	if (list == NULL) return NULL;
+	for (i = 0; i < n; i++) {
+		if ((str = nameTableItem(table, codes[i])) == NULL) {
+			Py_DECREF(list);
+			return NULL; }
+		PyList_SET_ITEM(list, i, str);
+	}
+	return list;
+}
+
+
+/* Expand the codes into a fixed-width unicode ndarray */
+PyObject *nameTableArray(NameTable *table, const int *codes, int n) {
+	PyObject *py_arr, *str;
+	npy_intp dims[1];
+	Py_UCS4 *encoded, *data;
+	int width, i;
+
+	width = table->maxLength > 0 ? table->maxLength : 1;
+
+	// Encode each unique name once
+	encoded = (Py_UCS4*) calloc(table->size * width, sizeof(Py_UCS4));
+	if (encoded == NULL && table->size > 0) {
+		PyErr_NoMemory();
+		return NULL; }
+	for (i = 0; i < table->size; i++) {
+		if ((str = nameTableItem(table, i)) == NULL) {
+			free(encoded);
+			return NULL; }
+		if (PyUnicode_AsUCS4(str, encoded + i*width, width, 0) == NULL) {
+			Py_DECREF(str);
+			free(encoded);
+			return NULL; }
+		Py_DECREF(str);
+	}
+
+	dims[0] = n;
+	py_arr = PyArray_New(&PyArray_Type, 1, dims, NPY_UNICODE, NULL, NULL,
+							width * sizeof(Py_UCS4), 0, NULL);
+	if (py_arr == NULL) {
+		free(encoded);
+		return NULL; }
+
+	data = (Py_UCS4*) PyArray_DATA((PyArrayObject*)py_arr);
+	for (i = 0; i < n; i++)
+		memcpy(data + i*width, encoded + codes[i]*width, width * sizeof(Py_UCS4));
+	free(encoded);
+
+	return py_arr;
+}
+
+
+/* Intern all strings from a Python list and store their codes in *
+ * newly allocated array. Returns length of the list or -1.       */
+int nameTableFromList(NameTable *table, PyObject *list, int **codes) {
+	PyObject *item;
+	const char *name;
+	Py_ssize_t len;
+	int n, i;
+
+	n = PyList_Size(list);
+	*codes = (int*) malloc((n > 0 ? n : 1) * sizeof(int));
+	if (*codes == NULL) {
+		PyErr_NoMemory();
+		return -1; }
+
+	for (i = 0; i < n; i++) {
+		item = PyList_GetItem(list, i); // borrowed
+		if (!PyUnicode_Check(item)) {
+			PyErr_SetString(PyExc_TypeError, "List of names must contain strings");
+			free(*codes);
+			*codes = NULL;
+			return -1; }
+		name = PyUnicode_AsUTF8AndSize(item, &len);
+		if (name == NULL || ((*codes)[i] = nameTableIntern(table, name, len)) == -1) {
+			free(*codes);
+			*codes = NULL;
+			return -1; }
+	}
+
+	return n;
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#ifndef __NAMETABLE_H__
+#define __NAMETABLE_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Table of unique (interned) names, such as atom or residue names. *
+ * Per-atom data is stored as an array of integer codes that index  *
+ * this table, so that each distinct name is kept only once.        */
+typedef struct {
+	int size;           /* number of unique names */
+	int capacity;       /* allocated length of names */
+	int maxLength;      /* length of the longest name */
+	char **names;       /* unique names, in order of appearance */
+	int *lengths;       /* lengths of the names, without the NUL */
+	PyObject **pyNames; /* Python strings, created on demand */
+	int hashSize;       /* size of the hash, power of two */
+	int *hash;          /* open addressing; -1 marks an empty slot */
+} NameTable;
+
+NameTable *nameTableNew(void);
+void nameTableFree(NameTable *table);
+int nameTableIntern(NameTable *table, const char *name, int len);
+int nameTableInternStripped(NameTable *table, const char *name, int len);
+const char *nameTableGet(const NameTable *table, int code);
+int nameTableLength(const NameTable *table, int code);
+PyObject *nameTableItem(NameTable *table, int code);
+PyObject *nameTableNames(NameTable *table);
+PyObject *nameTableList(NameTable *table, const int *codes, int n);
+PyObject *nameTableArray(NameTable *table, const int *codes, int n);
+int nameTableFromList(NameTable *table, PyObject *list, int **codes);
+
+#endif /* __NAMETABLE_H__ */
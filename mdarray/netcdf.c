@@ -0,0 +1,290 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+
+#include "netcdf.h"
+#include <errno.h>
+#include <stdint.h>
+
+/* Tags of the lists in the header */
+#define CDF_DIMENSION 0x0A
+#define CDF_VARIABLE  0x0B
+#define CDF_ATTRIBUTE 0x0C
+
+
+
+/* Big-endian numbers */
+static uint32_t getUint32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+	       | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t getUint64(const unsigned char *p) {
+	return ((uint64_t)getUint32(p) << 32) | getUint32(p + 4);
+}
+
+
+/* Position in the header being parsed */
+typedef struct {
+	const unsigned char *data;
+	size_t size, pos;
+} Cursor;
+
+static int readUint32(Cursor *c, uint32_t *value) {
+	if (c->pos + 4 > c->size) return -1;
+	*value = getUint32(c->data + c->pos);
+	c->pos += 4;
+	return 0;
+}
+
+/* Skip n bytes, rounded up to a multiple of four */
+static int skipPadded(Cursor *c, size_t n) {
+	n = (n + 3) & ~(size_t)3;
+	if (n > c->size - c->pos) return -1;
+	c->pos += n;
+	return 0;
+}
+
+/* Names are stored with their length and padded; long ones are cut */
+static int readName(Cursor *c, char *name) {
+	uint32_t len;
+	size_t n;
+
+	if (readUint32(c, &len)) return -1;
+	if (len > c->size - c->pos) return -1;
+	n = len < CDF_NAME_SIZE ? len : CDF_NAME_SIZE - 1;
+	memcpy(name, c->data + c->pos, n);
+	name[n] = '\0';
+	return skipPadded(c, len);
+}
+
+/* Header of a list; the number of elements is 0 if it is absent */
+static int readList(Cursor *c, uint32_t tag, uint32_t *n) {
+	uint32_t found;
+
+	if (readUint32(c, &found) || readUint32(c, n)) return -1;
+	if (found == 0 && *n == 0) return 0;
+	return found == tag ? 0 : -1;
+}
+
+
+size_t cdfTypeSize(int type) {
+	switch (type) {
+		case CDF_BYTE:
+		case CDF_CHAR:   return 1;
+		case CDF_SHORT:  return 2;
+		case CDF_INT:
+		case CDF_FLOAT:  return 4;
+		case CDF_DOUBLE: return 8;
+		default:         return 0;
+	}
+}
+
+
+/* Attributes are skipped, except for scale_factor, which is kept *
+ * in scale if it is given                                        */
+static int readAttributes(Cursor *c, double *scale) {
+	char name[CDF_NAME_SIZE];
+	uint32_t n, i, type, count, bits32;
+	uint64_t bits64;
+	size_t itemSize;
+	float f;
+
+	if (readList(c, CDF_ATTRIBUTE, &n)) return -1;
+	for (i = 0; i < n; i++) {
+		if (readName(c, name) || readUint32(c, &type) || readUint32(c, &count))
+			return -1;
+		if ((itemSize = cdfTypeSize(type)) == 0 || count > (c->size - c->pos) / itemSize)
+			return -1;
+		if (scale != NULL && !strcmp(name, "scale_factor") && count == 1) {
+			if (type == CDF_FLOAT) {
+				bits32 = getUint32(c->data + c->pos);
+				memcpy(&f, &bits32, 4);
+				*scale = f;
+			} else if (type == CDF_DOUBLE) {
+				bits64 = getUint64(c->data + c->pos);
+				memcpy(scale, &bits64, 8);
+			}
+		}
+		if (skipPadded(c, count * itemSize)) return -1;
+	}
+	return 0;
+}
+
+
+/* Parse the header of a file mapped at data. Returns -1 and sets errno *
+ * to EINVAL if it is not a classic or 64-bit offset NetCDF file.       */
+int cdfParseHeader(CdfFile *cdf, const unsigned char *data, size_t size) {
+	Cursor c = { data, size, 0 };
+	CdfVariable *var;
+	uint32_t n, i, k, dim, value;
+	long nRecordVars = 0, count, available;
+
+	if (size < 8 || memcmp(data, "CDF", 3) || (data[3] != 1 && data[3] != 2))
+		goto invalid;
+	cdf->version = data[3];
+	c.pos = 4;
+	if (readUint32(&c, &value)) goto invalid;
+	// Files written as a stream do not tell the number of records
+	cdf->nRecords = value == 0xFFFFFFFFu ? -1 : (long) value;
+
+	if (readList(&c, CDF_DIMENSION, &n) || n > CDF_MAX_DIMS) goto invalid;
+	cdf->nDims = n;
+	for (i = 0; i < n; i++) {
+		if (readName(&c, cdf->dims[i].name) || readUint32(&c, &value)) goto invalid;
+		cdf->dims[i].length = value;
+	}
+
+	if (readAttributes(&c, NULL)) goto invalid;
+
+	if (readList(&c, CDF_VARIABLE, &n) || n > CDF_MAX_VARS) goto invalid;
+	cdf->nVars = n;
+	cdf->recordSize = 0;
+	cdf->recordStart = -1;
+	for (i = 0; i < n; i++) {
+		var = cdf->vars + i;
+		if (readName(&c, var->name) || readUint32(&c, &value)
+				|| value > CDF_MAX_VAR_DIMS) goto invalid;
+		var->nDims = value;
+		var->record = 0;
+		count = 1;
+		for (k = 0; k < (uint32_t)var->nDims; k++) {
+			if (readUint32(&c, &dim) || dim >= (uint32_t)cdf->nDims) goto invalid;
+			var->shape[k] = cdf->dims[dim].length;
+			if (var->shape[k] == 0) {
+				if (k > 0) goto invalid;
+				var->record = 1;
+			} else
+				count *= var->shape[k];
+		}
+
+		var->scale = 1.0;
+		if (readAttributes(&c, &(var->scale))) goto invalid;
+		if (readUint32(&c, &value) || cdfTypeSize(value) == 0) goto invalid;
+		var->type = value;
+		// vsize is not reliable for large variables, compute the size
+		if (readUint32(&c, &value)) goto invalid;
+		var->size = count * cdfTypeSize(var->type);
+		if (cdf->version == 1) {
+			if (readUint32(&c, &value)) goto invalid;
+			var->begin = value;
+		} else {
+			if (c.pos + 8 > c.size) goto invalid;
+			var->begin = (long) getUint64(data + c.pos);
+			c.pos += 8;
+		}
+		if (var->begin < 0) goto invalid;
+
+		if (var->record) {
+			nRecordVars++;
+			cdf->recordSize += (var->size + 3) & ~3L;
+			if (cdf->recordStart < 0 || var->begin < cdf->recordStart)
+				cdf->recordStart = var->begin;
+		} else if ((size_t)var->begin + var->size > size)
+			goto invalid;
+	}
+
+	// A single record variable is not padded
+	if (nRecordVars == 1)
+		for (i = 0; i < (uint32_t)cdf->nVars; i++)
+			if (cdf->vars[i].record) cdf->recordSize = cdf->vars[i].size;
+
+	// Only complete records are used, the file may be still written
+	if (nRecordVars > 0 && cdf->recordSize > 0) {
+		available = ((long)size - cdf->recordStart) / cdf->recordSize;
+		for (i = 0; i < (uint32_t)cdf->nVars; i++) {
+			var = cdf->vars + i;
+			if (var->record && available > 0 && var->begin + (available - 1)
+					* cdf->recordSize + var->size > (long)size)
+				available--;
+		}
+		if (available < 0) available = 0;
+		if (cdf->nRecords < 0 || cdf->nRecords > available)
+			cdf->nRecords = available;
+	} else
+		cdf->nRecords = 0;
+
+	return 0;
+
+	invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+
+/* Variable of the given name, or NULL */
+const CdfVariable *cdfFind(const CdfFile *cdf, const char *name) {
+	int i;
+
+	for (i = 0; i < cdf->nVars; i++)
+		if (!strcmp(cdf->vars[i].name, name)) return cdf->vars + i;
+	return NULL;
+}
+
+
+/* Number of values of the variable (of a single record) */
+long cdfCount(const CdfVariable *var) {
+	return var->size / (long)cdfTypeSize(var->type);
+}
+
+
+/* Convert n big-endian values of the variable, multiplied by its *
+ * scale_factor and by factor                                     */
+void cdfDecode(const CdfVariable *var, const unsigned char *src, ARRAY_REAL *dst,
+               long n, double factor) {
+	uint32_t bits32;
+	uint64_t bits64;
+	float f;
+	double d;
+	long i;
+
+	factor *= var->scale;
+	switch (var->type) {
+		case CDF_FLOAT:
+			for (i = 0; i < n; i++, src += 4) {
+				bits32 = getUint32(src);
+				memcpy(&f, &bits32, 4);
+				dst[i] = f * factor;
+			}
+			break;
+		case CDF_DOUBLE:
+			for (i = 0; i < n; i++, src += 8) {
+				bits64 = getUint64(src);
+				memcpy(&d, &bits64, 8);
+				dst[i] = d * factor;
+			}
+			break;
+		case CDF_INT:
+			for (i = 0; i < n; i++, src += 4)
+				dst[i] = (int32_t)getUint32(src) * factor;
+			break;
+		case CDF_SHORT:
+			for (i = 0; i < n; i++, src += 2)
+				dst[i] = (int16_t)((src[0] << 8) | src[1]) * factor;
+			break;
+		default:
+			for (i = 0; i < n; i++, src++)
+				dst[i] = (signed char)*src * factor;
+			break;
+	}
+}
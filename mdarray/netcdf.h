@@ -0,0 +1,80 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#ifndef __NETCDF_H__
+#define __NETCDF_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Classic (CDF-1) and 64-bit offset (CDF-2) NetCDF files, as written *
+ * by AMBER. The header lists dimensions, attributes and variables;   *
+ * data are big-endian. Record variables, which have the unlimited    *
+ * dimension first, are interleaved: record i of a variable begins    *
+ * at begin + i * recordSize.                                         */
+#define CDF_NAME_SIZE 64
+#define CDF_MAX_DIMS 64
+#define CDF_MAX_VARS 64
+#define CDF_MAX_VAR_DIMS 8
+
+enum { CDF_BYTE = 1, CDF_CHAR, CDF_SHORT, CDF_INT, CDF_FLOAT, CDF_DOUBLE };
+
+typedef struct {
+	char name[CDF_NAME_SIZE];
+	long length;     /* 0 for the unlimited dimension */
+} CdfDim;
+
+typedef struct {
+	char name[CDF_NAME_SIZE];
+	int type;
+	int nDims;
+	long shape[CDF_MAX_VAR_DIMS];   /* the unlimited dimension is 0 */
+	int record;      /* the first dimension is the unlimited one */
+	long begin;      /* offset of the data, or of the first record */
+	long size;       /* bytes of the data, or of a single record */
+	double scale;    /* scale_factor attribute, 1 if missing */
+} CdfVariable;
+
+typedef struct {
+	int version;     /* 1 or 2 */
+	long nRecords;
+	long recordSize;
+	long recordStart;  /* offset of the first record */
+	int nDims;
+	CdfDim dims[CDF_MAX_DIMS];
+	int nVars;
+	CdfVariable vars[CDF_MAX_VARS];
+} CdfFile;
+
+int cdfParseHeader(CdfFile *cdf, const unsigned char *data, size_t size);
+const CdfVariable *cdfFind(const CdfFile *cdf, const char *name);
+size_t cdfTypeSize(int type);
+long cdfCount(const CdfVariable *var);
+void cdfDecode(const CdfVariable *var, const unsigned char *src, ARRAY_REAL *dst,
+               long n, double factor);
+
+#endif /* __NETCDF_H__ */
@@ -0,0 +1,230 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#include <stdint.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+	#include <immintrin.h>
+#endif
+#include "tokenizer.h"
+
+
+
+/* The block is processed in chunks of 64 bytes. For each chunk, two   *
+ * bitmasks are built - one marking blanks (space, tab, CR) and one    *
+ * marking newlines - with AVX2 or SSE2 compares where available. Then *
+ * beginnings and ends of fields are found with a few bit operations   *
+ * and visited in order, lowest bit first.                             */
+
+static inline void classifyChunk(const char *p, uint64_t *blank, uint64_t *newline) {
+#if defined(__AVX2__)
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i tb = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	__m256i lo, hi;
+	uint32_t bl, bh, nlo, nhi;
+
+	lo = _mm256_loadu_si256((const __m256i*)p);
+	hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+	nlo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl));
+	nhi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl));
+	bl = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(lo, sp), _mm256_cmpeq_epi8(lo, tb)),
+			_mm256_cmpeq_epi8(lo, cr)));
+	bh = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(hi, sp), _mm256_cmpeq_epi8(hi, tb)),
+			_mm256_cmpeq_epi8(hi, cr)));
+	*newline = (uint64_t)nlo | ((uint64_t)nhi << 32);
+	*blank = (uint64_t)bl | ((uint64_t)bh << 32);
+#elif defined(__SSE2__)
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tb = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+	__m128i v;
+	uint64_t b = 0, n = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		v = _mm_loadu_si128((const __m128i*)(p + 16*i));
+		n |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16*i);
+		b |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tb)),
+				_mm_cmpeq_epi8(v, cr))) << (16*i);
+	}
+	*newline = n;
+	*blank = b;
+#else
+	uint64_t b = 0, n = 0;
+	int i;
+	char c;
+
+	for (i = 0; i < 64; i++) {
+		c = p[i];
+		if (c == '\n') n |= 1ULL << i;
+		else if (c == ' ' || c == '\t' || c == '\r') b |= 1ULL << i;
+	}
+	*newline = n;
+	*blank = b;
+#endif
+}
+
+
+void tokensInit(Tokens *tok) {
+	tok->nLines = 0;
+	tok->nFields = 0;
+	tok->lineCapacity = 0;
+	tok->fieldCapacity = 0;
+	tok->lineFirst = NULL;
+	tok->lineFields = NULL;
+	tok->fieldBegin = NULL;
+	tok->fieldEnd = NULL;
+}
+
+
+void tokensFree(Tokens *tok) {
+	free(tok->lineFirst);
+	free(tok->lineFields);
+	free(tok->fieldBegin);
+	free(tok->fieldEnd);
+	tokensInit(tok);
+}
+
+
+/* The capacity changes only when both arrays have grown, so that *
+ * the tokens stay usable (and can be freed) after a failure.      */
+static int growLines(Tokens *tok) {
+	int cap;
+	void *tmp;
+
+	cap = tok->lineCapacity ? 2 * tok->lineCapacity : 256;
+	if ((tmp = realloc(tok->lineFirst, cap * sizeof(int))) == NULL) return -1;
+	tok->lineFirst = (int*) tmp;
+	if ((tmp = realloc(tok->lineFields, cap * sizeof(int))) == NULL) return -1;
+	tok->lineFields = (int*) tmp;
+	tok->lineCapacity = cap;
+	return 0;
+}
+
+
+static int growFields(Tokens *tok) {
+	int cap;
+	void *tmp;
+
+	cap = tok->fieldCapacity ? 2 * tok->fieldCapacity : 1024;
+	if ((tmp = realloc(tok->fieldBegin, cap * sizeof(int))) == NULL) return -1;
+	tok->fieldBegin = (int*) tmp;
+	if ((tmp = realloc(tok->fieldEnd, cap * sizeof(int))) == NULL) return -1;
+	tok->fieldEnd = (int*) tmp;
+	tok->fieldCapacity = cap;
+	return 0;
+}
+
+
+/* Split up to maxLines lines of the block into fields. Returns the    *
+ * number of bytes consumed, i.e. up to and including the last newline *
+ * processed, or -1 if out of memory. Incomplete last line is counted  *
+ * only if atEnd is set (no more data will follow). If tok->nLines <   *
+ * maxLines on return, the block ran out before enough lines were      *
+ * found. Python API is not used, so the GIL does not have to be held. */
+long tokenizeBlock(const char *block, long len, int maxLines, int atEnd,
+                   Tokens *tok) {
+	char tail[64];
+	uint64_t blank, newline, sep, prevSep, starts, ends, events, bit;
+	uint64_t carry = 1; // beginning of the block acts as separator
+	long base, pos, lineStart = 0;
+	int open = 0, lineFields = 0;
+	const char *chunk;
+
+	tok->nLines = 0;
+	tok->nFields = 0;
+	if (maxLines <= 0) return 0;
+	if (tok->lineCapacity == 0 && growLines(tok) == -1) return -1;
+
+	for (base = 0; base < len; base += 64) {
+
+		if (len - base >= 64) {
+			chunk = block + base;
+			classifyChunk(chunk, &blank, &newline);
+		} else {
+			// Pad the last chunk with blanks
+			memset(tail, ' ', 64);
+			memcpy(tail, block + base, len - base);
+			classifyChunk(tail, &blank, &newline);
+		}
+
+		sep = blank | newline;
+		prevSep = (sep << 1) | carry;
+		carry = sep >> 63;
+		starts = ~sep & prevSep;
+		ends = sep & ~prevSep;
+		events = starts | ends | newline;
+
+		while (events) {
+			bit = events & (~events + 1);
+			pos = base + __builtin_ctzll(events);
+
+			if (starts & bit) {
+				if (tok->nFields == tok->fieldCapacity && growFields(tok) == -1)
+					return -1;
+				tok->fieldBegin[tok->nFields] = pos;
+				open = 1;
+			} else {
+				if ((ends & bit) && open && pos <= len) {
+					tok->fieldEnd[tok->nFields++] = pos;
+					lineFields++;
+					open = 0;
+				}
+				if (newline & bit) {
+					if (tok->nLines == tok->lineCapacity && growLines(tok) == -1)
+						return -1;
+					tok->lineFirst[tok->nLines] = tok->nFields - lineFields;
+					tok->lineFields[tok->nLines] = lineFields;
+					tok->nLines++;
+					lineFields = 0;
+					lineStart = pos + 1;
+					if (tok->nLines == maxLines) return lineStart;
+				}
+			}
+			events &= events - 1;
+		}
+	}
+
+	// Last line without the newline character
+	if (atEnd && lineStart < len) {
+		if (open) {
+			tok->fieldEnd[tok->nFields++] = len;
+			lineFields++;
+		}
+		if (tok->nLines == tok->lineCapacity && growLines(tok) == -1)
+			return -1;
+		tok->lineFirst[tok->nLines] = tok->nFields - lineFields;
+		tok->lineFields[tok->nLines] = lineFields;
+		tok->nLines++;
+		return len;
+	}
+
+	// Drop fields of the incomplete line
+	tok->nFields -= lineFields;
+	return lineStart;
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#ifndef __TOKENIZER_H__
+#define __TOKENIZER_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Positions of whitespace-delimited fields in a block of text. Field *
+ * offsets are relative to the beginning of the block; fields of line *
+ * i are lineFirst[i] ... lineFirst[i]+lineFields[i]-1.               */
+typedef struct {
+	int nLines;
+	int nFields;
+	int lineCapacity;
+	int fieldCapacity;
+	int *lineFirst;
+	int *lineFields;
+	int *fieldBegin;
+	int *fieldEnd;
+} Tokens;
+
+void tokensInit(Tokens *tok);
+void tokensFree(Tokens *tok);
+long tokenizeBlock(const char *block, long len, int maxLines, int atEnd,
+                   Tokens *tok);
+
+#endif /* __TOKENIZER_H__ */
@@ -89,8 +89,11 @@ static void groupPurge(int *n, Group *g) {
 PyObject *find_bonds(PyObject *self, PyObject *args, PyObject *kwds) {
 	extern Element element_table[];
 	int i, j, nat, type, idx, start;
-	double ax, ay, az, bx, by, bz;
-	double ar, br, dist, covsum;
+	double ax, ay, az;
+	double ar, dist, covsum;
+	double *xyz, *radii;
+	const char *sym;
+	Py_ssize_t symlen;
 	npy_intp *numpyint;
 	float factor = 1.3;
 	char *format = NULL;
@@ -99,7 +102,7 @@ PyObject *find_bonds(PyObject *self, PyObject *args, PyObject *kwds) {
 	static char *kwlist[] = {
 		"coordinates", "types", "factor", "format", NULL };
 
-	PyObject *val1, *val2, *tmp_list, *tmptup;
+	PyObject *val1, *val2, *tmp_list = NULL, *tmptup;
 	PyObject *py_symbols;
 	PyObject *py_coords;
 	PyObject *py_result = NULL;
@@ -129,24 +132,46 @@ PyObject *find_bonds(PyObject *self, PyObject *args, PyObject *kwds) {
 
 	type = PyArray_TYPE((PyArrayObject*)py_coords);
 
-	py_result = PyList_New(0);
+	// Resolve coordinates and radii once, outside the double loop
+	xyz = (double*) malloc(3 * nat * sizeof(double) + 1);
+	radii = (double*) malloc(nat * sizeof(double) + 1);
+	if (xyz == NULL || radii == NULL) {
+		free(xyz);
+		free(radii);
+		PyErr_SetFromErrno(PyExc_MemoryError);
+		return NULL; }
 
 	for (i = 0; i < nat; i++) {
 
-		ax = (double)getFromArray2D(py_coords, type, i, 0);
-		ay = (double)getFromArray2D(py_coords, type, i, 1);
-		az = (double)getFromArray2D(py_coords, type, i, 2);
+		xyz[3*i+0] = (double)getFromArray2D(py_coords, type, i, 0);
+		xyz[3*i+1] = (double)getFromArray2D(py_coords, type, i, 1);
+		xyz[3*i+2] = (double)getFromArray2D(py_coords, type, i, 2);
 
 		val1 = PyList_GetItem(py_symbols, i); // borrowed
-		idx = getElementIndexBySymbol(PyUnicode_AsUTF8(val1));
+		sym = PyUnicode_Check(val1) ? PyUnicode_AsUTF8AndSize(val1, &symlen) : NULL;
+		idx = sym == NULL ? -1 : getElementIndexBySpan(sym, symlen);
 		if(idx == -1) {
 			PyErr_SetString(PyExc_RuntimeError, "Symbol unrecognized.");
+			free(xyz);
+			free(radii);
 			return NULL; }
 
-		ar = element_table[idx].covalent_radius;
-		if(ar < 0) {
+		radii[i] = element_table[idx].covalent_radius;
+		if(radii[i] < 0) {
 			PyErr_SetString(PyExc_RuntimeError, "Covalent radius undefined.");
+			free(xyz);
+			free(radii);
 			return NULL; }
+	}
+
+	py_result = PyList_New(0);
+
+	for (i = 0; i < nat; i++) {
+
+		ax = xyz[3*i+0];
+		ay = xyz[3*i+1];
+		az = xyz[3*i+2];
+		ar = radii[i];
 
 		if (fmt == FMT_DICT)
 			//tmp_list = PyList_New(0); // new
@@ -160,23 +185,8 @@ PyObject *find_bonds(PyObject *self, PyObject *args, PyObject *kwds) {
 
 			if (i == j) continue;
 
-			bx = (double)getFromArray2D(py_coords, type, j, 0);
-			by = (double)getFromArray2D(py_coords, type, j, 1);
-			bz = (double)getFromArray2D(py_coords, type, j, 2);
-
-			val2 = PyList_GetItem(py_symbols, j); // borrowed
-			idx = getElementIndexBySymbol(PyUnicode_AsUTF8(val2));
-			if(idx == -1) {
-				PyErr_SetString(PyExc_RuntimeError, "Symbol unrecognized.");
-				return NULL; }
-
-			br = element_table[idx].covalent_radius;
-			if(br < 0) {
-				PyErr_SetString(PyExc_RuntimeError, "Covalent radius undefined.");
-				return NULL; }
-
-			dist = sq(bx-ax) + sq(by-ay) + sq(bz-az);
-			covsum = (ar+br) * factor;
+			dist = sq(xyz[3*j+0]-ax) + sq(xyz[3*j+1]-ay) + sq(xyz[3*j+2]-az);
+			covsum = (ar+radii[j]) * factor;
 
 			if (dist < sq(covsum)) {
 
@@ -197,16 +207,116 @@ PyObject *find_bonds(PyObject *self, PyObject *args, PyObject *kwds) {
 				Py_DECREF(val2);
 			}
 		}
+		Py_DECREF(val1);
 		if (fmt == FMT_DICT) {
 			PyList_Append(py_result, tmp_list);
 			Py_DECREF(tmp_list);
 		}
 	}
 
+	free(xyz);
+	free(radii);
+
 	return py_result;
 }
 
 
+// Resolve atomic symbols into atomic numbers, masses and covalent radii
+// in a single pass; accepts a list of strings or a 'U'/'S' ndarray
+//
+PyObject *symbols_to_numbers(PyObject *self, PyObject *args, PyObject *kwds) {
+	extern Element element_table[];
+	PyObject *py_symbols, *py_seq = NULL, *item;
+	PyObject *py_numbers, *py_masses, *py_radii;
+	PyArrayObject *arr = NULL;
+	npy_intp dims[1];
+	int *numbers;
+	double *masses, *radii;
+	const char *sym;
+	char buf[3];
+	Py_ssize_t symlen;
+	int i, n, k, width = 0, idx, type = NPY_NOTYPE;
+
+	static char *kwlist[] = { "symbols", NULL };
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &py_symbols))
+		return NULL;
+
+	if (PyArray_Check(py_symbols)) {
+		arr = (PyArrayObject*)py_symbols;
+		type = PyArray_TYPE(arr);
+		if (PyArray_NDIM(arr) != 1) {
+			PyErr_SetString(PyExc_ValueError, "Array of symbols must be 1D");
+			return NULL; }
+	}
+
+	if (type == NPY_UNICODE || type == NPY_STRING) {
+		n = PyArray_DIM(arr, 0);
+		width = PyArray_ITEMSIZE(arr);
+		if (type == NPY_UNICODE) width /= sizeof(Py_UCS4);
+	} else {
+		py_seq = PySequence_Fast(py_symbols, "Symbols must be a sequence of strings");
+		if (py_seq == NULL) return NULL;
+		n = PySequence_Fast_GET_SIZE(py_seq);
+	}
+
+	dims[0] = n;
+	py_numbers = PyArray_SimpleNew(1, dims, NPY_INT);
+	py_masses = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+	py_radii = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+	if (py_numbers == NULL || py_masses == NULL || py_radii == NULL) {
+		Py_XDECREF(py_numbers);
+		Py_XDECREF(py_masses);
+		Py_XDECREF(py_radii);
+		Py_XDECREF(py_seq);
+		return NULL; }
+	numbers = (int*) PyArray_DATA((PyArrayObject*)py_numbers);
+	masses = (double*) PyArray_DATA((PyArrayObject*)py_masses);
+	radii = (double*) PyArray_DATA((PyArrayObject*)py_radii);
+
+	for (i = 0; i < n; i++) {
+
+		if (py_seq == NULL) {
+			// Copy at most three characters - enough to reject
+			// anything longer than a valid symbol
+			for (k = 0; k < 3 && k < width; k++) {
+				if (type == NPY_UNICODE) {
+					Py_UCS4 c = ((Py_UCS4*)PyArray_GETPTR1(arr, i))[k];
+					buf[k] = c < 128 ? (char)c : '?';
+				} else
+					buf[k] = ((char*)PyArray_GETPTR1(arr, i))[k];
+				if (buf[k] == '\0') break;
+			}
+			idx = getElementIndexBySpan(buf, k);
+		} else {
+			item = PySequence_Fast_GET_ITEM(py_seq, i); // borrowed
+			if (!PyUnicode_Check(item)) {
+				PyErr_SetString(PyExc_TypeError, "Symbols must be a sequence of strings");
+				Py_DECREF(py_numbers);
+				Py_DECREF(py_masses);
+				Py_DECREF(py_radii);
+				Py_DECREF(py_seq);
+				return NULL; }
+			sym = PyUnicode_AsUTF8AndSize(item, &symlen);
+			idx = getElementIndexBySpan(sym, symlen);
+		}
+
+		if (idx == -1) {
+			numbers[i] = -1;
+			masses[i] = 0.0;
+			radii[i] = -1.0;
+		} else {
+			numbers[i] = element_table[idx].number;
+			masses[i] = element_table[idx].mass;
+			radii[i] = element_table[idx].covalent_radius;
+		}
+	}
+	Py_XDECREF(py_seq);
+
+	return Py_BuildValue("(NNN)", py_numbers, py_masses, py_radii);
+}
+
+
 // This function uses data from findBonds to assemble atoms into molecules
 //
 PyObject *find_molecules(PyObject *self, PyObject *args, PyObject *kwds) {
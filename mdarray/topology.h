@@ -38,5 +38,6 @@ typedef struct {
 
 PyObject *find_molecules(PyObject *self, PyObject *args, PyObject *kwds);
 PyObject *find_bonds(PyObject *self, PyObject *args, PyObject *kwds);
+PyObject *symbols_to_numbers(PyObject *self, PyObject *args, PyObject *kwds);
 
 #endif /* __TOPOLOGY_H__ */
@@ -22,6 +22,9 @@
 
 
 #include <unistd.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "trajectory.h"
 #include "utils.h"
 #include "periodic_table.h"
@@ -33,9 +36,89 @@
 
 /* Method definitions */
 
+/* Errors found while reading without the GIL are stored in the instance *
+ * by set_error and turned into Python exceptions later by raise_error.  *
+ * With msg == NULL, the error is described by errno.                    */
+static void set_error(Trajectory *self, PyObject *type, const char *msg) {
+    self->errorType = type;
+    self->errorMessage = msg;
+    self->errorNumber = msg == NULL ? errno : 0;
+}
+
+
+/* Same as set_error, but errno is reported together with the file name */
+static void set_file_error(Trajectory *self, PyObject *type, const char *name) {
+    self->errorType = type;
+    self->errorMessage = name;
+    self->errorNumber = errno;
+}
+
+
+static void raise_error(Trajectory *self) {
+
+    if (self->errorType == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Unknown error");
+        return; }
+    if (self->errorNumber) {
+        errno = self->errorNumber;
+        if (self->errorMessage != NULL)
+            PyErr_SetFromErrnoWithFilename(self->errorType, self->errorMessage);
+        else
+            PyErr_SetFromErrno(self->errorType);
+    } else
+        PyErr_SetString(self->errorType, self->errorMessage);
+    self->errorType = NULL;
+}
+
+
+/* Close the underlying file; returns non-zero if closing failed */
+static int close_file(Trajectory *self) {
+    int status = 0;
+
+    switch(self->type) {
+        case XYZ:
+        case MOLDEN:
+        case GRO:
+        case PDB:
+        case LAMMPS:
+        case MDCRD:
+        case XDATCAR:
+            if (self->fd != NULL) status = fclose(self->fd);
+            self->fd = NULL;
+            break;
+        case NETCDF:
+            if (self->cdfData != NULL) munmap((void*)self->cdfData, self->cdfSize);
+            self->cdfData = NULL;
+            if (self->fd != NULL) status = fclose(self->fd);
+            self->fd = NULL;
+            break;
+#ifdef HAVE_HDF5
+        case H5MD:
+            if (self->h5md != NULL && self->h5md->file >= 0)
+                status = h5mdClose(self->h5md);
+            break;
+#endif
+#ifdef HAVE_GROMACS
+        case XTC:
+            if (self->xd != NULL) close_xtc(self->xd);
+            self->xd = NULL;
+            break;
+#endif
+        case GUESS:
+        default:
+            break;
+    }
+    return status;
+}
+
+
 static void Trajectory_dealloc(Trajectory* self)
 {
     PyObject *tmp;
+    int i;
+
+    // Remaining frames are still written, but errors cannot be reported
+    if (self->async) stop_writer(self);
 
     tmp = self->symbols;
     self->symbols = NULL;
@@ -49,6 +132,29 @@ static void Trajectory_dealloc(Trajectory* self)
     self->resNames = NULL;
     Py_XDECREF(tmp);
 
+    tmp = self->chains;
+    self->chains = NULL;
+    Py_XDECREF(tmp);
+
+    inputFree(&(self->input));
+    tokensFree(&(self->tokens));
+    free(self->outBuf);
+    free(self->line);
+    poolFree(self->frame.xyz);
+    poolFree(self->frame.vel);
+    poolFree(self->frame.extra);
+    free(self->frame.comment);
+    extFrameFree(&(self->frame.ext));
+    extPlanFree(&(self->extPlan));
+    lammps_free(&(self->lammps));
+
+    nameTableFree(self->symbolTable);
+    free(self->symbolCodes);
+    nameTableFree(self->resNameTable);
+    free(self->resNameCodes);
+    nameTableFree(self->chainTable);
+    free(self->chainCodes);
+
     tmp = self->aNumbers;
     self->aNumbers = NULL;
     Py_XDECREF(tmp);
@@ -58,21 +164,21 @@ static void Trajectory_dealloc(Trajectory* self)
     Py_XDECREF(tmp);
 
     free(self->fileName);
-    switch(self->type) {
-        case XYZ:
-        case MOLDEN:
-        case GRO:
-            if (self->fd != NULL) fclose(self->fd);
-            break;
-#ifdef HAVE_GROMACS
-        case XTC:
-            if (self->xd != NULL) close_xtc(self->xd);
-            break;
+    close_file(self);
+    free(self->cdf);
+#ifdef HAVE_HDF5
+    free(self->h5md);
 #endif
-        case GUESS:
-        default:
-            break;
-    }
+    if (self->nextFd != NULL) fclose(self->nextFd);
+    if (self->fileNames != NULL)
+        for (i = 0; i < self->nFiles; i++) free(self->fileNames[i]);
+    free(self->fileNames);
+    free(self->segmentStarts);
+    free(self->frameSegments);
+    free(self->frameOffsets);
+    frameCacheFree(self->cache);
+    Py_XDECREF(self->scanResult);
+    wholeGraphFree(self->whole);
 #ifdef HAVE_GROMACS
     sfree(self->xtcCoord);
 #endif
@@ -94,6 +200,22 @@ static PyObject *Trajectory_new(PyTypeObject *type, PyObject *args, PyObject *kw
         self->mode = 'r';
         self->fileName = NULL;
         self->fd = NULL;
+        self->fileNames = NULL;
+        self->nFiles = 0;
+        self->segment = 0;
+        self->segmentStarts = NULL;
+        self->nextFd = NULL;
+        self->skipDuplicates = 0;
+        self->checkDuplicate = 0;
+        self->haveTime = 0;
+        self->lastTime = 0.0;
+        self->frameSegments = NULL;
+        self->frameOffsets = NULL;
+        self->nIndexed = 0;
+        self->indexCapacity = 0;
+        self->totalFrames = -1;
+        self->cache = NULL;
+        self->scanResult = NULL;
 #ifdef HAVE_GROMACS
         self->xd = NULL;
         self->xtcCoord = NULL;
@@ -104,9 +226,46 @@ static PyObject *Trajectory_new(PyTypeObject *type, PyObject *args, PyObject *kw
         self->nAtoms = 0;
         self->lastFrame = -1;
 
-        Py_INCREF(Py_None);
-        self->symbols = Py_None;
-        
+        self->symbolTable = NULL;
+        self->symbolCodes = NULL;
+        self->resNameTable = NULL;
+        self->resNameCodes = NULL;
+        self->chainTable = NULL;
+        self->chainCodes = NULL;
+        self->chains = NULL;
+        self->symbols = NULL;
+        self->resNames = NULL;
+
+        inputInit(&(self->input));
+        self->block = NULL;
+        tokensInit(&(self->tokens));
+        extPlanInit(&(self->extPlan));
+        memset(&(self->lammps), 0, sizeof(LammpsColumns));
+        self->lammps.id = -1;
+        self->lammps.mol = -1;
+        self->outBuf = NULL;
+        self->outSize = 0;
+        self->hasPdbBox = 0;
+        self->modelsWritten = 0;
+        self->mdcrdBox = 0;
+        self->frameSize = 0;
+        memset(self->xdatcarCell, 0, sizeof(self->xdatcarCell));
+        self->xdatcarScale = 1.0;
+        self->whole = NULL;
+        self->cdf = NULL;
+        self->cdfData = NULL;
+        self->cdfSize = 0;
+#ifdef HAVE_HDF5
+        self->h5md = NULL;
+#endif
+        self->nextRecord = 0;
+        self->line = NULL;
+        self->lineSize = 0;
+        memset(&(self->frame), 0, sizeof(FrameData));
+        self->errorType = NULL;
+        self->async = 0;
+        self->closed = 0;
+
         Py_INCREF(Py_None);
         self->aNumbers = Py_None;
         
@@ -116,9 +275,6 @@ static PyObject *Trajectory_new(PyTypeObject *type, PyObject *args, PyObject *kw
         Py_INCREF(Py_None);
         self->resids = Py_None;
         
-        Py_INCREF(Py_None);
-        self->resNames = Py_None;
-        
     }
 
     return (PyObject *)self;
@@ -131,10 +287,279 @@ static PyObject *Trajectory_new(PyTypeObject *type, PyObject *args, PyObject *kw
  * general data like number of atoms and list of symbols. Actual reading *
  * of coordinates should go into read method                             */
 
+/* Set the list of files from a file name, a glob pattern or a list *
+ * of names. Patterns and lists are accepted only in 'r' mode.       */
+static int set_file_names(Trajectory *self, PyObject *py_fname) {
+    PyObject *seq = NULL;
+    const char *name = NULL;
+    glob_t found;
+    int i, n, status, globbed = 0;
+
+    if (PyUnicode_Check(py_fname)) {
+        if ((name = PyUnicode_AsUTF8(py_fname)) == NULL) return -1;
+        n = 1;
+        // Existing files are taken literally, even if the name has [ or *
+        if (self->mode == 'r' && strpbrk(name, "*?[") != NULL && access(name, F_OK)) {
+            status = glob(name, 0, NULL, &found);
+            if (status == GLOB_NOMATCH) {
+                errno = ENOENT;
+                PyErr_SetFromErrnoWithFilename(PyExc_IOError, name);
+                return -1; }
+            if (status != 0) {
+                PyErr_SetString(PyExc_IOError, "Could not expand the file name pattern");
+                return -1; }
+            n = found.gl_pathc;
+            globbed = 1;
+        }
+    } else {
+        if (self->mode != 'r') {
+            PyErr_SetString(PyExc_ValueError, "Many files can be given only in 'r' mode");
+            return -1; }
+        seq = PySequence_Fast(py_fname, "File name must be a string or a list of strings");
+        if (seq == NULL) return -1;
+        n = PySequence_Fast_GET_SIZE(seq);
+        if (n == 0) {
+            PyErr_SetString(PyExc_ValueError, "Empty list of files");
+            Py_DECREF(seq);
+            return -1; }
+    }
+
+    self->fileNames = (char**) calloc(n, sizeof(char*));
+    self->segmentStarts = (int*) malloc(n * sizeof(int));
+    if (self->fileNames == NULL || self->segmentStarts == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        n = 0; }
+    self->nFiles = n;
+
+    for (i = 0; i < n; i++) {
+        self->segmentStarts[i] = -1;
+        if (globbed)
+            name = found.gl_pathv[i];
+        else if (seq != NULL
+                && (name = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i))) == NULL)
+            break;
+        if ((self->fileNames[i] = strdup(name)) == NULL) {
+            PyErr_SetFromErrno(PyExc_MemoryError);
+            break; }
+    }
+
+    if (globbed) globfree(&found);
+    Py_XDECREF(seq);
+
+    if (n == 0 || i < n) return -1;
+    self->segmentStarts[0] = 0;
+    return 0;
+}
+
+
+/* Open the segment after the current one, so that the system can *
+ * start reading it while the current one is being processed.     */
+static void prefetch_segment(Trajectory *self) {
+    int next = self->segment + 1;
+
+    if (next >= self->nFiles || self->nextFd != NULL) return;
+    // Errors are reported when the segment is actually needed
+    self->nextFd = fopen(self->fileNames[next], "r");
+#ifdef POSIX_FADV_WILLNEED
+    if (self->nextFd != NULL)
+        posix_fadvise(fileno(self->nextFd), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+/* Close the current file and open the given segment instead */
+static int open_segment(Trajectory *self, int segment) {
+    const char *name;
+#ifdef HAVE_GROMACS
+    int natoms;
+#endif
+
+    close_file(self);
+    // The file opened in advance is used only if it is the right one
+    if (self->nextFd != NULL && segment != self->segment + 1) {
+        fclose(self->nextFd);
+        self->nextFd = NULL; }
+    self->segment = segment;
+    name = self->fileNames[segment];
+
+    switch(self->type) {
+        case XYZ:
+        case GRO:
+        case PDB:
+        case LAMMPS:
+        case MDCRD:
+        case XDATCAR:
+            self->fd = self->nextFd != NULL ? self->nextFd : fopen(name, "r");
+            self->nextFd = NULL;
+            if (self->fd == NULL) {
+                set_file_error(self, PyExc_IOError, name);
+                return -1; }
+            inputAttach(&(self->input), self->fd);
+            // Every MDCRD file begins with a title
+            if (self->type == MDCRD
+                    && inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+                set_error(self, PyExc_IOError, "Unexpected end of file");
+                return -1; }
+            break;
+#ifdef HAVE_GROMACS
+        case XTC:
+            if (self->nextFd != NULL) fclose(self->nextFd);
+            self->nextFd = NULL;
+            if (!read_xtc_natoms(name, &natoms)) {
+                set_error(self, PyExc_IOError, "Error reading XTC file");
+                return -1; }
+            if (natoms != self->nAtoms) {
+                set_error(self, PyExc_RuntimeError,
+                    "Number of atoms different than expected");
+                return -1; }
+            if ((self->xd = open_xtc(name, "r")) == NULL) {
+                set_error(self, PyExc_IOError, "Error opening XTC file");
+                return -1; }
+            break;
+#endif
+        case NETCDF:
+            self->fd = self->nextFd != NULL ? self->nextFd : fopen(name, "r");
+            self->nextFd = NULL;
+            if (self->fd == NULL) {
+                set_file_error(self, PyExc_IOError, name);
+                return -1; }
+            if (open_netcdf(self) == -1) return -1;
+            break;
+#ifdef HAVE_HDF5
+        case H5MD:
+            if (self->nextFd != NULL) fclose(self->nextFd);
+            self->nextFd = NULL;
+            if (open_h5md(self, name) == -1) return -1;
+            break;
+#endif
+        default:
+            set_error(self, PyExc_RuntimeError, "Should not be here");
+            return -1;
+    }
+
+    prefetch_segment(self);
+    return 0;
+}
+
+
+/* Continue reading with the next segment */
+static int open_next_segment(Trajectory *self) {
+
+    if (open_segment(self, self->segment + 1) == -1) return -1;
+    if (self->segmentStarts[self->segment] < 0)
+        self->segmentStarts[self->segment] = self->lastFrame + 1;
+    self->checkDuplicate = self->skipDuplicates;
+
+    return 0;
+}
+
+
+/* Offset of the next frame in the current file */
+static long frame_offset(Trajectory *self) {
+#ifdef HAVE_GROMACS
+    if (self->type == XTC) return (long) gmx_fio_ftell(self->xd);
+#endif
+    if (self->type == NETCDF || self->type == H5MD) return self->nextRecord;
+    return inputTell(&(self->input));
+}
+
+
+/* Remember where the frame starts, if it is the next unknown one */
+static int record_frame(Trajectory *self, long frame, long offset) {
+    void *tmp;
+
+    if (frame != self->nIndexed) return 0;
+    if (self->nIndexed == self->indexCapacity) {
+        self->indexCapacity = self->indexCapacity ? 2 * self->indexCapacity : 1024;
+        tmp = realloc(self->frameOffsets, self->indexCapacity * sizeof(long));
+        if (tmp == NULL) {
+            set_error(self, PyExc_MemoryError, NULL);
+            return -1; }
+        self->frameOffsets = (long*) tmp;
+        tmp = realloc(self->frameSegments, self->indexCapacity * sizeof(int));
+        if (tmp == NULL) {
+            set_error(self, PyExc_MemoryError, NULL);
+            return -1; }
+        self->frameSegments = (int*) tmp;
+    }
+    self->frameOffsets[self->nIndexed] = offset;
+    self->frameSegments[self->nIndexed] = self->segment;
+    self->nIndexed += 1;
+
+    return 0;
+}
+
+
+/* Position the file(s) so that the next frame read is the one with *
+ * the given global index. Frames not indexed yet are read and       *
+ * discarded. Returns 1 if the trajectory has fewer frames.          */
+static int seek_frame(Trajectory *self, long index) {
+    long start;
+    int status;
+
+    if (self->type == MOLDEN) {
+        PyErr_SetString(PyExc_NotImplementedError,
+                        "Random access is not supported for Molden files");
+        return -1; }
+    if (self->totalFrames >= 0 && index >= self->totalFrames) return 1;
+
+    // Frames of the same size are found without reading the ones before
+    if (self->frameSize > 0 && index >= self->nIndexed) {
+        if (inputSeek(&(self->input), self->frameOffsets[0] + index * self->frameSize)) {
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1; }
+        self->lastFrame = index - 1;
+        self->checkDuplicate = 0;
+        return 0;
+    }
+    // Records of a single NetCDF or H5MD file are addressed directly
+    if ((self->type == NETCDF || self->type == H5MD) && self->nFiles == 1) {
+        self->nextRecord = index;
+        self->lastFrame = index - 1;
+        self->checkDuplicate = 0;
+        return 0;
+    }
+
+    start = index < self->nIndexed ? index : self->nIndexed - 1;
+    if (self->frameSegments[start] != self->segment
+            && open_segment(self, self->frameSegments[start]) == -1) {
+        raise_error(self);
+        return -1; }
+#ifdef HAVE_GROMACS
+    if (self->type == XTC)
+        status = gmx_fio_seek(self->xd, (gmx_off_t)self->frameOffsets[start]);
+    else
+#endif
+    if (self->type == NETCDF || self->type == H5MD) {
+        self->nextRecord = self->frameOffsets[start];
+        status = 0;
+    } else
+        status = inputSeek(&(self->input), self->frameOffsets[start]);
+    if (status) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1; }
+
+    // Indexed frames are never duplicates
+    self->lastFrame = start - 1;
+    self->checkDuplicate = 0;
+    while (self->lastFrame + 1 < index) {
+        status = next_frame_data(self, &(self->frame), 1);
+        if (status == -1) {
+            raise_error(self);
+            return -1; }
+        if (status == 1) return 1;
+    }
+
+    return 0;
+}
+
+
 static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
 
     const char *filename;
+    PyObject *py_fname;
     FILE *test;
+    int stdinput;
     char *str_type = NULL;
     char ext[5];
     char *line = NULL;
@@ -151,22 +576,25 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
 	PyObject *py_sym = NULL;
 	PyObject *py_resid = NULL;
 	PyObject *py_resn = NULL;;
+	PyObject *py_chains = NULL;
+
+    int asyncWrite = 0;
+    int nAtoms = 0;
 
     static char *kwlist[] = {
         "filename", "mode", "symbols", "resids", "resnames",
-        "format", "units",
-        NULL };
+        "format", "units", "asyncWrite", "skipDuplicates", "chains",
+        "nAtoms", NULL };
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|sO!O!O!ss", kwlist,
-            &filename, &mode,
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|sO!O!O!ssppO!i", kwlist,
+            &py_fname, &mode,
             &PyList_Type, &py_sym,
             &PyArray_Type, &py_resid,
             &PyList_Type, &py_resn,
-            &str_type, &units))
+            &str_type, &units, &asyncWrite, &(self->skipDuplicates),
+            &PyList_Type, &py_chains, &nAtoms))
         return -1;
 
-    self->fileName = (char*) malloc((strlen(filename)+1) * sizeof(char));
-    strcpy(self->fileName, filename);
     if (mode == NULL || mode[0] == 'r')
         self->mode = 'r';
     else if (mode[0] == 'w')
@@ -177,6 +605,15 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
         PyErr_SetString(PyExc_ValueError, "Incorrect mode");
         return -1;
     }
+    if (asyncWrite && self->mode == 'r') {
+        PyErr_SetString(PyExc_ValueError, "asyncWrite can be used only in 'w' and 'a' modes");
+        return -1;
+    }
+
+    if (set_file_names(self, py_fname) == -1) return -1;
+    filename = self->fileNames[0];
+    self->fileName = (char*) malloc((strlen(filename)+1) * sizeof(char));
+    strcpy(self->fileName, filename);
 
     /* Set the enum symbol of the file format */
     if ( str_type != NULL ) {
@@ -184,6 +621,12 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
         else if ( !strcmp(str_type, "MOLDEN") ) self->type = MOLDEN;
         else if ( !strcmp(str_type,    "GRO") ) self->type = GRO;
         else if ( !strcmp(str_type,    "XTC") ) self->type = XTC;
+        else if ( !strcmp(str_type,    "PDB") ) self->type = PDB;
+        else if ( !strcmp(str_type, "LAMMPS") ) self->type = LAMMPS;
+        else if ( !strcmp(str_type,  "MDCRD") ) self->type = MDCRD;
+        else if ( !strcmp(str_type, "NETCDF") ) self->type = NETCDF;
+        else if ( !strcmp(str_type,   "H5MD") ) self->type = H5MD;
+        else if ( !strcmp(str_type, "XDATCAR") ) self->type = XDATCAR;
         else if ( !strcmp(str_type,  "GUESS") ) self->type = GUESS;
 		else {
 	        PyErr_SetString(PyExc_ValueError, "Incorrect format specification");
@@ -191,12 +634,33 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
 		}
     }
 
+    /* Standard input, e.g. a decompressor or a running simulation */
+    stdinput = !strcmp(filename, "-");
+    if (stdinput && (self->mode != 'r' || self->nFiles > 1
+                     || (self->type != XYZ && self->type != GRO && self->type != PDB
+                         && self->type != LAMMPS && self->type != MDCRD
+                         && self->type != XDATCAR))) {
+        PyErr_SetString(PyExc_ValueError,
+            "Standard input can be read only in 'r' mode, with format 'XYZ', 'GRO', 'PDB', 'LAMMPS', 'MDCRD' or 'XDATCAR'");
+        return -1; }
+
     /* Guess the file format, if not given explicitly */
     if ( self->type == GUESS ) {
         strcpy(ext, filename + strlen(filename) - 4);
         if      ( !strcmp(ext, ".xyz") ) self->type = XYZ;
         else if ( !strcmp(ext, ".gro") ) self->type = GRO;
         else if ( !strcmp(ext, ".xtc") ) self->type = XTC;
+        else if ( !strcmp(ext, ".pdb") ) self->type = PDB;
+        else if ( strlen(filename) > 10
+                  && !strcmp(filename + strlen(filename) - 10, ".lammpstrj") ) self->type = LAMMPS;
+        else if ( strlen(filename) > 6
+                  && !strcmp(filename + strlen(filename) - 6, ".mdcrd") ) self->type = MDCRD;
+        else if ( !strcmp(ext, "ncdf") || (strlen(filename) > 3
+                  && !strcmp(filename + strlen(filename) - 3, ".nc")) ) self->type = NETCDF;
+        else if ( !strcmp(ext, "h5md") || (strlen(filename) > 3
+                  && !strcmp(filename + strlen(filename) - 3, ".h5")) ) self->type = H5MD;
+        // VASP always uses this name, perhaps with a suffix
+        else if ( strstr(filename, "XDATCAR") != NULL ) self->type = XDATCAR;
         else if (self->mode == 'r' || self->mode == 'a') {
             /* Extract the first line */
             if ( (test = fopen(filename, "r")) == NULL ) {
@@ -209,6 +673,8 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
 
             /* Perhaps it's Molden format? */
             if ( !strcmp(line, "[molden format]") ) self->type = MOLDEN;
+            /* Or a LAMMPS dump? */
+            else if ( !strncmp(line, "item:", 5) ) self->type = LAMMPS;
 
             free(line);
 				line == NULL;
@@ -219,10 +685,24 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
             return -1;
         }
 
+    /* MDCRD files do not tell the number of atoms */
+    if (self->type == MDCRD && self->mode == 'r') {
+        if (nAtoms <= 0) {
+            PyErr_SetString(PyExc_ValueError, "MDCRD files need nAtoms");
+            return -1; }
+        self->nAtoms = nAtoms;
+    }
+
     /* Set correct units */
     if (units == NULL) {
         switch(self->type) {
             case XYZ:
+            case PDB:
+            case LAMMPS:
+            case MDCRD:
+            case XDATCAR:
+            case NETCDF:
+            case H5MD:
 				// For Molden format this is just preliminary; could be a.u.
 				// as well and will be determined during topology read
             case MOLDEN:
@@ -254,9 +734,9 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
             PyErr_SetString(PyExc_ValueError, "Don't use symbols in 'r' mode");
             return -1;
 		}
-        Py_DECREF(self->symbols);
-        self->symbols = py_sym;
-        Py_INCREF(self->symbols);
+        if ((self->symbolTable = nameTableNew()) == NULL) return -1;
+        if (nameTableFromList(self->symbolTable, py_sym,
+                              &(self->symbolCodes)) == -1) return -1;
     }
 
     if (py_resid != NULL) {
@@ -266,9 +746,15 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
     }
 
     if (py_resn != NULL) {
-        Py_DECREF(self->resNames);
-        self->resNames = py_resn;
-        Py_INCREF(self->resNames);
+        if ((self->resNameTable = nameTableNew()) == NULL) return -1;
+        if (nameTableFromList(self->resNameTable, py_resn,
+                              &(self->resNameCodes)) == -1) return -1;
+    }
+
+    if (py_chains != NULL) {
+        if ((self->chainTable = nameTableNew()) == NULL) return -1;
+        if (nameTableFromList(self->chainTable, py_chains,
+                              &(self->chainCodes)) == -1) return -1;
     }
 
     if (self->mode == 'w' || self->mode == 'a') {
@@ -277,19 +763,53 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
             PyErr_SetString(PyExc_FileExistsError, "Selected 'w' mode, but file exists");
             return -1; }
 
-        if (self->symbols == Py_None) {
+        if (self->symbolTable == NULL) {
             PyErr_SetString(PyExc_ValueError, "Need atomic symbols");
             return -1; }
 
-        self->nAtoms = PyList_Size(self->symbols);
+        self->nAtoms = PyList_Size(py_sym);
+
+        if (py_resn != NULL && PyList_Size(py_resn) != self->nAtoms) {
+            PyErr_SetString(PyExc_ValueError, "Number of residue names must match the number of atoms");
+            return -1; }
+
+        if (py_chains != NULL && PyList_Size(py_chains) != self->nAtoms) {
+            PyErr_SetString(PyExc_ValueError, "Number of chains must match the number of atoms");
+            return -1; }
 
         /* Open the coordinate file */
         switch(self->type) {
             case XYZ:
             case GRO:
+            case PDB:
                 if ( (self->fd = fopen(filename, mode)) == NULL ) {
                     PyErr_SetFromErrno(PyExc_IOError);
                     return -1; }
+                if (asyncWrite && start_writer(self) == -1) return -1;
+                break;
+            case H5MD:
+#ifdef HAVE_HDF5
+                if (asyncWrite) {
+                    PyErr_SetString(PyExc_ValueError, "asyncWrite is not supported for H5MD files");
+                    return -1; }
+                if ((self->h5md = (H5mdFile*) malloc(sizeof(H5mdFile))) == NULL) {
+                    PyErr_NoMemory();
+                    return -1; }
+                h5mdInit(self->h5md);
+                if (self->mode == 'w'
+                        ? h5mdCreate(self->h5md, filename, self->nAtoms, self->symbolCodes,
+                                     self->symbolTable->names, self->symbolTable->size)
+                        : h5mdOpen(self->h5md, filename, 'a')) {
+                    PyErr_SetString(PyExc_IOError, self->h5md->error);
+                    return -1; }
+                if (self->h5md->nAtoms != self->nAtoms) {
+                    PyErr_SetString(PyExc_ValueError, "Number of atoms different than in the file");
+                    return -1; }
+#else
+                PyErr_SetString(PyExc_SystemError,
+                    "mdarray has to be compiled with HDF5 support to handle H5MD files");
+                return -1;
+#endif
                 break;
             case MOLDEN:
             case XTC:
@@ -307,9 +827,37 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
         switch(self->type) {
             case XYZ:
             case GRO:
+            case PDB:
+            case LAMMPS:
+            case MDCRD:
+            case XDATCAR:
+                if (stdinput) self->fd = fdopen(dup(STDIN_FILENO), "r");
+                else self->fd = fopen(filename, "r");
+                if (self->fd == NULL) {
+                    PyErr_SetFromErrno(PyExc_IOError);
+                    return -1; }
+                // Keep the topology frame, so that it can be read again
+                inputAttach(&(self->input), self->fd);
+                self->input.mark = 0;
+                break;
+            case H5MD:
+#ifdef HAVE_HDF5
+                if (open_h5md(self, filename) == -1) {
+                    raise_error(self);
+                    return -1; }
+#else
+                PyErr_SetString(PyExc_SystemError,
+                    "mdarray has to be compiled with HDF5 support to handle H5MD files");
+                return -1;
+#endif
+                break;
+            case NETCDF:
                 if ( (self->fd = fopen(filename, "r")) == NULL ) {
                     PyErr_SetFromErrno(PyExc_IOError);
                     return -1; }
+                if (open_netcdf(self) == -1) {
+                    raise_error(self);
+                    return -1; }
                 break;
             case MOLDEN:
                 if ( (self->fd = fopen(filename, "r")) == NULL ) {
@@ -346,22 +894,55 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
         switch(self->type) {
             case XYZ:
                 if (read_topo_from_xyz(self) == -1) return -1;
-                rewind(self->fd);
+                inputSeek(&(self->input), 0);
+                self->input.mark = -1;
                 //self->filePosition1 = ftell(self->fd);
                 //self->filePosition2 = self->filePosition1;
                 break;
             case MOLDEN:
                 if (read_topo_from_molden(self) == -1) return -1;
-                fseek(self->fd, self->filePosition1, SEEK_SET);
+                inputAttach(&(self->input), self->fd);
+                if (inputSeek(&(self->input), self->filePosition1) == -1) {
+                    PyErr_SetFromErrno(PyExc_IOError);
+                    return -1; }
                 //self->filePosition1 = ftell(self->fd);
                 //self->filePosition2 = self->filePosition1;
                 break;
             case GRO:
                 if (read_topo_from_gro(self) == -1) return -1;
-                rewind(self->fd);
+                inputSeek(&(self->input), 0);
+                self->input.mark = -1;
                 //self->filePosition1 = ftell(self->fd);
                 //self->filePosition2 = self->filePosition1;
                 break;
+            case PDB:
+                if (read_topo_from_pdb(self) == -1) return -1;
+                inputSeek(&(self->input), 0);
+                self->input.mark = -1;
+                break;
+            case LAMMPS:
+                if (read_topo_from_lammps(self) == -1) return -1;
+                inputSeek(&(self->input), 0);
+                self->input.mark = -1;
+                break;
+            case MDCRD:
+                // Frames begin after the title
+                if (read_topo_from_mdcrd(self) == -1) return -1;
+                self->input.mark = -1;
+                break;
+            case XDATCAR:
+                if (read_topo_from_xdatcar(self) == -1) return -1;
+                self->input.mark = -1;
+                break;
+            case NETCDF:
+                // The number of records is known from the header
+                if (self->nFiles == 1) self->totalFrames = self->cdf->nRecords;
+                break;
+            case H5MD:
+#ifdef HAVE_HDF5
+                if (read_topo_from_h5md(self) == -1) return -1;
+#endif
+                break;
             case XTC:
 #ifdef HAVE_GROMACS
                 if (!read_first_xtc(self->xd, &(self->nAtoms), &step, &time,
@@ -379,6 +960,16 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
                 PyErr_SetString(PyExc_RuntimeError, "Should not be here");
                 return -1;
         }
+
+        if (self->nFiles > 1) {
+            if (self->type == MOLDEN) {
+                PyErr_SetString(PyExc_ValueError, "Molden files cannot be read as segments");
+                return -1; }
+            prefetch_segment(self);
+        }
+        if (self->type != MOLDEN && record_frame(self, 0, frame_offset(self)) == -1) {
+            raise_error(self);
+            return -1; }
     }
 
     return 0;
@@ -389,38 +980,40 @@ static int Trajectory_init(Trajectory *self, PyObject *args, PyObject *kwds) {
 static PyObject *Trajectory_read(Trajectory *self, PyObject *args,
 							PyObject *kwds) {
 
-    PyObject *py_result = NULL;
-	char *buffer = NULL;
-	size_t buflen;
-	long offset;
-	int status;
 	int doWrap = 0;
-	ARRAY_REAL box[3];
+	ARRAY_REAL box[9], inv[9];
 	ARRAY_REAL *boxptr = NULL;
-	int type;
 
-	PyObject *py_box = NULL;
+	PyObject *py_box = NULL, *py_whole = Py_None;
+	Unwrapper *unwrap = NULL;
 
     static char *kwlist[] = {
-        "wrap", "box", NULL };
+        "wrap", "box", "whole", "unwrap", NULL };
 
     if (self->mode != 'r') {
         PyErr_SetString(PyExc_RuntimeError, "Trying to read in write mode");
         return NULL; }
+    if (self->closed) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+        return NULL; }
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|pO!", kwlist,
-			&doWrap, &PyArray_Type, &py_box))
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|pO!OO!", kwlist,
+			&doWrap, &PyArray_Type, &py_box, &py_whole, &UnwrapperType, &unwrap))
         return NULL;
+	if (unwrap != NULL && unwrapperPrepare(unwrap, self->nAtoms) == -1)
+		return NULL;
+
+	// The graph is built again only when the bonds have changed
+	if (py_whole != Py_None
+			&& wholeGraphUpdate(&(self->whole), py_whole, self->nAtoms) == -1)
+		return NULL;
 
-	if(doWrap) {
+	if(doWrap || py_whole != Py_None || unwrap != NULL) {
 		// If the box is specified - use it to wrap atoms.
 		// Otherwise apply information from filetypes that
 		// support PBC or fail in other cases.
 		if (py_box != NULL) {
-			type = PyArray_TYPE((PyArrayObject*)py_box);
-			box[0] = (ARRAY_REAL)getFromVector(py_box, type, 0);
-			box[1] = (ARRAY_REAL)getFromVector(py_box, type, 1);
-			box[2] = (ARRAY_REAL)getFromVector(py_box, type, 2);
+			if (boxFromObject(py_box, box, inv) == -1) return NULL;
 			boxptr = box;
 		}
 
@@ -431,78 +1024,253 @@ static PyObject *Trajectory_read(Trajectory *self, PyObject *args,
 		//}
 	}
 
-	// Before really reading a frame, make sure that there is something
-	// to read. Get the next line, see if it makes sense and then rewind.
-	//
-	if (self->type != XTC) {
-		offset = ftell(self->fd);
-	    status = getline(&buffer, &buflen, self->fd);
-		if (status == -1) Py_RETURN_NONE;
-		stripline(buffer);
-		if (self->type == MOLDEN && buffer[0] == '[') Py_RETURN_NONE;
-	    fseek(self->fd, offset, SEEK_SET);
-		free(buffer);
-		buffer = NULL;
-	}
+	return next_frame(self, doWrap, boxptr, py_whole != Py_None ? self->whole : NULL, unwrap);
+}
+
+
+
+/* Read the next frame of the current file into frame; returns 0, 1  *
+ * at the end of file or -1 on error. With metaOnly, coordinates are  *
+ * skipped and only comment, time, step and box are read, if present. *
+ * The GIL is not needed.                                             */
+static int read_frame_data(Trajectory *self, FrameData *frame, int metaOnly) {
+
+    frame->hasVel = 0;
+    frame->hasExtra = 0;
+    frame->hasBox = 0;
+    frame->hasTime = 0;
+    frame->hasStep = 0;
+    frame->hasComment = 0;
 
     switch(self->type) {
 
         case MOLDEN:
         case XYZ:
-            py_result = read_frame_from_xyz(self, doWrap, boxptr);
-            break;
+            // Frames of Molden files are never skipped
+            if (metaOnly && self->type == XYZ)
+                return skip_frame_from_xyz(self, frame);
+            return read_frame_from_xyz(self, frame);
 
         case GRO:
-            py_result = read_frame_from_gro(self, doWrap, boxptr);
-            break;
+            return read_frame_from_gro(self, frame, metaOnly);
+
+        case PDB:
+            return read_frame_from_pdb(self, frame, metaOnly);
+
+        case LAMMPS:
+            return read_frame_from_lammps(self, frame, metaOnly);
+
+        case MDCRD:
+            return read_frame_from_mdcrd(self, frame, metaOnly);
+
+        case XDATCAR:
+            return read_frame_from_xdatcar(self, frame, metaOnly);
+
+        case NETCDF:
+            return read_frame_from_netcdf(self, frame, metaOnly);
+
+#ifdef HAVE_HDF5
+        case H5MD:
+            return read_frame_from_h5md(self, frame, metaOnly);
+#endif
 
 #ifdef HAVE_GROMACS
         case XTC:
-            py_result = read_frame_from_xtc(self, doWrap, boxptr);
-			// Checking for the EOF is done inside the function
-			if (py_result == Py_None) return py_result;
-            break;
+            if (metaOnly) return skip_frame_from_xtc(self, frame);
+            return read_frame_from_xtc(self, frame);
 #endif
 
         default:
-            break;
+            set_error(self, PyExc_RuntimeError, "Should not be here");
+            return -1;
     }
+}
 
-	if (py_result == NULL) return NULL;
+
+
+/* Read the next frame of the whole trajectory and record its position.  *
+ * When the current segment ends, continue with the next one; frames     *
+ * that repeat the last one returned may be skipped. Returns 0, 1 at the *
+ * end of the trajectory or -1 on error (see raise_error). metaOnly is   *
+ * passed to read_frame_data. The GIL is not needed.                      */
+static int next_frame_data(Trajectory *self, FrameData *frame, int metaOnly) {
+
+	long offset = 0;
+	int status;
+
+	while (1) {
+		if (self->type != MOLDEN) offset = frame_offset(self);
+		status = read_frame_data(self, frame, metaOnly);
+		if (status == -1) return -1;
+		if (status == 1) {
+			if (self->segment + 1 >= self->nFiles) {
+				self->totalFrames = self->lastFrame + 1;
+				return 1;
+			}
+			if (open_next_segment(self) == -1) return -1;
+			continue;
+		}
+
+		if (self->checkDuplicate && self->haveTime && frame->hasTime
+				&& frame->time <= self->lastTime
+								+ 1e-6 * fmax(1.0, fabs(self->lastTime)))
+			continue;
+		break;
+	}
+
+	self->checkDuplicate = 0;
+	if ((self->haveTime = frame->hasTime))
+		self->lastTime = frame->time;
     self->lastFrame += 1;
-    return py_result;
+	if (self->type != MOLDEN && record_frame(self, self->lastFrame, offset) == -1)
+		return -1;
+
+    return 0;
 
 }
 
 
 
+/* Wrap coordinates into the box given, or the one read from the file, *
+ * make molecules of the graph whole and unwrap them, in this order.    *
+ * Both boxes are 3x3 matrices; triclinic ones wrap into the unit cell. */
+static int wrap_frame(FrameData *frame, int nAtoms, ARRAY_REAL *newbox, int doWrap,
+				WholeGraph *whole, Unwrapper *unwrap) {
+	ARRAY_REAL lengths[3], inv[9];
 
-static PyObject *Trajectory_write(Trajectory *self, PyObject *args, PyObject *kwds) {
+	if (newbox == NULL) {
+		if (!frame->hasBox) {
+	   	    PyErr_SetString(PyExc_RuntimeError,
+					"Requested PBC, but box information is missing");
+			return -1; }
+		newbox = frame->box;
+	}
+	if (invertBox(newbox, inv) == -1) {
+   	    PyErr_SetString(PyExc_RuntimeError, "Box of the frame is singular");
+		return -1; }
+	if (doWrap && boxIsDiagonal(newbox)) {
+		lengths[0] = newbox[0];
+		lengths[1] = newbox[4];
+		lengths[2] = newbox[8];
+		wrapPBC(frame->xyz, nAtoms, lengths);
+	} else if (doWrap)
+		wrapTriclinic(frame->xyz, nAtoms, newbox, inv);
+	if (whole != NULL) wholeGraphApply(whole, frame->xyz, newbox, inv);
+	if (unwrap != NULL) unwrapperApply(unwrap, frame->xyz, newbox, inv);
 
-	PyObject *py_coords = NULL;
-	PyObject *py_vel = NULL;
-	PyObject *py_box = NULL;
-	char *comment = NULL;;
-	int out;
-	npy_intp *dims;
+	return 0;
+}
 
-	static char *kwlist[] = {
-		"coordinates", "velocities", "box", "comment", NULL };
 
-	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!|O!O!s", kwlist,
-			&PyArray_Type, &py_coords,
-			&PyArray_Type, &py_vel,
-			&PyArray_Type, &py_box,
-			&comment))
-		return NULL;
 
+/* Build the Frame returned by read(). Arrays of the frame data are *
+ * passed on and will be allocated again for the next frame.        */
+static PyObject *frame_to_object(Trajectory *self, FrameData *data) {
+	Frame *frame;
 
-	// Perform checks.
+	if ((frame = frameNew(self->nAtoms)) == NULL) return NULL;
 
-	// Mode must be w/a
-	if (self->mode != 'a' && self->mode != 'w') {
+	if (data->hasComment) {
+		if ((frame->comment = strdup(data->comment)) == NULL) {
+			PyErr_SetFromErrno(PyExc_MemoryError);
+			Py_DECREF(frame);
+			return NULL; }
+		frame->present |= 1u << FRAME_COMMENT;
+	}
+	if (data->hasStep) {
+		frame->step = data->step;
+		frame->present |= 1u << FRAME_STEP;
+	}
+	if (data->hasTime) {
+		frame->time = data->time;
+		frame->present |= 1u << FRAME_TIME;
+	}
+
+	frame->xyz = data->xyz;
+	data->xyz = NULL;
+	frame->present |= 1u << FRAME_COORDINATES;
+
+	if (data->hasVel) {
+		frame->vel = data->vel;
+		data->vel = NULL;
+		frame->present |= 1u << FRAME_VELOCITIES;
+	}
+	if (data->hasExtra) {
+		frame->extra = data->extra;
+		data->extra = NULL;
+		frame->present |= 1u << FRAME_EXTRA;
+	}
+	if (data->hasBox) {
+		memcpy(frame->box, data->box, 9 * sizeof(ARRAY_REAL));
+		frame->present |= 1u << FRAME_BOX;
+	}
+	if (data->hasExt && (frame->info = extInfoObject(&(data->ext),
+	                                &(self->extPlan), self->nAtoms)) == NULL) {
+		Py_DECREF(frame);
+		return NULL; }
+
+	return (PyObject*) frame;
+}
+
+
+
+/* Python-level counterpart of next_frame_data; returns None at the end */
+static PyObject *next_frame(Trajectory *self, int doWrap, ARRAY_REAL *boxptr,
+				WholeGraph *whole, Unwrapper *unwrap) {
+	int status;
+
+	// Fail before reading, when it is known that the box is missing
+	if ((doWrap || whole != NULL || unwrap != NULL) && boxptr == NULL
+			&& (self->type == XYZ || self->type == MOLDEN)) {
+   	    PyErr_SetString(PyExc_RuntimeError,
+				"Requested PBC, but box information is missing");
+		return NULL; }
+
+	if ((status = next_frame_data(self, &(self->frame), 0)) == -1) {
+		raise_error(self);
+		return NULL; }
+	if (status == 1) Py_RETURN_NONE;
+
+	if ((doWrap || whole != NULL || unwrap != NULL)
+			&& wrap_frame(&(self->frame), self->nAtoms, boxptr, doWrap, whole, unwrap) == -1)
+		return NULL;
+
+	return frame_to_object(self, &(self->frame));
+}
+
+
+
+
+static PyObject *Trajectory_write(Trajectory *self, PyObject *args, PyObject *kwds) {
+
+	PyObject *py_coords = NULL;
+	PyObject *py_vel = NULL;
+	PyObject *py_box = NULL;
+	char *comment = NULL;;
+	int out;
+	int copy = 1;
+	npy_intp *dims;
+
+	static char *kwlist[] = {
+		"coordinates", "velocities", "box", "comment", "copy", NULL };
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!|O!O!sp", kwlist,
+			&PyArray_Type, &py_coords,
+			&PyArray_Type, &py_vel,
+			&PyArray_Type, &py_box,
+			&comment, &copy))
+		return NULL;
+
+
+	// Perform checks.
+
+	// Mode must be w/a
+	if (self->mode != 'a' && self->mode != 'w') {
 		PyErr_SetString(PyExc_RuntimeError, "Trying to write in read mode");
 		return NULL; }
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
 
 	// Arrays must be 2D:
 	if (PyArray_NDIM((PyArrayObject*)py_coords) != 2) {
@@ -533,22 +1301,40 @@ static PyObject *Trajectory_write(Trajectory *self, PyObject *args, PyObject *kw
 			return NULL; }
 	}
 
-	// Symbols must be a sequence
-	if (!PyList_Check(self->symbols)) {
+	// Symbols must be present
+	if (self->symbolTable == NULL) {
         PyErr_SetString(PyExc_RuntimeError, "Trajectory instance must contain a list of symbols");
 		return NULL; }
 
+	// The frame is only staged here and written by the background thread
+	if (self->async) {
+		if (self->type == XYZ) py_vel = py_box = NULL;
+		if (self->type == PDB) py_vel = NULL;
+		if (stage_frame(self, py_coords, py_vel, py_box, comment, copy))
+			return NULL;
+		self->lastFrame += 1;
+		Py_RETURN_NONE;
+	}
+
 	switch(self->type) {
 		case XYZ:
 			out = write_frame_to_xyz(self, py_coords, comment);
 			if (out != 0) return NULL;
 			break;
 		case GRO:
-			if (write_frame_to_gro(self, py_coords, py_vel, py_box, comment)) {
-				PyErr_SetString(PyExc_RuntimeError, "Could not write");
-				return NULL;
-			}
+			out = write_frame_to_gro(self, py_coords, py_vel, py_box, comment);
+			if (out != 0) return NULL;
 			break;
+		case PDB:
+			out = write_frame_to_pdb(self, py_coords, py_box, comment);
+			if (out != 0) return NULL;
+			break;
+#ifdef HAVE_HDF5
+		case H5MD:
+			out = write_frame_to_h5md(self, py_coords, py_vel, py_box);
+			if (out != 0) return NULL;
+			break;
+#endif
 
 		default:
 			break;
@@ -560,6 +1346,175 @@ static PyObject *Trajectory_write(Trajectory *self, PyObject *args, PyObject *kw
 }
 
 
+/* Formatted frames are collected in the output buffer and written *
+ * once the buffer grows above this size                           */
+#define WRITE_CHUNK (8L << 20)
+
+static PyObject *Trajectory_writeFrames(Trajectory *self, PyObject *args, PyObject *kwds) {
+
+	PyObject *py_coords = NULL;
+	PyObject *py_vel = NULL;
+	PyObject *py_box = NULL;
+	PyObject *py_comments = NULL;
+	PyObject *seq = NULL;
+	PyArrayObject *coords = NULL, *vel = NULL, *box = NULL;
+	const double *xyz, *v, *b;
+	const char **texts = NULL;
+	Py_ssize_t *lengths = NULL;
+	const char *text;
+	Py_ssize_t len;
+	npy_intp *dims;
+	npy_intp nFrames, frame;
+	long used = 0, atomSize;
+	int err = 0, boxPerFrame = 0;
+
+	static char *kwlist[] = {
+		"coordinates", "boxes", "velocities", "comments", NULL };
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOO", kwlist,
+			&py_coords, &py_box, &py_vel, &py_comments))
+		return NULL;
+
+	// Mode must be w/a
+	if (self->mode != 'a' && self->mode != 'w') {
+		PyErr_SetString(PyExc_RuntimeError, "Trying to write in read mode");
+		return NULL; }
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
+	if (self->type != XYZ && self->type != GRO && self->type != PDB && self->type != H5MD) {
+		PyErr_SetString(PyExc_RuntimeError, "writeFrames supports only XYZ, GRO, PDB and H5MD formats");
+		return NULL; }
+	// Frames staged earlier go first; the writer is idle afterwards
+	if (self->async && wait_writer(self)) return NULL;
+	if (self->symbolTable == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Trajectory instance must contain a list of symbols");
+		return NULL; }
+
+	if (py_box == Py_None) py_box = NULL;
+	if (py_vel == Py_None) py_vel = NULL;
+	if (py_comments == Py_None) py_comments = NULL;
+
+	// All arrays are checked and converted once, before writing
+	if ((coords = as_double_array(py_coords, 3)) == NULL) goto fail;
+	dims = PyArray_DIMS(coords);
+	nFrames = dims[0];
+	if (dims[1] != self->nAtoms || dims[2] != 3) {
+        PyErr_SetString(PyExc_RuntimeError, "Shape of the coordinates array must be (nFrames, nAtoms, 3)");
+		goto fail; }
+
+	if (py_vel != NULL) {
+		if ((vel = as_double_array(py_vel, 3)) == NULL) goto fail;
+		dims = PyArray_DIMS(vel);
+		if (dims[0] != nFrames || dims[1] != self->nAtoms || dims[2] != 3) {
+    	    PyErr_SetString(PyExc_RuntimeError, "Shape of the velocities array must be (nFrames, nAtoms, 3)");
+			goto fail; }
+	}
+
+	// Box may be given once, for all frames, or per frame
+	if (py_box != NULL) {
+		box = (PyArrayObject*) PyArray_FROMANY(py_box, NPY_DOUBLE, 0, 0,
+							NPY_ARRAY_CARRAY_RO | NPY_ARRAY_FORCECAST);
+		if (box == NULL) goto fail;
+		dims = PyArray_DIMS(box);
+		boxPerFrame = PyArray_NDIM(box) == 3;
+		if ((PyArray_NDIM(box) != 2 && !boxPerFrame)
+				|| (boxPerFrame && (dims[0] != nFrames || dims[1] != 3 || dims[2] != 3))
+				|| (!boxPerFrame && (dims[0] != 3 || dims[1] != 3))) {
+    	    PyErr_SetString(PyExc_RuntimeError, "Shape of the box array must be (3, 3) or (nFrames, 3, 3)");
+			goto fail; }
+	}
+
+	// Comments may be a single string or a sequence of nFrames strings
+	texts = (const char**) malloc((nFrames + 1) * sizeof(const char*));
+	lengths = (Py_ssize_t*) malloc((nFrames + 1) * sizeof(Py_ssize_t));
+	if (texts == NULL || lengths == NULL) {
+		PyErr_SetFromErrno(PyExc_MemoryError);
+		goto fail; }
+	if (py_comments == NULL || PyUnicode_Check(py_comments)) {
+		text = "";
+		len = 0;
+		if (py_comments != NULL
+				&& (text = PyUnicode_AsUTF8AndSize(py_comments, &len)) == NULL)
+			goto fail;
+		for (frame = 0; frame < nFrames; frame++) {
+			texts[frame] = text;
+			lengths[frame] = len;
+		}
+	} else {
+		seq = PySequence_Fast(py_comments, "Comments must be a string or a sequence of strings");
+		if (seq == NULL) goto fail;
+		if (PySequence_Fast_GET_SIZE(seq) != nFrames) {
+			PyErr_SetString(PyExc_ValueError, "Number of comments must be equal to the number of frames");
+			goto fail; }
+		for (frame = 0; frame < nFrames; frame++) {
+			texts[frame] = PyUnicode_AsUTF8AndSize(
+						PySequence_Fast_GET_ITEM(seq, frame), &(lengths[frame]));
+			if (texts[frame] == NULL) goto fail;
+		}
+	}
+
+	/* Formatting and writing does not touch Python objects; the arrays *
+	 * and strings are kept alive by the references held here.          */
+	xyz = (const double*) PyArray_DATA(coords);
+	v = vel != NULL ? (const double*) PyArray_DATA(vel) : NULL;
+	b = box != NULL ? (const double*) PyArray_DATA(box) : NULL;
+	atomSize = 3L * self->nAtoms;
+
+	Py_BEGIN_ALLOW_THREADS
+#ifdef HAVE_HDF5
+	// All frames go to the datasets at once
+	if (self->type == H5MD) {
+		if (h5mdAppend(self->h5md, nFrames, xyz, v, b, boxPerFrame ? 9 : 0)) err = 3;
+		else self->lastFrame += nFrames;
+	}
+#endif
+	for (frame = 0; frame < nFrames && !err && self->type != H5MD; frame++) {
+		err = format_frame(self, &used, xyz + frame * atomSize,
+						v != NULL ? v + frame * atomSize : NULL,
+						b != NULL && boxPerFrame ? b + frame * 9 : b,
+						texts[frame], lengths[frame]);
+		if (err) break;
+		if (used >= WRITE_CHUNK || frame == nFrames - 1) {
+			if (fwrite(self->outBuf, 1, used, self->fd) != (size_t)used)
+				err = 2;
+			used = 0;
+		}
+		if (!err) self->lastFrame += 1;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (err == 1) {
+		PyErr_SetFromErrno(PyExc_MemoryError);
+		goto fail; }
+	if (err == 2) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		goto fail; }
+#ifdef HAVE_HDF5
+	if (err == 3) {
+		PyErr_SetString(PyExc_IOError, self->h5md->error);
+		goto fail; }
+#endif
+
+	free(texts);
+	free(lengths);
+	Py_XDECREF(seq);
+	Py_DECREF(coords);
+	Py_XDECREF(vel);
+	Py_XDECREF(box);
+	Py_RETURN_NONE;
+
+	fail:
+	free(texts);
+	free(lengths);
+	Py_XDECREF(seq);
+	Py_XDECREF(coords);
+	Py_XDECREF(vel);
+	Py_XDECREF(box);
+	return NULL;
+}
+
+
 
 
 
@@ -577,6 +1532,18 @@ static PyObject* Trajectory_repr(Trajectory *self) {
             strcpy(format,    "GRO"); break;
         case XTC:
             strcpy(format,    "XTC"); break;
+        case PDB:
+            strcpy(format,    "PDB"); break;
+        case LAMMPS:
+            strcpy(format, "LAMMPS"); break;
+        case MDCRD:
+            strcpy(format,  "MDCRD"); break;
+        case XDATCAR:
+            strcpy(format, "XDATCAR"); break;
+        case NETCDF:
+            strcpy(format, "NETCDF"); break;
+        case H5MD:
+            strcpy(format,   "H5MD"); break;
         default:
             strcpy(format,       ""); break;
     }
@@ -601,19 +1568,123 @@ static PyObject* Trajectory_repr(Trajectory *self) {
 
 
 
+/* Attribute getters */
+
+/* Wrap an array of codes in a read-only ndarray that shares the *
+ * memory with the Trajectory instance.                          */
+static PyObject *codesToArray(Trajectory *self, int *codes) {
+    PyObject *py_arr;
+    npy_intp dims[1];
+
+    dims[0] = self->nAtoms;
+    py_arr = PyArray_SimpleNewFromData(1, dims, NPY_INT, codes);
+    if (py_arr == NULL) return NULL;
+    PyArray_CLEARFLAGS((PyArrayObject*)py_arr, NPY_ARRAY_WRITEABLE);
+    Py_INCREF(self);
+    if (PyArray_SetBaseObject((PyArrayObject*)py_arr, (PyObject*)self) == -1) {
+        Py_DECREF(py_arr);
+        return NULL; }
+    return py_arr;
+}
+
+
+static PyObject *Trajectory_getSymbols(Trajectory *self, void *closure) {
+    if (self->symbolTable == NULL) Py_RETURN_NONE;
+    if (self->symbols == NULL) {
+        self->symbols = nameTableList(self->symbolTable,
+                                      self->symbolCodes, self->nAtoms);
+        if (self->symbols == NULL) return NULL;
+    }
+    Py_INCREF(self->symbols);
+    return self->symbols;
+}
+
+
+static PyObject *Trajectory_getResNames(Trajectory *self, void *closure) {
+    if (self->resNameTable == NULL) Py_RETURN_NONE;
+    if (self->resNames == NULL) {
+        self->resNames = nameTableList(self->resNameTable,
+                                       self->resNameCodes, self->nAtoms);
+        if (self->resNames == NULL) return NULL;
+    }
+    Py_INCREF(self->resNames);
+    return self->resNames;
+}
+
+
+static PyObject *Trajectory_getChains(Trajectory *self, void *closure) {
+    if (self->chainTable == NULL) Py_RETURN_NONE;
+    if (self->chains == NULL) {
+        self->chains = nameTableList(self->chainTable,
+                                     self->chainCodes, self->nAtoms);
+        if (self->chains == NULL) return NULL;
+    }
+    Py_INCREF(self->chains);
+    return self->chains;
+}
+
+
+static PyObject *Trajectory_getSymbolArray(Trajectory *self, void *closure) {
+    if (self->symbolTable == NULL) Py_RETURN_NONE;
+    return nameTableArray(self->symbolTable, self->symbolCodes, self->nAtoms);
+}
+
+
+static PyObject *Trajectory_getResNameArray(Trajectory *self, void *closure) {
+    if (self->resNameTable == NULL) Py_RETURN_NONE;
+    return nameTableArray(self->resNameTable, self->resNameCodes, self->nAtoms);
+}
+
+
+static PyObject *Trajectory_getSymbolTable(Trajectory *self, void *closure) {
+    if (self->symbolTable == NULL) Py_RETURN_NONE;
+    return nameTableNames(self->symbolTable);
+}
+
+
+static PyObject *Trajectory_getResNameTable(Trajectory *self, void *closure) {
+    if (self->resNameTable == NULL) Py_RETURN_NONE;
+    return nameTableNames(self->resNameTable);
+}
+
+
+static PyObject *Trajectory_getChainTable(Trajectory *self, void *closure) {
+    if (self->chainTable == NULL) Py_RETURN_NONE;
+    return nameTableNames(self->chainTable);
+}
+
+
+static PyObject *Trajectory_getSymbolCodes(Trajectory *self, void *closure) {
+    if (self->symbolTable == NULL) Py_RETURN_NONE;
+    return codesToArray(self, self->symbolCodes);
+}
+
+
+static PyObject *Trajectory_getResNameCodes(Trajectory *self, void *closure) {
+    if (self->resNameTable == NULL) Py_RETURN_NONE;
+    return codesToArray(self, self->resNameCodes);
+}
+
+
+static PyObject *Trajectory_getChainCodes(Trajectory *self, void *closure) {
+    if (self->chainTable == NULL) Py_RETURN_NONE;
+    return codesToArray(self, self->chainCodes);
+}
+
+/* End of attribute getters */
+
+
+
+
 /* Class definition */
 
 static PyMemberDef Trajectory_members[] = {
-    {"symbols", T_OBJECT_EX, offsetof(Trajectory, symbols), READONLY,
-     "A list of atomic symbols"},
     {"aNumbers", T_OBJECT_EX, offsetof(Trajectory, aNumbers), READONLY,
      "An ndarray with atomic numbers"},
     {"masses", T_OBJECT_EX, offsetof(Trajectory, masses), READONLY,
      "An ndarray with atomic masses"},
     {"resids", T_OBJECT_EX, offsetof(Trajectory, resids), READONLY,
      "An ndarray with residue numbers - one number per atom"},
-    {"resNames", T_OBJECT_EX, offsetof(Trajectory, resNames), READONLY,
-     "A list of residue names"},
     {"nAtoms", T_INT, offsetof(Trajectory, nAtoms), READONLY,
      "Number of atoms (int)"},
     {"lastFrame", T_INT, offsetof(Trajectory, lastFrame), READONLY,
@@ -623,1058 +1694,4132 @@ static PyMemberDef Trajectory_members[] = {
     // "Dictionary containing byte offsets to sections in Molden file"},
     {"fileName", T_STRING, offsetof(Trajectory, fileName), READONLY,
      "File name (str)"},
+    {"segment", T_INT, offsetof(Trajectory, segment), READONLY,
+     "Index of the file (in fileNames) being read"},
     {NULL}  /* Sentinel */
 };
 
 
 
 
-static PyMethodDef Trajectory_methods[] = {
+static PyObject *Trajectory_getFileNames(Trajectory *self, void *closure) {
+    PyObject *tuple, *name;
+    int i;
 
-    {"read", (PyCFunction)Trajectory_read, METH_VARARGS | METH_KEYWORDS,
-        "\n"
-        "Trajectory.read()\n"
-        "\n"
-        "Read next frame from trajectory. Returns a dictionary with:\n"
-        "\n"
-        "coordinates (ndarray)\n"
-        "step (int)\n"
-        "time (float)\n"
-        "box (ndarray) shape=3,3\n"
-        "\n" },
+    if ((tuple = PyTuple_New(self->nFiles)) == NULL) return NULL;
+    for (i = 0; i < self->nFiles; i++) {
+        if ((name = PyUnicode_FromString(self->fileNames[i])) == NULL) {
+            Py_DECREF(tuple);
+            return NULL; }
+        PyTuple_SET_ITEM(tuple, i, name);
+    }
+    return tuple;
+}
 
-	{"write", (PyCFunction)Trajectory_write, METH_VARARGS | METH_KEYWORDS,
-		"\n"
-		"Trajectory.write(coordinates, [ comment ])\n"
-		"\n"
-		"coordinates (ndarray)\n"
-		"velocities (ndarray)\n"
-		"box (ndarray)\n"
-		"comment (string)\n"
-		"\n" },
+static PyObject *Trajectory_getSegmentStarts(Trajectory *self, void *closure) {
+    PyObject *list, *val;
+    int i;
+
+    // Only segments that have been reached are known
+    if ((list = PyList_New(0)) == NULL) return NULL;
+    for (i = 0; i < self->nFiles && self->segmentStarts[i] >= 0; i++) {
+        if ((val = PyLong_FromLong(self->segmentStarts[i])) == NULL
+                || PyList_Append(list, val) == -1) {
+            Py_XDECREF(val);
+            Py_DECREF(list);
+            return NULL; }
+        Py_DECREF(val);
+    }
+    return list;
+}
 
+static PyGetSetDef Trajectory_getset[] = {
+    {"symbols", (getter)Trajectory_getSymbols, NULL,
+     "A list of atomic symbols", NULL},
+    {"resNames", (getter)Trajectory_getResNames, NULL,
+     "A list of residue names", NULL},
+    {"symbolArray", (getter)Trajectory_getSymbolArray, NULL,
+     "An ndarray (fixed-width unicode) with atomic symbols", NULL},
+    {"resNameArray", (getter)Trajectory_getResNameArray, NULL,
+     "An ndarray (fixed-width unicode) with residue names", NULL},
+    {"symbolTable", (getter)Trajectory_getSymbolTable, NULL,
+     "A tuple of unique atomic symbols, indexed by symbolCodes", NULL},
+    {"symbolCodes", (getter)Trajectory_getSymbolCodes, NULL,
+     "An ndarray with indices into symbolTable - one number per atom", NULL},
+    {"resNameTable", (getter)Trajectory_getResNameTable, NULL,
+     "A tuple of unique residue names, indexed by resNameCodes", NULL},
+    {"resNameCodes", (getter)Trajectory_getResNameCodes, NULL,
+     "An ndarray with indices into resNameTable - one number per atom", NULL},
+    {"chains", (getter)Trajectory_getChains, NULL,
+     "A list of chain identifiers (PDB)", NULL},
+    {"chainTable", (getter)Trajectory_getChainTable, NULL,
+     "A tuple of unique chain identifiers, indexed by chainCodes", NULL},
+    {"chainCodes", (getter)Trajectory_getChainCodes, NULL,
+     "An ndarray with indices into chainTable - one number per atom", NULL},
+    {"fileNames", (getter)Trajectory_getFileNames, NULL,
+     "A tuple of files (segments) that make up the trajectory", NULL},
+    {"segmentStarts", (getter)Trajectory_getSegmentStarts, NULL,
+     "A list with the global index of the first frame in each segment "
+     "reached so far", NULL},
     {NULL}  /* Sentinel */
 };
 
 
 
 
-PyTypeObject TrajectoryType = {
+/* traj[index] - random access to frames. The frame is read from the *
+ * cache if possible; sequential reading continues after it.          */
+static PyObject *Trajectory_getItem(Trajectory *self, PyObject *key) {
+	PyObject *frame, *copy;
+	Py_ssize_t index;
+	int status;
 
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "mdarray.Trajectory",          /*tp_name*/
-    sizeof(Trajectory),             /*tp_basicsize*/
-    0,                              /*tp_itemsize*/
+	if (self->mode != 'r') {
+		PyErr_SetString(PyExc_RuntimeError, "Trying to read in write mode");
+		return NULL; }
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
 
-    /* Methods to implement standard operations */
-    (destructor)Trajectory_dealloc, /*tp_dealloc*/
-    0,                              /*tp_print*/
-    0,                              /*tp_getattr*/
-    0,                              /*tp_setattr*/
-	 0,                              /* tp_reserved */
-    (reprfunc)Trajectory_repr,      /*tp_repr*/
+	index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+	if (index == -1 && PyErr_Occurred()) return NULL;
+	// Counting from the end requires reaching it first
+	if (index < 0) {
+		if (self->totalFrames < 0 && seek_frame(self, LONG_MAX) == -1)
+			return NULL;
+		index += self->totalFrames;
+	}
+	if (index < 0) {
+		PyErr_SetString(PyExc_IndexError, "Frame index out of range");
+		return NULL; }
 
-    /* Method suites for standard classes */
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
+	if (self->cache != NULL && (frame = frameCacheGet(self->cache, index)) != NULL) {
+		copy = frameCopy((Frame*)frame);
+		Py_DECREF(frame);
+		return copy;
+	}
 
-    /* More standard operations (here for binary compatibility) */
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
+	if ((status = seek_frame(self, index)) == -1) return NULL;
+	if (status == 0) {
+		if ((frame = next_frame(self, 0, NULL, NULL, NULL)) == NULL) return NULL;
+		if (frame != Py_None) {
+			if (self->cache == NULL) return frame;
+			if (frameCachePut(self->cache, index, frame) == -1) {
+				Py_DECREF(frame);
+				return NULL; }
+			copy = frameCopy((Frame*)frame);
+			Py_DECREF(frame);
+			return copy;
+		}
+		Py_DECREF(frame);
+	}
 
-    /* Functions to access object as input/output buffer */
-    0,                         /*tp_as_buffer*/
+	PyErr_SetString(PyExc_IndexError, "Frame index out of range");
+	return NULL;
+}
 
-    /* Flags to define presence of optional/expanded features */
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
 
-    /* Documentation string */
-    "Trajectory class. Implements reading of trajectories from XYZ. Molden, "
-	 "GRO and XTC. Writing is implemented for XYZ and GRO. The process is "
-	 "two-step; first, the object must be created, by specifying fileName "
-	 "(for reading) or topology information (for writing). Second, frames "
-	 "can be read/saved repeteadly. Reading examples:\n"
-    "  traj = Trajectory('my.xyz')\n"
-    "  frame1 = traj.read()\n"
-    "  frame2 = traj.read()\n"
-    "Object of the class Trajectory contains such fields as: symbols, "
-	 "aNumbers, masses, resIDs, resNames, nAtoms, nOfFrames, "
-	 "lastFrame, moldenSections, fileName. Method read() returns a dictionary "
-	 "with items depending on the file format, but at least 'coordinates' "
-	 "are present. Writing example:\n"
-    "  traj = Trajectory('my.xyz', symbols_list)\n"
-    "  traj.write(coordinates1)\n"
-    "  traj.write(coordinates2)\n"
-    "When writing a trajectory, at least the file name and the list of "
-	 "symbols must be specified. Creating an instance for reading:\n"
-    "  traj = Trajectory(fileName, format='GUESS', mode='r', units='angs')\n"
-    "Available formats include: XYZ, GRO, MOLDEN, XTC - guessed if not "
-	 "specified.\n"
-    "Mode: 'r' (default), 'w', 'a'.\n"
-    "Units: 'angs' (default), 'bohr', 'nm'.\n"
-    "Creating an instance for writing:\n"
-    "  traj = Trajectory(filename, format='GUESS', mode='w', symbols=, "
-	 "resids=, resnames=)\n"
-    "symbols and resnames are lists, while resids, coodinates and velocities "
-	 "are ndarrays.\n",           /* tp_doc */
 
-    0,                       /* tp_traverse */
-    0,                       /* tp_clear */
-    0,                       /* tp_richcompare */
-    0,                       /* tp_weaklistoffset */
-    0,                       /* tp_iter */
-    0,                       /* tp_iternext */
-    Trajectory_methods,        /* tp_methods */
-    Trajectory_members,        /* tp_members */
-    0,                         /* tp_getset */
-    0,                         /* tp_base */
-    0,                         /* tp_dict */
-    0,                         /* tp_descr_get */
-    0,                         /* tp_descr_set */
-    0,                         /* tp_dictoffset */
-    (initproc)Trajectory_init, /* tp_init */
-    0,                         /* tp_alloc */
-    Trajectory_new,            /* tp_new */
-	 0,                         /* tp_free */
-	 0,                         /* tp_is_gc */
-	 0,                         /* tp_bases */
-	 0,                         /* tp_mro */
-	 0,                         /* tp_cache */
-	 0,                         /* tp_subclasses */
-	 0,                         /* tp_weaklist */
-	 0,                         /* tp_del */
-	 0,                         /* tp_version_tag */
-	 0                          /* tp_finalize */
-};
+static PyObject *Trajectory_setCache(Trajectory *self, PyObject *args, PyObject *kwds) {
+	long maxFrames = 0, maxBytes = 0;
 
-/* End of class definition */
+	static char *kwlist[] = {
+		"maxFrames", "maxBytes", NULL };
 
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "|ll", kwlist,
+			&maxFrames, &maxBytes))
+		return NULL;
+	if (maxFrames < 0 || maxBytes < 0) {
+		PyErr_SetString(PyExc_ValueError, "Cache limits cannot be negative");
+		return NULL; }
 
+	frameCacheFree(self->cache);
+	self->cache = NULL;
+	if (maxFrames > 0 || maxBytes > 0)
+		if ((self->cache = frameCacheNew(maxFrames, maxBytes)) == NULL)
+			return NULL;
 
+	Py_RETURN_NONE;
+}
 
 
 
+static PyObject *Trajectory_cacheInfo(Trajectory *self) {
+	if (self->cache == NULL) Py_RETURN_NONE;
+	return frameCacheInfo(self->cache);
+}
 
-/* Local helper functions */
 
-static int read_topo_from_xyz(Trajectory *self) {
 
-    int nofatoms, pos, idx;
-    char *buffer = NULL;
-	char *buffpos, *token;
-	size_t buflen = 0;
-    int *anum;
-	ARRAY_REAL *masses;
-    extern Element element_table[];
+/* Grow the arrays of scan data, if needed */
+static int grow_scan_data(Trajectory *self, ScanData *data, long commentLen) {
+	void *tmp;
+	long size;
 
-    npy_intp dims[2];
-    PyObject *val;
+	if (data->nFrames == data->capacity) {
+		size = data->capacity ? 2 * data->capacity : 1024;
+		if ((tmp = realloc(data->steps, size * sizeof(long))) == NULL) goto fail;
+		data->steps = (long*) tmp;
+		if ((tmp = realloc(data->times, size * sizeof(double))) == NULL) goto fail;
+		data->times = (double*) tmp;
+		if ((tmp = realloc(data->boxes, 9 * size * sizeof(ARRAY_REAL))) == NULL) goto fail;
+		data->boxes = (ARRAY_REAL*) tmp;
+		if ((tmp = realloc(data->commentEnds, size * sizeof(long))) == NULL) goto fail;
+		data->commentEnds = (long*) tmp;
+		data->capacity = size;
+	}
+	if (data->commentsUsed + commentLen > data->commentsSize) {
+		size = 2 * data->commentsSize + commentLen + 4096;
+		if ((tmp = realloc(data->comments, size)) == NULL) goto fail;
+		data->comments = (char*) tmp;
+		data->commentsSize = size;
+	}
+	return 0;
 
-    /* Read number of atoms */
-    if (_getline(&buffer, &buflen, self->fd) == -1) return -1;
-    if (sscanf(buffer, "%d", &nofatoms) != 1 ) {
-        PyErr_SetString(PyExc_IOError, "Incorrect atom number");
-        return -1; }
+	fail:
+	set_error(self, PyExc_MemoryError, NULL);
+	return -1;
+}
 
-    /* Read the comment line */
-    if (_getline(&buffer, &buflen, self->fd) == -1) return -1;
 
-    /* Get rid of Py_None in self->symbols */
-    Py_DECREF(self->symbols);
-    self->symbols = PyList_New(nofatoms);
+/* Go through all frames from the beginning, reading only the headers. *
+ * Positions of the frames are recorded on the way. The GIL is not     *
+ * needed; returns 0 or -1 on error (see raise_error).                 */
+static int scan_frames(Trajectory *self, ScanData *data) {
+	FrameData *frame = &(self->frame);
+	long n, len;
+	int status;
 
-    anum = (int*) malloc(nofatoms * sizeof(int));
-    if(anum == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return -1; }
+	while ((status = next_frame_data(self, frame, 1)) == 0) {
+		len = frame->hasComment ? strlen(frame->comment) : 0;
+		if (grow_scan_data(self, data, len) == -1) return -1;
+		n = data->nFrames;
+		data->allSteps &= frame->hasStep;
+		data->allTimes &= frame->hasTime;
+		data->allBoxes &= frame->hasBox;
+		data->allComments &= frame->hasComment;
+		data->steps[n] = frame->step;
+		data->times[n] = frame->time;
+		memcpy(data->boxes + 9*n, frame->box, 9 * sizeof(ARRAY_REAL));
+		if (len) memcpy(data->comments + data->commentsUsed, frame->comment, len);
+		data->commentsUsed += len;
+		data->commentEnds[n] = data->commentsUsed;
+		data->nFrames += 1;
+	}
+	return status;
+}
 
-    masses = (ARRAY_REAL*) malloc(nofatoms * sizeof(ARRAY_REAL));
-    if(masses == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return -1; }
 
-    /* Atom loop */
-    for(pos = 0; pos < nofatoms; pos++) {
+/* Read-only copy of scan data as a 1D or 3D array */
+static PyObject *scan_array(long n, int type, const void *values, int nd, size_t itemSize) {
+	PyObject *py_arr;
+	npy_intp dims[3] = { n, 3, 3 };
 
-        /* Get the whole line */
-        if(_getline(&buffer, &buflen, self->fd) == -1) return -1;
-        buffer[strlen(buffer)-1] = '\0';
-        buffpos = buffer;
+	if ((py_arr = PyArray_SimpleNew(nd, dims, type)) == NULL) return NULL;
+	memcpy(PyArray_DATA((PyArrayObject*)py_arr), values, n * itemSize);
+	PyArray_CLEARFLAGS((PyArrayObject*)py_arr, NPY_ARRAY_WRITEABLE);
+	return py_arr;
+}
 
-        /* Read symbol */
-        token = strtok(buffpos, " \t");
-        val = Py_BuildValue("s", token);
-        PyList_SetItem(self->symbols, pos, val);
 
-        idx = getElementIndexBySymbol(token);
-        if (idx == -1) {
-            anum[pos] = -1;
-				masses[pos] = 0.0;
-        } else {
-            anum[pos] = element_table[idx].number;
-				masses[pos] = element_table[idx].mass;
+/* Dictionary with the results of scan(); items missing in any frame are None */
+static PyObject *scan_result(ScanData *data) {
+	PyObject *py_steps = NULL, *py_times = NULL, *py_boxes = NULL;
+	PyObject *py_comments = NULL, *py_result = NULL, *str;
+	long i, start;
+
+	py_steps = data->allSteps
+		? scan_array(data->nFrames, NPY_LONG, data->steps, 1, sizeof(long))
+		: (Py_INCREF(Py_None), Py_None);
+	py_times = data->allTimes
+		? scan_array(data->nFrames, NPY_DOUBLE, data->times, 1, sizeof(double))
+		: (Py_INCREF(Py_None), Py_None);
+	py_boxes = data->allBoxes
+		? scan_array(data->nFrames, NPY_ARRAY_REAL, data->boxes, 3, 9 * sizeof(ARRAY_REAL))
+		: (Py_INCREF(Py_None), Py_None);
+	if (data->allComments) {
+		if ((py_comments = PyTuple_New(data->nFrames)) == NULL) goto end;
+		for (i = 0, start = 0; i < data->nFrames; start = data->commentEnds[i++]) {
+			str = PyUnicode_FromStringAndSize(data->comments + start,
+							data->commentEnds[i] - start);
+			if (str == NULL) goto end;
+			PyTuple_SET_ITEM(py_comments, i, str);
 		}
+	} else {
+		py_comments = Py_None;
+		Py_INCREF(py_comments);
+	}
 
-        /* Free the line buffer */
-    }
-    free(buffer);
+	if (py_steps != NULL && py_times != NULL && py_boxes != NULL)
+		py_result = Py_BuildValue("{s:l,s:O,s:O,s:O,s:O}",
+				"frames", data->nFrames, "step", py_steps, "time", py_times,
+				"box", py_boxes, "comment", py_comments);
+
+	end:
+	Py_XDECREF(py_steps);
+	Py_XDECREF(py_times);
+	Py_XDECREF(py_boxes);
+	Py_XDECREF(py_comments);
+	return py_result;
+}
 
-    /* Add atomic numbers to the dictionary */
-    dims[0] = nofatoms;
-    dims[1] = 1;
-    Py_DECREF(self->aNumbers);
-    self->aNumbers = PyArray_SimpleNewFromData(1, dims, NPY_INT, (int*) anum);
-    Py_DECREF(self->masses);
-    self->masses = PyArray_SimpleNewFromData(1, dims, NPY_ARRAY_REAL, (ARRAY_REAL*) masses);
 
-    self->nAtoms = nofatoms;
+static PyObject *Trajectory_scan(Trajectory *self) {
+	ScanData data;
+	long next;
+	int status;
 
-    return 0;
+	if (self->mode != 'r') {
+		PyErr_SetString(PyExc_RuntimeError, "Trying to read in write mode");
+		return NULL; }
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
+	if (self->scanResult != NULL) {
+		Py_INCREF(self->scanResult);
+		return self->scanResult; }
+
+	next = self->lastFrame + 1;
+	if (seek_frame(self, 0) == -1) return NULL;
+
+	memset(&data, 0, sizeof(ScanData));
+	data.allSteps = data.allTimes = data.allBoxes = data.allComments = 1;
+	Py_BEGIN_ALLOW_THREADS
+	status = scan_frames(self, &data);
+	Py_END_ALLOW_THREADS
+
+	if (status == -1)
+		raise_error(self);
+	else
+		self->scanResult = scan_result(&data);
+	free(data.steps);
+	free(data.times);
+	free(data.boxes);
+	free(data.comments);
+	free(data.commentEnds);
+
+	// Sequential reading continues where it was
+	if ((status = seek_frame(self, next)) == 1) self->lastFrame = next - 1;
+	if (status == -1 || self->scanResult == NULL) return NULL;
+
+	Py_INCREF(self->scanResult);
+	return self->scanResult;
 }
 
 
+/* Mapping of a NetCDF file kept alive by the arrays of view() */
+typedef struct {
+	void *data;
+	size_t size;
+} CdfMapping;
 
+static void release_mapping(PyObject *capsule) {
+	CdfMapping *map = (CdfMapping*) PyCapsule_GetPointer(capsule, "mdarray.cdfmap");
 
-/* Read MOLDEN file and get the sections present. Store offset to the *
- * particular section too. Returns number of sections parsed or -1 on *
- * error. */
+	munmap(map->data, map->size);
+	free(map);
+}
 
-static int read_molden_sections(Trajectory *self) {
 
-    long filepos;
-    char *strptr;
-	char *line = NULL;
-	size_t llen;
-    char buffer[256];
-    int i, len, nsec = 0;
+/* traj.view(name) - read-only array over a variable of the mapped *
+ * NetCDF file, in its own (big-endian) type; record variables get *
+ * the number of records as the first dimension.                   */
+static PyObject *Trajectory_view(Trajectory *self, PyObject *args, PyObject *kwds) {
+	const char *name = "coordinates";
+	const CdfVariable *var;
+	CdfMapping *map;
+	PyArray_Descr *descr, *swapped;
+	PyObject *py_arr, *capsule;
+	npy_intp dims[CDF_MAX_VAR_DIMS], strides[CDF_MAX_VAR_DIMS];
+	int i, type;
 
-	for (i = 0; i < MAX_MOLDEN_SECTIONS; i++) {
-		self->moldenSect[i].offset = -1;
-		strcpy(self->moldenSect[i].name, "");
-	}
+	static char *kwlist[] = { "name", NULL };
 
-    rewind(self->fd);
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &name))
+		return NULL;
+	if (self->type != NETCDF || self->nFiles != 1) {
+		PyErr_SetString(PyExc_ValueError, "view() needs a single NetCDF file");
+		return NULL; }
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
+	if ((var = cdfFind(self->cdf, name)) == NULL) {
+		PyErr_Format(PyExc_KeyError, "No variable '%s' in the file", name);
+		return NULL; }
 
-    filepos = ftell(self->fd);
-    while (getline(&line, &llen, self->fd) != -1) {
+	switch (var->type) {
+		case CDF_BYTE:   type = NPY_INT8; break;
+		case CDF_CHAR:   type = NPY_UINT8; break;
+		case CDF_SHORT:  type = NPY_INT16; break;
+		case CDF_INT:    type = NPY_INT32; break;
+		case CDF_FLOAT:  type = NPY_FLOAT32; break;
+		default:         type = NPY_FLOAT64; break;
+	}
+	for (i = var->nDims - 1; i >= 0; i--) {
+		dims[i] = var->shape[i];
+		strides[i] = i == var->nDims - 1 ? (npy_intp) cdfTypeSize(var->type)
+		                                 : strides[i+1] * dims[i+1];
+	}
+	if (var->record) {
+		dims[0] = self->cdf->nRecords;
+		strides[0] = self->cdf->recordSize;
+	}
 
-	    stripline(line);
-    	make_lowercase(line);
+	// The array has its own mapping, which outlives the trajectory
+	if ((map = (CdfMapping*) malloc(sizeof(CdfMapping))) == NULL)
+		return PyErr_NoMemory();
+	map->size = self->cdfSize;
+	map->data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fileno(self->fd), 0);
+	if (map->data == MAP_FAILED) {
+		free(map);
+		PyErr_SetFromErrno(PyExc_IOError);
+		return NULL; }
+	if ((capsule = PyCapsule_New(map, "mdarray.cdfmap", release_mapping)) == NULL) {
+		munmap(map->data, map->size);
+		free(map);
+		return NULL; }
 
-        // Start of a section 
-        if(line[0] == '[') {
+	descr = PyArray_DescrFromType(type);
+	swapped = PyArray_DescrNewByteorder(descr, NPY_BIG);
+	Py_DECREF(descr);
+	if (swapped == NULL) {
+		Py_DECREF(capsule);
+		return NULL; }
+	// The descriptor is stolen
+	py_arr = PyArray_NewFromDescr(&PyArray_Type, swapped, var->nDims, dims, strides,
+			(char*) map->data + var->begin, 0, NULL);
+	if (py_arr == NULL) {
+		Py_DECREF(capsule);
+		return NULL; }
+	// The reference to capsule is stolen, even on failure
+	if (PyArray_SetBaseObject((PyArrayObject*) py_arr, capsule) == -1) {
+		Py_DECREF(py_arr);
+		return NULL; }
+	return py_arr;
+}
 
-            // Get the name 
-            strptr = strchr(line, ']');
-            len = (int)(strptr - line) - 1;
-            strncpy(buffer, line+1, len);
-            buffer[len] = '\0';
 
-			self->moldenSect[nsec].offset = filepos;
-			strcpy(self->moldenSect[nsec].name, buffer);
+/* traj.readFrames(start, stop, atoms, out, name) - one element of a *
+ * range of frames and a selection of atoms of an H5MD file, read at  *
+ * once into a (frames, atoms, 3) array.                             */
+static PyObject *Trajectory_readFrames(Trajectory *self, PyObject *args, PyObject *kwds) {
+#ifdef HAVE_HDF5
+	Py_ssize_t start = 0, stop = PY_SSIZE_T_MAX, first, last, step, n, i;
+	const char *name = "position";
+	PyObject *py_atoms = NULL, *py_out = NULL;
+	PyArrayObject *atoms = NULL, *out = NULL;
+	H5mdElement *el;
+	hsize_t *runs = NULL;
+	const npy_intp *idx;
+	npy_intp dims[3];
+	int nRuns = 0, status;
+	double factor;
+
+	static char *kwlist[] = { "start", "stop", "atoms", "out", "name", NULL };
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nnOOs", kwlist,
+			&start, &stop, &py_atoms, &py_out, &name))
+		return NULL;
+	if (self->type != H5MD || self->mode != 'r' || self->nFiles != 1) {
+		PyErr_SetString(PyExc_ValueError, "readFrames() needs a single H5MD file in 'r' mode");
+		return NULL; }
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
 
-			// Out of three sections that provide coordinates,
-			// if more than one is present, the order of preference
-			// should be:
-			// GEOMETRIES, ATOMS, FR-COORD
-			if (!strcmp(buffer, "geometries")) {
-				self->moldenStyle = MLGEOM;
-			} else if (self->moldenStyle != MLGEOM && !strcmp(buffer, "atoms")) {
-				self->moldenStyle = MLATOMS;
-			} else if (self->moldenStyle != MLGEOM &&
-			           self->moldenStyle != MLATOMS && !strcmp(buffer, "fr-coord")) {
-					self->moldenStyle = MLFREQ;
-					// Set default units for this style - maybe not perfect
-					// place to do it...
-    	        	self->units = BOHR;
+	if (!strcmp(name, "position")) el = &(self->h5md->position);
+	else if (!strcmp(name, "velocity")) el = &(self->h5md->velocity);
+	else el = NULL;
+	if (el == NULL || el->value < 0) {
+		PyErr_Format(PyExc_KeyError, "No element '%s' in the file", name);
+		return NULL; }
+	PySlice_AdjustIndices(el->dims[0], &start, &stop, 1);
+	dims[0] = stop > start ? stop - start : 0;
+	dims[1] = self->nAtoms;
+	dims[2] = 3;
+
+	/* Atoms are a slice or increasing indices; they are read as runs *
+	 * of consecutive atoms.                                          */
+	if (py_atoms != NULL && py_atoms != Py_None) {
+		if (PySlice_Check(py_atoms)) {
+			if (PySlice_Unpack(py_atoms, &first, &last, &step) == -1) return NULL;
+			if (step < 1) {
+				PyErr_SetString(PyExc_ValueError, "Step of atoms must be positive");
+				return NULL; }
+			n = PySlice_AdjustIndices(self->nAtoms, &first, &last, step);
+			runs = (hsize_t*) malloc((step == 1 ? 2 : 2 * n + 2) * sizeof(hsize_t));
+			if (runs == NULL) return PyErr_NoMemory();
+			if (step == 1 && n > 0) {
+				runs[0] = first;
+				runs[1] = n;
+				nRuns = 1;
+			} else if (step > 1)
+				for (i = 0; i < n; i++) {
+					runs[2*i] = first + i * step;
+					runs[2*i+1] = 1;
+					nRuns++;
+				}
+			dims[1] = n;
+		} else {
+			atoms = (PyArrayObject*) PyArray_FROMANY(py_atoms, NPY_INTP, 1, 1,
+								NPY_ARRAY_CARRAY_RO | NPY_ARRAY_FORCECAST);
+			if (atoms == NULL) return NULL;
+			n = PyArray_DIM(atoms, 0);
+			idx = (const npy_intp*) PyArray_DATA(atoms);
+			if ((runs = (hsize_t*) malloc((2 * n + 2) * sizeof(hsize_t))) == NULL) {
+				Py_DECREF(atoms);
+				return PyErr_NoMemory(); }
+			for (i = 0; i < n; i++) {
+				if (idx[i] < 0 || idx[i] >= self->nAtoms || (i > 0 && idx[i] <= idx[i-1])) {
+					PyErr_SetString(PyExc_ValueError,
+						"Atoms must be increasing indices, smaller than nAtoms");
+					Py_DECREF(atoms);
+					free(runs);
+					return NULL; }
+				if (nRuns > 0 && (hsize_t)idx[i] == runs[2*nRuns-2] + runs[2*nRuns-1])
+					runs[2*nRuns-1] += 1;
+				else {
+					runs[2*nRuns] = idx[i];
+					runs[2*nRuns+1] = 1;
+					nRuns++;
+				}
 			}
-			if (++nsec > MAX_MOLDEN_SECTIONS) return -1;
+			Py_DECREF(atoms);
+			dims[1] = n;
+		}
+	}
 
-        }
-        
-        filepos = ftell(self->fd);
-    }
-    free(line);
+	// The caller may provide the array to be filled
+	if (py_out != NULL && py_out != Py_None) {
+		if (!PyArray_Check(py_out) || PyArray_TYPE((PyArrayObject*)py_out) != NPY_DOUBLE
+				|| !PyArray_ISCARRAY((PyArrayObject*)py_out)
+				|| PyArray_NDIM((PyArrayObject*)py_out) != 3
+				|| !PyArray_CompareLists(PyArray_DIMS((PyArrayObject*)py_out), dims, 3)) {
+			PyErr_Format(PyExc_ValueError, "out must be a writeable, C-contiguous float64 "
+				"array of shape (%ld, %ld, 3)", (long)dims[0], (long)dims[1]);
+			free(runs);
+			return NULL; }
+		out = (PyArrayObject*) py_out;
+		Py_INCREF(out);
+	} else if ((out = (PyArrayObject*) PyArray_SimpleNew(3, dims, NPY_DOUBLE)) == NULL) {
+		free(runs);
+		return NULL; }
 
-    rewind(self->fd);
+	switch(self->units) {
+		case NM: factor = 10.0; break;
+		case BOHR: factor = BOHRTOANGS; break;
+		default: factor = 1.0; break;
+	}
+	if (el->factor > 0.0) factor = el->factor;
+
+	status = 0;
+	if (dims[0] > 0 && dims[1] > 0) {
+		Py_BEGIN_ALLOW_THREADS
+		status = h5mdRead(self->h5md, el, start, dims[0], runs, runs != NULL ? nRuns : 0,
+						factor, (ARRAY_REAL*) PyArray_DATA(out));
+		Py_END_ALLOW_THREADS
+	}
+	free(runs);
+	if (status) {
+		PyErr_SetString(PyExc_IOError, self->h5md->error);
+		Py_DECREF(out);
+		return NULL; }
 
-    return nsec;
+	return (PyObject*) out;
+#else
+	PyErr_SetString(PyExc_ValueError, "readFrames() needs a single H5MD file in 'r' mode");
+	return NULL;
+#endif
 }
 
 
-static int get_section_idx(Trajectory *self, const char name[]) {
-	int idx;
+/* len(traj) - number of frames; in 'r' mode the file is scanned first */
+static Py_ssize_t Trajectory_length(Trajectory *self) {
+	PyObject *result;
 
-	for (idx = 0; idx < MAX_MOLDEN_SECTIONS; idx++)
-		if (!strcmp(self->moldenSect[idx].name, name)) return idx;
-	return -1;
+	if (self->mode != 'r') return self->lastFrame + 1;
+	if (self->totalFrames < 0) {
+		if ((result = Trajectory_scan(self)) == NULL) return -1;
+		Py_DECREF(result);
+	}
+	return self->totalFrames;
 }
 
 
-static int read_topo_from_molden(Trajectory *self) {
+static PyMappingMethods Trajectory_as_mapping = {
+	(lenfunc)Trajectory_length,        /* mp_length */
+	(binaryfunc)Trajectory_getItem,    /* mp_subscript */
+	0,                                 /* mp_ass_subscript */
+};
 
-	char *line = NULL;
-	size_t llen;
-	char buffer[1000];
-	char *token;
-	int i, nat, idx;
-	int *anum;
-	long offset;
-    extern Element element_table[];
 
-	npy_intp dims[2];
-	PyObject *val;
 
-	// Make sure that the sections are done 
-	if (self->moldenStyle == MLUNK) {
-		PyErr_SetString(PyExc_RuntimeError, "Unidentified Molden style");
-		return -1;
-	}
+static PyObject *Trajectory_flush(Trajectory *self) {
 
-	// Find the right section with coordinates
-	switch(self->moldenStyle) {
-	 	case MLGEOM:
-			idx = get_section_idx(self, "geometries");
-			break;
-		case MLATOMS:
-			idx = get_section_idx(self, "atoms");
-			break;
-		case MLFREQ:
-			idx = get_section_idx(self, "fr-coord");
-			break;
+	if (self->closed) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL; }
+	if (self->async && wait_writer(self)) return NULL;
+	if (self->mode != 'r' && self->fd != NULL && fflush(self->fd)) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return NULL; }
+#ifdef HAVE_HDF5
+	if (self->mode != 'r' && self->type == H5MD && h5mdFlush(self->h5md)) {
+		PyErr_SetString(PyExc_IOError, "Could not flush the H5MD file");
+		return NULL; }
+#endif
+
+	Py_RETURN_NONE;
+}
+
+
+
+static PyObject *Trajectory_close(Trajectory *self) {
+	int err = 0;
+
+	if (self->closed) Py_RETURN_NONE;
+	if (self->async) {
+		err = wait_writer(self);
+		stop_writer(self);
 	}
-	if (idx == -1) {
-		PyErr_SetString(PyExc_RuntimeError, "Could not find section");
-		return -1; }
-	offset = self->moldenSect[idx].offset;
+	if (close_file(self) && !err) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		err = -1; }
+	self->closed = 1;
 
-    // In these styles we don't know how many atoms are there,
-    // so we have to count atoms first.
-	if (self->moldenStyle == MLATOMS || self->moldenStyle == MLFREQ) {
+	if (err) return NULL;
+	Py_RETURN_NONE;
+}
 
-        fseek(self->fd, offset, SEEK_SET);
 
-        //self->filePosition1 = ftell(self->fd);
-        // Read [section] to reach atoms
-	    if (_getline(&line, &llen, self->fd) == -1) return -1;
 
-        nat = 0;
-		while (getline(&line, &llen, self->fd) != -1) {
-	   	   	stripline(line);
-			if (line[0] == '[') break;
-			nat += 1;
+/* Background writer thread; formats and writes staged frames in the *
+ * order they were staged. Only C data is used, so no GIL is needed.  */
+static void *writer_thread(void *arg) {
+	Trajectory *self = (Trajectory*) arg;
+	StagedFrame *slot;
+	long used;
+	int err;
+
+	pthread_mutex_lock(&self->lock);
+	while (1) {
+		while (self->pending == 0 && !self->stopWriter)
+			pthread_cond_wait(&self->cond, &self->lock);
+		if (self->pending == 0) break;
+		slot = self->staged + self->stageTail;
+		err = self->writerError;
+		pthread_mutex_unlock(&self->lock);
+
+		// After the first error remaining frames are dropped
+		if (!err) {
+			used = 0;
+			err = format_frame(self, &used, slot->xyz, slot->vel,
+						slot->box, slot->comment, slot->commentLen);
+			if (err)
+				err = ENOMEM;
+			else if (fwrite(self->outBuf, 1, used, self->fd) != (size_t)used)
+				err = errno ? errno : EIO;
 		}
-   		//fseek(self->fd, self->filePosition1, SEEK_SET);
-        self->nAtoms = nat;
+
+		pthread_mutex_lock(&self->lock);
+		if (err && !self->writerError) self->writerError = err;
+		self->stageTail = (self->stageTail + 1) % ASYNC_SLOTS;
+		self->pending -= 1;
+		pthread_cond_broadcast(&self->cond);
 	}
+	pthread_mutex_unlock(&self->lock);
 
-	// Seek to section and read the atoms
-    fseek(self->fd, offset, SEEK_SET);
-    if (_getline(&line, &llen, self->fd) == -1) return -1;
-    stripline(line);
-    make_lowercase(line);
+	return NULL;
+}
 
-	// Store the position where coordinates begin
-    self->filePosition1 = ftell(self->fd);
 
-	switch(self->moldenStyle) {
+static int start_writer(Trajectory *self) {
+	int status;
 
-	 	case MLGEOM:
+	memset(self->staged, 0, sizeof(self->staged));
+	self->stageHead = 0;
+	self->stageTail = 0;
+	self->pending = 0;
+	self->stopWriter = 0;
+	self->writerError = 0;
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->cond, NULL);
+
+	if ((status = pthread_create(&self->writer, NULL, writer_thread, self)) != 0) {
+		pthread_cond_destroy(&self->cond);
+		pthread_mutex_destroy(&self->lock);
+		errno = status;
+		PyErr_SetFromErrno(PyExc_OSError);
+		return -1; }
+	self->async = 1;
 
-			token = strstr(line, "zmat");
-			if (token != NULL ) {
-				PyErr_SetString(PyExc_RuntimeError, "Z-mat not supported");
-				return -1;
-			}
-	        //self->filePosition1 = ftell(self->fd);
-    	    read_topo_from_xyz(self);
-			break;
+	return 0;
+}
 
-	 	case MLATOMS:
 
-	        if ( !strcmp(line, "[atoms] angs") )
-    	        self->units = ANGS;
-	        else if ( !strcmp(line, "[atoms] au") )
-    	        self->units = BOHR;
-	        else {
-    	        PyErr_SetString(PyExc_RuntimeError, "Unrecognized units");
-        	    return -1; }
+/* Let the thread write out the remaining frames and finish; the GIL *
+ * is held meanwhile. Returns errno of the first failed write or 0.  */
+static int stop_writer(Trajectory *self) {
+	StagedFrame *slot;
+	int i, j;
 
-			// No 'break' here! The next part is common for MLATOMS and MLFREQ
+	pthread_mutex_lock(&self->lock);
+	self->stopWriter = 1;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->lock);
+	pthread_join(self->writer, NULL);
 
-	 	case MLFREQ:
+	for (i = 0; i < ASYNC_SLOTS; i++) {
+		slot = self->staged + i;
+		for (j = 0; j < 3; j++) Py_CLEAR(slot->arrays[j]);
+		free(slot->copy);
+		free(slot->comment);
+	}
+	pthread_cond_destroy(&self->cond);
+	pthread_mutex_destroy(&self->lock);
+	self->async = 0;
 
-	        // Get rid of Py_None in self->symbols 
-    	    Py_DECREF(self->symbols);
-        	self->symbols = PyList_New(nat);
+	return self->writerError;
+}
 
-	        anum = (int*) malloc(nat * sizeof(int));
-    	    if(anum == NULL) {
-        	    PyErr_SetFromErrno(PyExc_MemoryError);
-	            return -1; }
 
-	        // Loop over atoms 
-    	    for ( i = 0; i < nat; i++ ) {
-				if (_getline(&line, &llen, self->fd) == -1) return -1;
+/* Wait until all staged frames are written and release the arrays *
+ * borrowed from the caller. Sets an exception if a write failed.  */
+static int wait_writer(Trajectory *self) {
+	int i, j, err;
 
-	            strcpy(buffer, line);
-    	        token = strtok(buffer, " \t");
-        	    val = Py_BuildValue("s", token);
-            	PyList_SetItem(self->symbols, i, val);
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->lock);
+	while (self->pending > 0)
+		pthread_cond_wait(&self->cond, &self->lock);
+	err = self->writerError;
+	pthread_mutex_unlock(&self->lock);
+	Py_END_ALLOW_THREADS
 
-   		        // not used 
-				if (self->moldenStyle == MLATOMS)
-		            token = strtok(NULL, " \t");
+	for (i = 0; i < ASYNC_SLOTS; i++)
+		for (j = 0; j < 3; j++) Py_CLEAR(self->staged[i].arrays[j]);
 
-				if (self->moldenStyle == MLATOMS) {
-		            token = strtok(NULL, " \t");
-	    	        anum[i] = atoi(token);
-				} else {
-			        idx = getElementIndexBySymbol(token);
-					if (idx == -1) anum[i] = -1;
-					else
-				        anum[i] = element_table[idx].number;
-				}
+	if (err) {
+		errno = err;
+		PyErr_SetFromErrno(err == ENOMEM ? PyExc_MemoryError : PyExc_IOError);
+		return -1; }
+
+	return 0;
+}
+
+
+/* Put a frame into the next free slot for the writer thread. Data is *
+ * copied, unless copy is 0 - then the arrays are only referenced and *
+ * must not be modified until the frame is written (see flush).       */
+static int stage_frame(Trajectory *self, PyObject *py_coords, PyObject *py_vel,
+				PyObject *py_box, const char *comment, int copy) {
+	PyObject *inputs[3] = { py_coords, py_vel, py_box };
+	PyArrayObject *arrays[3] = { NULL, NULL, NULL };
+	const double *data[3] = { NULL, NULL, NULL };
+	StagedFrame *slot;
+	double *tmp;
+	long size, pos, len;
+	int i, err;
+
+	// Conversion is done before waiting, while the writer is busy
+	for (i = 0; i < 3; i++)
+		if (inputs[i] != NULL && (arrays[i] = as_double_array(inputs[i], 2)) == NULL)
+			goto fail;
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->lock);
+	while (self->pending == ASYNC_SLOTS)
+		pthread_cond_wait(&self->cond, &self->lock);
+	err = self->writerError;
+	pthread_mutex_unlock(&self->lock);
+	Py_END_ALLOW_THREADS
+
+	if (err) {
+		errno = err;
+		PyErr_SetFromErrno(err == ENOMEM ? PyExc_MemoryError : PyExc_IOError);
+		goto fail; }
+
+	slot = self->staged + self->stageHead;
+	for (i = 0; i < 3; i++) Py_CLEAR(slot->arrays[i]);
+
+	/* Arrays that had to be converted are private copies already; *
+	 * only the ones owned by the caller need copying.             */
+	size = 0;
+	for (i = 0; i < 3; i++)
+		if (arrays[i] != NULL && copy && (PyObject*)arrays[i] == inputs[i])
+			size += PyArray_SIZE(arrays[i]);
+	if (size > slot->copySize) {
+		tmp = (double*) realloc(slot->copy, size * sizeof(double));
+		if (tmp == NULL) {
+			PyErr_SetFromErrno(PyExc_MemoryError);
+			goto fail; }
+		slot->copy = tmp;
+		slot->copySize = size;
+	}
+	len = comment != NULL ? strlen(comment) : 0;
+	if (len + 1 > slot->commentSize) {
+		free(slot->comment);
+		if ((slot->comment = (char*) malloc(len + 1)) == NULL) {
+			slot->commentSize = 0;
+			PyErr_SetFromErrno(PyExc_MemoryError);
+			goto fail; }
+		slot->commentSize = len + 1;
+	}
+
+	pos = 0;
+	for (i = 0; i < 3; i++) {
+		if (arrays[i] == NULL) continue;
+		if (copy && (PyObject*)arrays[i] == inputs[i]) {
+			memcpy(slot->copy + pos, PyArray_DATA(arrays[i]), PyArray_NBYTES(arrays[i]));
+			data[i] = slot->copy + pos;
+			pos += PyArray_SIZE(arrays[i]);
+			Py_DECREF(arrays[i]);
+		} else {
+			data[i] = (const double*) PyArray_DATA(arrays[i]);
+			slot->arrays[i] = (PyObject*) arrays[i];
+		}
+		arrays[i] = NULL;
+	}
+	slot->xyz = data[0];
+	slot->vel = data[1];
+	slot->box = data[2];
+	memcpy(slot->comment, comment != NULL ? comment : "", len + 1);
+	slot->commentLen = len;
+
+	self->stageHead = (self->stageHead + 1) % ASYNC_SLOTS;
+	pthread_mutex_lock(&self->lock);
+	self->pending += 1;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->lock);
+
+	return 0;
+
+	fail:
+	for (i = 0; i < 3; i++) Py_XDECREF(arrays[i]);
+	return -1;
+}
+
+
+
+static PyMethodDef Trajectory_methods[] = {
+
+    {"read", (PyCFunction)Trajectory_read, METH_VARARGS | METH_KEYWORDS,
+        "\n"
+        "Trajectory.read(wrap=False, box=None, whole=None, unwrap=None)\n"
+        "\n"
+        "Read next frame from trajectory. With 'wrap', atoms are wrapped\n"
+        "into the box of the frame, or 'box' (three lengths or a 3x3 matrix,\n"
+        "triclinic boxes included). With 'whole', bonds or molecules as for\n"
+        "mdarray.makeWhole, molecules are then made whole; the bond graph\n"
+        "is kept while the bonds do not change. With 'unwrap', an Unwrapper,\n"
+        "atoms are made continuous with the frames it has seen before.\n"
+        "Returns an mdarray.Frame, used like a dictionary, or None at the\n"
+        "end of the trajectory. Depending on the format, it has:\n"
+        "\n"
+        "comment (str)\n"
+        "step (int)\n"
+        "time (float)\n"
+        "coordinates (ndarray) shape=nAtoms,3\n"
+        "velocities (ndarray) shape=nAtoms,3\n"
+        "extra (ndarray) like charges, one value per atom\n"
+        "box (ndarray) shape=3,3, rows are the cell vectors\n"
+        "\n"
+        "followed by the keys of Frame.info (dict), the other data of the\n"
+        "frame, like extended XYZ columns or the origin of LAMMPS boxes.\n"
+        "\n" },
+
+	{"write", (PyCFunction)Trajectory_write, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"Trajectory.write(coordinates, [ comment ])\n"
+		"\n"
+		"coordinates (ndarray)\n"
+		"velocities (ndarray)\n"
+		"box (ndarray)\n"
+		"comment (string)\n"
+		"copy (bool) if False and asyncWrite is on, the arrays are not\n"
+		"            copied and must not be modified until flush()\n"
+		"\n" },
+
+	{"writeFrames", (PyCFunction)Trajectory_writeFrames, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"Trajectory.writeFrames(coordinates, [ boxes, velocities, comments ])\n"
+		"\n"
+		"Write many frames at once; arrays are checked only once and the\n"
+		"frames are formatted without holding the GIL.\n"
+		"\n"
+		"coordinates (ndarray) shape=nFrames,nAtoms,3\n"
+		"boxes (ndarray) shape=3,3 or nFrames,3,3\n"
+		"velocities (ndarray) shape=nFrames,nAtoms,3\n"
+		"comments (string or sequence of strings)\n"
+		"\n" },
+
+	{"setCache", (PyCFunction)Trajectory_setCache, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"Trajectory.setCache([ maxFrames, maxBytes ])\n"
+		"\n"
+		"Keep frames accessed by index (traj[i]) in memory; the least\n"
+		"recently used ones are dropped when either limit is exceeded.\n"
+		"Zero means no limit; without limits the cache is switched off.\n"
+		"Arrays of cached frames are read-only and shared between calls.\n"
+		"\n" },
+
+	{"cacheInfo", (PyCFunction)Trajectory_cacheInfo, METH_NOARGS,
+		"\n"
+		"Trajectory.cacheInfo()\n"
+		"\n"
+		"Return a dictionary with cache statistics (hits, misses, frames,\n"
+		"bytes, maxFrames, maxBytes) or None if the cache is off.\n"
+		"\n" },
+
+	{"scan", (PyCFunction)Trajectory_scan, METH_NOARGS,
+		"\n"
+		"Trajectory.scan()\n"
+		"\n"
+		"Go through the whole trajectory quickly, without reading the\n"
+		"coordinates, and return a dictionary with the number of frames\n"
+		"('frames') and arrays of 'step', 'time' and 'box', as well as a\n"
+		"tuple of comments ('comment'); items missing in the file are None.\n"
+		"The result is kept and the positions of the frames are used for\n"
+		"random access. Sequential reading is not affected.\n"
+		"\n" },
+
+	{"view", (PyCFunction)Trajectory_view, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"Trajectory.view([ name ])\n"
+		"\n"
+		"NetCDF files only: return a read-only array over the variable\n"
+		"(default 'coordinates') of the memory-mapped file, without\n"
+		"copying or converting it. Values are in the units and the\n"
+		"big-endian type of the file, scale_factor is not applied.\n"
+		"Record variables get the number of records as the first\n"
+		"dimension.\n"
+		"\n" },
+
+	{"readFrames", (PyCFunction)Trajectory_readFrames, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"Trajectory.readFrames([ start, stop, atoms, out, name ])\n"
+		"\n"
+		"H5MD files only: read frames start to stop (like a slice) of the\n"
+		"selected atoms at once and return them as a (frames, atoms, 3)\n"
+		"array. Only the chunks needed are read, each one once.\n"
+		"\n"
+		"atoms (slice or increasing indices) all atoms by default\n"
+		"out (ndarray) C-contiguous float64 array to be filled\n"
+		"name (string) 'position' (default) or 'velocity'\n"
+		"\n" },
+
+	{"flush", (PyCFunction)Trajectory_flush, METH_NOARGS,
+		"\n"
+		"Trajectory.flush()\n"
+		"\n"
+		"Wait until all frames are written (with asyncWrite=True) and\n"
+		"flush the file buffers. Errors of the background writer are\n"
+		"reported here, or by the next write().\n"
+		"\n" },
+
+	{"close", (PyCFunction)Trajectory_close, METH_NOARGS,
+		"\n"
+		"Trajectory.close()\n"
+		"\n"
+		"Write out all pending frames and close the file.\n"
+		"\n" },
+
+    {NULL}  /* Sentinel */
+};
+
+
+
+
+PyTypeObject TrajectoryType = {
+
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "mdarray.Trajectory",          /*tp_name*/
+    sizeof(Trajectory),             /*tp_basicsize*/
+    0,                              /*tp_itemsize*/
+
+    /* Methods to implement standard operations */
+    (destructor)Trajectory_dealloc, /*tp_dealloc*/
+    0,                              /*tp_print*/
+    0,                              /*tp_getattr*/
+    0,                              /*tp_setattr*/
+	 0,                              /* tp_reserved */
+    (reprfunc)Trajectory_repr,      /*tp_repr*/
+
+    /* Method suites for standard classes */
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    &Trajectory_as_mapping,    /*tp_as_mapping*/
+
+    /* More standard operations (here for binary compatibility) */
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+
+    /* Functions to access object as input/output buffer */
+    0,                         /*tp_as_buffer*/
+
+    /* Flags to define presence of optional/expanded features */
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+
+    /* Documentation string */
+    "Trajectory class. Implements reading of trajectories from XYZ. Molden, "
+	 "GRO, PDB, LAMMPS dump, AMBER mdcrd and NetCDF, H5MD, VASP XDATCAR and XTC. Writing is implemented for "
+	 "XYZ, GRO, PDB and H5MD (if built with HDF5). The process is "
+	 "two-step; first, the object must be created, by specifying fileName "
+	 "(for reading) or topology information (for writing). Second, frames "
+	 "can be read/saved repeteadly. Reading examples:\n"
+    "  traj = Trajectory('my.xyz')\n"
+    "  frame1 = traj.read()\n"
+    "  frame2 = traj.read()\n"
+    "Object of the class Trajectory contains such fields as: symbols, "
+	 "aNumbers, masses, resIDs, resNames, nAtoms, nOfFrames, "
+	 "lastFrame, moldenSections, fileName. Method read() returns a Frame, which "
+	 "works like a dictionary with items depending on the file format, but at least 'coordinates' "
+	 "are present. Writing example:\n"
+    "  traj = Trajectory('my.xyz', symbols_list)\n"
+    "  traj.write(coordinates1)\n"
+    "  traj.write(coordinates2)\n"
+    "When writing a trajectory, at least the file name and the list of "
+	 "symbols must be specified. Creating an instance for reading:\n"
+    "  traj = Trajectory(fileName, format='GUESS', mode='r', units='angs')\n"
+    "Available formats include: XYZ, GRO, PDB, LAMMPS, MDCRD, NETCDF, H5MD, XDATCAR, MOLDEN, XTC - guessed if not "
+	 "specified.\n"
+    "Mode: 'r' (default), 'w', 'a'.\n"
+    "Units: 'angs' (default), 'bohr', 'nm'.\n"
+    "MDCRD files need also nAtoms, the number of atoms.\n"
+    "In 'r' mode fileName may also be a list of files or a glob pattern; the "
+	 "files are read one after another as a single trajectory. With "
+	 "skipDuplicates=True, frames at the start of a file that repeat the "
+	 "time of the last frame are skipped.\n"
+    "Creating an instance for writing:\n"
+    "  traj = Trajectory(filename, format='GUESS', mode='w', symbols=, "
+	 "resids=, resnames=, chains=)\n"
+    "symbols, resnames and chains are lists, while resids, coodinates and velocities "
+	 "are ndarrays.\n",           /* tp_doc */
+
+    0,                       /* tp_traverse */
+    0,                       /* tp_clear */
+    0,                       /* tp_richcompare */
+    0,                       /* tp_weaklistoffset */
+    0,                       /* tp_iter */
+    0,                       /* tp_iternext */
+    Trajectory_methods,        /* tp_methods */
+    Trajectory_members,        /* tp_members */
+    Trajectory_getset,         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)Trajectory_init, /* tp_init */
+    0,                         /* tp_alloc */
+    Trajectory_new,            /* tp_new */
+	 0,                         /* tp_free */
+	 0,                         /* tp_is_gc */
+	 0,                         /* tp_bases */
+	 0,                         /* tp_mro */
+	 0,                         /* tp_cache */
+	 0,                         /* tp_subclasses */
+	 0,                         /* tp_weaklist */
+	 0,                         /* tp_del */
+	 0,                         /* tp_version_tag */
+	 0                          /* tp_finalize */
+};
+
+/* End of class definition */
+
+
+
+
+
+
+
+/* Local helper functions */
+
+/* Read a block of nLines lines starting at the current position of *
+ * the input and split it into fields (stored in self->tokens). The *
+ * block stays in the input buffer, valid until the next read, and   *
+ * is consumed. Returns number of bytes in the block or -1 on error. */
+
+static long read_line_block(Trajectory *self, int nLines) {
+    InputBuffer *in = &(self->input);
+    long len, used;
+
+    // Initial guess of the size; more is read if needed
+    len = inputFill(in, 64L * nLines + 64);
+
+    while (1) {
+        if (len == -1) {
+            set_error(self, PyExc_IOError, NULL);
+            return -1; }
+        used = tokenizeBlock(inputData(in), len, nLines, in->eof, &(self->tokens));
+        if (used == -1) {
+            set_error(self, PyExc_MemoryError, NULL);
+            return -1; }
+        if (self->tokens.nLines == nLines) break;
+        if (in->eof) {
+            set_error(self, PyExc_IOError, "Unexpected end of file");
+            return -1; }
+        len = inputFill(in, 2 * len);
+    }
+
+    self->block = inputData(in);
+    inputConsume(in, used);
+    return used;
+}
+
+
+static int read_topo_from_xyz(Trajectory *self) {
+
+    int nofatoms, pos, idx, code, field, species = 0;
+	Tokens *tok;
+    int *anum, *elements;
+	ARRAY_REAL *masses;
+    extern Element element_table[];
+
+    npy_intp dims[2];
+
+    /* Read number of atoms */
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+        PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    if (sscanf(self->line, "%d", &nofatoms) != 1 ) {
+        PyErr_SetString(PyExc_IOError, "Incorrect atom number");
+        return -1; }
+
+    /* Read the comment line; in extended XYZ it tells where symbols are */
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+        PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    if (self->type == XYZ) {
+        if (read_ext_header(self, &(self->frame), self->line) == -1) {
+            raise_error(self);
+            return -1; }
+        if (self->frame.hasExt) {
+            if (self->extPlan.species < 0) {
+                PyErr_SetString(PyExc_IOError, "Missing species in extended XYZ");
+                return -1; }
+            species = self->extPlan.columns[self->extPlan.species].first;
+        }
+    }
+
+    if ((self->symbolTable = nameTableNew()) == NULL) return -1;
+    self->symbolCodes = (int*) malloc(nofatoms * sizeof(int));
+    if(self->symbolCodes == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        return -1; }
+
+    anum = (int*) poolAlloc(nofatoms * sizeof(int));
+    if(anum == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        return -1; }
+
+    masses = (ARRAY_REAL*) poolAlloc(nofatoms * sizeof(ARRAY_REAL));
+    if(masses == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        return -1; }
+
+    /* Read all atom lines at once */
+    if (read_line_block(self, nofatoms) == -1) {
+        raise_error(self);
+        return -1; }
+    tok = &(self->tokens);
+
+    /* Atom loop */
+    for(pos = 0; pos < nofatoms; pos++) {
+
+        /* Read symbol */
+        if (tok->lineFields[pos] <= species) {
+            PyErr_SetString(PyExc_IOError, "Missing atomic symbol");
+            return -1; }
+        field = tok->lineFirst[pos] + species;
+        code = nameTableIntern(self->symbolTable, self->block + tok->fieldBegin[field],
+                               tok->fieldEnd[field] - tok->fieldBegin[field]);
+        if (code == -1) return -1;
+        self->symbolCodes[pos] = code;
+    }
+
+    /* Look up each unique symbol only once */
+    elements = (int*) malloc((self->symbolTable->size + 1) * sizeof(int));
+    if(elements == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        return -1; }
+    for(code = 0; code < self->symbolTable->size; code++)
+        elements[code] = getElementIndexBySymbol(
+                                nameTableGet(self->symbolTable, code));
+
+    for(pos = 0; pos < nofatoms; pos++) {
+        idx = elements[self->symbolCodes[pos]];
+        if (idx == -1) {
+            anum[pos] = -1;
+				masses[pos] = 0.0;
+        } else {
+            anum[pos] = element_table[idx].number;
+				masses[pos] = element_table[idx].mass;
+		}
+    }
+    free(elements);
+
+    /* Add atomic numbers to the dictionary */
+    dims[0] = nofatoms;
+    dims[1] = 1;
+    if (set_owned_array(&(self->aNumbers), dims, NPY_INT, anum) == -1) {
+        poolFree(masses);
+        return -1; }
+    if (set_owned_array(&(self->masses), dims, NPY_ARRAY_REAL, masses) == -1)
+        return -1;
+
+    self->nAtoms = nofatoms;
+
+    return 0;
+}
+
+
+
+
+/* Read MOLDEN file and get the sections present. Store offset to the *
+ * particular section too. Returns number of sections parsed or -1 on *
+ * error. */
+
+static int read_molden_sections(Trajectory *self) {
+
+    long filepos;
+    char *strptr;
+	char *line = NULL;
+	size_t llen;
+    char buffer[256];
+    int i, len, nsec = 0;
+
+	for (i = 0; i < MAX_MOLDEN_SECTIONS; i++) {
+		self->moldenSect[i].offset = -1;
+		strcpy(self->moldenSect[i].name, "");
+	}
+
+    rewind(self->fd);
+
+    filepos = ftell(self->fd);
+    while (getline(&line, &llen, self->fd) != -1) {
+
+	    stripline(line);
+    	make_lowercase(line);
+
+        // Start of a section 
+        if(line[0] == '[') {
+
+            // Get the name 
+            strptr = strchr(line, ']');
+            len = (int)(strptr - line) - 1;
+            strncpy(buffer, line+1, len);
+            buffer[len] = '\0';
+
+			self->moldenSect[nsec].offset = filepos;
+			strcpy(self->moldenSect[nsec].name, buffer);
+
+			// Out of three sections that provide coordinates,
+			// if more than one is present, the order of preference
+			// should be:
+			// GEOMETRIES, ATOMS, FR-COORD
+			if (!strcmp(buffer, "geometries")) {
+				self->moldenStyle = MLGEOM;
+			} else if (self->moldenStyle != MLGEOM && !strcmp(buffer, "atoms")) {
+				self->moldenStyle = MLATOMS;
+			} else if (self->moldenStyle != MLGEOM &&
+			           self->moldenStyle != MLATOMS && !strcmp(buffer, "fr-coord")) {
+					self->moldenStyle = MLFREQ;
+					// Set default units for this style - maybe not perfect
+					// place to do it...
+    	        	self->units = BOHR;
+			}
+			if (++nsec > MAX_MOLDEN_SECTIONS) return -1;
+
+        }
+        
+        filepos = ftell(self->fd);
+    }
+    free(line);
+
+    rewind(self->fd);
+
+    return nsec;
+}
+
+
+static int get_section_idx(Trajectory *self, const char name[]) {
+	int idx;
+
+	for (idx = 0; idx < MAX_MOLDEN_SECTIONS; idx++)
+		if (!strcmp(self->moldenSect[idx].name, name)) return idx;
+	return -1;
+}
+
+
+static int read_topo_from_molden(Trajectory *self) {
+
+	char *line = NULL;
+	size_t llen;
+	char buffer[1000];
+	char *token;
+	int i, nat, idx;
+	int *anum;
+	long offset;
+    extern Element element_table[];
+
+	npy_intp dims[2];
+
+	// Make sure that the sections are done 
+	if (self->moldenStyle == MLUNK) {
+		PyErr_SetString(PyExc_RuntimeError, "Unidentified Molden style");
+		return -1;
+	}
+
+	// Find the right section with coordinates
+	switch(self->moldenStyle) {
+	 	case MLGEOM:
+			idx = get_section_idx(self, "geometries");
+			break;
+		case MLATOMS:
+			idx = get_section_idx(self, "atoms");
+			break;
+		case MLFREQ:
+			idx = get_section_idx(self, "fr-coord");
+			break;
+	}
+	if (idx == -1) {
+		PyErr_SetString(PyExc_RuntimeError, "Could not find section");
+		return -1; }
+	offset = self->moldenSect[idx].offset;
+
+    // In these styles we don't know how many atoms are there,
+    // so we have to count atoms first.
+	if (self->moldenStyle == MLATOMS || self->moldenStyle == MLFREQ) {
+
+        fseek(self->fd, offset, SEEK_SET);
+
+        //self->filePosition1 = ftell(self->fd);
+        // Read [section] to reach atoms
+	    if (_getline(&line, &llen, self->fd) == -1) return -1;
+
+        nat = 0;
+		while (getline(&line, &llen, self->fd) != -1) {
+	   	   	stripline(line);
+			if (line[0] == '[') break;
+			nat += 1;
+		}
+   		//fseek(self->fd, self->filePosition1, SEEK_SET);
+        self->nAtoms = nat;
+	}
+
+	// Seek to section and read the atoms
+    fseek(self->fd, offset, SEEK_SET);
+    if (_getline(&line, &llen, self->fd) == -1) return -1;
+    stripline(line);
+    make_lowercase(line);
+
+	// Store the position where coordinates begin
+    self->filePosition1 = ftell(self->fd);
+
+	switch(self->moldenStyle) {
+
+	 	case MLGEOM:
+
+			token = strstr(line, "zmat");
+			if (token != NULL ) {
+				PyErr_SetString(PyExc_RuntimeError, "Z-mat not supported");
+				return -1;
+			}
+	        //self->filePosition1 = ftell(self->fd);
+			// The XYZ reader takes the data from the input buffer
+			inputAttach(&(self->input), self->fd);
+			if (inputSeek(&(self->input), self->filePosition1) == -1) {
+				PyErr_SetFromErrno(PyExc_IOError);
+				return -1;
+			}
+    	    read_topo_from_xyz(self);
+			break;
+
+	 	case MLATOMS:
+
+	        if ( !strcmp(line, "[atoms] angs") )
+    	        self->units = ANGS;
+	        else if ( !strcmp(line, "[atoms] au") )
+    	        self->units = BOHR;
+	        else {
+    	        PyErr_SetString(PyExc_RuntimeError, "Unrecognized units");
+        	    return -1; }
+
+			// No 'break' here! The next part is common for MLATOMS and MLFREQ
+
+	 	case MLFREQ:
+
+	        if ((self->symbolTable = nameTableNew()) == NULL) return -1;
+	        self->symbolCodes = (int*) malloc(nat * sizeof(int));
+    	    if(self->symbolCodes == NULL) {
+        	    PyErr_SetFromErrno(PyExc_MemoryError);
+	            return -1; }
+
+	        anum = (int*) poolAlloc(nat * sizeof(int));
+    	    if(anum == NULL) {
+        	    PyErr_SetFromErrno(PyExc_MemoryError);
+	            return -1; }
+
+	        // Loop over atoms 
+    	    for ( i = 0; i < nat; i++ ) {
+				if (_getline(&line, &llen, self->fd) == -1) return -1;
+
+	            strcpy(buffer, line);
+    	        token = strtok(buffer, " \t");
+        	    if ((self->symbolCodes[i] = nameTableIntern(
+            	            self->symbolTable, token, -1)) == -1) return -1;
+
+   		        // not used 
+				if (self->moldenStyle == MLATOMS)
+		            token = strtok(NULL, " \t");
+
+				if (self->moldenStyle == MLATOMS) {
+		            token = strtok(NULL, " \t");
+	    	        anum[i] = atoi(token);
+				} else {
+			        idx = getElementIndexBySymbol(token);
+					if (idx == -1) anum[i] = -1;
+					else
+				        anum[i] = element_table[idx].number;
+				}
+
+        	}
+
+	        // Add atomic numbers to the dictionary 
+    	    dims[0] = nat;
+        	dims[1] = 1;
+	        if (set_owned_array(&(self->aNumbers), dims, NPY_INT, anum) == -1)
+	            return -1;
+			break;
+
+	    default:
+
+	        PyErr_SetString(PyExc_RuntimeError, "geometry/atom section missing");
+    	    return -1;
+	}
+    
+    free(line);
+
+    return 0;
+}
+
+
+
+
+static int read_topo_from_gro(Trajectory *self) {
+
+    Py_ssize_t pos;
+    int nofatoms;
+    char *buffer;
+    char symbuf[100];
+    int *resid;
+    npy_intp dims[2];
+
+    // Read the comment line 
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+        PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+        return -1; }
+
+    // Read number of atoms 
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+        PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    if( sscanf(self->line, "%d", &nofatoms) != 1 ) {
+        PyErr_SetString(PyExc_IOError, "Incorrect atom number");
+        return -1; }
+
+    self->nAtoms = nofatoms;
+
+    if ((self->symbolTable = nameTableNew()) == NULL) return -1;
+    if ((self->resNameTable = nameTableNew()) == NULL) return -1;
+    self->symbolCodes = (int*) malloc(nofatoms * sizeof(int));
+    self->resNameCodes = (int*) malloc(nofatoms * sizeof(int));
+    if(self->symbolCodes == NULL || self->resNameCodes == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        return -1; }
+
+    resid = (int*) poolAlloc(nofatoms * sizeof(int));
+    if(resid == NULL) {
+        PyErr_SetFromErrno(PyExc_MemoryError);
+        return -1; }
+
+    // Atom loop 
+    for(pos = 0; pos < nofatoms; pos++) {
+
+        // Get the whole line 
+        if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+            PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+            return -1; }
+        buffer = self->line;
+
+        // Read residue id 
+        strncpy(symbuf, buffer, 5);
+        symbuf[5] = '\0';
+        stripline(symbuf);
+        resid[pos] = atoi(symbuf);
+
+        // Read residue name 
+        if ((self->resNameCodes[pos] = nameTableInternStripped(
+                    self->resNameTable, buffer+5, 5)) == -1) return -1;
+
+        // Read atom name 
+        if ((self->symbolCodes[pos] = nameTableInternStripped(
+                    self->symbolTable, buffer+10, 5)) == -1) return -1;
+    }
+
+    // Add residue IDs to the dictionary 
+    dims[0] = nofatoms;
+    dims[1] = 1;
+    if (set_owned_array(&(self->resids), dims, NPY_INT, resid) == -1)
+        return -1;
+
+    return 0;
+}
+
+
+
+
+/* Replace *attr with a 1D array over data from the buffer pool, which *
+ * is freed with the array (or at once, on failure).                   */
+static int set_owned_array(PyObject **attr, npy_intp *dims, int type, void *data) {
+    PyObject *py_arr;
+
+    if ((py_arr = poolArray(1, dims, type, data)) == NULL) {
+        poolFree(data);
+        return -1; }
+    Py_XSETREF(*attr, py_arr);
+    return 0;
+}
+
+
+/* Make sure that the coordinate array of the frame is allocated */
+static int alloc_frame_array(Trajectory *self, ARRAY_REAL **array, int width) {
+
+    if (*array != NULL) return 0;
+    *array = (ARRAY_REAL*) poolAlloc(width * self->nAtoms * sizeof(ARRAY_REAL));
+    if (*array == NULL) {
+        set_error(self, PyExc_MemoryError, NULL);
+        return -1; }
+    return 0;
+}
+
+
+/* 
+ * WARNING: This function is used by other format than XYZ,
+ * like Molden for instance, so be careful with implementation.
+ */
+
+static int read_frame_from_xyz(Trajectory *self, FrameData *frame) {
+
+	Tokens *tok;
+    const char *line;
+    size_t avail;
+    ssize_t len;
+    int pos, nat, k, first, field, nfields;
+    float factor;
+
+    switch(self->units) {
+        case ANGS: factor = 1.0; break;
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+    }
+
+    frame->hasComment = 0;
+    frame->hasExtra = 0;
+
+	// Sections of Molden files end where the next one begins;
+	// look at the next line and go back.
+	if (self->type == MOLDEN) {
+	    if ((line = inputPeekLine(&(self->input), &avail)) == NULL) return 1;
+		while (avail > 0 && isspace((unsigned char)*line)) { line++; avail--; }
+		if (avail > 0 && *line == '[') return 1;
+	}
+
+	// Number of atoms and comment are present only in these
+	// types & flavours
+	if (self->type == XYZ ||
+		(self->type == MOLDEN && self->moldenStyle == MLGEOM)) {
+
+	    /* Read number of atoms */
+	    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) return 1;
+
+	    if (sscanf(self->line, "%d", &nat) != 1) {
+	        set_error(self, PyExc_IOError, "Incorrect number of atoms");
+    	    return -1;
+	    }
+
+	    if (nat != self->nAtoms) {
+    	    set_error(self, PyExc_RuntimeError,
+				"Number of atoms different than expected");
+	        return -1; }
+
+	    /* Read the comment line */
+    	if ((len = inputGetLine(&(self->input), &(frame->comment),
+	                            &(frame->commentSize))) == -1) {
+	        set_error(self, PyExc_IOError, "Unexpected end of file");
+    	    return -1; }
+	    if (len > 0 && frame->comment[len-1] == '\n') frame->comment[len-1] = '\0';
+	    frame->hasComment = 1;
+	}
+	if (self->type == XYZ && read_ext_header(self, frame, frame->comment) == -1)
+		return -1;
+
+    if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+
+    /* Read all atom lines at once and split them into fields */
+    if (read_line_block(self, self->nAtoms) == -1) return -1;
+    if (frame->hasExt) return read_ext_atoms(self, frame, factor, NULL);
+    tok = &(self->tokens);
+    line = self->block;
+
+    // MOLDEN's [Atoms] section has two additional entries before
+    // coordinates: atom number and atomic number
+    if (self->type == MOLDEN && self->moldenStyle == MLATOMS) first = 3;
+    else first = 1;
+
+    /* Atom loop */
+    for(pos = 0; pos < self->nAtoms; pos++) {
+
+        nfields = tok->lineFields[pos];
+        field = tok->lineFirst[pos] + first;
+
+        /* Read coordinates */
+        if (nfields < first + 3) {
+            set_error(self, PyExc_IOError, "Missing coordinate");
+            return -1; }
+        for (k = 0; k < 3; k++)
+            frame->xyz[3*pos + k] = parseFloat(line + tok->fieldBegin[field+k],
+                                        line + tok->fieldEnd[field+k],
+                                        NULL) * factor;
+
+        // Read charge, if present
+        if ( nfields > first + 3 ) {
+
+            // This is bad: until now, there were no extra data
+            if ( pos > 0 && !frame->hasExtra ) {
+                set_error(self, PyExc_IOError, "Unexpected extra data found");
+                return -1;
+            }
+
+            if (!frame->hasExtra && alloc_frame_array(self, &(frame->extra), 1) == -1)
+                return -1;
+            frame->hasExtra = 1;
+            frame->extra[pos] = parseFloat(line + tok->fieldBegin[field+3],
+                                    line + tok->fieldEnd[field+3], NULL);
+
+        } else {
+
+            // This is bad: we were expecting extra data here and found nothing
+            if ( pos > 0 && frame->hasExtra ) {
+                set_error(self, PyExc_IOError, "Inconsistent extra data");
+                return -1;
+            }
+        }
+
+    }
+
+    return 0;
+
+}
+
+
+
+/* Extended XYZ: split the comment into key=value pairs. The frame is  *
+ * an extended one if Lattice or Properties are given; then the plan of *
+ * columns is compiled (if Properties changed) and the box, time and    *
+ * step are taken from the comment. The GIL is not needed.              */
+static int read_ext_header(Trajectory *self, FrameData *frame, const char *comment) {
+    const char *properties, *value;
+    double numbers[9], factor;
+    int i;
+
+    frame->hasExt = 0;
+    frame->hasBox = 0;
+    frame->hasTime = 0;
+    frame->hasStep = 0;
+
+    // Plain comments are common, check them quickly
+    if (strchr(comment, '=') == NULL) return 0;
+    if (extParseComment(&(frame->ext), comment) == -1) {
+        set_error(self, PyExc_MemoryError, NULL);
+        return -1; }
+    properties = extFind(&(frame->ext), "Properties");
+    if (properties == NULL && extFind(&(frame->ext), "Lattice") == NULL) return 0;
+    frame->hasExt = 1;
+
+    if (properties == NULL) properties = "species:S:1:pos:R:3";
+    if (self->extPlan.source == NULL || strcmp(properties, self->extPlan.source)) {
+        if (extCompilePlan(&(self->extPlan), properties) == -1) {
+            if (errno == EINVAL)
+                set_error(self, PyExc_IOError, "Incorrect Properties in extended XYZ");
+            else
+                set_error(self, PyExc_MemoryError, NULL);
+            return -1; }
+    }
+
+    if ((value = extFind(&(frame->ext), "Lattice")) != NULL) {
+        if (extParseNumbers(value, numbers, 9) == -1) {
+            set_error(self, PyExc_IOError, "Incorrect Lattice in extended XYZ");
+            return -1; }
+        switch(self->units) {
+            case NM: factor = 10.0; break;
+            case BOHR: factor = BOHRTOANGS; break;
+            default: factor = 1.0; break;
+        }
+        for (i = 0; i < 9; i++) frame->box[i] = numbers[i] * factor;
+        frame->hasBox = 1;
+    }
+    if ((value = extFind(&(frame->ext), "time")) != NULL
+            && !extParseNumbers(value, numbers, 1)) {
+        frame->time = numbers[0];
+        frame->hasTime = 1;
+    }
+    if ((value = extFind(&(frame->ext), "step")) != NULL
+            && !extParseNumbers(value, numbers, 1)) {
+        frame->step = (long) numbers[0];
+        frame->hasStep = 1;
+    }
+
+    return 0;
+}
+
+
+/* Read atom lines of extended XYZ (already split into fields) *
+ * following the plan; species are only in the topology. Line  *
+ * i goes to atom order[i], unless order is NULL.              */
+static int read_ext_atoms(Trajectory *self, FrameData *frame, double factor,
+                          const int *order) {
+    ExtPlan *plan = &(self->extPlan);
+    ExtFrame *ext = &(frame->ext);
+    Tokens *tok = &(self->tokens);
+    const char *line = self->block, *begin;
+    ExtColumn *col;
+    char *cell;
+    long len;
+    int pos, atom, i, k, field, cells;
+
+    // Columns read with an older plan have different sizes
+    if (ext->version != plan->version) {
+        for (i = 0; i < EXT_MAX_COLUMNS; i++) {
+            poolFree(ext->columns[i]);
+            ext->columns[i] = NULL; }
+        ext->version = plan->version;
+    }
+
+    frame->hasVel = 0;
+    for (i = 0; i < plan->nColumns; i++) {
+        col = plan->columns + i;
+        if (col->role == EXT_VEL) {
+            if (alloc_frame_array(self, &(frame->vel), 3) == -1) return -1;
+            frame->hasVel = 1;
+        } else if (col->role == EXT_OTHER && ext->columns[i] == NULL) {
+            ext->columns[i] = poolAlloc((size_t)self->nAtoms * col->width
+                                        * extCellSize(col->type));
+            if (ext->columns[i] == NULL) {
+                set_error(self, PyExc_MemoryError, NULL);
+                return -1; }
+        }
+    }
+
+    for (pos = 0; pos < self->nAtoms; pos++) {
+        if (tok->lineFields[pos] < plan->nFields) {
+            set_error(self, PyExc_IOError, "Missing columns in atom lines");
+            return -1; }
+        atom = order != NULL ? order[pos] : pos;
+
+        for (i = 0; i < plan->nColumns; i++) {
+            col = plan->columns + i;
+            field = tok->lineFirst[pos] + col->first;
+            cells = atom * col->width;
+
+            for (k = 0; k < col->width; k++, field++) {
+                begin = line + tok->fieldBegin[field];
+                len = tok->fieldEnd[field] - tok->fieldBegin[field];
+                switch (col->role) {
+                    case EXT_POS:
+                        frame->xyz[3*atom + k] = parseFloat(begin, begin + len, NULL) * factor;
+                        continue;
+                    case EXT_VEL:
+                        frame->vel[3*atom + k] = parseFloat(begin, begin + len, NULL);
+                        continue;
+                    case EXT_SPECIES:
+                        continue;
+                }
+                switch (col->type) {
+                    case 'R':
+                        ((ARRAY_REAL*)ext->columns[i])[cells + k] =
+                                parseFloat(begin, begin + len, NULL);
+                        break;
+                    case 'I':
+                        ((long*)ext->columns[i])[cells + k] = strtol(begin, NULL, 10);
+                        break;
+                    case 'L':
+                        ((npy_bool*)ext->columns[i])[cells + k] =
+                                (*begin == 'T' || *begin == 't' || *begin == '1');
+                        break;
+                    default:
+                        cell = (char*)ext->columns[i] + (size_t)(cells + k) * EXT_STRING_SIZE;
+                        if (len >= EXT_STRING_SIZE) len = EXT_STRING_SIZE - 1;
+                        memcpy(cell, begin, len);
+                        cell[len] = '\0';
+                        break;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* Skip nLines lines of the input, only looking for the line ends; *
+ * the last line may lack the end. The GIL is not needed.          */
+static int skip_lines(Trajectory *self, long nLines) {
+    InputBuffer *in = &(self->input);
+    const char *ptr, *end;
+    long got;
+    int partial = 0;
+
+    while (nLines > 0) {
+        if ((got = inputFill(in, 1)) <= 0) {
+            if (got == 0 && nLines == 1 && partial) return 0;
+            set_error(self, PyExc_IOError, got ? NULL : "Unexpected end of file");
+            return -1; }
+        ptr = inputData(in);
+        end = ptr + got;
+        while (nLines > 0 && (ptr = memchr(ptr, '\n', end - ptr)) != NULL) {
+            ptr++;
+            nLines--;
+        }
+        if (nLines == 0) {
+            // The rest belongs to the next line
+            inputConsume(in, ptr - inputData(in));
+            return 0; }
+        partial = (end[-1] != '\n');
+        inputConsume(in, got);
+    }
+    return 0;
+}
+
+
+/* Read the number of atoms and the comment, skip coordinates */
+static int skip_frame_from_xyz(Trajectory *self, FrameData *frame) {
+    ssize_t len;
+    int nat;
+
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) return 1;
+    if (sscanf(self->line, "%d", &nat) != 1) {
+        set_error(self, PyExc_IOError, "Incorrect number of atoms");
+        return -1; }
+    if (nat != self->nAtoms) {
+        set_error(self, PyExc_RuntimeError,
+            "Number of atoms different than expected");
+        return -1; }
+
+    if ((len = inputGetLine(&(self->input), &(frame->comment),
+                            &(frame->commentSize))) == -1) {
+        set_error(self, PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    if (len > 0 && frame->comment[len-1] == '\n') frame->comment[len-1] = '\0';
+    frame->hasComment = 1;
+
+    if (read_ext_header(self, frame, frame->comment) == -1) return -1;
+
+    return skip_lines(self, self->nAtoms);
+}
+
+
+
+/* Gromacs puts time and step into the title of GRO frames, as in  *
+ * "Water t= 10.00000 step= 5000"; store them in the frame.       */
+static void parse_gro_title(FrameData *frame) {
+    const char *title = frame->comment, *ptr, *stop;
+    char *end;
+
+    for (ptr = title; (ptr = strstr(ptr, "t=")) != NULL; ptr += 2)
+        if (ptr == title || isspace((unsigned char)ptr[-1])) break;
+    if (ptr == NULL) return;
+    for (ptr += 2; isspace((unsigned char)*ptr); ptr++);
+    frame->time = parseFloat(ptr, NULL, &stop);
+    if (stop == ptr) return;
+    frame->hasTime = 1;
+
+    if ((ptr = strstr(stop, "step=")) != NULL) {
+        frame->step = strtol(ptr + 5, &end, 10);
+        if (end != ptr + 5) frame->hasStep = 1;
+    }
+}
+
+
+static int read_frame_from_gro(Trajectory *self, FrameData *frame, int metaOnly) {
+
+    int nat, pos;
+    ssize_t len;
+    char *buffer;
+    ARRAY_REAL *box = frame->box;
+
+    frame->hasComment = 0;
+    frame->hasVel = 0;
+
+    // Read the comment line 
+    if ((len = inputGetLine(&(self->input), &(frame->comment),
+                            &(frame->commentSize))) == -1)
+        return 1;
+    stripline(frame->comment);
+    frame->hasComment = 1;
+    parse_gro_title(frame);
+
+    // Read number of atoms 
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1
+            || sscanf(self->line, "%d", &nat) != 1 || nat != self->nAtoms) {
+        set_error(self, PyExc_IOError, "Incorrect atom number");
+        return -1; }
+
+    // Only the box is needed after the atoms
+    if (metaOnly && skip_lines(self, self->nAtoms) == -1) return -1;
+
+    // Set-up the raw arrays for coordinates and velocities
+    if (!metaOnly && alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+
+    // Atom loop 
+    for(pos = 0; !metaOnly && pos < self->nAtoms; pos++) {
+
+        // Get the whole line 
+        if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+            set_error(self, PyExc_IOError, "Unexpected end of file");
+            return -1; }
+        buffer = self->line;
+        if(pos == 0 && strlen(buffer) > 50) {
+            if (alloc_frame_array(self, &(frame->vel), 3) == -1) return -1;
+            frame->hasVel = 1;
+        }
+
+        // Read coordinates 
+        frame->xyz[3*pos + 0] = strPartFloat(buffer, 20, 8) * 10.0;
+        frame->xyz[3*pos + 1] = strPartFloat(buffer, 28, 8) * 10.0;
+        frame->xyz[3*pos + 2] = strPartFloat(buffer, 36, 8) * 10.0;
+
+        // Read velocities 
+        if(frame->hasVel) {
+            frame->vel[3*pos + 0] = strPartFloat(buffer, 44, 8);
+            frame->vel[3*pos + 1] = strPartFloat(buffer, 52, 8);
+            frame->vel[3*pos + 2] = strPartFloat(buffer, 60, 8);
+        }
+    }
+
+    // Get the cell line 
+    if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+        set_error(self, PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    buffer = self->line;
+    box[3*0 + 0] = strPartFloat(buffer,  0, 10) * 10.0;
+    box[3*1 + 1] = strPartFloat(buffer, 10, 10) * 10.0;
+    box[3*2 + 2] = strPartFloat(buffer, 20, 10) * 10.0;
+    if (strlen(buffer) > 31) box[3*0 + 1] = strPartFloat(buffer, 30, 10) * 10.0;
+    else                     box[3*0 + 1] = 0.0;
+    if (strlen(buffer) > 41) box[3*0 + 2] = strPartFloat(buffer, 40, 10) * 10.0;
+    else                     box[3*0 + 2] = 0.0;
+    if (strlen(buffer) > 51) box[3*1 + 0] = strPartFloat(buffer, 50, 10) * 10.0;
+    else                     box[3*1 + 0] = 0.0;
+    if (strlen(buffer) > 61) box[3*1 + 2] = strPartFloat(buffer, 60, 10) * 10.0;
+    else                     box[3*1 + 2] = 0.0;
+    if (strlen(buffer) > 71) box[3*2 + 0] = strPartFloat(buffer, 70, 10) * 10.0;
+    else                     box[3*2 + 0] = 0.0;
+    if (strlen(buffer) > 81) box[3*2 + 1] = strPartFloat(buffer, 80, 10) * 10.0;
+    else                     box[3*2 + 1] = 0.0;
+    frame->hasBox = 1;
+
+    return 0;
+
+}
+
+/* PDB records are recognized by the name in columns 1-6 */
+static int pdb_record(const char *line, size_t len, const char *name) {
+    size_t n = strlen(name), i;
+
+    if (len < n || strncmp(line, name, n)) return 0;
+    for (i = n; i < 6 && i < len; i++)
+        if (!isspace((unsigned char)line[i])) return 0;
+    return 1;
+}
+
+
+/* Box vectors from the cell lengths and angles (in degrees); the  *
+ * first vector goes along x, the second one in the xy plane.       */
+static void cell_to_box(const ARRAY_REAL *cell, ARRAY_REAL *box) {
+    double ca, cb, cg, sg, cy;
+
+    // Right angles are common, keep them exact
+    ca = cell[3] == 90.0 ? 0.0 : cos(cell[3] * M_PI / 180.0);
+    cb = cell[4] == 90.0 ? 0.0 : cos(cell[4] * M_PI / 180.0);
+    cg = cell[5] == 90.0 ? 0.0 : cos(cell[5] * M_PI / 180.0);
+    sg = cell[5] == 90.0 ? 1.0 : sin(cell[5] * M_PI / 180.0);
+    cy = (ca - cb * cg) / sg;
+
+    box[0] = cell[0];
+    box[1] = 0.0;
+    box[2] = 0.0;
+    box[3] = cell[1] * cg;
+    box[4] = cell[1] * sg;
+    box[5] = 0.0;
+    box[6] = cell[2] * cb;
+    box[7] = cell[2] * cy;
+    box[8] = cell[2] * sqrt(fmax(0.0, 1.0 - cb * cb - cy * cy));
+}
+
+
+/* Box of a CRYST1 record */
+static void parse_cryst1(const char *line, size_t len, ARRAY_REAL *box, double factor) {
+    ARRAY_REAL cell[6] = { 0.0, 0.0, 0.0, 90.0, 90.0, 90.0 };
+    size_t columns[7] = { 6, 15, 24, 33, 40, 47, 54 };
+    int i;
+
+    for (i = 0; i < 6 && columns[i] < len; i++)
+        cell[i] = parseFloat(line + columns[i],
+                    line + (columns[i+1] < len ? columns[i+1] : len), NULL);
+    for (i = 0; i < 3; i++) cell[i] *= factor;
+    cell_to_box(cell, box);
+}
+
+
+/* Element of the atom, from columns 77-78 or, if they are blank, *
+ * from the first letter of the atom name; index in element_table */
+static int pdb_element(const char *line, size_t len) {
+    char symbol[2];
+    int n = 0, i;
+
+    for (i = 76; i < 78 && (size_t)i < len; i++)
+        if (isalpha((unsigned char)line[i])) {
+            symbol[n] = n ? tolower((unsigned char)line[i]) : toupper((unsigned char)line[i]);
+            n++; }
+    if (n > 0) return getElementIndexBySpan(symbol, n);
+
+    for (i = 12; i < 16 && (size_t)i < len; i++)
+        if (isalpha((unsigned char)line[i])) {
+            symbol[0] = toupper((unsigned char)line[i]);
+            return getElementIndexBySpan(symbol, 1);
+        }
+    return -1;
+}
+
+
+/* Topology is read from the first model: atom names go to symbols, *
+ * residues and chains to their tables, elements give atomic        *
+ * numbers and masses.                                              */
+static int read_topo_from_pdb(Trajectory *self) {
+    InputBuffer *in = &(self->input);
+    const char *line;
+    size_t len;
+    int nat = 0, capacity = 0, idx, pos;
+    int *resid = NULL, *elements = NULL, *anum;
+    ARRAY_REAL *masses;
+    void *tmp;
+    npy_intp dims[2];
+    extern Element element_table[];
+
+    if ((self->symbolTable = nameTableNew()) == NULL) return -1;
+    if ((self->resNameTable = nameTableNew()) == NULL) return -1;
+    if ((self->chainTable = nameTableNew()) == NULL) return -1;
+
+    while ((line = inputPeekLine(in, &len)) != NULL) {
+        inputConsume(in, len);
+
+        if (pdb_record(line, len, "CRYST1")) {
+            parse_cryst1(line, len, self->pdbBox, 1.0);
+            self->hasPdbBox = 1;
+            continue; }
+        if (pdb_record(line, len, "ENDMDL") || pdb_record(line, len, "END")) {
+            if (nat > 0) break;
+            continue; }
+        if (!pdb_record(line, len, "ATOM") && !pdb_record(line, len, "HETATM"))
+            continue;
+        if (len < 54) {
+            PyErr_SetString(PyExc_IOError, "Missing coordinate");
+            goto fail; }
+
+        if (nat == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            if ((tmp = realloc(self->symbolCodes, capacity * sizeof(int))) == NULL) goto nomem;
+            self->symbolCodes = (int*) tmp;
+            if ((tmp = realloc(self->resNameCodes, capacity * sizeof(int))) == NULL) goto nomem;
+            self->resNameCodes = (int*) tmp;
+            if ((tmp = realloc(self->chainCodes, capacity * sizeof(int))) == NULL) goto nomem;
+            self->chainCodes = (int*) tmp;
+            if ((tmp = realloc(resid, capacity * sizeof(int))) == NULL) goto nomem;
+            resid = (int*) tmp;
+            if ((tmp = realloc(elements, capacity * sizeof(int))) == NULL) goto nomem;
+            elements = (int*) tmp;
+        }
+
+        // Name in columns 13-16, residue in 18-21, chain in 22, number in 23-26
+        if ((self->symbolCodes[nat] = nameTableInternStripped(
+                    self->symbolTable, line + 12, 4)) == -1) goto fail;
+        if ((self->resNameCodes[nat] = nameTableInternStripped(
+                    self->resNameTable, line + 17, 4)) == -1) goto fail;
+        if ((self->chainCodes[nat] = nameTableInternStripped(
+                    self->chainTable, line + 21, 1)) == -1) goto fail;
+        resid[nat] = (int) parseFloat(line + 22, line + 26, NULL);
+        elements[nat] = pdb_element(line, len);
+        nat++;
+    }
+
+    if (nat == 0) {
+        PyErr_SetString(PyExc_IOError, "No atoms found");
+        goto fail; }
+    self->nAtoms = nat;
+
+    dims[0] = nat;
+    dims[1] = 1;
+    anum = (int*) poolAlloc(nat * sizeof(int));
+    masses = (ARRAY_REAL*) poolAlloc(nat * sizeof(ARRAY_REAL));
+    if (anum == NULL || masses == NULL) {
+        poolFree(anum);
+        poolFree(masses);
+        goto nomem; }
+    for (pos = 0; pos < nat; pos++) {
+        idx = elements[pos];
+        anum[pos] = idx == -1 ? -1 : element_table[idx].number;
+        masses[pos] = idx == -1 ? 0.0 : element_table[idx].mass;
+    }
+    if (set_owned_array(&(self->aNumbers), dims, NPY_INT, anum) == -1) {
+        poolFree(masses);
+        goto fail; }
+    if (set_owned_array(&(self->masses), dims, NPY_ARRAY_REAL, masses) == -1)
+        goto fail;
+
+    if ((anum = (int*) poolAlloc(nat * sizeof(int))) == NULL) goto nomem;
+    memcpy(anum, resid, nat * sizeof(int));
+    if (set_owned_array(&(self->resids), dims, NPY_INT, anum) == -1) goto fail;
+
+    free(resid);
+    free(elements);
+    return 0;
+
+    nomem:
+    PyErr_SetFromErrno(PyExc_MemoryError);
+    fail:
+    free(resid);
+    free(elements);
+    return -1;
+}
+
+
+/* A frame ends with ENDMDL (or END), so records before MODEL, like  *
+ * TITLE and CRYST1, belong to it. TITLE becomes the comment; models *
+ * without CRYST1 get the box given before the first one.            */
+static int read_frame_from_pdb(Trajectory *self, FrameData *frame, int metaOnly) {
+    InputBuffer *in = &(self->input);
+    const char *line;
+    size_t len, clen;
+    int nat = 0, k;
+    double factor;
+    char *tmp;
+
+    switch(self->units) {
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+        default: factor = 1.0; break;
+    }
+
+    if (!metaOnly && alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+
+    while ((line = inputPeekLine(in, &len)) != NULL) {
+        inputConsume(in, len);
+
+        if (pdb_record(line, len, "ATOM") || pdb_record(line, len, "HETATM")) {
+            if (nat == self->nAtoms) {
+                set_error(self, PyExc_RuntimeError,
+                    "Number of atoms different than expected");
+                return -1; }
+            if (!metaOnly) {
+                if (len < 54) {
+                    set_error(self, PyExc_IOError, "Missing coordinate");
+                    return -1; }
+                for (k = 0; k < 3; k++)
+                    frame->xyz[3*nat + k] = parseFloat(line + 30 + 8*k,
+                                                line + 38 + 8*k, NULL) * factor;
+            }
+            nat++;
+
+        } else if (pdb_record(line, len, "CRYST1")) {
+            parse_cryst1(line, len, frame->box, factor);
+            frame->hasBox = 1;
+
+        } else if (pdb_record(line, len, "TITLE") && !frame->hasComment) {
+            clen = len > 10 ? len - 10 : 0;
+            if (frame->commentSize < clen + 1) {
+                if ((tmp = (char*) realloc(frame->comment, clen + 1)) == NULL) {
+                    set_error(self, PyExc_MemoryError, NULL);
+                    return -1; }
+                frame->comment = tmp;
+                frame->commentSize = clen + 1;
+            }
+            memcpy(frame->comment, line + 10, clen);
+            frame->comment[clen] = '\0';
+            stripline(frame->comment);
+            frame->hasComment = 1;
+            parse_gro_title(frame);
+
+        } else if (pdb_record(line, len, "ENDMDL") || pdb_record(line, len, "END")) {
+            if (nat > 0) break;
+        }
+    }
+
+    if (line == NULL && errno) {
+        set_error(self, PyExc_IOError, NULL);
+        return -1; }
+    if (nat == 0) return 1;
+    if (nat != self->nAtoms) {
+        set_error(self, PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    if (!frame->hasBox && self->hasPdbBox) {
+        for (k = 0; k < 9; k++) frame->box[k] = self->pdbBox[k] * factor;
+        frame->hasBox = 1;
+    }
+
+    return 0;
+}
+
+/* Memory of the LAMMPS column description */
+static void lammps_free(LammpsColumns *lmp) {
+    free(lmp->header);
+    free(lmp->ids);
+    free(lmp->order);
+    free(lmp->count);
+}
+
+
+/* Translate the names of ITEM: ATOMS into the plan of extended XYZ   *
+ * columns: x y z (or xu, xs, xsu) become pos, vx vy vz velo, fx fy   *
+ * fz forces and ix iy iz image. Elements, or types if there are no   *
+ * elements, are the species; other columns are numbers in the info.  */
+static int lammps_columns(Trajectory *self, const char *names) {
+    static const char *triples[][4] = {
+        { "x", "y", "z", "pos" }, { "xu", "yu", "zu", "pos" },
+        { "xs", "ys", "zs", "pos" }, { "xsu", "ysu", "zsu", "pos" },
+        { "vx", "vy", "vz", "velo" }, { "fx", "fy", "fz", "forces" },
+        { "ix", "iy", "iz", "image" }, { NULL } };
+    LammpsColumns *lmp = &(self->lammps);
+    const char *ptr, *start[4 * EXT_MAX_COLUMNS];
+    char *props, *out, *header;
+    int len[4 * EXT_MAX_COLUMNS];
+    int n = 0, i, t, id = -1, mol = -1, scaled = 0, hasPos = 0, hasElement = 0;
+
+#define NAME_IS(j, name) (len[j] == (int)strlen(name) && !strncmp(start[j], name, len[j]))
+
+    // The columns usually stay the same for the whole file
+    if (lmp->header != NULL && !strcmp(lmp->header, names)) return 0;
+
+    for (ptr = names; ; n++) {
+        while (isspace((unsigned char)*ptr)) ptr++;
+        if (!*ptr) break;
+        if (n == 4 * EXT_MAX_COLUMNS) {
+            set_error(self, PyExc_IOError, "Too many columns in LAMMPS dump");
+            return -1; }
+        start[n] = ptr;
+        while (*ptr && !isspace((unsigned char)*ptr)) ptr++;
+        len[n] = ptr - start[n];
+        if (NAME_IS(n, "element")) hasElement = 1;
+    }
+
+    if ((props = (char*) malloc(strlen(names) + 8 * n + 16)) == NULL) {
+        set_error(self, PyExc_MemoryError, NULL);
+        return -1; }
+    out = props;
+    for (i = 0; i < n; ) {
+        for (t = 0; triples[t][0] != NULL; t++)
+            if (i + 2 < n && NAME_IS(i, triples[t][0]) && NAME_IS(i+1, triples[t][1])
+                    && NAME_IS(i+2, triples[t][2])) break;
+        // Positions are taken from the first set only
+        if (triples[t][0] != NULL && !(t < 4 && hasPos)) {
+            if (t < 4) {
+                hasPos = 1;
+                scaled = (t == 2 || t == 3); }
+            out += sprintf(out, "%s:%c:3:", triples[t][3], t == 6 ? 'I' : 'R');
+            i += 3;
+            continue;
+        }
+        if (NAME_IS(i, "id")) {
+            out += sprintf(out, "id:I:1:");
+            id = i;
+        } else if (NAME_IS(i, "mol")) {
+            out += sprintf(out, "mol:I:1:");
+            mol = i;
+        } else if (NAME_IS(i, "element") || (NAME_IS(i, "type") && !hasElement))
+            out += sprintf(out, "species:S:1:");
+        else if (NAME_IS(i, "type"))
+            out += sprintf(out, "type:I:1:");
+        else
+            out += sprintf(out, "%.*s:R:1:", len[i], start[i]);
+        i++;
+    }
+    if (out > props) out[-1] = '\0';
+
+#undef NAME_IS
+
+    if (!hasPos) {
+        free(props);
+        set_error(self, PyExc_IOError, "Missing positions in LAMMPS dump");
+        return -1; }
+    if (extCompilePlan(&(self->extPlan), props) == -1) {
+        free(props);
+        if (errno == EINVAL)
+            set_error(self, PyExc_IOError, "Incorrect columns in LAMMPS dump");
+        else
+            set_error(self, PyExc_MemoryError, NULL);
+        return -1; }
+    free(props);
+
+    if ((header = strdup(names)) == NULL) {
+        set_error(self, PyExc_MemoryError, NULL);
+        return -1; }
+    free(lmp->header);
+    lmp->header = header;
+    lmp->id = id;
+    lmp->mol = mol;
+    lmp->scaled = scaled;
+
+    return 0;
+}
+
+
+/* Box of ITEM: BOX BOUNDS, of the given style: 0 for orthogonal, 1  *
+ * with xy xz yz tilts, 2 for general triclinic (abc origin). Lower  *
+ * bounds of the box, or its origin, go to origin.                   */
+static int lammps_box(Trajectory *self, FrameData *frame, int style,
+                      double *origin, double factor) {
+    double v[3][4], lo[3], hi[3], xy, xz, yz;
+    const char *ptr, *end;
+    int i, k;
+
+    for (i = 0; i < 3; i++) {
+        if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+            set_error(self, PyExc_IOError, "Unexpected end of file");
+            return -1; }
+        v[i][2] = v[i][3] = 0.0;
+        ptr = self->line;
+        for (k = 0; k < 4; k++) {
+            while (isspace((unsigned char)*ptr)) ptr++;
+            v[i][k] = parseFloat(ptr, NULL, &end);
+            if (end == ptr) break;
+            ptr = end;
+        }
+        if (k < (style == 2 ? 4 : style == 1 ? 3 : 2)) {
+            set_error(self, PyExc_IOError, "Incorrect box in LAMMPS dump");
+            return -1; }
+    }
+
+    memset(frame->box, 0, 9 * sizeof(ARRAY_REAL));
+    if (style == 2) {
+        for (i = 0; i < 3; i++) {
+            for (k = 0; k < 3; k++) frame->box[3*i + k] = v[i][k] * factor;
+            origin[i] = v[i][3] * factor;
+        }
+    } else {
+        // Bounds of tilted boxes enclose the whole cell
+        xy = v[0][2];
+        xz = v[1][2];
+        yz = v[2][2];
+        lo[0] = v[0][0] - fmin(fmin(0.0, xy), fmin(xz, xy + xz));
+        hi[0] = v[0][1] - fmax(fmax(0.0, xy), fmax(xz, xy + xz));
+        lo[1] = v[1][0] - fmin(0.0, yz);
+        hi[1] = v[1][1] - fmax(0.0, yz);
+        lo[2] = v[2][0];
+        hi[2] = v[2][1];
+        frame->box[0] = (hi[0] - lo[0]) * factor;
+        frame->box[3] = xy * factor;
+        frame->box[4] = (hi[1] - lo[1]) * factor;
+        frame->box[6] = xz * factor;
+        frame->box[7] = yz * factor;
+        frame->box[8] = (hi[2] - lo[2]) * factor;
+        for (i = 0; i < 3; i++) origin[i] = lo[i] * factor;
+    }
+    frame->hasBox = 1;
+
+    return 0;
+}
+
+
+/* Read the items of a LAMMPS dump frame, up to ITEM: ATOMS; unknown *
+ * items, like UNITS, are skipped. Returns 0, 1 at the end of file   *
+ * or -1 on error. The GIL is not needed.                            */
+static int lammps_header(Trajectory *self, FrameData *frame, int *nat,
+                         double *origin, double factor) {
+    const char *item;
+    int first = 1, kind;
+
+    *nat = -1;
+    while (1) {
+        if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1) {
+            if (first) return 1;
+            goto eof; }
+        stripline(self->line);
+
+        // Values of unknown items
+        if (strncmp(self->line, "ITEM:", 5)) {
+            if (first && *self->line) {
+                set_error(self, PyExc_IOError, "Incorrect LAMMPS dump");
+                return -1; }
+            continue;
+        }
+        first = 0;
+        item = self->line + 5;
+        while (isspace((unsigned char)*item)) item++;
+
+        // Items with a single value in the next line
+        kind = !strcmp(item, "TIMESTEP") ? 'S' : !strcmp(item, "TIME") ? 'T'
+               : !strcmp(item, "NUMBER OF ATOMS") ? 'N' : 0;
+        if (kind) {
+            if (inputGetLine(&(self->input), &(self->line), &(self->lineSize)) == -1)
+                goto eof;
+            if (kind == 'S') {
+                frame->step = strtol(self->line, NULL, 10);
+                frame->hasStep = 1;
+            } else if (kind == 'T') {
+                frame->time = parseFloat(self->line, NULL, NULL);
+                frame->hasTime = 1;
+            } else
+                *nat = (int) strtol(self->line, NULL, 10);
+        } else if (!strncmp(item, "BOX BOUNDS", 10)) {
+            if (lammps_box(self, frame, strstr(item, "abc") != NULL ? 2
+                                : strstr(item, "xy") != NULL, origin, factor) == -1)
+                return -1;
+        } else if (!strncmp(item, "ATOMS", 5)) {
+            if (lammps_columns(self, item + 5) == -1) return -1;
+            break;
+        }
+    }
+
+    if (*nat < 0) {
+        set_error(self, PyExc_IOError, "Missing number of atoms in LAMMPS dump");
+        return -1; }
+    return 0;
+
+    eof:
+    set_error(self, PyExc_IOError, "Unexpected end of file");
+    return -1;
+}
+
+
+static int compare_ids(const void *a, const void *b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Atom index of each line of the block, from the ids. Lines come in *
+ * any order, so they are sorted by counting sort; sparse ids are    *
+ * looked up in a sorted copy instead. *order is NULL if there are   *
+ * no ids, or they are in order already.                             */
+static int lammps_order(Trajectory *self, int nat, const int **order) {
+    LammpsColumns *lmp = &(self->lammps);
+    Tokens *tok = &(self->tokens);
+    long minId = 0, maxId = 0, range, id, *sorted, *found;
+    int pos, start, count, inOrder = 1;
+    void *tmp;
+
+    *order = NULL;
+    if (lmp->id < 0) return 0;
+
+    if (nat > lmp->capacity) {
+        if ((tmp = realloc(lmp->ids, nat * sizeof(long))) == NULL) goto nomem;
+        lmp->ids = (long*) tmp;
+        if ((tmp = realloc(lmp->order, nat * sizeof(int))) == NULL) goto nomem;
+        lmp->order = (int*) tmp;
+        lmp->capacity = nat;
+    }
+
+    for (pos = 0; pos < nat; pos++) {
+        if (tok->lineFields[pos] <= lmp->id) {
+            set_error(self, PyExc_IOError, "Missing columns in atom lines");
+            return -1; }
+        id = strtol(self->block + tok->fieldBegin[tok->lineFirst[pos] + lmp->id], NULL, 10);
+        lmp->ids[pos] = id;
+        if (pos == 0) minId = maxId = id;
+        else {
+            if (id <= lmp->ids[pos-1]) inOrder = 0;
+            if (id < minId) minId = id;
+            if (id > maxId) maxId = id;
+        }
+    }
+    if (inOrder) return 0;
+
+    range = maxId - minId + 1;
+    if (range <= 4L * nat + 1024) {
+        if (range > lmp->countSize) {
+            if ((tmp = realloc(lmp->count, range * sizeof(int))) == NULL) goto nomem;
+            lmp->count = (int*) tmp;
+            lmp->countSize = range;
+        }
+        memset(lmp->count, 0, range * sizeof(int));
+        for (pos = 0; pos < nat; pos++) lmp->count[lmp->ids[pos] - minId]++;
+        for (id = 0, start = 0; id < range; id++) {
+            count = lmp->count[id];
+            if (count > 1) {
+                set_error(self, PyExc_IOError, "Repeated atom id in LAMMPS dump");
+                return -1; }
+            lmp->count[id] = start;
+            start += count;
+        }
+        for (pos = 0; pos < nat; pos++)
+            lmp->order[pos] = lmp->count[lmp->ids[pos] - minId]++;
+    } else {
+        if ((sorted = (long*) malloc(nat * sizeof(long))) == NULL) goto nomem;
+        memcpy(sorted, lmp->ids, nat * sizeof(long));
+        qsort(sorted, nat, sizeof(long), compare_ids);
+        for (pos = 1; pos < nat; pos++)
+            if (sorted[pos] == sorted[pos-1]) {
+                free(sorted);
+                set_error(self, PyExc_IOError, "Repeated atom id in LAMMPS dump");
+                return -1; }
+        for (pos = 0; pos < nat; pos++) {
+            found = (long*) bsearch(lmp->ids + pos, sorted, nat, sizeof(long), compare_ids);
+            lmp->order[pos] = found - sorted;
+        }
+        free(sorted);
+    }
+
+    *order = lmp->order;
+    return 0;
+
+    nomem:
+    set_error(self, PyExc_MemoryError, NULL);
+    return -1;
+}
 
-        	}
 
-	        // Add atomic numbers to the dictionary 
-    	    dims[0] = nat;
-        	dims[1] = 1;
-	        Py_DECREF(self->aNumbers);
-	        self->aNumbers = PyArray_SimpleNewFromData(1, dims, NPY_INT, anum);
-			break;
+/* Topology of LAMMPS dump files, from the first frame: species      *
+ * (elements, or types) are the symbols and molecules the residues.  */
+static int read_topo_from_lammps(Trajectory *self) {
+    Tokens *tok = &(self->tokens);
+    const int *order;
+    double origin[3];
+    int nat, pos, atom, field, code, idx, status;
+    int *anum, *elements, *resid;
+    ARRAY_REAL *masses;
+    npy_intp dims[2];
+    extern Element element_table[];
 
-	    default:
+    if ((status = lammps_header(self, &(self->frame), &nat, origin, 1.0)) == -1) {
+        raise_error(self);
+        return -1; }
+    if (status == 1 || nat <= 0) {
+        PyErr_SetString(PyExc_IOError, "No atoms found");
+        return -1; }
+    self->nAtoms = nat;
 
-	        PyErr_SetString(PyExc_RuntimeError, "geometry/atom section missing");
-    	    return -1;
-	}
-    
-    free(line);
+    if (read_line_block(self, nat) == -1 || lammps_order(self, nat, &order) == -1) {
+        raise_error(self);
+        return -1; }
+    dims[0] = nat;
+    dims[1] = 1;
+
+    if (self->extPlan.species >= 0) {
+        field = self->extPlan.columns[self->extPlan.species].first;
+        if ((self->symbolTable = nameTableNew()) == NULL) return -1;
+        if ((self->symbolCodes = (int*) malloc(nat * sizeof(int))) == NULL) {
+            PyErr_SetFromErrno(PyExc_MemoryError);
+            return -1; }
+        for (pos = 0; pos < nat; pos++) {
+            if (tok->lineFields[pos] <= field) {
+                PyErr_SetString(PyExc_IOError, "Missing atomic symbol");
+                return -1; }
+            atom = order != NULL ? order[pos] : pos;
+            idx = tok->lineFirst[pos] + field;
+            code = nameTableIntern(self->symbolTable, self->block + tok->fieldBegin[idx],
+                                   tok->fieldEnd[idx] - tok->fieldBegin[idx]);
+            if (code == -1) return -1;
+            self->symbolCodes[atom] = code;
+        }
+
+        // Numeric types are not elements and get -1
+        elements = (int*) malloc((self->symbolTable->size + 1) * sizeof(int));
+        anum = (int*) poolAlloc(nat * sizeof(int));
+        masses = (ARRAY_REAL*) poolAlloc(nat * sizeof(ARRAY_REAL));
+        if (elements == NULL || anum == NULL || masses == NULL) {
+            free(elements);
+            poolFree(anum);
+            poolFree(masses);
+            PyErr_SetFromErrno(PyExc_MemoryError);
+            return -1; }
+        for (code = 0; code < self->symbolTable->size; code++)
+            elements[code] = getElementIndexBySymbol(
+                                    nameTableGet(self->symbolTable, code));
+        for (pos = 0; pos < nat; pos++) {
+            idx = elements[self->symbolCodes[pos]];
+            anum[pos] = idx == -1 ? -1 : element_table[idx].number;
+            masses[pos] = idx == -1 ? 0.0 : element_table[idx].mass;
+        }
+        free(elements);
+        if (set_owned_array(&(self->aNumbers), dims, NPY_INT, anum) == -1) {
+            poolFree(masses);
+            return -1; }
+        if (set_owned_array(&(self->masses), dims, NPY_ARRAY_REAL, masses) == -1)
+            return -1;
+    }
+
+    if (self->lammps.mol >= 0) {
+        if ((resid = (int*) poolAlloc(nat * sizeof(int))) == NULL) {
+            PyErr_SetFromErrno(PyExc_MemoryError);
+            return -1; }
+        for (pos = 0; pos < nat; pos++) {
+            if (tok->lineFields[pos] <= self->lammps.mol) {
+                poolFree(resid);
+                PyErr_SetString(PyExc_IOError, "Missing columns in atom lines");
+                return -1; }
+            idx = tok->lineFirst[pos] + self->lammps.mol;
+            resid[order != NULL ? order[pos] : pos] =
+                    (int) strtol(self->block + tok->fieldBegin[idx], NULL, 10);
+        }
+        if (set_owned_array(&(self->resids), dims, NPY_INT, resid) == -1) return -1;
+    }
+
+    return 0;
+}
+
+
+/* Frames of LAMMPS dump files. Atoms are put in the order of ids,   *
+ * scaled positions are turned into Cartesian ones and the columns   *
+ * that do not fit the usual fields go to the info, together with    *
+ * the origin of the box. The GIL is not needed.                     */
+static int read_frame_from_lammps(Trajectory *self, FrameData *frame, int metaOnly) {
+    const int *order;
+    double origin[3] = { 0.0, 0.0, 0.0 }, factor, s[3];
+    int nat, status, i, k;
+
+    switch(self->units) {
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+        default: factor = 1.0; break;
+    }
+
+    frame->hasExt = 0;
+    if ((status = lammps_header(self, frame, &nat, origin, factor)) != 0) return status;
+    if (nat != self->nAtoms) {
+        set_error(self, PyExc_RuntimeError, "Number of atoms different than expected");
+        return -1; }
+    if (metaOnly) return skip_lines(self, nat);
+
+    if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+    if (read_line_block(self, nat) == -1) return -1;
+    if (lammps_order(self, nat, &order) == -1) return -1;
+    if (read_ext_atoms(self, frame, self->lammps.scaled ? 1.0 : factor, order) == -1)
+        return -1;
+
+    if (self->lammps.scaled) {
+        if (!frame->hasBox) {
+            set_error(self, PyExc_IOError, "Scaled positions without box");
+            return -1; }
+        for (i = 0; i < nat; i++) {
+            for (k = 0; k < 3; k++) s[k] = frame->xyz[3*i + k];
+            for (k = 0; k < 3; k++)
+                frame->xyz[3*i + k] = origin[k] + s[0] * frame->box[k]
+                                    + s[1] * frame->box[3+k] + s[2] * frame->box[6+k];
+        }
+    }
+
+    extSetReal(&(frame->ext), "origin", origin, 3);
+    frame->hasExt = 1;
 
     return 0;
 }
 
+/* Decode a fixed-width field, like %8.3f of AMBER files, with integer *
+ * arithmetic; anything else (exponents, overflow) goes to parseFloat. */
+static double parse_fixed(const char *field, int width) {
+    static const double scales[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                     1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16 };
+    const char *ptr = field, *end = field + width;
+    long digits = 0;
+    int decimals = -1, negative = 0;
+
+    while (ptr < end && *ptr == ' ') ptr++;
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) negative = (*ptr++ == '-');
+    for (; ptr < end; ptr++) {
+        if (*ptr >= '0' && *ptr <= '9') {
+            digits = 10 * digits + (*ptr - '0');
+            if (decimals >= 0) decimals++;
+        } else if (*ptr == '.' && decimals < 0)
+            decimals = 0;
+        else
+            return parseFloat(field, end, NULL);
+    }
+    if (decimals > 0) return (negative ? -digits : digits) / scales[decimals];
+    return negative ? -digits : digits;
+}
 
 
+/* Topology of MDCRD files is only the number of atoms, given by the *
+ * user. The first frame is read to find out if there are box lines  *
+ * and if all lines have the full width; then frames have the same   *
+ * size and their positions are computed instead of searched.        */
+static int read_topo_from_mdcrd(Trajectory *self) {
+    InputBuffer *in = &(self->input);
+    const char *line;
+    size_t len, used;
+    long start, nValues, expected;
+    int nLines, i;
+    struct stat st;
+
+    if (inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+        PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    start = inputTell(in);
+
+    // Values of the first frame, ten per line
+    nValues = 3L * self->nAtoms;
+    nLines = (nValues + MDCRD_PER_LINE - 1) / MDCRD_PER_LINE;
+    self->frameSize = 0;
+    expected = 1;
+    for (i = 0; i < nLines; i++) {
+        if ((line = inputPeekLine(in, &len)) == NULL) {
+            PyErr_SetString(PyExc_IOError, "No atoms found");
+            return -1; }
+        if (len != (size_t)(i + 1 < nLines ? MDCRD_PER_LINE
+                            : nValues - (long)i * MDCRD_PER_LINE) * MDCRD_WIDTH + 1)
+            expected = 0;
+        inputConsume(in, len);
+    }
 
-static int read_topo_from_gro(Trajectory *self) {
+    // A box line has three values; the next frame begins with more,
+    // unless there is a single atom
+    self->mdcrdBox = 0;
+    if ((line = inputPeekLine(in, &len)) != NULL) {
+        for (used = len; used > 0 && isspace((unsigned char)line[used-1]); used--);
+        if (used > 0 && used <= 3 * MDCRD_WIDTH && nValues > 3) {
+            self->mdcrdBox = 1;
+            if (len != 3 * MDCRD_WIDTH + 1) expected = 0;
+        }
+    }
 
-    Py_ssize_t pos;
-    int nofatoms;
-    char *buffer = NULL;
-	size_t buflen;
-    char symbuf[100];
-    int *resid;
+    if (expected && self->nFiles == 1 && !fstat(fileno(self->fd), &st)
+            && S_ISREG(st.st_mode)) {
+        self->frameSize = nLines + nValues * MDCRD_WIDTH
+                          + (self->mdcrdBox ? 3 * MDCRD_WIDTH + 1 : 0);
+        if ((st.st_size - start) % self->frameSize == 0)
+            self->totalFrames = (st.st_size - start) / self->frameSize;
+        else
+            self->frameSize = 0;
+    }
+
+    if (inputSeek(in, start) == -1) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1; }
+    return 0;
+}
+
+
+/* Frames of MDCRD files: coordinates in fields of MDCRD_WIDTH      *
+ * characters, ten per line, and optionally a line with the lengths *
+ * of the box. The GIL is not needed.                               */
+static int read_frame_from_mdcrd(Trajectory *self, FrameData *frame, int metaOnly) {
+    InputBuffer *in = &(self->input);
+    const char *line;
+    size_t len;
+    long nValues, value, n, k;
+    double factor;
+
+    switch(self->units) {
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+        default: factor = 1.0; break;
+    }
+
+    // Blank lines at the end of file
+    while ((line = inputPeekLine(in, &len)) != NULL) {
+        for (k = 0; k < (long)len && isspace((unsigned char)line[k]); k++);
+        if (k < (long)len) break;
+        inputConsume(in, len);
+    }
+    if (line == NULL) {
+        if (!errno) return 1;
+        set_error(self, PyExc_IOError, NULL);
+        return -1; }
+
+    nValues = 3L * self->nAtoms;
+    if (metaOnly) {
+        if (skip_lines(self, (nValues + MDCRD_PER_LINE - 1) / MDCRD_PER_LINE) == -1)
+            return -1;
+    } else {
+        if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+        for (value = 0; value < nValues; value += n) {
+            if ((line = inputPeekLine(in, &len)) == NULL) {
+                set_error(self, PyExc_IOError, errno ? NULL : "Unexpected end of file");
+                return -1; }
+            n = nValues - value < MDCRD_PER_LINE ? nValues - value : MDCRD_PER_LINE;
+            if (len < (size_t)(n * MDCRD_WIDTH)) {
+                set_error(self, PyExc_IOError, "Missing coordinate");
+                return -1; }
+            for (k = 0; k < n; k++)
+                frame->xyz[value + k] = parse_fixed(line + k * MDCRD_WIDTH, MDCRD_WIDTH) * factor;
+            inputConsume(in, len);
+        }
+    }
+
+    if (self->mdcrdBox) {
+        if ((line = inputPeekLine(in, &len)) == NULL || len < 3 * MDCRD_WIDTH) {
+            set_error(self, PyExc_IOError, "Missing box");
+            return -1; }
+        memset(frame->box, 0, 9 * sizeof(ARRAY_REAL));
+        for (k = 0; k < 3; k++)
+            frame->box[4*k] = parse_fixed(line + k * MDCRD_WIDTH, MDCRD_WIDTH) * factor;
+        frame->hasBox = 1;
+        inputConsume(in, len);
+    }
+
+    return 0;
+}
+
+/* Topology of XDATCAR files: symbols are the element names (VASP 5) *
+ * repeated as many times as given in the next line. Frames are read *
+ * from the beginning, since the header holds the lattice.           */
+static int read_topo_from_xdatcar(Trajectory *self) {
+    extern Element element_table[];
+    InputBuffer *in = &(self->input);
+    char *names = NULL, *name, *save, *ptr, *end;
+    int *elements = NULL, *anum;
+    ARRAY_REAL *masses;
     npy_intp dims[2];
-    PyObject *val;
+    long count;
+    int i, idx, code, status = -1;
 
-    // Read the comment line 
-    if(_getline(&buffer, &buflen, self->fd) == -1) return -1;
-    buffer[strlen(buffer)-1] = '\0';
-    stripline(buffer);
+    for (i = 0; i < 6; i++)
+        if (inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+            PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+            return -1; }
 
-    // Read number of atoms 
-    if (_getline(&buffer, &buflen, self->fd) == -1) return -1;
-    if( sscanf(buffer, "%d", &nofatoms) != 1 ) {
-        PyErr_SetString(PyExc_IOError, "Incorrect atom number");
+    // VASP 5 gives the element names before the numbers of atoms
+    for (ptr = self->line; isspace((unsigned char)*ptr); ptr++);
+    if (isalpha((unsigned char)*ptr)) {
+        if ((names = strdup(self->line)) == NULL) {
+            PyErr_NoMemory();
+            return -1; }
+        if (inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+            PyErr_SetString(PyExc_IOError, "Unexpected end of file");
+            goto end; }
+    }
+
+    self->nAtoms = 0;
+    for (ptr = self->line; (count = strtol(ptr, &end, 10)) > 0 || end != ptr; ptr = end)
+        self->nAtoms += count;
+    if (self->nAtoms <= 0) {
+        PyErr_SetString(PyExc_IOError, "No atoms found");
+        goto end; }
+
+    if (names != NULL) {
+        self->symbolTable = nameTableNew();
+        self->symbolCodes = (int*) malloc(self->nAtoms * sizeof(int));
+        if (self->symbolTable == NULL || self->symbolCodes == NULL) {
+            PyErr_NoMemory();
+            goto end; }
+        ptr = self->line;
+        i = 0;
+        // Names like Si_pv or O/a1b2 are those of the potentials
+        for (name = strtok_r(names, " \t\r\n", &save); name != NULL;
+                name = strtok_r(NULL, " \t\r\n", &save)) {
+            count = strtol(ptr, &end, 10);
+            if (end == ptr) break;
+            ptr = end;
+            if ((code = nameTableIntern(self->symbolTable, name, strcspn(name, "_/"))) == -1)
+                goto end;
+            while (count-- > 0) self->symbolCodes[i++] = code;
+        }
+        if (i != self->nAtoms || name != NULL) {
+            PyErr_SetString(PyExc_IOError, "Element names do not match the numbers of atoms");
+            goto end; }
+
+        // Elements are looked up once per name
+        elements = (int*) malloc((self->symbolTable->size + 1) * sizeof(int));
+        anum = (int*) poolAlloc(self->nAtoms * sizeof(int));
+        masses = (ARRAY_REAL*) poolAlloc(self->nAtoms * sizeof(ARRAY_REAL));
+        if (elements == NULL || anum == NULL || masses == NULL) {
+            poolFree(anum);
+            poolFree(masses);
+            PyErr_NoMemory();
+            goto end; }
+        for (code = 0; code < self->symbolTable->size; code++)
+            elements[code] = getElementIndexBySpan(nameTableGet(self->symbolTable, code),
+                                    nameTableLength(self->symbolTable, code));
+        for (i = 0; i < self->nAtoms; i++) {
+            idx = elements[self->symbolCodes[i]];
+            anum[i] = idx == -1 ? -1 : element_table[idx].number;
+            masses[i] = idx == -1 ? 0.0 : element_table[idx].mass;
+        }
+        dims[0] = self->nAtoms;
+        dims[1] = 1;
+        if (set_owned_array(&(self->aNumbers), dims, NPY_INT, anum) == -1) {
+            poolFree(masses);
+            goto end; }
+        if (set_owned_array(&(self->masses), dims, NPY_ARRAY_REAL, masses) == -1)
+            goto end;
+    }
+
+    if (inputSeek(in, 0) == -1) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        goto end; }
+    status = 0;
+
+    end:
+    free(elements);
+    free(names);
+    return status;
+}
+
+
+/* Header of XDATCAR frames: comment, scale, lattice vectors, element *
+ * names and numbers of atoms. It is given once, or before every      *
+ * frame in variable-cell runs. The GIL is not needed.                */
+static int xdatcar_header(Trajectory *self) {
+    InputBuffer *in = &(self->input);
+    ARRAY_REAL *cell = self->xdatcarCell;
+    double scale = 1.0, volume;
+    const char *stop;
+    char *ptr, *end;
+    long count, total = 0;
+    int i, k;
+
+    for (i = 0; i < 5; i++) {
+        if (inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+            set_error(self, PyExc_IOError, "Unexpected end of file");
+            return -1; }
+        if (i == 0) continue;
+        ptr = self->line;
+        // Scale, then the lattice vectors as rows
+        for (k = 0; k < (i == 1 ? 1 : 3); k++, ptr += stop - ptr) {
+            while (isspace((unsigned char)*ptr)) ptr++;
+            if (i == 1) scale = parseFloat(ptr, NULL, &stop);
+            else cell[3*(i-2) + k] = parseFloat(ptr, NULL, &stop);
+            if (stop == ptr) {
+                set_error(self, PyExc_IOError, "Incorrect lattice in XDATCAR header");
+                return -1; }
+        }
+    }
+
+    // Negative scale is the volume of the cell
+    if (scale < 0.0) {
+        volume = fabs(cell[0] * (cell[4] * cell[8] - cell[5] * cell[7])
+                    - cell[1] * (cell[3] * cell[8] - cell[5] * cell[6])
+                    + cell[2] * (cell[3] * cell[7] - cell[4] * cell[6]));
+        scale = volume > 0.0 ? cbrt(-scale / volume) : 0.0;
+    }
+    for (k = 0; k < 9; k++) cell[k] *= scale;
+    self->xdatcarScale = scale;
+
+    // Names, if given, were read with the topology
+    if (inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+        set_error(self, PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    for (ptr = self->line; isspace((unsigned char)*ptr); ptr++);
+    if (isalpha((unsigned char)*ptr)
+            && inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+        set_error(self, PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    for (ptr = self->line; (count = strtol(ptr, &end, 10)) > 0 || end != ptr; ptr = end)
+        total += count;
+    if (total != self->nAtoms) {
+        set_error(self, PyExc_RuntimeError, "Number of atoms different than expected");
+        return -1; }
+
+    return 0;
+}
+
+
+/* Frames of XDATCAR files begin with "Direct configuration= N", *
+ * where N becomes the step, after the header if the cell changes. *
+ * Direct coordinates are turned into Cartesian ones while parsed. *
+ * The GIL is not needed.                                          */
+static int read_frame_from_xdatcar(Trajectory *self, FrameData *frame, int metaOnly) {
+    InputBuffer *in = &(self->input);
+    const ARRAY_REAL *cell = self->xdatcarCell;
+    const char *line, *ptr;
+    char *end;
+    Tokens *tok;
+    size_t len;
+    double factor, u, v, w;
+    int pos, field, cartesian, k;
+
+    switch(self->units) {
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+        default: factor = 1.0; break;
+    }
+
+    // Blank lines at the end of file
+    while ((line = inputPeekLine(in, &len)) != NULL) {
+        for (k = 0; k < (long)len && isspace((unsigned char)line[k]); k++);
+        if (k < (long)len) break;
+        inputConsume(in, len);
+    }
+    if (line == NULL) {
+        if (!errno) return 1;
+        set_error(self, PyExc_IOError, NULL);
+        return -1; }
+
+    // Old versions write "Konfig=", with direct coordinates
+    for (ptr = line; isspace((unsigned char)*ptr); ptr++);
+    if (strncasecmp(ptr, "direct", 6) && strncasecmp(ptr, "cartesian", 9)
+            && strncasecmp(ptr, "konfig", 6) && xdatcar_header(self) == -1)
+        return -1;
+
+    if (inputGetLine(in, &(self->line), &(self->lineSize)) == -1) {
+        set_error(self, PyExc_IOError, "Unexpected end of file");
+        return -1; }
+    for (ptr = self->line; isspace((unsigned char)*ptr); ptr++);
+    cartesian = tolower((unsigned char)*ptr) == 'c';
+    if ((ptr = strchr(ptr, '=')) != NULL) {
+        frame->step = strtol(ptr + 1, &end, 10);
+        frame->hasStep = end != ptr + 1;
+    }
+
+    for (k = 0; k < 9; k++) frame->box[k] = cell[k] * factor;
+    frame->hasBox = 1;
+
+    if (metaOnly) return skip_lines(self, self->nAtoms);
+
+    if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+    if (read_line_block(self, self->nAtoms) == -1) return -1;
+    tok = &(self->tokens);
+    line = self->block;
+
+    for (pos = 0; pos < self->nAtoms; pos++) {
+        if (tok->lineFields[pos] < 3) {
+            set_error(self, PyExc_IOError, "Missing coordinate");
+            return -1; }
+        field = tok->lineFirst[pos];
+        u = parseFloat(line + tok->fieldBegin[field], line + tok->fieldEnd[field], NULL);
+        v = parseFloat(line + tok->fieldBegin[field+1], line + tok->fieldEnd[field+1], NULL);
+        w = parseFloat(line + tok->fieldBegin[field+2], line + tok->fieldEnd[field+2], NULL);
+        if (cartesian) {
+            frame->xyz[3*pos + 0] = u * self->xdatcarScale * factor;
+            frame->xyz[3*pos + 1] = v * self->xdatcarScale * factor;
+            frame->xyz[3*pos + 2] = w * self->xdatcarScale * factor;
+        } else
+            for (k = 0; k < 3; k++)
+                frame->xyz[3*pos + k] = (u * cell[k] + v * cell[3+k] + w * cell[6+k]) * factor;
+    }
+
+    return 0;
+}
+
+
+/* Map the NetCDF file opened as self->fd and parse its header; the *
+ * number of atoms is taken from the coordinates. The GIL is not    *
+ * needed.                                                          */
+static int open_netcdf(Trajectory *self) {
+    const CdfVariable *var;
+    struct stat st;
+    void *data;
+
+    if (self->cdf == NULL && (self->cdf = (CdfFile*) malloc(sizeof(CdfFile))) == NULL) {
+        set_error(self, PyExc_MemoryError, NULL);
+        return -1; }
+    if (fstat(fileno(self->fd), &st)) {
+        set_error(self, PyExc_IOError, NULL);
+        return -1; }
+    if (st.st_size < 8) {
+        set_error(self, PyExc_IOError, "Not a NetCDF file");
+        return -1; }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(self->fd), 0);
+    if (data == MAP_FAILED) {
+        set_error(self, PyExc_IOError, NULL);
+        return -1; }
+    self->cdfData = (const unsigned char*) data;
+    self->cdfSize = st.st_size;
+    self->nextRecord = 0;
+
+    if (cdfParseHeader(self->cdf, self->cdfData, self->cdfSize) == -1) {
+        set_error(self, PyExc_IOError, memcmp(data, "\x89HDF", 4)
+                  ? "Not a classic or 64-bit offset NetCDF file"
+                  : "NetCDF-4 (HDF5) files are not supported");
+        return -1; }
+    var = cdfFind(self->cdf, "coordinates");
+    if (var == NULL || !var->record || var->nDims != 3 || var->shape[2] != 3) {
+        set_error(self, PyExc_IOError, "Missing coordinates in NetCDF file");
+        return -1; }
+    if (self->nAtoms > 0 && var->shape[1] != self->nAtoms) {
+        set_error(self, PyExc_RuntimeError, "Number of atoms different than expected");
+        return -1; }
+    self->nAtoms = var->shape[1];
+
+    return 0;
+}
+
+
+/* Record of the variable, or NULL if it is missing or is not a *
+ * record variable of the expected size                         */
+static const unsigned char *netcdf_record(Trajectory *self, const char *name,
+                                          long count, const CdfVariable **var) {
+    *var = cdfFind(self->cdf, name);
+    if (*var == NULL || !(*var)->record || cdfCount(*var) != count) return NULL;
+    return self->cdfData + (*var)->begin + self->nextRecord * self->cdf->recordSize;
+}
+
+
+/* Frames of AMBER NetCDF files are records of the mapped file: *
+ * coordinates, velocities, time and box are decoded from them.  *
+ * The GIL is not needed.                                        */
+static int read_frame_from_netcdf(Trajectory *self, FrameData *frame, int metaOnly) {
+    const CdfVariable *var, *angles;
+    const unsigned char *data, *angleData;
+    ARRAY_REAL cell[6], time;
+    double factor;
+    long nValues = 3L * self->nAtoms;
+
+    if (self->nextRecord >= self->cdf->nRecords) return 1;
+
+    switch(self->units) {
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+        default: factor = 1.0; break;
+    }
+
+    if (!metaOnly) {
+        data = netcdf_record(self, "coordinates", nValues, &var);
+        if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+        cdfDecode(var, data, frame->xyz, nValues, factor);
+
+        // Velocities are scaled to Angstrom/ps by their scale_factor
+        if ((data = netcdf_record(self, "velocities", nValues, &var)) != NULL) {
+            if (alloc_frame_array(self, &(frame->vel), 3) == -1) return -1;
+            cdfDecode(var, data, frame->vel, nValues, 1.0);
+            frame->hasVel = 1;
+        }
+    }
+
+    if ((data = netcdf_record(self, "time", 1, &var)) != NULL) {
+        cdfDecode(var, data, &time, 1, 1.0);
+        frame->time = time;
+        frame->hasTime = 1;
+    }
+
+    if ((data = netcdf_record(self, "cell_lengths", 3, &var)) != NULL
+            && (angleData = netcdf_record(self, "cell_angles", 3, &angles)) != NULL) {
+        cdfDecode(var, data, cell, 3, factor);
+        cdfDecode(angles, angleData, cell + 3, 3, 1.0);
+        if (cell[0] > 0.0 && cell[1] > 0.0 && cell[2] > 0.0) {
+            cell_to_box(cell, frame->box);
+            frame->hasBox = 1;
+        }
+    }
+
+    self->nextRecord += 1;
+    return 0;
+}
+
+#ifdef HAVE_HDF5
+/* Open the H5MD file as the current one; the number of atoms is   *
+ * taken from the positions. The GIL is not needed.                */
+static int open_h5md(Trajectory *self, const char *name) {
+
+    if (self->h5md == NULL) {
+        if ((self->h5md = (H5mdFile*) malloc(sizeof(H5mdFile))) == NULL) {
+            set_error(self, PyExc_MemoryError, NULL);
+            return -1; }
+        h5mdInit(self->h5md);
+    }
+    if (h5mdOpen(self->h5md, name, 'r')) {
+        set_error(self, PyExc_IOError, self->h5md->error);
+        return -1; }
+    if (self->nAtoms > 0 && self->h5md->nAtoms != self->nAtoms) {
+        set_error(self, PyExc_RuntimeError, "Number of atoms different than expected");
+        return -1; }
+    self->nAtoms = self->h5md->nAtoms;
+    self->nextRecord = 0;
+
+    return 0;
+}
+
+
+/* Symbols of H5MD files are the names of species, if they are given *
+ * in the 'names' attribute, otherwise the species numbers.           */
+static int read_topo_from_h5md(Trajectory *self) {
+    char **names, number[16];
+    const char *name;
+    int *codes, nNames, i, status;
+
+    if ((status = h5mdSpecies(self->h5md, &codes, &names, &nNames)) == -1) {
+        PyErr_SetString(PyExc_IOError, self->h5md->error);
         return -1; }
+    if (status == 0) {
+        self->symbolTable = nameTableNew();
+        self->symbolCodes = (int*) malloc(self->nAtoms * sizeof(int));
+        if (self->symbolTable == NULL || self->symbolCodes == NULL) {
+            PyErr_NoMemory();
+            status = -1; }
+        for (i = 0; i < self->nAtoms && status == 0; i++) {
+            if (codes[i] >= 0 && codes[i] < nNames)
+                name = names[codes[i]];
+            else {
+                snprintf(number, sizeof(number), "%d", codes[i]);
+                name = number;
+            }
+            if ((self->symbolCodes[i] = nameTableIntern(self->symbolTable, name, -1)) == -1)
+                status = -1;
+        }
+        for (i = 0; i < nNames; i++) free(names[i]);
+        free(names);
+        free(codes);
+        if (status == -1) return -1;
+    }
+
+    if (self->nFiles == 1) self->totalFrames = self->h5md->nFrames;
+    return 0;
+}
+
+
+/* Frames of H5MD files are read from the datasets by index. Units *
+ * of the file are used, if given. The GIL is not needed.          */
+static int read_frame_from_h5md(Trajectory *self, FrameData *frame, int metaOnly) {
+    H5mdFile *h5 = self->h5md;
+    long frameIndex = self->nextRecord;
+    double factor, time;
+    long step;
+    int known;
+
+    if (frameIndex >= h5->nFrames) return 1;
+
+    switch(self->units) {
+        case NM: factor = 10.0; break;
+        case BOHR: factor = BOHRTOANGS; break;
+        default: factor = 1.0; break;
+    }
+
+    if (!metaOnly) {
+        if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+        if (h5mdRead(h5, &(h5->position), frameIndex, 1, NULL, 0,
+                h5->position.factor > 0.0 ? h5->position.factor : factor, frame->xyz)) {
+            set_error(self, PyExc_IOError, h5->error);
+            return -1; }
+
+        if (h5->velocity.value >= 0 && frameIndex < (long)h5->velocity.dims[0]) {
+            if (alloc_frame_array(self, &(frame->vel), 3) == -1) return -1;
+            if (h5mdRead(h5, &(h5->velocity), frameIndex, 1, NULL, 0,
+                    h5->velocity.factor > 0.0 ? h5->velocity.factor : factor, frame->vel)) {
+                set_error(self, PyExc_IOError, h5->error);
+                return -1; }
+            frame->hasVel = 1;
+        }
+    }
+
+    if ((known = h5mdStepTime(h5, &(h5->position), frameIndex, &step, &time)) == -1) {
+        set_error(self, PyExc_IOError, h5->error);
+        return -1; }
+    if (known & 1) {
+        frame->step = step;
+        frame->hasStep = 1; }
+    if (known & 2) {
+        frame->time = time;
+        frame->hasTime = 1; }
+
+    switch (h5mdReadBox(h5, frameIndex, h5->boxFactor > 0.0 ? h5->boxFactor : factor,
+                        frame->box)) {
+        case -1:
+            set_error(self, PyExc_IOError, h5->error);
+            return -1;
+        case 0:
+            frame->hasBox = 1;
+            break;
+    }
+
+    self->nextRecord += 1;
+    return 0;
+}
+#endif
+
+
+
+
+
+
+
+
+#ifdef HAVE_GROMACS
+static int read_frame_from_xtc(Trajectory *self, FrameData *frame) {
+
+    matrix mbox;
+    float time, prec;
+    gmx_bool bOK;
+    int i, k, step;
+
+    if (!read_next_xtc(self->xd, self->nAtoms, &step, &time, mbox, self->xtcCoord, &prec, &bOK))
+        return 1;
+
+    if (!bOK) {
+        set_error(self, PyExc_IOError, "Corrupted frame");
+        return -1;
+    }
+
+    frame->step = step;
+    frame->hasStep = 1;
+    frame->time = time;
+    frame->hasTime = 1;
+
+    /* Times 10, because converting from nm */
+    for (i = 0; i < 3; i++)
+        for (k = 0; k < 3; k++)
+            frame->box[3*i + k] = (ARRAY_REAL)mbox[i][k] * 10;
+    frame->hasBox = 1;
+
+    if (alloc_frame_array(self, &(frame->xyz), 3) == -1) return -1;
+    for (i = 0; i < self->nAtoms; i++) {
+        frame->xyz[i*3 + 0] = (ARRAY_REAL)(self->xtcCoord[i][0] * 10.0);
+        frame->xyz[i*3 + 1] = (ARRAY_REAL)(self->xtcCoord[i][1] * 10.0);
+        frame->xyz[i*3 + 2] = (ARRAY_REAL)(self->xtcCoord[i][2] * 10.0);
+    }
+
+    return 0;
+}
+
+
+/* Big-endian (XDR) integer or float from the file */
+static int read_xdr_int(FILE *fp, int *value) {
+    unsigned char b[4];
+
+    if (fread(b, 1, 4, fp) != 4) return -1;
+    *value = (int)(((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16)
+                 | ((unsigned int)b[2] << 8) | (unsigned int)b[3]);
+    return 0;
+}
+
+
+static int read_xdr_float(FILE *fp, float *value) {
+    union { int i; float f; } u;
+
+    if (read_xdr_int(fp, &(u.i)) == -1) return -1;
+    *value = u.f;
+    return 0;
+}
 
-    self->nAtoms = nofatoms;
 
-    // Get rid of Py_None in self->symbols etc. 
-    Py_DECREF(self->symbols);
-    self->symbols = PyList_New(nofatoms);
-    Py_DECREF(self->resNames);
-    self->resNames = PyList_New(nofatoms);
+/* Read the header of an XTC frame and jump over the compressed *
+ * coordinates, using the size stored in the frame.             */
+static int skip_frame_from_xtc(Trajectory *self, FrameData *frame) {
+    FILE *fp = gmx_fio_getfp(self->xd);
+    int magic, natoms, step, nbytes, i;
+    float time, value;
+    long skip;
 
-    resid = (int*) malloc(nofatoms * sizeof(int));
-    if(resid == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
+    if (read_xdr_int(fp, &magic) == -1) return 1;
+    if (magic != 1995 || read_xdr_int(fp, &natoms) || read_xdr_int(fp, &step)
+            || read_xdr_float(fp, &time)) {
+        set_error(self, PyExc_IOError, "Corrupted frame");
+        return -1; }
+    if (natoms != self->nAtoms) {
+        set_error(self, PyExc_RuntimeError,
+            "Number of atoms different than expected");
         return -1; }
 
-    // Atom loop 
-    for(pos = 0; pos < nofatoms; pos++) {
+    for (i = 0; i < 9; i++) {
+        if (read_xdr_float(fp, &value)) {
+            set_error(self, PyExc_IOError, "Corrupted frame");
+            return -1; }
+        frame->box[i] = (ARRAY_REAL)value * 10;
+    }
+    frame->hasBox = 1;
+    frame->step = step;
+    frame->hasStep = 1;
+    frame->time = time;
+    frame->hasTime = 1;
+
+    // Small systems are stored uncompressed; otherwise the header of the
+    // coordinates (precision, ranges, small index) is followed by the size
+    if (read_xdr_int(fp, &natoms)) {
+        set_error(self, PyExc_IOError, "Corrupted frame");
+        return -1; }
+    if (natoms <= 9)
+        skip = 12L * natoms;
+    else {
+        if (fseek(fp, 4 + 24 + 4, SEEK_CUR) || read_xdr_int(fp, &nbytes)) {
+            set_error(self, PyExc_IOError, "Corrupted frame");
+            return -1; }
+        skip = ((long)nbytes + 3) & ~3L;
+    }
+    if (fseek(fp, skip, SEEK_CUR)) {
+        set_error(self, PyExc_IOError, NULL);
+        return -1; }
 
-        // Get the whole line 
-        if (_getline(&buffer, &buflen, self->fd) == -1) return -1;
+    return 0;
+}
+#endif /* HAVE_GROMACS */
 
-        // Read residue id 
-        strncpy(symbuf, buffer, 5);
-        symbuf[5] = '\0';
-        stripline(symbuf);
-        resid[pos] = atoi(symbuf);
 
-        // Read residue name 
-        strncpy(symbuf, buffer+5, 5);
-        symbuf[5] = '\0';
-        stripline(symbuf);
-        val = Py_BuildValue("s", symbuf);
-        PyList_SetItem(self->resNames, pos, val);
 
-        // Read atom name 
-        strncpy(symbuf, buffer+10, 5);
-        symbuf[5] = '\0';
-        stripline(symbuf);
-        val = Py_BuildValue("s", symbuf);
-        PyList_SetItem(self->symbols, pos, val);
-    }
+/* Make sure that the output buffer can hold at least size bytes; *
+ * does not touch Python objects, so it is safe without the GIL.   */
+static int reserve_output(Trajectory *self, long size) {
+	char *tmp;
 
-    // Free the line buffer 
-    free(buffer);
+	if (size <= self->outSize) return 0;
+	if (size < 2 * self->outSize) size = 2 * self->outSize;
+	tmp = (char*) realloc(self->outBuf, size);
+	if (tmp == NULL) return -1;
+	self->outBuf = tmp;
+	self->outSize = size;
+	return 0;
+}
 
-    // Add residue IDs to the dictionary 
-    dims[0] = nofatoms;
-    dims[1] = 1;
-    Py_DECREF(self->resids);
-    self->resids = PyArray_SimpleNewFromData(1, dims, NPY_INT, resid);
-    // **************************************************************
-    // Do not free the raw array! It will be still used by Python! *
-    // **************************************************************
 
-    return 0;
-}
+/* Append one XYZ frame to the output buffer at position *used. The *
+ * coordinates must be a contiguous (nAtoms, 3) array of doubles.   *
+ * Python API is not used, so this may run without the GIL.         */
+static int format_xyz_frame(Trajectory *self, long *used, const double *xyz,
+							const char *comment, long commentLen) {
+	char *ptr;
+	long lineMax;
+	int at, k, code, len;
+
+	/* Symbols are copied from the table, each line has three numbers  *
+	 * formatted like "% 12.8f"; the buffer is grown if the line could *
+	 * not fit, which only happens for very large numbers.             */
+	lineMax = self->symbolTable->maxLength + 3 * (FORMAT_FIXED_MAX + 1) + 1;
+	if (reserve_output(self, *used + 24 + commentLen
+						+ (long)self->nAtoms * 48 + lineMax))
+		return -1;
 
+	ptr = self->outBuf + *used;
+	ptr += formatInt(ptr, self->nAtoms, 0);
+	*ptr++ = '\n';
+	memcpy(ptr, comment, commentLen);
+	ptr += commentLen;
+	*ptr++ = '\n';
 
+	for (at = 0; at < self->nAtoms; at++) {
+		*used = ptr - self->outBuf;
+		if (*used + lineMax > self->outSize) {
+			if (reserve_output(self, *used + lineMax)) return -1;
+			ptr = self->outBuf + *used;
+		}
+		code = self->symbolCodes[at];
+		len = nameTableLength(self->symbolTable, code);
+		memcpy(ptr, nameTableGet(self->symbolTable, code), len);
+		ptr += len;
+		for (k = 0; k < 3; k++) {
+			*ptr++ = ' ';
+			ptr += formatFixed(ptr, xyz[3*at + k], 12, 8, ' ');
+		}
+		*ptr++ = '\n';
+	}
+	*used = ptr - self->outBuf;
 
+	return 0;
+}
 
-/* 
- * WARNING: This function is used by other format than XYZ,
- * like Molden for instance, so be careful with implementation.
- */
 
-static PyObject *read_frame_from_xyz(Trajectory *self, int doWrap, ARRAY_REAL *box) {
+/* Copy a name to ptr, padded with blanks to width columns */
+static int format_name(char *ptr, const char *name, int len, int width, int left) {
+	int n = 0;
 
-    PyObject *py_result, *py_coord;
-	PyObject *py_extra;
-	PyObject *val, *key;
-    char *buffer = NULL;
-	char *buffpos, *token;
-	size_t buflen;
-    int pos, nat;
-    float factor;
-    ARRAY_REAL *xyz;
-	ARRAY_REAL *extra;
-	unsigned short int extra_present;
-    npy_intp dims[2];
+	if (!left) while (n < width - len) ptr[n++] = ' ';
+	memcpy(ptr + n, name, len);
+	n += len;
+	if (left) while (n < width) ptr[n++] = ' ';
+	return n;
+}
 
-	if (doWrap && box == NULL) {
-   	    PyErr_SetString(PyExc_RuntimeError,
-				"Requested PBC, but box information is missing");
-       	Py_DECREF(py_result);
-        return NULL; }
 
-    switch(self->units) {
-        case ANGS: factor = 1.0; break;
-        case NM: factor = 10.0; break;
-        case BOHR: factor = BOHRTOANGS; break;
-    }
-    /* Create the dictionary that will be returned */
-    py_result = PyDict_New();
+/* Append one GRO frame to the output buffer at position *used; vel *
+ * and box may be NULL. Coordinates and box are in Angstroms and    *
+ * are converted to nm; numbers are rounded to float, as the        *
+ * precision of the format is low anyway. Safe without the GIL.     */
+static int format_gro_frame(Trajectory *self, long *used, const double *xyz,
+			const double *vel, const double *box, const char *comment, long commentLen) {
+	char *ptr;
+	long lineMax;
+	int i, k, resid, code, nfields;
+	const char *resids;
+	npy_intp residStride = 0;
+	float b[9];
+	int box_order[9][2] = { {0,0}, {1,1}, {2,2}, {0,1}, {0,2}, {1,0}, {1,2}, {2,0}, {2,1} };
 
-	// Number of atoms and comment are present only in these
-	// types & flavours
-	if (self->type == XYZ ||
-		(self->type == MOLDEN && self->moldenStyle == MLGEOM)) {
+	resids = NULL;
+	if (self->resids != Py_None) {
+		resids = PyArray_BYTES((PyArrayObject*)self->resids);
+		residStride = PyArray_STRIDE((PyArrayObject*)self->resids, 0);
+	}
 
-	    /* Read number of atoms */
-	    if (_getline(&buffer, &buflen, self->fd) == -1) {
-	        Py_DECREF(py_result);
-    	    return NULL;
+	lineMax = 2 * 11 + (self->resNameTable != NULL ? self->resNameTable->maxLength : 0)
+				+ self->symbolTable->maxLength + 10 + 6 * FORMAT_FIXED_MAX + 1;
+	if (reserve_output(self, *used + 24 + commentLen
+						+ (long)self->nAtoms * 70 + lineMax))
+		return -1;
+
+	ptr = self->outBuf + *used;
+	memcpy(ptr, comment, commentLen);
+	ptr += commentLen;
+	*ptr++ = '\n';
+	ptr += formatInt(ptr, self->nAtoms, 5);
+	*ptr++ = '\n';
+
+	for (i = 0; i < self->nAtoms; i++) {
+		*used = ptr - self->outBuf;
+		if (*used + lineMax > self->outSize) {
+			if (reserve_output(self, *used + lineMax)) return -1;
+			ptr = self->outBuf + *used;
 		}
 
-	    if (sscanf(buffer, "%d", &nat) != 1) {
-        	PyErr_SetFromErrno(PyExc_IOError);
-	        Py_DECREF(py_result);
-    	    return NULL;
-	    }
+		resid = resids != NULL ? *((const int*)(resids + i*residStride)) : 1;
+		ptr += formatInt(ptr, resid, 5);
+		if (self->resNameTable != NULL) {
+			code = self->resNameCodes[i];
+			ptr += format_name(ptr, nameTableGet(self->resNameTable, code),
+						nameTableLength(self->resNameTable, code), 5, 1);
+		} else
+			ptr += format_name(ptr, "", 0, 5, 1);
+		code = self->symbolCodes[i];
+		ptr += format_name(ptr, nameTableGet(self->symbolTable, code),
+					nameTableLength(self->symbolTable, code), 5, 0);
+		ptr += formatInt(ptr, i+1, 5);
+
+		for (k = 0; k < 3; k++)
+			ptr += formatFixed(ptr, (float)((float)xyz[3*i+k] / 10.0), 8, 3, 0);
+		if (vel != NULL)
+			for (k = 0; k < 3; k++)
+				ptr += formatFixed(ptr, (float)vel[3*i+k], 8, 4, 0);
+		*ptr++ = '\n';
+	}
 
-	    if (nat != self->nAtoms) {
-    	    PyErr_SetString(PyExc_RuntimeError,
-				"Number of atoms different than expected");
-        	Py_DECREF(py_result);
-	        return NULL; }
+	if (box != NULL) {
+		for (i = 0; i < 9; i++)
+			b[i] = (float)box[3*box_order[i][0] + box_order[i][1]] / 10.0;
+		nfields = 3;
+		for (i = 3; i < 9; i++)
+			if (fabs(b[i]) > 1e-6) nfields = 9;
+	} else {
+		for (i = 0; i < 3; i++) b[i] = 0.0;
+		nfields = 3;
+	}
+	*used = ptr - self->outBuf;
+	if (reserve_output(self, *used + 9 * FORMAT_FIXED_MAX + 1)) return -1;
+	ptr = self->outBuf + *used;
+	for (i = 0; i < nfields; i++)
+		ptr += formatFixed(ptr, b[i], 10, 5, 0);
+	*ptr++ = '\n';
+	*used = ptr - self->outBuf;
 
-	    /* Read the comment line */
-    	if (_getline(&buffer, &buflen, self->fd) == -1) {
-	        Py_DECREF(py_result);
-    	    return NULL; }
+	return 0;
+}
 
-	    buffer[strlen(buffer)-1] = '\0';
+/* Element written for an atom name: the name itself if it is an *
+ * element symbol, otherwise its first letter (as in CA, OW, HB2) */
+static int pdb_name_element(const char *name, int len) {
+	int idx;
 
-	    val = Py_BuildValue("s", buffer);
-    	key = PyUnicode_FromString("comment");
-	    PyDict_SetItem(py_result, key, val);
-    	Py_DECREF(key);
-	    Py_DECREF(val);
+	if (len <= 2 && (idx = getElementIndexBySpan(name, len)) != -1) return idx;
+	for (; len > 0 && !isalpha((unsigned char)*name); name++, len--);
+	return len > 0 ? getElementIndexBySpan(name, 1) : -1;
+}
 
+/* Append one PDB model to the output buffer at position *used; box *
+ * may be NULL. The comment goes to TITLE and the box to CRYST1,    *
+ * both before MODEL, as the reader expects. Safe without the GIL.  */
+static int format_pdb_frame(Trajectory *self, long *used, const double *xyz,
+			const double *box, const char *comment, long commentLen) {
+	extern Element element_table[];
+	char *ptr;
+	long lineMax;
+	int i, k, u, v, resid, code, len, elem, pad;
+	const char *resids, *name, *symbol;
+	npy_intp residStride = 0;
+	double cell[6], dot;
+
+	resids = NULL;
+	if (self->resids != Py_None) {
+		resids = PyArray_BYTES((PyArrayObject*)self->resids);
+		residStride = PyArray_STRIDE((PyArrayObject*)self->resids, 0);
 	}
 
-    /* Set-up the raw arrays for coordinates and extra data */
-    xyz = (ARRAY_REAL*) malloc(3 * self->nAtoms * sizeof(ARRAY_REAL));
-    if(xyz == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        Py_DECREF(py_result);
-        return NULL; }
-    extra = (ARRAY_REAL*) malloc(self->nAtoms * sizeof(ARRAY_REAL));
-    if(extra == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        Py_DECREF(py_result);
-        return NULL; }
-    extra_present = 0;
+	lineMax = 30 + 3 * FORMAT_FIXED_MAX + 25;
+	if (reserve_output(self, *used + 11 + commentLen + 81 + 16
+						+ (long)self->nAtoms * 79 + lineMax))
+		return -1;
 
-    /* Atom loop */
-    for(pos = 0; pos < self->nAtoms; pos++) {
+	ptr = self->outBuf + *used;
+	if (commentLen > 0) {
+		memcpy(ptr, "TITLE     ", 10);
+		ptr += 10;
+		memcpy(ptr, comment, commentLen);
+		ptr += commentLen;
+		*ptr++ = '\n';
+	}
 
-        /* Get the whole line */
-        if (_getline(&buffer, &buflen, self->fd) == -1) {
-	        Py_DECREF(py_result);
-            return NULL; }
-        buffer[strlen(buffer)-1] = '\0';
-        buffpos = buffer;
+	if (box != NULL && (box[0] != 0.0 || box[4] != 0.0 || box[8] != 0.0)) {
+		for (i = 0; i < 3; i++)
+			cell[i] = sqrt(box[3*i] * box[3*i] + box[3*i+1] * box[3*i+1]
+							+ box[3*i+2] * box[3*i+2]);
+		// alpha between b and c, beta between a and c, gamma between a and b
+		for (i = 0; i < 3; i++) {
+			u = (i + 1) % 3;
+			v = (i + 2) % 3;
+			if (u > v) { k = u; u = v; v = k; }
+			dot = box[3*u] * box[3*v] + box[3*u+1] * box[3*v+1] + box[3*u+2] * box[3*v+2];
+			cell[3+i] = cell[u] > 0.0 && cell[v] > 0.0 ?
+						acos(dot / (cell[u] * cell[v])) * 180.0 / M_PI : 90.0;
+		}
+		ptr += snprintf(ptr, 81, "CRYST1%9.3f%9.3f%9.3f%7.2f%7.2f%7.2f P 1           1\n",
+						cell[0], cell[1], cell[2], cell[3], cell[4], cell[5]);
+	}
 
-        /* Read symbol */
-        token = strtok(buffpos, " \t");
+	memcpy(ptr, "MODEL     ", 10);
+	ptr += 10;
+	ptr += formatInt(ptr, ++self->modelsWritten, 4);
+	*ptr++ = '\n';
 
-		// This style has two additional entries
-		if (self->type == MOLDEN && self->moldenStyle == MLATOMS) {
-	        token = strtok(NULL, " \t");
-    	    token = strtok(NULL, " \t");
+	for (i = 0; i < self->nAtoms; i++) {
+		*used = ptr - self->outBuf;
+		if (*used + lineMax > self->outSize) {
+			if (reserve_output(self, *used + lineMax)) return -1;
+			ptr = self->outBuf + *used;
 		}
 
-        /* Read coordinates */
-        if ( (token = strtok(NULL, " \t")) == NULL) {
-            PyErr_SetString(PyExc_IOError, "Missing coordinate");
-            Py_DECREF(py_result);
-            return NULL; }
-        xyz[3*pos + 0] = atof(token) * factor;
-        if ( (token = strtok(NULL, " \t")) == NULL) {
-            PyErr_SetString(PyExc_IOError, "Missing coordinate");
-            Py_DECREF(py_result);
-            return NULL; }
-        xyz[3*pos + 1] = atof(token) * factor;
-        if ( (token = strtok(NULL, " \t")) == NULL) {
-            PyErr_SetString(PyExc_IOError, "Missing coordinate");
-            Py_DECREF(py_result);
-            return NULL; }
-        xyz[3*pos + 2] = atof(token) * factor;
-
-		if (doWrap) wrapPBCsingle(xyz + (3*pos), box);
+		memcpy(ptr, "ATOM  ", 6);
+		ptr += 6;
+		ptr += formatInt(ptr, (i + 1) % 100000, 5);
+		*ptr++ = ' ';
+
+		// Names shorter than four characters start in column 14,
+		// unless they begin with a two-letter element
+		code = self->symbolCodes[i];
+		name = nameTableGet(self->symbolTable, code);
+		len = nameTableLength(self->symbolTable, code);
+		elem = pdb_name_element(name, len);
+		symbol = elem != -1 ? element_table[elem].symbol : "";
+		pad = len < 4 && !(symbol[0] != '\0' && symbol[1] != '\0');
+		if (pad) *ptr++ = ' ';
+		ptr += format_name(ptr, name, len < 4 ? len : 4, pad ? 3 : 4, 1);
+		*ptr++ = ' ';
+
+		if (self->resNameTable != NULL) {
+			code = self->resNameCodes[i];
+			len = nameTableLength(self->resNameTable, code);
+			ptr += format_name(ptr, nameTableGet(self->resNameTable, code),
+						len < 4 ? len : 4, 4, 1);
+		} else
+			ptr += format_name(ptr, "", 0, 4, 1);
+		*ptr++ = self->chainTable != NULL && nameTableLength(self->chainTable,
+					self->chainCodes[i]) > 0 ?
+					nameTableGet(self->chainTable, self->chainCodes[i])[0] : ' ';
+
+		resid = resids != NULL ? *((const int*)(resids + i*residStride)) : 1;
+		ptr += formatInt(ptr, resid % 10000, 4);
+		memcpy(ptr, "    ", 4);
+		ptr += 4;
+
+		for (k = 0; k < 3; k++)
+			ptr += formatFixed(ptr, xyz[3*i+k], 8, 3, 0);
+		memcpy(ptr, "  1.00  0.00          ", 22);
+		ptr += 22;
+		// Element, right-justified in columns 77-78
+		*ptr++ = symbol[0] != '\0' && symbol[1] != '\0' ? toupper((unsigned char)symbol[0]) : ' ';
+		*ptr++ = symbol[0] == '\0' ? ' ' : symbol[1] != '\0'
+					? toupper((unsigned char)symbol[1]) : symbol[0];
+		*ptr++ = '\n';
+	}
 
-        // Read charge, if present
-        token = strtok(NULL, " \t");
-        if ( token != NULL ) {
+	*used = ptr - self->outBuf;
+	if (reserve_output(self, *used + 7)) return -1;
+	ptr = self->outBuf + *used;
+	memcpy(ptr, "ENDMDL\n", 7);
+	*used += 7;
 
-            // This is bad: until now, there were no extra data
-            if ( pos > 0 && !extra_present ) {
-                PyErr_SetString(PyExc_IOError, "Unexpected extra data found");
-                Py_DECREF(py_result);
-                return NULL;
-            }
+	return 0;
+}
 
-            extra_present = 1;
-            extra[pos] = atof(token);
 
-        } else {
+/* Append a frame in the format of the trajectory; vel and box are *
+ * ignored by the formats that do not store them.                  */
+static int format_frame(Trajectory *self, long *used, const double *xyz,
+			const double *vel, const double *box, const char *comment, long commentLen) {
 
-            // This is bad: we were expecting extra data here and found nothing
-            if ( pos > 0 && extra_present ) {
-                PyErr_SetString(PyExc_IOError, "Inconsistent extra data");
-                Py_DECREF(py_result);
-                return NULL;
-            }
-        }
+	switch (self->type) {
+		case XYZ:
+			return format_xyz_frame(self, used, xyz, comment, commentLen);
+		case GRO:
+			return format_gro_frame(self, used, xyz, vel, box, comment, commentLen);
+		case PDB:
+			return format_pdb_frame(self, used, xyz, box, comment, commentLen);
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+}
 
-    }
-    free(buffer);
 
-    /* Add coordinates to the dictionary */
-    dims[0] = self->nAtoms;
-    dims[1] = 3;
-    py_coord = PyArray_SimpleNewFromData(2, dims, NPY_ARRAY_REAL, xyz);
-    /***************************************************************
-     * Do not free the raw array! It will be still used by Python! *
-     ***************************************************************/
-
-    key = PyUnicode_FromString("coordinates");
-    PyDict_SetItem(py_result, key, py_coord);
-    Py_DECREF(key);
-    Py_DECREF(py_coord);
-
-
-    /* Add extra data, if present */
-    if ( extra_present ) {
-        py_extra = PyArray_SimpleNewFromData(1, dims, NPY_ARRAY_REAL, extra);
-        key = PyUnicode_FromString("extra");
-        PyDict_SetItem(py_result, key, py_extra);
-        Py_DECREF(key);
-        Py_DECREF(py_extra);
-    } else
-        // Free the extra data ONLY if the Python object was not created!
-        free(extra);
 
-    return py_result;
+/* Return a C-contiguous array of doubles with the given number of *
+ * dimensions, converting the input if necessary (new reference).  */
+static PyArrayObject *as_double_array(PyObject *array, int ndim) {
+	PyArrayObject *converted;
 
+	converted = (PyArrayObject*) PyArray_FROMANY(array, NPY_DOUBLE, 0, 0,
+							NPY_ARRAY_CARRAY_RO | NPY_ARRAY_FORCECAST);
+	if (converted != NULL && PyArray_NDIM(converted) != ndim) {
+		PyErr_Format(PyExc_RuntimeError, "Array must be %dD", ndim);
+		Py_DECREF(converted);
+		return NULL; }
+	return converted;
 }
 
 
+static int write_frame_to_xyz(Trajectory *self, PyObject *py_coords, char *comment) {
+	PyArrayObject *coords;
+	long used = 0;
+	int out;
 
+	// Double should be accurate enough for writing
+	if ((coords = as_double_array(py_coords, 2)) == NULL) return -1;
+	out = format_xyz_frame(self, &used, (const double*) PyArray_DATA(coords),
+					comment != NULL ? comment : "", comment != NULL ? strlen(comment) : 0);
+	Py_DECREF(coords);
+	if (out) {
+		PyErr_SetFromErrno(PyExc_MemoryError);
+		return -1; }
 
-static PyObject *read_frame_from_gro(Trajectory *self, int doWrap, ARRAY_REAL *newbox) {
-
-    int nat, pos;
-    char *buffer = NULL;
-	size_t buflen;
-    ARRAY_REAL *xyz, *vel, *box;
-    unsigned short int velocities_present = 0;
-	ARRAY_REAL wrapBox[3];
-
-    npy_intp dims[2];
+	if (fwrite(self->outBuf, 1, used, self->fd) != (size_t)used) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return -1; }
 
-    PyObject *key, *val, *py_result, *py_coord, *py_vel, *py_box;
+	return 0;
+}
 
 
-    // Create the dictionary that will be returned 
-    py_result = PyDict_New();
 
-    // Read the comment line 
-    if (_getline(&buffer, &buflen, self->fd) == -1) return NULL;
+static int write_frame_to_gro(Trajectory *self, PyObject *py_coords,
+				PyObject *py_vel, PyObject *py_box, char *comment) {
+	PyArrayObject *coords, *vel = NULL, *box = NULL;
+	long used = 0;
+	int out;
 
-    if (buffer[0] == '\0') {
-        free(buffer);
-        return NULL; }
-    
-    buffer[strlen(buffer)-1] = '\0';
-    stripline(buffer);
+	coords = as_double_array(py_coords, 2);
+	if (py_vel != NULL) vel = as_double_array(py_vel, 2);
+	if (py_box != NULL) box = as_double_array(py_box, 2);
+	if (coords == NULL || (py_vel != NULL && vel == NULL)
+			|| (py_box != NULL && box == NULL)) {
+		Py_XDECREF(coords);
+		Py_XDECREF(vel);
+		Py_XDECREF(box);
+		return -1; }
 
-    val = Py_BuildValue("s", buffer);
-    key = PyUnicode_FromString("comment");
-    PyDict_SetItem(py_result, key, val);
-    Py_DECREF(key);
-    Py_DECREF(val);
+	out = format_gro_frame(self, &used, (const double*) PyArray_DATA(coords),
+				vel != NULL ? (const double*) PyArray_DATA(vel) : NULL,
+				box != NULL ? (const double*) PyArray_DATA(box) : NULL,
+				comment != NULL ? comment : "", comment != NULL ? strlen(comment) : 0);
+	Py_DECREF(coords);
+	Py_XDECREF(vel);
+	Py_XDECREF(box);
+	if (out) {
+		PyErr_SetFromErrno(PyExc_MemoryError);
+		return -1; }
 
-    // Read number of atoms 
-    if (_getline(&buffer, &buflen, self->fd) == -1) return NULL;
-    if( sscanf(buffer, "%d", &nat) != 1 || nat != self->nAtoms) {
-        PyErr_SetString(PyExc_IOError, "Incorrect atom number");
-        free(buffer);
-        return NULL; }
+	if (fwrite(self->outBuf, 1, used, self->fd) != (size_t)used) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return -1; }
 
-    // Set-up the raw arrays for coordinates and charges 
-    xyz = (ARRAY_REAL*) malloc(3 * self->nAtoms * sizeof(ARRAY_REAL));
-    if(xyz == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return NULL; }
-    vel = (ARRAY_REAL*) malloc(3 * self->nAtoms * sizeof(ARRAY_REAL));
-    if(vel == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return NULL; }
-    box = (ARRAY_REAL*) malloc(9 * sizeof(ARRAY_REAL));
-    if(box == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return NULL; }
+	return 0;
+}
 
-    // Atom loop 
-    for(pos = 0; pos < self->nAtoms; pos++) {
 
-        // Get the whole line 
-        if (_getline(&buffer, &buflen, self->fd) == -1) return NULL;
-        if(pos == 0 && strlen(buffer) > 50) velocities_present = 1;
+static int write_frame_to_pdb(Trajectory *self, PyObject *py_coords,
+				PyObject *py_box, char *comment) {
+	PyArrayObject *coords, *box = NULL;
+	long used = 0;
+	int out;
 
-        // Read coordinates 
-        xyz[3*pos + 0] = strPartFloat(buffer, 20, 8) * 10.0;
-        xyz[3*pos + 1] = strPartFloat(buffer, 28, 8) * 10.0;
-        xyz[3*pos + 2] = strPartFloat(buffer, 36, 8) * 10.0;
+	coords = as_double_array(py_coords, 2);
+	if (py_box != NULL) box = as_double_array(py_box, 2);
+	if (coords == NULL || (py_box != NULL && box == NULL)) {
+		Py_XDECREF(coords);
+		Py_XDECREF(box);
+		return -1; }
 
-        // Read velocities 
-        if(velocities_present) {
-            vel[3*pos + 0] = strPartFloat(buffer, 44, 8);
-            vel[3*pos + 1] = strPartFloat(buffer, 52, 8);
-            vel[3*pos + 2] = strPartFloat(buffer, 60, 8);
-        }
-    }
+	out = format_pdb_frame(self, &used, (const double*) PyArray_DATA(coords),
+				box != NULL ? (const double*) PyArray_DATA(box) : NULL,
+				comment != NULL ? comment : "", comment != NULL ? strlen(comment) : 0);
+	Py_DECREF(coords);
+	Py_XDECREF(box);
+	if (out) {
+		PyErr_SetFromErrno(PyExc_MemoryError);
+		return -1; }
 
-    // Get the cell line 
-    if (_getline(&buffer, &buflen, self->fd) == -1) return NULL;
-    box[3*0 + 0] = strPartFloat(buffer,  0, 10) * 10.0;
-    box[3*1 + 1] = strPartFloat(buffer, 10, 10) * 10.0;
-    box[3*2 + 2] = strPartFloat(buffer, 20, 10) * 10.0;
-    if (strlen(buffer) > 31) box[3*0 + 1] = strPartFloat(buffer, 30, 10) * 10.0;
-    else                     box[3*0 + 1] = 0.0;
-    if (strlen(buffer) > 41) box[3*0 + 2] = strPartFloat(buffer, 40, 10) * 10.0;
-    else                     box[3*0 + 2] = 0.0;
-    if (strlen(buffer) > 51) box[3*1 + 0] = strPartFloat(buffer, 50, 10) * 10.0;
-    else                     box[3*1 + 0] = 0.0;
-    if (strlen(buffer) > 61) box[3*1 + 2] = strPartFloat(buffer, 60, 10) * 10.0;
-    else                     box[3*1 + 2] = 0.0;
-    if (strlen(buffer) > 71) box[3*2 + 0] = strPartFloat(buffer, 70, 10) * 10.0;
-    else                     box[3*2 + 0] = 0.0;
-    if (strlen(buffer) > 81) box[3*2 + 1] = strPartFloat(buffer, 80, 10) * 10.0;
-    else                     box[3*2 + 1] = 0.0;
-    free(buffer);
-
-	if (doWrap) {
-		if (newbox == NULL) {
-			wrapBox[0] = box[0];
-			wrapBox[1] = box[4];
-			wrapBox[2] = box[8];
-			wrapPBC(xyz, self->nAtoms, wrapBox);
-		} else {
-			wrapPBC(xyz, self->nAtoms, newbox);
-		}
-	}
+	if (fwrite(self->outBuf, 1, used, self->fd) != (size_t)used) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return -1; }
 
-    // Add coordinates to the dictionary 
-    dims[0] = self->nAtoms;
-    dims[1] = 3;
-    py_coord = PyArray_SimpleNewFromData(2, dims, NPY_ARRAY_REAL, (ARRAY_REAL*) xyz);
-    // Do not free the raw array! It will be still used by Python!
+	return 0;
+}
 
-    key = PyUnicode_FromString("coordinates");
-    PyDict_SetItem(py_result, key, py_coord);
-    Py_DECREF(key);
-    Py_DECREF(py_coord);
+#ifdef HAVE_HDF5
+static int write_frame_to_h5md(Trajectory *self, PyObject *py_coords,
+				PyObject *py_vel, PyObject *py_box) {
+	PyArrayObject *coords, *vel = NULL, *box = NULL;
+	int out;
 
+	coords = as_double_array(py_coords, 2);
+	if (py_vel != NULL) vel = as_double_array(py_vel, 2);
+	if (py_box != NULL) box = as_double_array(py_box, 2);
+	if (coords == NULL || (py_vel != NULL && vel == NULL)
+			|| (py_box != NULL && box == NULL)) {
+		Py_XDECREF(coords);
+		Py_XDECREF(vel);
+		Py_XDECREF(box);
+		return -1; }
 
-    // Add velocities to the dictionary 
-    if(velocities_present) {
-        py_vel = PyArray_SimpleNewFromData(2, dims, NPY_ARRAY_REAL, (ARRAY_REAL*) vel);
-        // Do not free the raw array! It will be still used by Python!
+	Py_BEGIN_ALLOW_THREADS
+	out = h5mdAppend(self->h5md, 1, (const double*) PyArray_DATA(coords),
+				vel != NULL ? (const double*) PyArray_DATA(vel) : NULL,
+				box != NULL ? (const double*) PyArray_DATA(box) : NULL, 9);
+	Py_END_ALLOW_THREADS
+	Py_DECREF(coords);
+	Py_XDECREF(vel);
+	Py_XDECREF(box);
+	if (out) {
+		PyErr_SetString(PyExc_IOError, self->h5md->error);
+		return -1; }
 
-        key = PyUnicode_FromString("velocities");
-        PyDict_SetItem(py_result, key, py_vel);
-        Py_DECREF(key);
-        Py_DECREF(py_vel);
-    } else
-        free(vel);
+	return 0;
+}
+#endif
 
-    dims[0] = 3;
-    dims[1] = 3;
-    py_box = PyArray_SimpleNewFromData(2, dims, NPY_ARRAY_REAL, (ARRAY_REAL*) box);
-    key = PyUnicode_FromString("box");
-    PyDict_SetItem(py_result, key, py_box);
-    Py_DECREF(key);
-    Py_DECREF(py_box);
 
-    return py_result;
 
-}
 
 
+/* End of helper functions */
 
 
-#ifdef HAVE_GROMACS
-static PyObject *read_frame_from_xtc(Trajectory *self, int doWrap, ARRAY_REAL *newbox) {
 
-    PyObject *py_dict, *val, *key, *py_coord, *py_box;
-    matrix mbox;
-    ARRAY_REAL *box, *xyz;
-    ARRAY_REAL wrapBox[3];
-    float time, prec;
-    npy_intp dims[2];
-    gmx_bool bOK;
-    int i, step;
 
-    /* Create the dictionary that will be returned */
-    py_dict = PyDict_New();
 
-    if (!read_next_xtc(self->xd, self->nAtoms, &step, &time, mbox, self->xtcCoord, &prec, &bOK)) {
-        Py_DECREF(py_dict);
-        Py_RETURN_NONE;
-    }
+/* Reading side of convert(): fills the ring of frames in the queue, *
+ * keeping every stride-th frame of the source. Runs without the GIL. */
+static void *convert_reader(void *arg) {
+	ConvertQueue *q = (ConvertQueue*) arg;
+	FrameData *frame;
+	long skip;
+	int status = 0;
 
-    if (!bOK) {
-        PyErr_SetString(PyExc_IOError, "Corrupted frame");
-        return NULL;
-    }
+	pthread_mutex_lock(&q->lock);
+	while (!q->stop) {
+		if (q->count == CONVERT_SLOTS) {
+			pthread_cond_wait(&q->cond, &q->lock);
+			continue; }
+		frame = q->frames + q->head;
+		pthread_mutex_unlock(&q->lock);
 
-    val = Py_BuildValue("i", step);
-    key = PyUnicode_FromString("step");
-    PyDict_SetItem(py_dict, key, val);
-    Py_DECREF(key);
-    Py_DECREF(val);
+		status = next_frame_data(q->src, frame, 0);
 
-    val = Py_BuildValue("f", time);
-    key = PyUnicode_FromString("time");
-    PyDict_SetItem(py_dict, key, val);
-    Py_DECREF(key);
-    Py_DECREF(val);
+		pthread_mutex_lock(&q->lock);
+		if (status != 0) break;
+		q->head = (q->head + 1) % CONVERT_SLOTS;
+		q->count += 1;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
 
-    box = (ARRAY_REAL*) malloc(9 * sizeof(ARRAY_REAL));
-    if(box == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return NULL; }
+		// Frames in between are read, but not passed on
+		for (skip = 1; status == 0 && skip < q->stride; skip++)
+			status = next_frame_data(q->src, &(q->src->frame), 1);
 
-    /* Only orthogonal boxes; implement other later */
-    box[0] = (ARRAY_REAL)mbox[0][0] * 10;
-    box[1] = (ARRAY_REAL)mbox[0][1] * 10;
-    box[2] = (ARRAY_REAL)mbox[0][2] * 10;
-    box[3] = (ARRAY_REAL)mbox[1][0] * 10;
-    box[4] = (ARRAY_REAL)mbox[1][1] * 10;
-    box[5] = (ARRAY_REAL)mbox[1][2] * 10;
-    box[6] = (ARRAY_REAL)mbox[2][0] * 10;
-    box[7] = (ARRAY_REAL)mbox[2][1] * 10;
-    box[8] = (ARRAY_REAL)mbox[2][2] * 10;
-
-	if (doWrap) {
-		if (newbox == NULL) {
-			wrapBox[0] = box[0];
-			wrapBox[1] = box[4];
-			wrapBox[2] = box[8];
-		} else {
-			wrapBox[0] = newbox[0];
-			wrapBox[1] = newbox[1];
-			wrapBox[2] = newbox[2];
-		}
+		pthread_mutex_lock(&q->lock);
+		if (status != 0) break;
 	}
+	q->done = 1;
+	q->failed = (status == -1);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
 
-    dims[0] = 3;
-    dims[1] = 3;
-    py_box = PyArray_SimpleNewFromData(2, dims, NPY_ARRAY_REAL, (ARRAY_REAL*) box);
-    key = PyUnicode_FromString("box");
-    PyDict_SetItem(py_dict, key, py_box);
-    Py_DECREF(key);
-    Py_DECREF(py_box);
-
-    /* Set-up the raw arrays for coordinates */
-    xyz = (ARRAY_REAL*) malloc(3 * self->nAtoms * sizeof(ARRAY_REAL));
-    if(xyz == NULL) {
-        PyErr_SetFromErrno(PyExc_MemoryError);
-        return NULL; }
+	return NULL;
+}
 
-    for (i = 0; i < self->nAtoms; i++) {
-        /* Times 10, because converting from nm */
-        xyz[i*3    ] = (ARRAY_REAL)(self->xtcCoord[i][0] * 10.0);
-        xyz[i*3 + 1] = (ARRAY_REAL)(self->xtcCoord[i][1] * 10.0);
-        xyz[i*3 + 2] = (ARRAY_REAL)(self->xtcCoord[i][2] * 10.0);
-		wrapPBCsingle(xyz + (i*3), wrapBox);
-    }
 
-    /* Add coordinates to the dictionary */
-    dims[0] = self->nAtoms;
-    dims[1] = 3;
-    py_coord = PyArray_SimpleNewFromData(2, dims, NPY_ARRAY_REAL, (ARRAY_REAL*) xyz);
-    /***************************************************************
-     * Do not free the raw array! It will be still used by Python! *
-     ***************************************************************/
+/* Writing side of convert(): formats the frames of the queue and writes *
+ * them to the destination. Runs without the GIL; returns errno of the   *
+ * failure or 0.                                                          */
+static int convert_writer(ConvertQueue *q, Trajectory *dst, const npy_intp *atoms,
+						double *xyz, double *vel, long *written) {
+	FrameData *frame;
+	const double *pxyz, *pvel;
+	char title[64];
+	const char *comment;
+	long used;
+	int i, k, err = 0;
+
+	pthread_mutex_lock(&q->lock);
+	while (1) {
+		while (q->count == 0 && !q->done)
+			pthread_cond_wait(&q->cond, &q->lock);
+		if (q->count == 0) break;
+		frame = q->frames + q->tail;
+		pthread_mutex_unlock(&q->lock);
+
+		pxyz = frame->xyz;
+		pvel = frame->hasVel ? frame->vel : NULL;
+		if (atoms != NULL) {
+			for (i = 0; i < dst->nAtoms; i++)
+				for (k = 0; k < 3; k++) {
+					xyz[3*i + k] = frame->xyz[3*atoms[i] + k];
+					if (pvel != NULL) vel[3*i + k] = frame->vel[3*atoms[i] + k];
+				}
+			pxyz = xyz;
+			if (pvel != NULL) pvel = vel;
+		}
 
-    key = PyUnicode_FromString("coordinates");
-    PyDict_SetItem(py_dict, key, py_coord);
-    Py_DECREF(key);
-    Py_DECREF(py_coord);
+		// Formats without a comment still keep time and step
+		if (frame->hasComment)
+			comment = frame->comment;
+		else if (frame->hasTime) {
+			snprintf(title, sizeof(title), "t= %.5f step= %ld",
+					frame->time, frame->hasStep ? frame->step : 0L);
+			comment = title;
+		} else
+			comment = "";
+
+		used = 0;
+#ifdef HAVE_HDF5
+		if (dst->type == H5MD)
+			err = h5mdAppend(dst->h5md, 1, pxyz, pvel,
+					frame->hasBox ? frame->box : NULL, 9) ? EIO : 0;
+		else
+#endif
+		if ((err = format_frame(dst, &used, pxyz, pvel,
+					frame->hasBox ? frame->box : NULL, comment, strlen(comment))))
+			err = ENOMEM;
+		else if (fwrite(dst->outBuf, 1, used, dst->fd) != (size_t)used)
+			err = errno ? errno : EIO;
+
+		pthread_mutex_lock(&q->lock);
+		q->tail = (q->tail + 1) % CONVERT_SLOTS;
+		q->count -= 1;
+		pthread_cond_broadcast(&q->cond);
+		if (err) break;
+		dst->lastFrame += 1;
+		*written += 1;
+	}
+	// Tell the reader to quit, in case the writer failed
+	q->stop = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
 
-    return py_dict;
+	return err;
 }
-#endif /* HAVE_GROMACS */
 
 
+/* Call the Trajectory constructor with a file name and keywords */
+static Trajectory *open_trajectory(PyObject *fname, PyObject *kwds) {
+	PyObject *args, *traj;
 
-static int write_frame_to_xyz(Trajectory *self, PyObject *py_coords, char *comment) {
-	int type;
-	int at;
-	// Double should be accurate enough for writing
-	double x, y, z;
-	char *sym;
+	if ((args = PyTuple_Pack(1, fname)) == NULL) return NULL;
+	traj = PyObject_Call((PyObject*)&TrajectoryType, args, kwds);
+	Py_DECREF(args);
+	return (Trajectory*) traj;
+}
 
-	fprintf(self->fd, "%d\n", self->nAtoms);
-	if( comment != NULL )
-		fprintf(self->fd, "%s\n", comment);
-	else
-		fprintf(self->fd, "\n");
 
-	type = PyArray_TYPE((PyArrayObject*)py_coords);
+/* Take a subset of names; a list or None */
+static PyObject *select_names(PyObject *names, const npy_intp *atoms, int nAtoms) {
+	PyObject *subset, *item;
+	int i;
 
-	for (at = 0; at < self->nAtoms; at++) {
-		sym = PyUnicode_AsUTF8(PyList_GetItem(self->symbols, at));
-		x = (double)getFromArray2D(py_coords, type, at, 0);
-		y = (double)getFromArray2D(py_coords, type, at, 1);
-		z = (double)getFromArray2D(py_coords, type, at, 2);
-		fprintf(self->fd, "%s % 12.8f % 12.8f % 12.8f\n", sym, x, y, z);
+	if (atoms == NULL || names == Py_None) {
+		Py_INCREF(names);
+		return names; }
+	if ((subset = PyList_New(nAtoms)) == NULL) return NULL;
+	for (i = 0; i < nAtoms; i++) {
+		item = PyList_GET_ITEM(names, atoms[i]);
+		Py_INCREF(item);
+		PyList_SET_ITEM(subset, i, item);
 	}
-	
-	return 0;
+	return subset;
 }
 
 
+/* Add a string to keyword arguments, unless it is NULL */
+static int set_string_option(PyObject *kwds, const char *key, const char *value) {
+	PyObject *py_value;
+	int status;
 
-static int write_frame_to_gro(Trajectory *self, PyObject *py_coords,
-				PyObject *py_vel, PyObject *py_box, char *comment) {
+	if (value == NULL) return 0;
+	if ((py_value = PyUnicode_FromString(value)) == NULL) return -1;
+	status = PyDict_SetItemString(kwds, key, py_value);
+	Py_DECREF(py_value);
+	return status;
+}
 
-	int i, resid, type, vtype;
-	// Using float here, since the accuracy of gro is low anyway
-	float x, y, z, vx, vy, vz;
-	float box[9];
-	char *sym, *resnam;
-	char empty[1] = "";
-	int box_order[9][2] = { {0,0}, {1,1}, {2,2}, {0,1}, {0,2}, {1,0}, {1,2}, {2,0}, {2,1} };
-	npy_intp *dims;
 
-	if( comment != NULL )
-        fprintf(self->fd, "%s\n", comment);
-    else
-        fprintf(self->fd, "\n");
-    fprintf(self->fd, "%5d\n", self->nAtoms);
+/* Open the destination file with the names of the selected atoms */
+static Trajectory *open_destination(PyObject *fname, Trajectory *topo,
+							PyArrayObject *atoms, int nAtoms) {
+	PyObject *kwds, *names, *resids, *resNames, *chains;
+	Trajectory *dst = NULL;
+	const npy_intp *sel = atoms != NULL ? (npy_intp*) PyArray_DATA(atoms) : NULL;
 
-	type = PyArray_TYPE((PyArrayObject*)py_coords);
-	if (py_vel != NULL)
-		vtype = PyArray_TYPE((PyArrayObject*)py_vel);
+	if ((names = Trajectory_getSymbols(topo, NULL)) == NULL) return NULL;
+	if (names == Py_None) {
+		PyErr_SetString(PyExc_ValueError,
+				"Source has no atom names, use the topology argument");
+		Py_DECREF(names);
+		return NULL; }
+	if ((resNames = Trajectory_getResNames(topo, NULL)) == NULL) {
+		Py_DECREF(names);
+		return NULL; }
+	if ((chains = Trajectory_getChains(topo, NULL)) == NULL) {
+		Py_DECREF(names);
+		Py_DECREF(resNames);
+		return NULL; }
 
-    for (i = 0; i < self->nAtoms; i++) {
+	if (atoms != NULL && topo->resids != Py_None)
+		resids = PyArray_TakeFrom((PyArrayObject*)topo->resids,
+							(PyObject*)atoms, 0, NULL, NPY_RAISE);
+	else {
+		resids = topo->resids;
+		Py_INCREF(resids);
+	}
+	Py_SETREF(names, select_names(names, sel, nAtoms));
+	Py_SETREF(resNames, select_names(resNames, sel, nAtoms));
+	Py_SETREF(chains, select_names(chains, sel, nAtoms));
+
+	if (names != NULL && resNames != NULL && chains != NULL && resids != NULL
+			&& (kwds = Py_BuildValue("{s:s,s:O}", "mode", "w", "symbols", names)) != NULL) {
+		if ((resids == Py_None || !PyDict_SetItemString(kwds, "resids", resids))
+				&& (resNames == Py_None
+					|| !PyDict_SetItemString(kwds, "resnames", resNames))
+				&& (chains == Py_None
+					|| !PyDict_SetItemString(kwds, "chains", chains)))
+			dst = open_trajectory(fname, kwds);
+		Py_DECREF(kwds);
+	}
+	Py_XDECREF(names);
+	Py_XDECREF(resNames);
+	Py_XDECREF(chains);
+	Py_XDECREF(resids);
 
-		if (self->resids != Py_None)
-			resid = *((int*) PyArray_GETPTR1((PyArrayObject*)self->resids, i));
-		else
-			resid = 1;
+	return dst;
+}
 
-		if (self->resNames != Py_None)
-			resnam = PyUnicode_AsUTF8(PyList_GetItem(self->resNames, i));
-		else
-			resnam = empty;
 
-        sym = PyUnicode_AsUTF8(PyList_GetItem(self->symbols, i));
+PyObject *convert_trajectory(PyObject *module, PyObject *args, PyObject *kwds) {
 
-		x = (float)getFromArray2D(py_coords, type, i, 0) / 10.0;
-		y = (float)getFromArray2D(py_coords, type, i, 1) / 10.0;
-		z = (float)getFromArray2D(py_coords, type, i, 2) / 10.0;
+	PyObject *py_src, *py_dst, *py_atoms = NULL, *py_topo = NULL;
+	PyObject *srcKwds = NULL;
+	PyArrayObject *atoms = NULL;
+	Trajectory *src = NULL, *topo = NULL, *dst = NULL;
+	ConvertQueue q;
+	pthread_t reader;
+	const npy_intp *sel = NULL;
+	double *xyz = NULL, *vel = NULL;
+	char *units = NULL, *format = NULL;
+	long stride = 1, written = 0;
+	int i, nAtoms = 0, status, err = 0;
 
-		if (py_vel != NULL) {
-			vx = (float)getFromArray2D(py_vel, vtype, i, 0);
-			vy = (float)getFromArray2D(py_vel, vtype, i, 1);
-			vz = (float)getFromArray2D(py_vel, vtype, i, 2);
-       		fprintf(self->fd, "%5d%-5s%5s%5d%8.3f%8.3f%8.3f%8.4f%8.4f%8.4f\n",
-				resid, resnam, sym, i+1, x, y, z, vx, vy, vz);
-		} else {
-        	fprintf(self->fd, "%5d%-5s%5s%5d%8.3f%8.3f%8.3f\n",
-				resid, resnam, sym, i+1, x, y, z);
-		}
-    }
-	/* Do some testing on the array */
-	if (py_box != NULL) {
-		type = PyArray_TYPE((PyArrayObject*)py_box);
-		for (i = 0; i < 9; i++) {
-			box[i] = (float)getFromArray2D(py_box, type,
-						box_order[i][0], box_order[i][1]) / 10.0;
-		}
-		for (i = 0; i < 3; i++)
-			fprintf(self->fd, "%10.5f", box[i]);
-		if (fabs(box[3]) > 1e-6 || fabs(box[4]) > 1e-6 || fabs(box[5]) > 1e-6 ||
-		    fabs(box[6]) > 1e-6 || fabs(box[7]) > 1e-6 || fabs(box[8]) > 1e-6)
-			for (i = 3; i < 9; i++)
-				fprintf(self->fd, "%10.5f", box[i]);
-		fprintf(self->fd, "\n");
-	} else
-		fprintf(self->fd, "%10.5f%10.5f%10.5f\n", 0.0, 0.0, 0.0);
+	static char *kwlist[] = {
+		"src", "dst", "stride", "atoms", "units", "topology",
+		"nAtoms", "format", NULL };
 
-	return 0;
-}
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "OO|lOsOis", kwlist,
+			&py_src, &py_dst, &stride, &py_atoms, &units, &py_topo,
+			&nAtoms, &format))
+		return NULL;
 
+	if (stride < 1) {
+		PyErr_SetString(PyExc_ValueError, "stride must be positive");
+		return NULL; }
 
+	// Source, with the options given, and the file with atom names
+	if ((srcKwds = Py_BuildValue("{s:i}", "nAtoms", nAtoms)) == NULL) return NULL;
+	if (set_string_option(srcKwds, "units", units) == -1
+			|| set_string_option(srcKwds, "format", format) == -1) {
+		Py_DECREF(srcKwds);
+		return NULL; }
+	src = open_trajectory(py_src, srcKwds);
+	Py_XDECREF(srcKwds);
+	if (src == NULL) return NULL;
+	if (src->type == MOLDEN) {
+		PyErr_SetString(PyExc_NotImplementedError,
+						"Molden files cannot be converted");
+		goto fail; }
+
+	if (py_topo != NULL && py_topo != Py_None) {
+		if ((topo = open_trajectory(py_topo, NULL)) == NULL) goto fail;
+		if (topo->nAtoms != src->nAtoms) {
+			PyErr_SetString(PyExc_ValueError,
+					"Number of atoms in the topology does not match");
+			goto fail; }
+	} else {
+		topo = src;
+		Py_INCREF(topo);
+	}
 
-/* End of helper functions */
+	nAtoms = src->nAtoms;
+	if (py_atoms != NULL && py_atoms != Py_None) {
+		atoms = (PyArrayObject*) PyArray_FROMANY(py_atoms, NPY_INTP, 1, 1,
+							NPY_ARRAY_CARRAY_RO | NPY_ARRAY_FORCECAST);
+		if (atoms == NULL) goto fail;
+		nAtoms = PyArray_DIM(atoms, 0);
+		sel = (npy_intp*) PyArray_DATA(atoms);
+		for (i = 0; i < nAtoms; i++)
+			if (sel[i] < 0 || sel[i] >= src->nAtoms) {
+				PyErr_SetString(PyExc_IndexError, "Atom index out of range");
+				goto fail; }
+		xyz = (double*) malloc(3 * nAtoms * sizeof(double));
+		vel = (double*) malloc(3 * nAtoms * sizeof(double));
+		if (xyz == NULL || vel == NULL) {
+			PyErr_SetFromErrno(PyExc_MemoryError);
+			goto fail; }
+	}
 
+	if ((dst = open_destination(py_dst, topo, atoms, nAtoms)) == NULL) goto fail;
+
+	memset(&q, 0, sizeof(ConvertQueue));
+	q.src = src;
+	q.stride = stride;
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+
+	if ((status = pthread_create(&reader, NULL, convert_reader, &q)) != 0) {
+		errno = status;
+		PyErr_SetFromErrno(PyExc_OSError);
+	} else {
+		Py_BEGIN_ALLOW_THREADS
+		err = convert_writer(&q, dst, sel, xyz, vel, &written);
+		pthread_join(reader, NULL);
+		if (close_file(dst) && !err) err = errno;
+		Py_END_ALLOW_THREADS
+		dst->closed = 1;
+
+		if (err) {
+			errno = err;
+			PyErr_SetFromErrno(PyExc_IOError);
+		} else if (q.failed)
+			raise_error(src);
+	}
 
+	for (i = 0; i < CONVERT_SLOTS; i++) {
+		poolFree(q.frames[i].xyz);
+		poolFree(q.frames[i].vel);
+		poolFree(q.frames[i].extra);
+		free(q.frames[i].comment);
+		extFrameFree(&(q.frames[i].ext));
+	}
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.lock);
+	if (PyErr_Occurred()) goto fail;
+
+	free(xyz);
+	free(vel);
+	Py_XDECREF(atoms);
+	Py_DECREF(dst);
+	Py_DECREF(topo);
+	Py_DECREF(src);
+	return PyLong_FromLong(written);
+
+	fail:
+	free(xyz);
+	free(vel);
+	Py_XDECREF(atoms);
+	Py_XDECREF(dst);
+	Py_XDECREF(topo);
+	Py_XDECREF(src);
+	return NULL;
+}
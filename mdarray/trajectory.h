@@ -29,6 +29,19 @@
 
 /* Make sure the general declarations are made first */
 #include "mdarray.h"
+#include "nametable.h"
+#include "tokenizer.h"
+#include "inputbuffer.h"
+#include "extxyz.h"
+#include "frame.h"
+#include "bufferpool.h"
+#include "framecache.h"
+#include "netcdf.h"
+#include "h5md.h"
+#include "whole.h"
+#include "unwrap.h"
+#include <pthread.h>
+#include <glob.h>
 
 typedef enum __moldenStyle {
 	MLATOMS, MLGEOM, MLFREQ, MLUNK } MoldenStyle;
@@ -39,15 +52,88 @@ typedef struct __moldenSection {
 	} MoldenSection;
 #define MAX_MOLDEN_SECTIONS 50
 
+/* Fields of AMBER mdcrd files: %8.3f, ten per line */
+#define MDCRD_WIDTH 8
+#define MDCRD_PER_LINE 10
+
+/* Frame waiting to be written by the background writer thread */
+typedef struct __stagedFrame {
+		const double *xyz, *vel, *box; /* data to be written */
+		double *copy;                  /* owned copy of the data */
+		long copySize;
+		PyObject *arrays[3];           /* arrays kept alive until written */
+		char *comment;
+		long commentLen, commentSize;
+	} StagedFrame;
+#define ASYNC_SLOTS 2
+
+/* Metadata of all frames, collected by scan() */
+typedef struct __scanData {
+		long nFrames, capacity;
+		long *steps;
+		double *times;
+		ARRAY_REAL *boxes;
+		char *comments;        /* all comments, one after another */
+		long commentsUsed, commentsSize;
+		long *commentEnds;     /* end of each comment in comments */
+		int allSteps, allTimes, allBoxes, allComments;
+	} ScanData;
+
+/* Frame read from the file, before it is turned into Python objects. *
+ * The arrays are allocated by the readers when they are NULL.        */
+typedef struct __frameData {
+		ARRAY_REAL *xyz, *vel, *extra;
+		ARRAY_REAL box[9];
+		double time;
+		long step;
+		int hasVel, hasExtra, hasBox, hasTime, hasStep, hasComment, hasExt;
+		char *comment;
+		size_t commentSize;
+		ExtFrame ext;   /* the rest of extended XYZ frames */
+	} FrameData;
+
+/* Columns of LAMMPS dump files. The ITEM: ATOMS header is translated *
+ * into the plan of extended XYZ columns; atom lines, which may come   *
+ * in any order, are sorted by id.                                     */
+typedef struct __lammpsColumns {
+		char *header;     /* names of columns the plan was made from */
+		int id, mol;      /* fields of atom ids and molecules, or -1 */
+		int scaled;       /* positions are fractional (xs or xsu) */
+		long *ids;        /* ids of atom lines of the current frame */
+		int *order;       /* atom index of each line */
+		int *count;       /* counting sort buckets */
+		int capacity;
+		long countSize;
+	} LammpsColumns;
+
 typedef struct {
 
 	PyObject_HEAD
 
-	enum { GUESS, XYZ, MOLDEN, GRO, XTC } type;
+	enum { GUESS, XYZ, MOLDEN, GRO, XTC, PDB, LAMMPS, MDCRD, NETCDF, H5MD, XDATCAR } type;
 	enum { ANGS, BOHR, NM } units;
 	char mode;
 	char *fileName; /* Used while opening the file and for __repr__ */
 	FILE *fd;
+	/* Trajectory split into many files (segments), read one by one */
+	char **fileNames;
+	int nFiles;
+	int segment;          /* index of the file being read */
+	int *segmentStarts;   /* global index of the first frame of each segment */
+	FILE *nextFd;         /* next segment, opened in advance */
+	int skipDuplicates;   /* skip frames repeated at segment boundaries */
+	int checkDuplicate;   /* set until the first new frame of a segment */
+	int haveTime;
+	double lastTime;      /* time of the last frame returned */
+	/* Positions of frames (file and offset) found so far, used for *
+	 * random access; frames accessed by index may be cached.       */
+	int *frameSegments;
+	long *frameOffsets;
+	long nIndexed;
+	long indexCapacity;
+	long totalFrames;     /* number of frames, -1 until the end is reached */
+	FrameCache *cache;
+	PyObject *scanResult;  /* kept result of scan() */
 	/* Used for keeping track of the position in the file while reading     *
 	 * frames. Two variables are needed, because some formats, like Molden, *
 	 * store geometries and energies in different parts of the file.        */
@@ -60,35 +146,222 @@ typedef struct {
 	MoldenStyle moldenStyle;
 	int nAtoms;
 	int lastFrame;
-	PyObject *symbols; /* list of symbols */
+	NameTable *symbolTable; /* unique atomic symbols */
+	int *symbolCodes; /* per-atom index into symbolTable */
+	NameTable *resNameTable; /* unique residue names */
+	int *resNameCodes; /* per-atom index into resNameTable */
+	NameTable *chainTable; /* unique chain identifiers */
+	int *chainCodes; /* per-atom index into chainTable */
+	PyObject *symbols; /* list of symbols, built on demand */
 	PyObject *aNumbers; /* atomic numbers */
 	PyObject *resids; /* residue numbers */
-	PyObject *resNames; /* residue names */
+	PyObject *resNames; /* list of residue names, built on demand */
+	PyObject *chains; /* list of chain identifiers, built on demand */
 	PyObject *masses; /* atomic Masses */
 
+	/* Text formats are read through the look-ahead buffer. The block of *
+	 * lines read at once points into it and so do its fields.           */
+	InputBuffer input;
+	const char *block;
+	Tokens tokens;
+	ExtPlan extPlan;  /* columns of extended XYZ files */
+	LammpsColumns lammps;
+
+	/* Line buffer and the last frame read */
+	char *line;
+	size_t lineSize;
+	FrameData frame;
+
+	/* Error found while reading, see set_error */
+	PyObject *errorType;
+	const char *errorMessage;
+	int errorNumber;
+
+	/* Text of a frame being written, flushed with a single fwrite */
+	char *outBuf;
+	long outSize;
+
+	/* PDB: box of CRYST1 given before the first model applies to all *
+	 * of them; models written are numbered by the formatting thread. */
+	ARRAY_REAL pdbBox[9];
+	int hasPdbBox;
+	int modelsWritten;
+
+	/* MDCRD: box line after each frame; size of frames in bytes, if *
+	 * all lines have the full width (0 otherwise).                  */
+	int mdcrdBox;
+	long frameSize;
+
+	/* XDATCAR: lattice vectors (rows, in Angstrom) and scale of the *
+	 * last header read                                             */
+	ARRAY_REAL xdatcarCell[9];
+	double xdatcarScale;
+
+	/* Graph of the bonds last given to read(whole=...) */
+	WholeGraph *whole;
+
+	/* NETCDF: header and mapping of the current file */
+	CdfFile *cdf;
+	const unsigned char *cdfData;
+	size_t cdfSize;
+#ifdef HAVE_HDF5
+	H5mdFile *h5md;
+#endif
+	/* NETCDF, H5MD: index of the next frame in the current file */
+	long nextRecord;
+
+	/* Background writer, used with asyncWrite=True. Frames are staged   *
+	 * in a ring of slots; the lock protects stageTail, pending,         *
+	 * stopWriter and writerError, the rest is owned by the main thread. */
+	int async;
+	int closed;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	StagedFrame staged[ASYNC_SLOTS];
+	int stageHead;   /* next slot to be filled */
+	int stageTail;   /* next slot to be written */
+	int pending;     /* slots filled, but not written yet */
+	int stopWriter;
+	int writerError; /* errno of the first failed write */
+
 	/* Sections in Molden file and offsets */
 	MoldenSection moldenSect[MAX_MOLDEN_SECTIONS];
 
 } Trajectory;
 
+/* Frames passed from the reading thread to the writing one in convert() */
+#define CONVERT_SLOTS 4
+typedef struct __convertQueue {
+		Trajectory *src;
+		long stride;
+		FrameData frames[CONVERT_SLOTS];
+		int head;    /* next slot to be read into */
+		int tail;    /* next slot to be written */
+		int count;   /* slots read, but not written yet */
+		int done;    /* the reader has finished */
+		int failed;  /* the reader has failed, see src->errorType */
+		int stop;    /* the writer has finished */
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+	} ConvertQueue;
+
 #define MLSEC_ATOMS       0
 #define MLSEC_GEOCONV     1
 #define MLSEC_GEOMETRIES  2
 #define MLSEC_FREQ        3
 #define MLSEC_FR_COORD    4
 
+static void set_error(Trajectory *self, PyObject *type, const char *msg);
+static void set_file_error(Trajectory *self, PyObject *type, const char *name);
+static void raise_error(Trajectory *self);
+static int close_file(Trajectory *self);
+static int set_file_names(Trajectory *self, PyObject *py_fname);
+static void prefetch_segment(Trajectory *self);
+static int open_segment(Trajectory *self, int segment);
+static int open_next_segment(Trajectory *self);
+static long frame_offset(Trajectory *self);
+static int record_frame(Trajectory *self, long frame, long offset);
+static int seek_frame(Trajectory *self, long index);
+static PyObject *next_frame(Trajectory *self, int doWrap, ARRAY_REAL *box,
+				WholeGraph *whole, Unwrapper *unwrap);
+static PyObject *Trajectory_getItem(Trajectory *self, PyObject *key);
+static int grow_scan_data(Trajectory *self, ScanData *data, long commentLen);
+static int scan_frames(Trajectory *self, ScanData *data);
+static PyObject *scan_array(long n, int type, const void *values, int nd, size_t itemSize);
+static PyObject *scan_result(ScanData *data);
+static PyObject *Trajectory_scan(Trajectory *self);
+static void release_mapping(PyObject *capsule);
+static PyObject *Trajectory_view(Trajectory *self, PyObject *args, PyObject *kwds);
+static PyObject *Trajectory_readFrames(Trajectory *self, PyObject *args, PyObject *kwds);
+static int read_frame_data(Trajectory *self, FrameData *frame, int metaOnly);
+static int next_frame_data(Trajectory *self, FrameData *frame, int metaOnly);
+static int wrap_frame(FrameData *frame, int nAtoms, ARRAY_REAL *box, int doWrap,
+				WholeGraph *whole, Unwrapper *unwrap);
+static PyObject *frame_to_object(Trajectory *self, FrameData *data);
+static long read_line_block(Trajectory *self, int nLines);
 static int read_topo_from_xyz(Trajectory *self);
 static int read_topo_from_gro(Trajectory *self);
-static PyObject *read_frame_from_xyz(Trajectory *self, int doWrap, ARRAY_REAL *box);
+static int set_owned_array(PyObject **attr, npy_intp *dims, int type, void *data);
+static int alloc_frame_array(Trajectory *self, ARRAY_REAL **array, int width);
+static int read_frame_from_xyz(Trajectory *self, FrameData *frame);
+static int read_ext_header(Trajectory *self, FrameData *frame, const char *comment);
+static int read_ext_atoms(Trajectory *self, FrameData *frame, double factor,
+                          const int *order);
+static int skip_lines(Trajectory *self, long nLines);
+static int skip_frame_from_xyz(Trajectory *self, FrameData *frame);
 static int write_frame_to_xyz(Trajectory *self, PyObject *py_coords, char *comment);
+static int reserve_output(Trajectory *self, long size);
+static PyArrayObject *as_double_array(PyObject *array, int ndim);
+static int format_xyz_frame(Trajectory *self, long *used, const double *xyz,
+							const char *comment, long commentLen);
+static int format_gro_frame(Trajectory *self, long *used, const double *xyz,
+			const double *vel, const double *box, const char *comment, long commentLen);
+static int format_pdb_frame(Trajectory *self, long *used, const double *xyz,
+			const double *box, const char *comment, long commentLen);
+static int format_frame(Trajectory *self, long *used, const double *xyz,
+			const double *vel, const double *box, const char *comment, long commentLen);
+static int start_writer(Trajectory *self);
+static int stop_writer(Trajectory *self);
+static int wait_writer(Trajectory *self);
+static int stage_frame(Trajectory *self, PyObject *py_coords, PyObject *py_vel,
+				PyObject *py_box, const char *comment, int copy);
 
-static PyObject *read_frame_from_gro(Trajectory *self, int doWrap, ARRAY_REAL *box);
+static void parse_gro_title(FrameData *frame);
+static int read_frame_from_gro(Trajectory *self, FrameData *frame, int metaOnly);
 static int write_frame_to_gro(Trajectory *self, PyObject *py_coords,
 				PyObject *py_vel, PyObject *py_box, char *comment);
+static int pdb_record(const char *line, size_t len, const char *name);
+static void cell_to_box(const ARRAY_REAL *cell, ARRAY_REAL *box);
+static void parse_cryst1(const char *line, size_t len, ARRAY_REAL *box, double factor);
+static int pdb_element(const char *line, size_t len);
+static int read_topo_from_pdb(Trajectory *self);
+static int read_frame_from_pdb(Trajectory *self, FrameData *frame, int metaOnly);
+static int write_frame_to_pdb(Trajectory *self, PyObject *py_coords,
+				PyObject *py_box, char *comment);
+static void lammps_free(LammpsColumns *lmp);
+static int lammps_columns(Trajectory *self, const char *names);
+static int lammps_box(Trajectory *self, FrameData *frame, int style,
+				double *origin, double factor);
+static int lammps_header(Trajectory *self, FrameData *frame, int *nat,
+				double *origin, double factor);
+static int compare_ids(const void *a, const void *b);
+static int lammps_order(Trajectory *self, int nat, const int **order);
+static int read_topo_from_lammps(Trajectory *self);
+static int read_frame_from_lammps(Trajectory *self, FrameData *frame, int metaOnly);
+static double parse_fixed(const char *field, int width);
+static int read_topo_from_mdcrd(Trajectory *self);
+static int read_frame_from_mdcrd(Trajectory *self, FrameData *frame, int metaOnly);
+static int read_topo_from_xdatcar(Trajectory *self);
+static int xdatcar_header(Trajectory *self);
+static int read_frame_from_xdatcar(Trajectory *self, FrameData *frame, int metaOnly);
+static int open_netcdf(Trajectory *self);
+static const unsigned char *netcdf_record(Trajectory *self, const char *name,
+				long count, const CdfVariable **var);
+static int read_frame_from_netcdf(Trajectory *self, FrameData *frame, int metaOnly);
+#ifdef HAVE_HDF5
+static int open_h5md(Trajectory *self, const char *name);
+static int read_topo_from_h5md(Trajectory *self);
+static int read_frame_from_h5md(Trajectory *self, FrameData *frame, int metaOnly);
+static int write_frame_to_h5md(Trajectory *self, PyObject *py_coords,
+				PyObject *py_vel, PyObject *py_box);
+#endif
 #ifdef HAVE_GROMACS
-static PyObject *read_frame_from_xtc(Trajectory *self, int doWrap, ARRAY_REAL *box);
+static int read_frame_from_xtc(Trajectory *self, FrameData *frame);
+static int read_xdr_int(FILE *fp, int *value);
+static int read_xdr_float(FILE *fp, float *value);
+static int skip_frame_from_xtc(Trajectory *self, FrameData *frame);
 #endif
 
+static void *convert_reader(void *arg);
+static int convert_writer(ConvertQueue *q, Trajectory *dst, const npy_intp *atoms,
+						double *xyz, double *vel, long *written);
+static Trajectory *open_trajectory(PyObject *fname, PyObject *kwds);
+static PyObject *select_names(PyObject *names, const npy_intp *atoms, int nAtoms);
+static Trajectory *open_destination(PyObject *fname, Trajectory *topo,
+							PyArrayObject *atoms, int nAtoms);
+PyObject *convert_trajectory(PyObject *module, PyObject *args, PyObject *kwds);
+
 static int read_molden_sections(Trajectory *self);
 static int get_section_idx(Trajectory *self, const char name[]);
 static int read_topo_from_molden(Trajectory *self);
@@ -0,0 +1,266 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#include <string.h>
+#include "unwrap.h"
+#include "measure.h"
+
+
+
+static PyObject *Unwrapper_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+	Unwrapper *self;
+
+	self = (Unwrapper*) type->tp_alloc(type, 0);
+	if (self != NULL) {
+		self->nAtoms = 0;
+		self->nFrames = 0;
+		self->previous = NULL;
+	}
+	return (PyObject*) self;
+}
+
+
+static void Unwrapper_dealloc(Unwrapper *self) {
+	free(self->previous);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+/* The number of atoms is fixed by the first frame; the GIL is needed */
+int unwrapperPrepare(Unwrapper *self, int nAtoms) {
+
+	if (self->previous != NULL) {
+		if (nAtoms == self->nAtoms) return 0;
+		PyErr_SetString(PyExc_ValueError, "Number of atoms different than expected");
+		return -1; }
+
+	if ((self->previous = (ARRAY_REAL*) malloc((3 * nAtoms + 1) * sizeof(ARRAY_REAL))) == NULL) {
+		PyErr_NoMemory();
+		return -1; }
+	self->nAtoms = nAtoms;
+	return 0;
+}
+
+
+/* Unwrap a frame in place. The first one is taken as it is; in the *
+ * next ones, displacements from the previous frame are reduced to  *
+ * the nearest image with the vectorized kernel. The GIL is not     *
+ * needed.                                                          */
+void unwrapperApply(Unwrapper *self, ARRAY_REAL *xyz, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]) {
+	ARRAY_REAL *prev = self->previous;
+	long i, n = 3L * self->nAtoms;
+
+	if (self->nFrames++ > 0) {
+		for (i = 0; i < n; i++) xyz[i] -= prev[i];
+		minimumImage(xyz, self->nAtoms, box, inv);
+		for (i = 0; i < n; i++) xyz[i] += prev[i];
+	}
+	memcpy(prev, xyz, n * sizeof(ARRAY_REAL));
+}
+
+
+static PyObject *Unwrapper_apply(Unwrapper *self, PyObject *args, PyObject *kwds) {
+	PyArrayObject *py_coords, *py_box;
+	PyObject *py_boxArg;
+	const ARRAY_REAL *b;
+	ARRAY_REAL *xyz, *boxes;
+	npy_intp nFrames, nBoxes, f;
+	int ndim, bdim, nAtoms, per;
+
+	static char *kwlist[] = { "coordinates", "box", NULL };
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!O", kwlist,
+			&PyArray_Type, &py_coords, &py_boxArg))
+		return NULL;
+
+	ndim = PyArray_NDIM(py_coords);
+	if (PyArray_TYPE(py_coords) != NPY_ARRAY_REAL || !PyArray_IS_C_CONTIGUOUS(py_coords)
+			|| !PyArray_ISWRITEABLE(py_coords) || ndim < 2 || ndim > 3
+			|| PyArray_DIM(py_coords, ndim - 1) != 3) {
+		PyErr_SetString(PyExc_ValueError,
+			"Coordinates must be a writeable, C-contiguous float64 array of shape ([frames,] atoms, 3)");
+		return NULL; }
+	nAtoms = (int)PyArray_DIM(py_coords, ndim - 2);
+	nFrames = ndim == 3 ? PyArray_DIM(py_coords, 0) : 1;
+
+	// One box for all frames, (3,) or (3,3), or one for each frame,
+	// (frames,3,3) or, unless it could be a matrix, (frames,3)
+	py_box = (PyArrayObject*) PyArray_FROM_OTF(py_boxArg, NPY_ARRAY_REAL, NPY_ARRAY_IN_ARRAY);
+	if (py_box == NULL) return NULL;
+	bdim = PyArray_NDIM(py_box);
+	nBoxes = -1;
+	per = 3;
+	if (bdim == 1 && PyArray_DIM(py_box, 0) == 3)
+		nBoxes = 1;
+	else if (bdim == 2 && PyArray_DIM(py_box, 0) == 3 && PyArray_DIM(py_box, 1) == 3) {
+		nBoxes = 1;
+		per = 9;
+	} else if (bdim == 2 && ndim == 3 && PyArray_DIM(py_box, 0) == nFrames
+			&& PyArray_DIM(py_box, 1) == 3)
+		nBoxes = nFrames;
+	else if (bdim == 3 && ndim == 3 && PyArray_DIM(py_box, 0) == nFrames
+			&& PyArray_DIM(py_box, 1) == 3 && PyArray_DIM(py_box, 2) == 3) {
+		nBoxes = nFrames;
+		per = 9;
+	}
+	if (nBoxes < 0) {
+		Py_DECREF(py_box);
+		PyErr_SetString(PyExc_ValueError, "Box must be three lengths or a 3x3 matrix, for all frames or each");
+		return NULL; }
+
+	// All boxes are checked before any frame is changed
+	if ((boxes = (ARRAY_REAL*) malloc((18 * nBoxes + 1) * sizeof(ARRAY_REAL))) == NULL) {
+		Py_DECREF(py_box);
+		return PyErr_NoMemory(); }
+	b = (const ARRAY_REAL*) PyArray_DATA(py_box);
+	for (f = 0; f < nBoxes; f++)
+		if (boxFromValues(b + f * per, per, boxes + 18 * f, boxes + 18 * f + 9) == -1) {
+			free(boxes);
+			Py_DECREF(py_box);
+			PyErr_SetString(PyExc_ValueError, "Box is singular or has non-positive lengths");
+			return NULL; }
+	Py_DECREF(py_box);
+
+	if (unwrapperPrepare(self, nAtoms) == -1) {
+		free(boxes);
+		return NULL; }
+
+	xyz = (ARRAY_REAL*) PyArray_DATA(py_coords);
+	Py_BEGIN_ALLOW_THREADS
+	for (f = 0; f < nFrames; f++) {
+		b = boxes + (nBoxes > 1 ? 18 * f : 0);
+		unwrapperApply(self, xyz + 3L * nAtoms * f, b, b + 9);
+	}
+	Py_END_ALLOW_THREADS
+	free(boxes);
+
+	Py_INCREF(py_coords);
+	return (PyObject*) py_coords;
+}
+
+
+static PyObject *Unwrapper_reset(Unwrapper *self) {
+	free(self->previous);
+	self->previous = NULL;
+	self->nAtoms = 0;
+	self->nFrames = 0;
+	Py_RETURN_NONE;
+}
+
+
+static PyMemberDef Unwrapper_members[] = {
+	{"nAtoms", T_INT, offsetof(Unwrapper, nAtoms), READONLY,
+		"Number of atoms, set by the first frame"},
+	{"nFrames", T_LONG, offsetof(Unwrapper, nFrames), READONLY,
+		"Number of frames unwrapped so far"},
+	{NULL}  /* Sentinel */
+};
+
+
+static PyMethodDef Unwrapper_methods[] = {
+	{"apply", (PyCFunction)Unwrapper_apply, METH_VARARGS | METH_KEYWORDS,
+		"\n"
+		"Unwrapper.apply(coordinates, box)\n"
+		"\n"
+		"Unwrap 'coordinates', the next frame or frames of the trajectory\n"
+		"(a C-contiguous float64 array of shape ([frames,] atoms, 3)), in\n"
+		"place. 'box' is three lengths or a 3x3 matrix, for all frames, or\n"
+		"an array of them, (frames, 3, 3) or (frames, 3), one for each frame;\n"
+		"a (3, 3) box is always a matrix, so lengths of three frames must be\n"
+		"given as (3, 3, 3) diagonal matrices.\n"
+		"Returns the same array.\n"
+		"\n" },
+	{"reset", (PyCFunction)Unwrapper_reset, METH_NOARGS,
+		"\n"
+		"Unwrapper.reset()\n"
+		"\n"
+		"Forget the previous frames, to start another trajectory.\n"
+		"\n" },
+	{NULL}  /* Sentinel */
+};
+
+
+PyTypeObject UnwrapperType = {
+
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "mdarray.Unwrapper",            /*tp_name*/
+    sizeof(Unwrapper),              /*tp_basicsize*/
+    0,                              /*tp_itemsize*/
+
+    /* Methods to implement standard operations */
+    (destructor)Unwrapper_dealloc,  /*tp_dealloc*/
+    0,                              /*tp_print*/
+    0,                              /*tp_getattr*/
+    0,                              /*tp_setattr*/
+	 0,                              /* tp_reserved */
+    0,                              /*tp_repr*/
+
+    /* Method suites for standard classes */
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+
+    /* More standard operations (here for binary compatibility) */
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+
+    /* Functions to access object as input/output buffer */
+    0,                         /*tp_as_buffer*/
+
+    /* Flags to define presence of optional/expanded features */
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+
+    /* Documentation string */
+    "Unwrapper()\n"
+    "Keeps atoms continuous across periodic boundaries in successive "
+	 "frames, for diffusion and MSD. Each atom is moved to the image "
+	 "nearest to its unwrapped position in the previous frame, so atoms "
+	 "must not move by more than half of the box between frames. Frames "
+	 "are given to apply(), or read with Trajectory.read(unwrap=...):\n"
+    "  unwrapper = Unwrapper()\n"
+    "  frame = traj.read(unwrap=unwrapper)\n"
+    "Orthorhombic and triclinic boxes, also changing in time, are "
+	 "supported.\n",             /* tp_doc */
+
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Unwrapper_methods,         /* tp_methods */
+    Unwrapper_members,         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    Unwrapper_new,             /* tp_new */
+};
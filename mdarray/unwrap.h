@@ -0,0 +1,52 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+#ifndef __UNWRAP_H__
+#define __UNWRAP_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Unwraps successive frames: every atom is moved to the image nearest *
+ * to its unwrapped position in the previous frame. Keeping positions  *
+ * rather than image counts also follows boxes changing in time.       */
+typedef struct {
+
+	PyObject_HEAD
+
+	int nAtoms;
+	long nFrames;          /* frames unwrapped so far */
+	ARRAY_REAL *previous;  /* unwrapped positions of the last frame */
+
+} Unwrapper;
+
+extern PyTypeObject UnwrapperType;
+
+int unwrapperPrepare(Unwrapper *self, int nAtoms);
+void unwrapperApply(Unwrapper *self, ARRAY_REAL *xyz, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]);
+
+#endif /* __UNWRAP_H__ */
@@ -24,6 +24,7 @@
 
 
 #include "utils.h"
+#include <float.h>
 #include "periodic_table.h"
 
 
@@ -74,36 +75,269 @@ int stripline(char *line) {
 }
 
 
+/* Locale-independent conversion of numbers. Most numbers in trajectory *
+ * files are short decimals, such as "-12.345678", which are converted  *
+ * exactly by the fast path below: the digits fit in a 64-bit integer   *
+ * and the power of ten is exactly representable, so a single multiply  *
+ * or divide is correctly rounded. Everything else (long mantissas,     *
+ * large exponents, inf, nan) goes to strtod_l with the "C" locale.     */
+
+static const double exactPowersOfTen[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+
+static double parseFloatSlow(const char *start, const char *end, const char **stop) {
+	static locale_t cLocale = (locale_t)0;
+	char local[64], *copy, *ptr;
+	size_t len, i;
+	double val;
+
+	if (cLocale == (locale_t)0)
+		cLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+
+	for (len = 0; start + len < end && start[len] != '\0'; len++);
+	copy = len < sizeof(local) ? local : (char*) malloc(len + 1);
+	if (copy == NULL) {
+		if (stop != NULL) *stop = start;
+		return 0.0; }
+	memcpy(copy, start, len);
+	copy[len] = '\0';
+	// Fortran-style exponent, e.g. 1.0D+00
+	for (i = 0; i < len; i++)
+		if (copy[i] == 'd' || copy[i] == 'D') copy[i] = 'e';
+
+	val = strtod_l(copy, &ptr, cLocale);
+	if (stop != NULL) *stop = start + (ptr - copy);
+	if (copy != local) free(copy);
+	return val;
+}
+
+/* Convert the number found in [start, end); leading blanks are skipped *
+ * and conversion stops at the first character that cannot be part of  *
+ * the number, or at NUL. If end is NULL, the string must be NUL-       *
+ * terminated. If stop is not NULL, it receives the position after the *
+ * number; if there is no number, nothing is consumed apart from the    *
+ * blanks and 0 is returned, like atof does.                            */
+double parseFloat(const char *start, const char *end, const char **stop) {
+	const char *p, *first;
+	unsigned long long mantissa = 0;
+	int negative = 0, digits = 0, exponent = 0, expSign = 1, expVal = 0;
+	int anyDigit = 0;
+	double val;
+
+	if (end == NULL) end = start + strlen(start);
+
+	p = start;
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+	first = p;
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	// Integer part; leading zeros do not count as significant digits
+	while (p < end && *p >= '0' && *p <= '9') {
+		anyDigit = 1;
+		if (mantissa || *p != '0') {
+			if (digits < 19) mantissa = mantissa * 10 + (*p - '0');
+			else exponent++;
+			digits++;
+		}
+		p++;
+	}
+
+	// Fractional part
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			anyDigit = 1;
+			if (mantissa || *p != '0') {
+				if (digits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+				}
+				digits++;
+			} else
+				exponent--;
+			p++;
+		}
+	}
+
+	if (!anyDigit) return parseFloatSlow(first, end, stop);
+
+	// Exponent, also in Fortran style
+	if (p < end && (*p == 'e' || *p == 'E' || *p == 'd' || *p == 'D')) {
+		const char *save = p;
+		p++;
+		if (p < end && (*p == '-' || *p == '+')) {
+			if (*p == '-') expSign = -1;
+			p++;
+		}
+		if (p < end && *p >= '0' && *p <= '9') {
+			while (p < end && *p >= '0' && *p <= '9') {
+				if (expVal < 100000) expVal = expVal * 10 + (*p - '0');
+				p++;
+			}
+			exponent += expSign * expVal;
+		} else
+			p = save;
+	}
+
+	if (digits > 19 || mantissa > MAX_EXACT_MANTISSA
+			|| exponent < -22 || exponent > 22)
+		return parseFloatSlow(first, end, stop);
+
+	val = (double)mantissa;
+	if (exponent < 0) val /= exactPowersOfTen[-exponent];
+	else val *= exactPowersOfTen[exponent];
+
+	if (stop != NULL) *stop = p;
+	return negative ? -val : val;
+}
+
+
+/* Write v to out in the same way as printf("%*.*f") would, with flag *
+ * being ' ', '+' or 0 (no flag). Values are scaled by 10^prec and     *
+ * rounded to an integer; when the result could differ from correctly  *
+ * rounded printf output (a tie or a huge number), snprintf is used.   *
+ * The output is not terminated; returns number of characters.         */
+int formatFixed(char *out, double v, int width, int prec, char flag) {
+	char digits[32], *ptr;
+	double scaled, frac;
+	unsigned long long r, ip, fp;
+	int negative, n, len, i;
+
+	negative = signbit(v) ? 1 : 0;
+	scaled = fabs(v) * exactPowersOfTen[prec < 0 || prec > 17 ? 0 : prec];
+
+	if (!isfinite(v) || prec < 0 || prec > 17 || scaled >= 9007199254740992.0)
+		goto fallback;
+	frac = scaled - floor(scaled);
+	if (fabs(frac - 0.5) <= 4 * DBL_EPSILON * (scaled > 1.0 ? scaled : 1.0))
+		goto fallback;
+
+	r = (unsigned long long)(scaled + 0.5);
+	ip = r / (unsigned long long)exactPowersOfTen[prec];
+	fp = r % (unsigned long long)exactPowersOfTen[prec];
+
+	// Digits are produced backwards, from the end of the buffer
+	ptr = digits + sizeof(digits);
+	for (i = 0; i < prec; i++) {
+		*--ptr = '0' + fp % 10;
+		fp /= 10;
+	}
+	if (prec > 0) *--ptr = '.';
+	do {
+		*--ptr = '0' + ip % 10;
+		ip /= 10;
+	} while (ip);
+	if (negative) *--ptr = '-';
+	else if (flag == ' ' || flag == '+') *--ptr = flag;
+
+	len = digits + sizeof(digits) - ptr;
+	n = 0;
+	while (n < width - len) out[n++] = ' ';
+	memcpy(out + n, ptr, len);
+	return n + len;
+
+fallback:
+	if (flag == '+') n = sprintf(out, "%+*.*f", width, prec, v);
+	else if (flag == ' ') n = sprintf(out, "% *.*f", width, prec, v);
+	else n = sprintf(out, "%*.*f", width, prec, v);
+	// Make sure that the decimal point is a point, whatever the locale
+	for (i = 0; i < n; i++)
+		if (out[i] == ',') out[i] = '.';
+	return n;
+}
+
+
+/* Write v to out right-justified in width columns, like "%*ld" */
+int formatInt(char *out, long v, int width) {
+	char digits[24], *ptr;
+	unsigned long u;
+	int len, n;
+
+	u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+	ptr = digits + sizeof(digits);
+	do {
+		*--ptr = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (v < 0) *--ptr = '-';
+
+	len = digits + sizeof(digits) - ptr;
+	n = 0;
+	while (n < width - len) out[n++] = ' ';
+	memcpy(out + n, ptr, len);
+	return n + len;
+}
+
+
 /* Extract number from buf (at pos, with length len) and return as float *
  * For example: "abc  45.6 xyz"                                          *
  *               0123456789012                                           *
  *               strPartFloat(buf, 4, 5) -> " 45.6" -> 45.6              */
 
 float strPartFloat(const char *buf, int pos, int len) {
-	char *number;
-	float fret;
-
-	number = (char*) malloc((len+1) * sizeof(char));
-	strncpy(number, buf+pos, len);
-	number[len] = '\0';
-	stripline(number);
-	fret = (float)atof(number);
-	free(number);
-	return fret;
+	return (float)parseFloat(buf+pos, buf+pos+len, NULL);
 }
 
 
 
-int getElementIndexBySymbol(const char *symbol) {
-	extern Element element_table[];
-	int idx = 0;
+/* Element symbols have one uppercase letter, optionally followed by *
+ * a lowercase one, so they map directly onto a table of 26*27 slots *
+ * with the index in element_table (or -1). The table is filled on   *
+ * the first use.                                                    */
+
+#define ELEMENT_SLOTS (26*27)
+static short elementSlots[ELEMENT_SLOTS];
+static int elementSlotsReady = 0;
 
-	while (element_table[idx].number != -1) {
-		if (!strcmp(symbol, element_table[idx].symbol)) return idx;
-		idx += 1;
+static int elementSlot(const char *symbol, int len) {
+	int c0, c1;
+
+	if (len < 1 || len > 2) return -1;
+	c0 = symbol[0];
+	if (c0 < 'A' || c0 > 'Z') return -1;
+	if (len == 1) return (c0 - 'A') * 27;
+	c1 = symbol[1];
+	if (c1 < 'a' || c1 > 'z') return -1;
+	return (c0 - 'A') * 27 + (c1 - 'a' + 1);
+}
+
+void initElementLookup(void) {
+	extern Element element_table[];
+	int idx, slot;
+
+	if (elementSlotsReady) return;
+	for (slot = 0; slot < ELEMENT_SLOTS; slot++) elementSlots[slot] = -1;
+	for (idx = 0; element_table[idx].number != -1; idx++) {
+		slot = elementSlot(element_table[idx].symbol,
+		                   strlen(element_table[idx].symbol));
+		if (slot != -1) elementSlots[slot] = idx;
 	}
+	elementSlotsReady = 1;
+}
+
+/* Return index in element_table of an element given by a span of *
+ * len characters (not necessarily NUL-terminated), or -1.        */
+int getElementIndexBySpan(const char *symbol, int len) {
+	int slot;
+
+	if (!elementSlotsReady) initElementLookup();
+	if ((slot = elementSlot(symbol, len)) == -1) return -1;
+	return elementSlots[slot];
+}
+
+int getElementIndexBySymbol(const char *symbol) {
+	int len;
 
-	return -1;
+	// Symbols are at most two characters long
+	for (len = 0; len < 3 && symbol[len] != '\0'; len++);
+	return getElementIndexBySpan(symbol, len);
 }
 
 /* Read a cartesian vector from ndarray and return as C-array. *
@@ -35,7 +35,13 @@
 
 int make_lowercase(char *);
 int stripline(char *);
+double parseFloat(const char *start, const char *end, const char **stop);
 float strPartFloat(const char *buf, int pos, int len);
+int formatFixed(char *out, double v, int width, int prec, char flag);
+int formatInt(char *out, long v, int width);
+#define FORMAT_FIXED_MAX 330
+void initElementLookup(void);
+int getElementIndexBySpan(const char *symbol, int len);
 int getElementIndexBySymbol(const char *symbol);
 //ARRAY_REAL *vectorToDouble(ARRAY_REAL dvec[], PyArrayObject *arr);
 //void wrapCartesian(double point[3], double box[3]);
@@ -0,0 +1,269 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+
+#include <string.h>
+#include "whole.h"
+#include "measure.h"
+
+
+
+/* Edges of the graph from a sequence of groups of atoms: pairs as   *
+ * returned by findBonds, or whole molecules as by findMolecules. A  *
+ * group of more than two atoms is linked to its lowest index, so    *
+ * molecules must be smaller than half of the box.                   */
+static int collect_edges(PyObject *bonds, int nAtoms, int **edges, int *nEdges) {
+	PyObject *groups, *iter, *item;
+	int *list = NULL, *tmp, first, idx, size = 0, n = 0, k, start;
+	long value;
+	Py_ssize_t g;
+
+	if ((groups = PySequence_Fast(bonds, "Bonds must be a sequence")) == NULL)
+		return -1;
+
+	for (g = 0; g < PySequence_Fast_GET_SIZE(groups); g++) {
+		if ((iter = PyObject_GetIter(PySequence_Fast_GET_ITEM(groups, g))) == NULL)
+			goto fail;
+		start = n;
+		first = -1;
+		while ((item = PyIter_Next(iter)) != NULL) {
+			value = PyLong_AsLong(item);
+			Py_DECREF(item);
+			if (value == -1 && PyErr_Occurred()) break;
+			if (value < 0 || value >= nAtoms) {
+				PyErr_Format(PyExc_IndexError, "Atom index %ld out of range", value);
+				break; }
+			idx = (int)value;
+			if (first == -1) {
+				first = idx;
+				continue; }
+			if (2 * (n + 1) > size) {
+				size = size ? 2 * size : 256;
+				if ((tmp = (int*) realloc(list, size * sizeof(int))) == NULL) {
+					PyErr_NoMemory();
+					break; }
+				list = tmp;
+			}
+			list[2*n] = first;
+			list[2*n + 1] = idx;
+			n++;
+		}
+		Py_DECREF(iter);
+		if (PyErr_Occurred()) goto fail;
+
+		// Sets are not ordered; the root is the lowest index
+		for (k = start; k < n; k++)
+			if (list[2*k + 1] < first) first = list[2*k + 1];
+		for (k = start; k < n; k++) {
+			if (list[2*k + 1] == first) list[2*k + 1] = list[2*k];
+			list[2*k] = first;
+		}
+	}
+
+	Py_DECREF(groups);
+	*edges = list;
+	*nEdges = n;
+	return 0;
+
+	fail:
+	Py_DECREF(groups);
+	free(list);
+	return -1;
+}
+
+
+/* Build the graph from the edges, which it keeps */
+static WholeGraph *build_graph(int *edges, int nEdges, int nAtoms) {
+	WholeGraph *graph;
+	int *offset = NULL, *adjacent = NULL, *queue = NULL;
+	char *visited = NULL;
+	int i, k, a, b, head, tail, root;
+
+	graph = (WholeGraph*) calloc(1, sizeof(WholeGraph));
+	offset = (int*) calloc(nAtoms + 1, sizeof(int));
+	adjacent = (int*) malloc((2 * nEdges + 1) * sizeof(int));
+	queue = (int*) malloc((nAtoms + 1) * sizeof(int));
+	visited = (char*) calloc(nAtoms + 1, 1);
+	if (graph == NULL || offset == NULL || adjacent == NULL || queue == NULL || visited == NULL)
+		goto nomem;
+	graph->nAtoms = nAtoms;
+	graph->edges = edges;
+	graph->nEdges = nEdges;
+	graph->atom = (int*) malloc((nAtoms + 1) * sizeof(int));
+	graph->parent = (int*) malloc((nAtoms + 1) * sizeof(int));
+	graph->work = (ARRAY_REAL*) malloc((3 * nAtoms + 1) * sizeof(ARRAY_REAL));
+	if (graph->atom == NULL || graph->parent == NULL || graph->work == NULL)
+		goto nomem;
+
+	// Adjacency lists, compressed
+	for (k = 0; k < nEdges; k++) {
+		offset[edges[2*k] + 1]++;
+		offset[edges[2*k + 1] + 1]++;
+	}
+	for (i = 0; i < nAtoms; i++) offset[i+1] += offset[i];
+	for (k = 0; k < nEdges; k++) {
+		a = edges[2*k];
+		b = edges[2*k + 1];
+		adjacent[offset[a]++] = b;
+		adjacent[offset[b]++] = a;
+	}
+	for (i = nAtoms; i > 0; i--) offset[i] = offset[i-1];
+	offset[0] = 0;
+
+	// Breadth-first search from the lowest atom of each molecule
+	for (root = 0; root < nAtoms; root++) {
+		if (visited[root]) continue;
+		visited[root] = 1;
+		head = tail = 0;
+		queue[tail++] = root;
+		while (head < tail) {
+			a = queue[head++];
+			for (k = offset[a]; k < offset[a+1]; k++) {
+				b = adjacent[k];
+				if (visited[b]) continue;
+				visited[b] = 1;
+				queue[tail++] = b;
+				graph->atom[graph->nLinks] = b;
+				graph->parent[graph->nLinks] = a;
+				graph->nLinks++;
+			}
+		}
+	}
+
+	free(offset);
+	free(adjacent);
+	free(queue);
+	free(visited);
+	return graph;
+
+	nomem:
+	PyErr_NoMemory();
+	if (graph == NULL) free(edges);
+	free(offset);
+	free(adjacent);
+	free(queue);
+	free(visited);
+	wholeGraphFree(graph);
+	return NULL;
+}
+
+
+/* Build the graph; the GIL is needed */
+WholeGraph *wholeGraphNew(PyObject *bonds, int nAtoms) {
+	int *edges, nEdges;
+
+	if (collect_edges(bonds, nAtoms, &edges, &nEdges) == -1) return NULL;
+	return build_graph(edges, nEdges, nAtoms);
+}
+
+
+/* Keep *graph if it was built from the same bonds, else replace it; *
+ * bonds changed in place are found too. The GIL is needed.          */
+int wholeGraphUpdate(WholeGraph **graph, PyObject *bonds, int nAtoms) {
+	WholeGraph *old = *graph, *fresh;
+	int *edges, nEdges;
+
+	if (collect_edges(bonds, nAtoms, &edges, &nEdges) == -1) return -1;
+	if (old != NULL && old->nAtoms == nAtoms && old->nEdges == nEdges
+			&& (nEdges == 0 || !memcmp(old->edges, edges, 2 * nEdges * sizeof(int)))) {
+		free(edges);
+		return 0; }
+	if ((fresh = build_graph(edges, nEdges, nAtoms)) == NULL) return -1;
+	wholeGraphFree(old);
+	*graph = fresh;
+	return 0;
+}
+
+
+void wholeGraphFree(WholeGraph *graph) {
+	if (graph == NULL) return;
+	free(graph->edges);
+	free(graph->atom);
+	free(graph->parent);
+	free(graph->work);
+	free(graph);
+}
+
+
+/* Make molecules whole in a frame. Displacements from the parents  *
+ * are taken to the nearest image all at once, with the vectorized  *
+ * kernel; then atoms are placed in order. The GIL is not needed.   */
+void wholeGraphApply(WholeGraph *graph, ARRAY_REAL *xyz, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]) {
+	ARRAY_REAL *d = graph->work;
+	const ARRAY_REAL *p;
+	ARRAY_REAL *x;
+	int i, k;
+
+	for (i = 0; i < graph->nLinks; i++) {
+		x = xyz + 3 * graph->atom[i];
+		p = xyz + 3 * graph->parent[i];
+		for (k = 0; k < 3; k++) d[3*i + k] = x[k] - p[k];
+	}
+	minimumImage(d, graph->nLinks, box, inv);
+	for (i = 0; i < graph->nLinks; i++) {
+		x = xyz + 3 * graph->atom[i];
+		p = xyz + 3 * graph->parent[i];
+		for (k = 0; k < 3; k++) x[k] = p[k] + d[3*i + k];
+	}
+}
+
+
+/* Python interface: makeWhole(coordinates, box, bonds)          */
+PyObject *make_whole(PyObject *self, PyObject *args, PyObject *kwds) {
+	PyArrayObject *py_coords;
+	PyObject *py_box, *py_bonds;
+	WholeGraph *graph;
+	ARRAY_REAL box[9], inv[9];
+	ARRAY_REAL *xyz;
+	npy_intp nFrames, f;
+	int nAtoms, ndim;
+
+	static char *kwlist[] = { "coordinates", "box", "bonds", NULL };
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O!OO", kwlist,
+			&PyArray_Type, &py_coords, &py_box, &py_bonds))
+		return NULL;
+
+	ndim = PyArray_NDIM(py_coords);
+	if (PyArray_TYPE(py_coords) != NPY_ARRAY_REAL || !PyArray_IS_C_CONTIGUOUS(py_coords)
+			|| !PyArray_ISWRITEABLE(py_coords) || ndim < 2 || ndim > 3
+			|| PyArray_DIM(py_coords, ndim - 1) != 3) {
+		PyErr_SetString(PyExc_ValueError,
+			"Coordinates must be a writeable, C-contiguous float64 array of shape ([frames,] atoms, 3)");
+		return NULL; }
+	if (boxFromObject(py_box, box, inv) == -1) return NULL;
+
+	nAtoms = (int)PyArray_DIM(py_coords, ndim - 2);
+	nFrames = ndim == 3 ? PyArray_DIM(py_coords, 0) : 1;
+	if ((graph = wholeGraphNew(py_bonds, nAtoms)) == NULL) return NULL;
+
+	xyz = (ARRAY_REAL*) PyArray_DATA(py_coords);
+	Py_BEGIN_ALLOW_THREADS
+	for (f = 0; f < nFrames; f++)
+		wholeGraphApply(graph, xyz + 3 * nAtoms * f, box, inv);
+	Py_END_ALLOW_THREADS
+	wholeGraphFree(graph);
+
+	Py_INCREF(py_coords);
+	return (PyObject*) py_coords;
+}
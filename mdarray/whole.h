@@ -0,0 +1,53 @@
+/***************************************************************************
+
+    mdarray
+
+    Python module for manipulation of atomic coordinates
+    Copyright (C) 2012, Borys Szefczyk
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ ***************************************************************************/
+
+#ifndef __WHOLE_H__
+#define __WHOLE_H__
+
+/* This should come before other Numpy-related declarations in every *
+ * file that does not define the module's init function              */
+#define NO_IMPORT_ARRAY
+
+/* Make sure the general declarations are made first */
+#include "mdarray.h"
+
+/* Spanning forest of the bond graph, in breadth-first order: each *
+ * atom is placed at the nearest image of its parent, which comes  *
+ * earlier. Built once and applied to any number of frames.        */
+typedef struct {
+	int nAtoms;
+	int nLinks;
+	int *atom;         /* atoms placed, in order */
+	int *parent;       /* atom each one is placed next to */
+	ARRAY_REAL *work;  /* displacements, 3 per link */
+	int nEdges;
+	int *edges;        /* pairs it was built from, to tell if bonds change */
+} WholeGraph;
+
+WholeGraph *wholeGraphNew(PyObject *bonds, int nAtoms);
+int wholeGraphUpdate(WholeGraph **graph, PyObject *bonds, int nAtoms);
+void wholeGraphFree(WholeGraph *graph);
+void wholeGraphApply(WholeGraph *graph, ARRAY_REAL *xyz, const ARRAY_REAL box[9],
+			const ARRAY_REAL inv[9]);
+PyObject *make_whole(PyObject *self, PyObject *args, PyObject *kwds);
+
+#endif /* __WHOLE_H__ */
@@ -56,6 +56,17 @@ if extraPackagePresent('libgromacs'):
     extraCFlags.extend(flags['extra'])
     extraLFlags.extend(flags['extra'])
 
+# Check if HDF5 is present, for H5MD files
+if extraPackagePresent('hdf5'):
+    flags = getPackageFlags('hdf5')
+    inc_dirs.extend(flags['inc_dirs'])
+    lib_dirs.extend(flags['lib_dirs'])
+    libs.extend(flags['libs'])
+    define.extend(flags['define'])
+    define.append(('HAVE_HDF5', None))
+    extraCFlags.extend(flags['extra'])
+    extraLFlags.extend(flags['extra'])
+
 print("INC_DIRS:", inc_dirs)
 print("LIB_DIRS:", lib_dirs)
 print("LIBS:", libs)
@@ -30,7 +30,8 @@ class TestCUtils(unittest.TestCase):
 
         # Make tests
         obj = cc.compile(["tests/test_utils.c",
-            "mdarray/utils.c", "mdarray/periodic_table.c" ],
+            "mdarray/utils.c", "mdarray/periodic_table.c",
+            "mdarray/tokenizer.c" ],
             extra_postargs=extraOptions)
         cc.link_executable(obj, "tests/test_utils.x", extra_postargs=extraOptions)
 
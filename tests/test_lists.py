@@ -1,4 +1,5 @@
 import unittest
+import numpy
 import mdarray as mt
 
 
@@ -41,3 +42,18 @@ class TestAtomicLists(unittest.TestCase):
         acr = mt.CovalentRadii
         self.assertAlmostEqual(acr['H'], 0.31)
         self.assertAlmostEqual(acr['K'], 2.03)
+
+    def test_symbolsToNumbers(self):
+
+        symbols = ['H', 'C', 'Og', 'Xx', 'he']
+        expected = [1, 6, 118, -1, -1]
+        for seq in [ symbols, numpy.array(symbols),
+                     numpy.array(symbols, dtype='S') ]:
+            num, mass, rad = mt.symbolsToNumbers(seq)
+            self.assertEqual(list(num), expected)
+            self.assertAlmostEqual(mass[0], 1.008)
+            self.assertAlmostEqual(mass[1], 12.011)
+            self.assertEqual(mass[3], 0.0)
+            self.assertAlmostEqual(rad[1], 0.73)
+            self.assertEqual(rad[4], -1.0)
+        self.assertRaises(TypeError, mt.symbolsToNumbers, ['H', 1])
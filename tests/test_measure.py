@@ -0,0 +1,82 @@
+import unittest
+import numpy
+import mdarray as mt
+
+
+class TestMeasure(unittest.TestCase):
+
+    def setUp(self):
+
+        rng = numpy.random.RandomState(3)
+        self.box = numpy.array([10.0, 12.5, 7.0])
+        # Sizes not multiple of the vector width leave a scalar tail
+        self.coords = rng.uniform(-40, 40, (2, 37, 3))
+
+
+    def test_wrap(self):
+
+        coords = self.coords.copy()
+        result = mt.wrap(coords, self.box)
+        self.assertIs(result, coords)
+        self.assertTrue(numpy.all(coords >= 0) and numpy.all(coords < self.box))
+        shift = (self.coords - coords) / self.box
+        self.assertTrue(numpy.allclose(shift, numpy.round(shift)))
+
+        coords = self.coords[0].copy()
+        mt.wrap(coords, numpy.diag(self.box))
+        self.assertTrue(numpy.allclose(coords, numpy.mod(self.coords[0], self.box)))
+
+        # Points on the faces
+        coords = numpy.array([[0.0, 12.5, -7.0], [-10.0, 25.0, 3.5]])
+        mt.wrap(coords, self.box)
+        self.assertTrue(numpy.array_equal(coords, [[0.0, 0.0, 0.0], [0.0, 0.0, 3.5]]))
+
+
+    def test_wrapErrors(self):
+
+        self.assertRaises(ValueError, mt.wrap, self.coords.astype('f4'), self.box)
+        self.assertRaises(ValueError, mt.wrap, self.coords[:, :, :2].copy(), self.box)
+        self.assertRaises(ValueError, mt.wrap, self.coords[:, ::2], self.box)
+        self.assertRaises(ValueError, mt.wrap, self.coords.copy(), [10.0, 10.0])
+        self.assertRaises(ValueError, mt.wrap, self.coords.copy(), [10.0, 0.0, 10.0])
+        self.assertRaises(ValueError, mt.wrap, self.coords.copy(),
+                          [[10, 0, 0], [20, 0, 0], [0, 0, 10]])
+        self.assertRaises(ValueError, mt.minimumImage, self.coords.copy(), [[1, 2], [3, 4]])
+
+
+    def test_wrapTriclinic(self):
+
+        # Rows are the cell vectors, as in the box of frames
+        box = numpy.array([[10.0, 0.0, 0.0], [3.0, 9.0, 0.0], [-2.0, 4.0, 8.0]])
+        coords = self.coords.copy()
+        mt.wrap(coords, box)
+        frac = numpy.dot(coords, numpy.linalg.inv(box))
+        self.assertTrue(numpy.all(frac > -1e-12) and numpy.all(frac < 1 + 1e-12))
+        shift = numpy.dot(self.coords - coords, numpy.linalg.inv(box))
+        self.assertTrue(numpy.allclose(shift, numpy.round(shift)))
+
+
+    def test_minimumImage(self):
+
+        # Rhombic dodecahedron (xy-square) of Gromacs
+        d = 8.0
+        box = numpy.array([[d, 0, 0], [0, d, 0], [d / 2, d / 2, d * numpy.sqrt(2) / 2]])
+        vectors = self.coords.reshape(-1, 3).copy()
+        result = mt.minimumImage(vectors, box)
+        self.assertIs(result, vectors)
+
+        images = numpy.array([ i * box[0] + j * box[1] + k * box[2]
+                               for i in range(-9, 10) for j in range(-9, 10) for k in range(-9, 10) ])
+        for original, reduced in zip(self.coords.reshape(-1, 3), vectors):
+            candidates = original + images
+            lengths = numpy.linalg.norm(candidates, axis=1)
+            self.assertAlmostEqual(numpy.linalg.norm(reduced), lengths.min())
+            self.assertTrue(numpy.allclose(numpy.linalg.norm(candidates - reduced, axis=1).min(), 0))
+
+        vectors = self.coords.copy()
+        mt.minimumImage(vectors, self.box)
+        self.assertTrue(numpy.all(numpy.abs(vectors) <= self.box / 2))
+
+
+if __name__ == '__main__':
+    unittest.main()
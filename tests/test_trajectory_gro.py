@@ -130,6 +130,164 @@ class TestTrajectoryGRO(unittest.TestCase):
         os.remove(full)
 
 
+    def test_writeFrames(self):
+
+        nFrames = 5
+        crd = numpy.array([ self.crd + i for i in range(nFrames) ])
+        vel = numpy.array([ self.vel * i for i in range(nFrames) ])
+        box = numpy.array([ self.box * (i+1) for i in range(nFrames) ])
+        comments = [ "frame %d" % i for i in range(nFrames) ]
+
+        single = "%s/single.gro" % self.tmpDir
+        traj = mt.Trajectory(single, "w", self.symbols, self.resids, self.resnames)
+        for i in range(nFrames):
+            traj.write(crd[i], vel[i], box[i], comments[i])
+        del traj
+        batch = "%s/batch.gro" % self.tmpDir
+        traj = mt.Trajectory(batch, "w", self.symbols, self.resids, self.resnames)
+        traj.writeFrames(crd, boxes=box, velocities=vel, comments=comments)
+        self.assertEqual(traj.lastFrame, nFrames-1)
+        del traj
+        with open(single) as f: expected = f.read()
+        with open(batch) as f: saved = f.read()
+        self.assertEqual(saved, expected)
+
+        # The same box and comment for all frames
+        os.remove(batch)
+        traj = mt.Trajectory(batch, "w", self.symbols, self.resids, self.resnames)
+        traj.writeFrames(crd[:1], boxes=self.box, comments=self.comment)
+        del traj
+        with open(batch) as f: saved = f.read()
+        self.assertEqual(saved, DATA)
+
+        os.remove(batch)
+        traj = mt.Trajectory(batch, "w", self.symbols, self.resids, self.resnames)
+        self.assertRaises(RuntimeError, traj.writeFrames, crd[0])
+        self.assertRaises(RuntimeError, traj.writeFrames, crd, boxes=box[:2])
+        self.assertRaises(ValueError, traj.writeFrames, crd, comments=comments[:2])
+        del traj
+
+
+    def test_asyncWrite(self):
+
+        full = "%s/async.gro" % self.tmpDir
+        traj = mt.Trajectory(full, "w", self.symbols, self.resids, self.resnames,
+                             asyncWrite=True)
+        traj.write(self.crd, self.vel, self.box, self.comment)
+        traj.write(self.crd, self.vel, self.box, self.comment, copy=False)
+        del traj
+        with open(full) as f: saved = f.read()
+        self.assertEqual(saved, 2*DATAV)
+        os.remove(full)
+
+
+    def test_segments(self):
+
+        # Three parts; each one starts with the last frame of the previous
+        times = [ [0, 1, 2], [2, 3, 4], [4, 5] ]
+        for n, part in enumerate(times):
+            full = "%s/run.part%04d.gro" % (self.tmpDir, n+1)
+            traj = mt.Trajectory(full, "w", self.symbols, self.resids, self.resnames)
+            for t in part:
+                traj.write(self.crd + t, box=self.box,
+                           comment="Test t= %.5f step= %d" % (t, 10*t))
+            del traj
+
+        traj = mt.Trajectory(self.tmpDir + "/run.part*.gro")
+        self.assertEqual(len(traj.fileNames), 3)
+        self.assertTrue(traj.fileNames[0].endswith("part0001.gro"))
+        frames = []
+        frame = traj.read()
+        while frame:
+            frames.append(frame)
+            frame = traj.read()
+        self.assertEqual(len(frames), 8)
+        self.assertEqual(traj.lastFrame, 7)
+        self.assertEqual(traj.segment, 2)
+        self.assertEqual(traj.segmentStarts, [0, 3, 6])
+        self.assertEqual(frames[4]['step'], 30)
+
+        traj = mt.Trajectory(list(traj.fileNames),
+                             skipDuplicates=True)
+        self.assertEqual(traj.segmentStarts, [0])
+        got = []
+        frame = traj.read()
+        while frame:
+            got.append(frame['time'])
+            self.assertTrue(numpy.allclose(frame['coordinates'],
+                                           self.crd + frame['time'], atol=1e-3))
+            frame = traj.read()
+        self.assertEqual(got, [0, 1, 2, 3, 4, 5])
+        self.assertEqual(traj.segmentStarts, [0, 3, 5])
+        self.assertEqual(traj[4]['time'], 4)
+        self.assertEqual(traj[1]['time'], 1)
+        self.assertEqual(traj[-1]['time'], 5)
+        self.assertEqual(traj[3]['comment'], "Test t= 3.00000 step= 30")
+        self.assertEqual(traj.read()['time'], 4)
+
+        traj = mt.Trajectory(self.tmpDir + "/run.part*.gro", skipDuplicates=True)
+        info = traj.scan()
+        self.assertEqual(len(traj), 6)
+        self.assertEqual(list(info['time']), [0, 1, 2, 3, 4, 5])
+        self.assertEqual(list(info['step']), [0, 10, 20, 30, 40, 50])
+        self.assertEqual(info['box'].shape, (6, 3, 3))
+        self.assertTrue(numpy.allclose(info['box'][5], self.box))
+        self.assertEqual(traj.read()['time'], 0)
+        self.assertEqual(traj[5]['time'], 5)
+
+        self.assertRaises(IOError, mt.Trajectory, self.tmpDir + "/none*.gro")
+        self.assertRaises(ValueError, mt.Trajectory, [])
+        self.assertRaises(ValueError, mt.Trajectory, [self.tmpDir + "/x.gro"], "w",
+                          self.symbols)
+
+
+    def test_convert(self):
+
+        nFrames = 7
+        src = "%s/src.gro" % self.tmpDir
+        traj = mt.Trajectory(src, "w", self.symbols, self.resids, self.resnames)
+        for i in range(nFrames):
+            traj.write(self.crd + i, self.vel, self.box,
+                       "Test t= %.5f step= %d" % (i, 10*i))
+        del traj
+
+        # GRO -> GRO gives the same file
+        dst = "%s/copy.gro" % self.tmpDir
+        self.assertEqual(mt.convert(src, dst), nFrames)
+        with open(src) as f: expected = f.read()
+        with open(dst) as f: saved = f.read()
+        self.assertEqual(saved, expected)
+
+        # GRO -> XYZ, every third frame and some atoms only
+        atoms = [0, 3, 4, 22]
+        xyz = "%s/sub.xyz" % self.tmpDir
+        self.assertEqual(mt.convert(src, xyz, stride=3, atoms=atoms), 3)
+        traj = mt.Trajectory(xyz)
+        self.assertEqual(traj.symbols, [ self.symbols[i] for i in atoms ])
+        for i in (0, 3, 6):
+            frame = traj.read()
+            self.assertTrue(numpy.allclose(frame['coordinates'],
+                                           self.crd[atoms] + i, atol=1e-6))
+            self.assertEqual(frame['comment'], "Test t= %.5f step= %d" % (i, 10*i))
+        self.assertIsNone(traj.read())
+
+        # XYZ -> GRO, with names taken from the topology
+        back = "%s/back.gro" % self.tmpDir
+        self.assertEqual(mt.convert(xyz, back), 3)
+        gro = "%s/back2.gro" % self.tmpDir
+        mt.convert(src, gro, atoms=atoms, stride=3, topology=src)
+        traj = mt.Trajectory(gro)
+        self.assertEqual(traj.resNames, [ self.resnames[i] for i in atoms ])
+        self.assertTrue(numpy.array_equal(traj.resids, self.resids[atoms]))
+        self.assertEqual(traj[2]['step'], 60)
+        self.assertTrue(numpy.allclose(traj[2]['velocities'], self.vel[atoms]))
+
+        self.assertRaises(FileExistsError, mt.convert, src, dst)
+        self.assertRaises(IndexError, mt.convert, src, dst + "x", atoms=[23])
+        self.assertRaises(ValueError, mt.convert, src, dst + "y", stride=0)
+        self.assertRaises(ValueError, mt.convert, src, dst + "z", topology=xyz)
+
+
     def test_read(self):
 
         full = "%s/read.gro" % self.tmpDir
@@ -162,3 +320,21 @@ class TestTrajectoryGRO(unittest.TestCase):
         maxDiff = numpy.max(numpy.abs(diff))
         self.assertTrue(maxDiff <= 0.0001)
         os.remove(full)
+
+
+    def test_topologyTables(self):
+
+        full = "%s/read.gro" % self.tmpDir
+        with open(full, 'w') as f:
+            f.write(DATA)
+        traj = mt.Trajectory(full)
+        self.assertEqual(traj.resNameTable, ('ALA',))
+        self.assertTrue(numpy.all(traj.resNameCodes == 0))
+        self.assertEqual(len(traj.symbolTable), len(set(self.symbols)))
+        expanded = [ traj.symbolTable[c] for c in traj.symbolCodes ]
+        self.assertEqual(expanded, self.symbols)
+        self.assertEqual(traj.symbolArray.dtype, numpy.dtype('U3'))
+        self.assertEqual(list(traj.symbolArray), self.symbols)
+        self.assertEqual(list(traj.resNameArray), self.resnames)
+        self.assertFalse(traj.symbolCodes.flags.writeable)
+        os.remove(full)
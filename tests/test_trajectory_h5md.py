@@ -0,0 +1,162 @@
+import unittest
+import tempfile
+import os
+import numpy
+import mdarray as mt
+
+
+class TestTrajectoryH5MD(unittest.TestCase):
+
+    def setUp(self):
+
+        if not mt.__config__['hdf5']:
+            self.skipTest('Skipping tests since HDF5 support was not compiled')
+        self.tmpDir = tempfile.mkdtemp()
+        self.symbols = [ 'C', 'O', 'H', 'H', 'N', 'H', 'C' ]
+        self.nAtoms = len(self.symbols)
+        rng = numpy.random.RandomState(11)
+        self.frames = rng.uniform(-20, 20, (8, self.nAtoms, 3))
+        self.velocities = rng.uniform(-1, 1, (8, self.nAtoms, 3))
+        self.boxes = numpy.array([ numpy.diag(b) for b in rng.uniform(30, 40, (8, 3)) ])
+        self.fileName = "%s/run.h5md" % self.tmpDir
+
+
+    def tearDown(self):
+
+        for f in os.listdir(self.tmpDir):
+            if not f.startswith("."): os.remove(self.tmpDir+"/"+f)
+        os.rmdir(self.tmpDir)
+
+
+    def write(self, fileName=None, frames=slice(None)):
+
+        traj = mt.Trajectory(fileName or self.fileName, 'w', self.symbols)
+        traj.write(self.frames[frames][0], velocities=self.velocities[frames][0],
+                   box=self.boxes[frames][0])
+        traj.writeFrames(self.frames[frames][1:], boxes=self.boxes[frames][1:],
+                         velocities=self.velocities[frames][1:])
+        traj.close()
+
+
+    def test_writeRead(self):
+
+        self.write()
+        traj = mt.Trajectory(self.fileName)
+        self.assertIn("H5MD", repr(traj))
+        self.assertEqual(traj.symbols, self.symbols)
+        self.assertEqual(len(traj), 8)
+
+        # Positions and velocities are stored in single precision
+        for i in range(8):
+            frame = traj.read()
+            self.assertTrue(numpy.allclose(frame.coordinates, self.frames[i], atol=1e-5))
+            self.assertTrue(numpy.allclose(frame.velocities, self.velocities[i], atol=1e-6))
+            self.assertTrue(numpy.allclose(frame.box, self.boxes[i]))
+            self.assertEqual(frame.step, i)
+        self.assertIsNone(traj.read())
+        self.assertTrue(numpy.allclose(traj[5]['coordinates'], self.frames[5], atol=1e-5))
+        self.assertTrue(numpy.array_equal(traj.scan()['step'], numpy.arange(8)))
+
+
+    def test_readFrames(self):
+
+        self.write()
+        traj = mt.Trajectory(self.fileName)
+        frames = traj.readFrames()
+        self.assertEqual(frames.shape, (8, self.nAtoms, 3))
+        self.assertTrue(numpy.allclose(frames, self.frames, atol=1e-5))
+
+        # Atoms given as indices are read in runs of consecutive ones
+        atoms = [ 0, 2, 3, 6 ]
+        frames = traj.readFrames(2, 7, atoms=atoms)
+        self.assertTrue(numpy.allclose(frames, self.frames[2:7, atoms], atol=1e-5))
+        frames = traj.readFrames(-3, atoms=slice(1, None, 2))
+        self.assertTrue(numpy.allclose(frames, self.frames[-3:, 1::2], atol=1e-5))
+
+        out = numpy.zeros((4, 2, 3))
+        result = traj.readFrames(1, 5, atoms=slice(3, 5), out=out)
+        self.assertIs(result, out)
+        self.assertTrue(numpy.allclose(out, self.frames[1:5, 3:5], atol=1e-5))
+        self.assertTrue(numpy.allclose(traj.readFrames(6, name='velocity'),
+                                       self.velocities[6:], atol=1e-6))
+        self.assertEqual(traj.readFrames(5, 2).shape, (0, self.nAtoms, 3))
+
+        self.assertRaises(ValueError, traj.readFrames, 0, 4, out=numpy.zeros((3, self.nAtoms, 3)))
+        self.assertRaises(ValueError, traj.readFrames, 0, 4, out=numpy.zeros((4, self.nAtoms, 3), 'f4'))
+        self.assertRaises(ValueError, traj.readFrames, atoms=[3, 1])
+        self.assertRaises(ValueError, traj.readFrames, atoms=[self.nAtoms])
+        self.assertRaises(KeyError, traj.readFrames, name='force')
+
+
+    def test_append(self):
+
+        self.write(frames=slice(0, 5))
+        traj = mt.Trajectory(self.fileName, 'a', self.symbols)
+        traj.writeFrames(self.frames[5:], boxes=self.boxes[5:], velocities=self.velocities[5:])
+        # Frames are either all with velocities and box or all without
+        self.assertRaises(IOError, traj.write, self.frames[0])
+        traj.close()
+
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(len(traj), 8)
+        self.assertTrue(numpy.allclose(traj.readFrames(), self.frames, atol=1e-5))
+        self.assertTrue(numpy.allclose(traj[7]['box'], self.boxes[7]))
+
+
+    def test_segments(self):
+
+        names = [ "%s/part%d.h5md" % (self.tmpDir, k) for k in range(2) ]
+        self.write(names[0], slice(0, 3))
+        self.write(names[1], slice(3, 8))
+        traj = mt.Trajectory(names)
+        self.assertTrue(numpy.allclose(traj[6]['coordinates'], self.frames[6], atol=1e-5))
+        self.assertTrue(numpy.allclose(traj[1]['coordinates'], self.frames[1], atol=1e-5))
+        self.assertEqual(len(traj), 8)
+        self.assertRaises(ValueError, traj.readFrames)
+
+
+    def test_external(self):
+
+        try:
+            import h5py
+        except ImportError:
+            self.skipTest('Skipping test since h5py is not available')
+
+        # Layout written by other programs: own step and time datasets,
+        # fixed box and units in nm
+        with h5py.File(self.fileName, 'w') as f:
+            group = f.create_group('particles/water')
+            group['species'] = numpy.array([8, 1, 1])
+            position = group.create_group('position')
+            position['value'] = self.frames[:, :3].astype('f4') / 10
+            position['value'].attrs['unit'] = 'nm'
+            position['step'] = 100 * numpy.arange(8)
+            position['time'] = 0.2 * numpy.arange(8)
+            box = group.create_group('box')
+            box['edges'] = numpy.array([3.0, 4.0, 5.0])
+            box['edges'].attrs['unit'] = 'nm'
+
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(traj.symbols, [ '8', '1', '1' ])
+        frame = traj[3]
+        self.assertTrue(numpy.allclose(frame.coordinates, self.frames[3, :3], atol=1e-5))
+        self.assertEqual(frame.step, 300)
+        self.assertAlmostEqual(frame.time, 0.6)
+        self.assertTrue(numpy.allclose(frame.box, numpy.diag([30.0, 40.0, 50.0])))
+
+
+    def test_errors(self):
+
+        self.assertRaises(ValueError, mt.Trajectory, self.fileName, 'w', self.symbols,
+                          asyncWrite=True)
+        with open(self.fileName, 'w') as f:
+            f.write("Not an HDF5 file\n")
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+        xyz = "%s/test.xyz" % self.tmpDir
+        with open(xyz, 'w') as f:
+            f.write("1\n\nC 0 0 0\n")
+        self.assertRaises(ValueError, mt.Trajectory(xyz).readFrames)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,164 @@
+import unittest
+import tempfile
+import os
+import numpy
+import mdarray as mt
+
+DATA = """ITEM: TIMESTEP
+0
+ITEM: NUMBER OF ATOMS
+4
+ITEM: BOX BOUNDS pp pp pp
+-5.0 5.0
+0.0 12.0
+0.0 14.0
+ITEM: ATOMS id mol type element x y z vx vy vz fx fy fz q
+3 1 2 H 1.0 1.5 2.5 0.3 0.0 0.0 1.0 2.0 3.0 0.4
+1 1 1 O 1.0 1.0 2.0 0.1 0.0 0.0 0.0 0.0 0.0 -0.8
+4 2 3 N 4.0 4.0 4.0 0.4 0.0 0.0 0.0 0.0 0.0 0.0
+2 1 2 H 1.5 1.0 2.5 0.2 0.0 0.0 0.0 0.0 0.0 0.4
+ITEM: TIMESTEP
+100
+ITEM: NUMBER OF ATOMS
+4
+ITEM: BOX BOUNDS xy xz yz pp pp pp
+-3.0 12.0 2.0
+0.0 12.0 -1.0
+0.0 14.0 0.0
+ITEM: ATOMS id mol type element x y z vx vy vz fx fy fz q
+2 1 2 H 1.6 1.1 2.6 0.2 0.0 0.0 0.0 0.0 0.0 0.4
+4 2 3 N 4.1 4.1 4.1 0.4 0.0 0.0 0.0 0.0 0.0 0.0
+1 1 1 O 1.1 1.1 2.1 0.1 0.0 0.0 0.0 0.0 0.0 -0.8
+3 1 2 H 1.1 1.6 2.6 0.3 0.0 0.0 1.0 2.0 3.0 0.4
+"""
+
+SCALED = """ITEM: UNITS
+real
+ITEM: TIME
+0.5
+ITEM: TIMESTEP
+10
+ITEM: NUMBER OF ATOMS
+3
+ITEM: BOX BOUNDS pp pp pp
+1.0 11.0
+0.0 20.0
+0.0 10.0
+ITEM: ATOMS id type xs ys zs ix iy iz
+1000 1 0.5 0.5 0.5 0 0 1
+10 2 0.0 0.25 0.1 -1 0 0
+500000 1 1.0 1.0 1.0 0 2 0
+"""
+
+
+class TestTrajectoryLAMMPS(unittest.TestCase):
+
+    def setUp(self):
+
+        self.tmpDir = tempfile.mkdtemp()
+        self.fileName = "%s/run.lammpstrj" % self.tmpDir
+        with open(self.fileName, 'w') as f:
+            f.write(DATA)
+
+
+    def tearDown(self):
+
+        for f in os.listdir(self.tmpDir):
+            if not f.startswith("."): os.remove(self.tmpDir+"/"+f)
+        os.rmdir(self.tmpDir)
+
+
+    def test_topology(self):
+
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(traj.nAtoms, 4)
+        self.assertEqual(traj.symbols, ['O', 'H', 'H', 'N'])
+        self.assertEqual(list(traj.aNumbers), [8, 1, 1, 7])
+        self.assertEqual(list(traj.resids), [1, 1, 1, 2])
+        self.assertIn("LAMMPS", repr(traj))
+
+
+    def test_read(self):
+
+        traj = mt.Trajectory(self.fileName)
+        frame = traj.read()
+        self.assertEqual(frame.step, 0)
+        self.assertTrue(numpy.allclose(frame.coordinates,
+                [[1.0, 1.0, 2.0], [1.5, 1.0, 2.5], [1.0, 1.5, 2.5], [4.0, 4.0, 4.0]]))
+        self.assertTrue(numpy.allclose(frame.velocities[:,0], [0.1, 0.2, 0.3, 0.4]))
+        self.assertTrue(numpy.allclose(frame.box, numpy.diag([10.0, 12.0, 14.0])))
+        self.assertTrue(numpy.allclose(frame.origin, [-5.0, 0.0, 0.0]))
+        self.assertEqual(frame.origin.dtype, numpy.float64)
+        self.assertTrue(numpy.allclose(frame.forces[2], [1.0, 2.0, 3.0]))
+        self.assertTrue(numpy.allclose(frame.q, [-0.8, 0.4, 0.4, 0.0]))
+        self.assertEqual(list(frame.id), [1, 2, 3, 4])
+        self.assertEqual(list(frame.type), [1, 2, 2, 3])
+
+        # Triclinic bounds enclose the tilted cell
+        frame = traj.read()
+        self.assertEqual(frame.step, 100)
+        self.assertTrue(numpy.allclose(frame.coordinates[0], [1.1, 1.1, 2.1]))
+        self.assertTrue(numpy.allclose(frame.coordinates[3], [4.1, 4.1, 4.1]))
+        box = [[12.0, 0.0, 0.0], [2.0, 12.0, 0.0], [-1.0, 0.0, 14.0]]
+        self.assertTrue(numpy.allclose(frame.box, box))
+        self.assertTrue(numpy.allclose(frame.origin, [-2.0, 0.0, 0.0]))
+        self.assertIsNone(traj.read())
+
+        # Random access and scan
+        self.assertTrue(numpy.allclose(traj[0]['coordinates'][2], [1.0, 1.5, 2.5]))
+        self.assertEqual(list(traj.scan()['step']), [0, 100])
+        self.assertEqual(len(traj), 2)
+
+
+    def test_scaled(self):
+
+        full = "%s/scaled.dump" % self.tmpDir
+        with open(full, 'w') as f:
+            f.write(SCALED)
+        traj = mt.Trajectory(full)
+        self.assertEqual(traj.symbols, ['2', '1', '1'])
+        self.assertEqual(list(traj.aNumbers), [-1, -1, -1])
+        self.assertIsNone(traj.resids)
+        frame = traj.read()
+        self.assertEqual(frame.time, 0.5)
+        self.assertEqual(frame.step, 10)
+
+        # Sparse ids: 10, 1000, 500000
+        self.assertTrue(numpy.allclose(frame.coordinates,
+                [[1.0, 5.0, 1.0], [6.0, 10.0, 5.0], [11.0, 20.0, 10.0]]))
+        self.assertEqual(frame.image.tolist(), [[-1, 0, 0], [0, 0, 1], [0, 2, 0]])
+        self.assertIsNone(traj.read())
+
+
+    def test_errors(self):
+
+        with open(self.fileName, 'w') as f:
+            f.write(DATA.replace("4\nITEM: BOX BOUNDS xy", "5\nITEM: BOX BOUNDS xy"))
+        traj = mt.Trajectory(self.fileName)
+        traj.read()
+        self.assertRaises(RuntimeError, traj.read)
+
+        with open(self.fileName, 'w') as f:
+            f.write(DATA.replace(" x y z ", " a b c "))
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+
+        with open(self.fileName, 'w') as f:
+            f.write(DATA[:-40])
+        traj = mt.Trajectory(self.fileName)
+        traj.read()
+        self.assertRaises(IOError, traj.read)
+
+        # Repeated ids, in dense and in sparse ranges
+        with open(self.fileName, 'w') as f:
+            f.write(DATA.replace("4 2 3 N 4.0", "3 2 3 N 4.0"))
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+        with open(self.fileName, 'w') as f:
+            f.write(SCALED.replace("500000 1", "1000 1"))
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+
+        self.assertRaises(NotImplementedError, mt.Trajectory,
+                          "%s/out.lammpstrj" % self.tmpDir, "w", ['H'])
+
+
+if __name__ == '__main__':
+    unittest.main()
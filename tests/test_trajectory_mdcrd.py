@@ -0,0 +1,117 @@
+import unittest
+import tempfile
+import os
+import numpy
+import mdarray as mt
+
+
+def mdcrd(frames, boxes=None, title="Cpptraj Generated trajectory"):
+    """Text of an mdcrd file, in the layout written by AMBER"""
+    text = title + "\n"
+    for i, crd in enumerate(frames):
+        values = [ "%8.3f" % v for v in crd.flatten() ]
+        for k in range(0, len(values), 10):
+            text += "".join(values[k:k+10]) + "\n"
+        if boxes is not None:
+            text += "".join("%8.3f" % v for v in boxes[i]) + "\n"
+    return text
+
+
+class TestTrajectoryMDCRD(unittest.TestCase):
+
+    def setUp(self):
+
+        self.tmpDir = tempfile.mkdtemp()
+        self.nAtoms = 7
+        rng = numpy.random.RandomState(5)
+        self.frames = numpy.round(rng.uniform(-150, 150, (6, self.nAtoms, 3)), 3)
+        self.boxes = numpy.round(rng.uniform(20, 30, (6, 3)), 3)
+        self.fileName = "%s/run.mdcrd" % self.tmpDir
+        with open(self.fileName, 'w') as f:
+            f.write(mdcrd(self.frames, self.boxes))
+
+
+    def tearDown(self):
+
+        for f in os.listdir(self.tmpDir):
+            if not f.startswith("."): os.remove(self.tmpDir+"/"+f)
+        os.rmdir(self.tmpDir)
+
+
+    def test_read(self):
+
+        traj = mt.Trajectory(self.fileName, nAtoms=self.nAtoms)
+        self.assertEqual(traj.nAtoms, self.nAtoms)
+        self.assertIsNone(traj.symbols)
+        self.assertIn("MDCRD", repr(traj))
+
+        # Known without reading, the frames have the same size
+        self.assertEqual(len(traj), 6)
+        for i in range(6):
+            frame = traj.read()
+            self.assertTrue(numpy.allclose(frame.coordinates, self.frames[i]))
+            self.assertTrue(numpy.allclose(frame.box, numpy.diag(self.boxes[i])))
+        self.assertIsNone(traj.read())
+
+        traj = mt.Trajectory(self.fileName, nAtoms=self.nAtoms, units='nm')
+        self.assertTrue(numpy.allclose(traj[-1]['coordinates'], self.frames[-1] * 10))
+        self.assertTrue(numpy.allclose(traj[3]['coordinates'], self.frames[3] * 10))
+        self.assertTrue(numpy.allclose(traj.read()['coordinates'], self.frames[4] * 10))
+        self.assertRaises(IndexError, traj.__getitem__, 6)
+        self.assertTrue(numpy.allclose(traj.scan()['box'][:,1,1], self.boxes[:,1] * 10))
+
+
+    def test_readIrregular(self):
+
+        # Without box lines and with a line of different width, frames
+        # are found by reading
+        text = mdcrd(self.frames).splitlines(True)
+        text[3] = text[3].rstrip("\n") + "   \n"
+        with open(self.fileName, 'w') as f:
+            f.write("".join(text) + "\n")
+        traj = mt.Trajectory(self.fileName, nAtoms=self.nAtoms)
+        self.assertTrue(numpy.allclose(traj[4]['coordinates'], self.frames[4]))
+        self.assertFalse('box' in traj[0])
+        self.assertEqual(len(traj), 6)
+
+
+    def test_segments(self):
+
+        names = []
+        for k in range(2):
+            names.append("%s/part%d.mdcrd" % (self.tmpDir, k))
+            with open(names[-1], 'w') as f:
+                f.write(mdcrd(self.frames[3*k:3*k+3], self.boxes[3*k:3*k+3]))
+        traj = mt.Trajectory(names, nAtoms=self.nAtoms)
+        self.assertTrue(numpy.allclose(traj[4]['coordinates'], self.frames[4]))
+        self.assertEqual(len(traj), 6)
+
+
+    def test_convert(self):
+
+        # Names from a topology, the format from the argument
+        topo = "%s/topo.xyz" % self.tmpDir
+        with open(topo, 'w') as f:
+            f.write("%d\n\n" % self.nAtoms)
+            f.write("".join("C %f %f %f\n" % tuple(r) for r in self.frames[0]))
+        src = "%s/run.trj" % self.tmpDir
+        os.rename(self.fileName, src)
+        dst = "%s/out.xyz" % self.tmpDir
+        self.assertEqual(mt.convert(src, dst, topology=topo, nAtoms=self.nAtoms,
+                                    format='MDCRD'), 6)
+        traj = mt.Trajectory(dst)
+        self.assertTrue(numpy.allclose(traj[5]['coordinates'], self.frames[5]))
+        self.assertRaises(ValueError, mt.convert, src, "%s/bad.xyz" % self.tmpDir,
+                          topology=topo, format='MDCRD')
+
+
+    def test_errors(self):
+
+        self.assertRaises(ValueError, mt.Trajectory, self.fileName)
+        traj = mt.Trajectory(self.fileName, nAtoms=self.nAtoms + 1)
+        self.assertRaises(IOError, traj.read)
+        self.assertRaises(IOError, mt.Trajectory, self.fileName, nAtoms=100)
+
+
+if __name__ == '__main__':
+    unittest.main()
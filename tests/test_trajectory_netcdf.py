@@ -0,0 +1,175 @@
+import unittest
+import tempfile
+import struct
+import os
+import numpy
+import mdarray as mt
+
+
+def ncName(name):
+    data = name.encode()
+    return struct.pack('>I', len(data)) + data + b'\0' * (-len(data) % 4)
+
+
+def netcdf(coords, boxes, velocities=None, velScale=20.455, numrecs=None):
+    """Classic (CDF-1) file in the AMBER NetCDF trajectory convention"""
+    nFrames, nAtoms = coords.shape[:2]
+    dims = [ ('frame', 0), ('spatial', 3), ('atom', nAtoms),
+             ('cell_spatial', 3), ('cell_angular', 3) ]
+    # name, dimension ids, type (2 char, 5 float, 6 double), attributes
+    variables = [ ('spatial', [1], 2, b''),
+                  ('time', [0], 5, b''),
+                  ('coordinates', [0, 2, 1], 5, b''),
+                  ('cell_lengths', [0, 3], 6, b''),
+                  ('cell_angles', [0, 4], 6, b'') ]
+    if velocities is not None:
+        attr = ncName('scale_factor') + struct.pack('>IId', 6, 1, velScale)
+        variables.append(('velocities', [0, 2, 1], 5,
+                          struct.pack('>II', 0x0C, 1) + attr))
+    itemSize = { 2: 1, 5: 4, 6: 8 }
+
+    def sizeOf(var):
+        n = itemSize[var[2]]
+        for d in var[1]:
+            if dims[d][1]: n *= dims[d][1]
+        return n
+
+    def header(begins):
+        text = b'CDF\x01' + struct.pack('>I', nFrames if numrecs is None else numrecs)
+        text += struct.pack('>II', 0x0A, len(dims))
+        for name, length in dims:
+            text += ncName(name) + struct.pack('>I', length)
+        text += struct.pack('>II', 0, 0)
+        text += struct.pack('>II', 0x0B, len(variables))
+        for var, begin in zip(variables, begins):
+            text += ncName(var[0]) + struct.pack('>I', len(var[1]))
+            text += b''.join(struct.pack('>I', d) for d in var[1])
+            text += (var[3] or struct.pack('>II', 0, 0))
+            text += struct.pack('>III', var[2], (sizeOf(var) + 3) // 4 * 4, begin)
+        return text
+
+    start = len(header([0] * len(variables)))
+    begins = [ start ]
+    recordStart = start + 4
+    recordSize = 0
+    for var in variables[1:]:
+        begins.append(recordStart + recordSize)
+        recordSize += (sizeOf(var) + 3) // 4 * 4
+    data = header(begins) + b'xyz\0'
+    for i in range(nFrames):
+        data += struct.pack('>f', 2.0 * i)
+        data += coords[i].astype('>f4').tobytes()
+        data += boxes[i].astype('>f8').tobytes()
+        data += numpy.array([90.0, 90.0, 90.0], '>f8').tobytes()
+        if velocities is not None:
+            data += (velocities[i] / velScale).astype('>f4').tobytes()
+    return data
+
+
+class TestTrajectoryNetCDF(unittest.TestCase):
+
+    def setUp(self):
+
+        self.tmpDir = tempfile.mkdtemp()
+        self.nAtoms = 5
+        rng = numpy.random.RandomState(7)
+        self.frames = rng.uniform(-20, 20, (6, self.nAtoms, 3)).astype(numpy.float32)
+        self.velocities = rng.uniform(-1, 1, (6, self.nAtoms, 3)).astype(numpy.float32)
+        self.boxes = rng.uniform(20, 30, (6, 3))
+        self.fileName = "%s/run.nc" % self.tmpDir
+        with open(self.fileName, 'wb') as f:
+            f.write(netcdf(self.frames, self.boxes, self.velocities))
+
+
+    def tearDown(self):
+
+        for f in os.listdir(self.tmpDir):
+            if not f.startswith("."): os.remove(self.tmpDir+"/"+f)
+        os.rmdir(self.tmpDir)
+
+
+    def test_read(self):
+
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(traj.nAtoms, self.nAtoms)
+        self.assertIn("NETCDF", repr(traj))
+
+        # Known from the header
+        self.assertEqual(len(traj), 6)
+        for i in range(6):
+            frame = traj.read()
+            self.assertTrue(numpy.allclose(frame.coordinates, self.frames[i]))
+            self.assertTrue(numpy.allclose(frame.velocities, self.velocities[i], atol=1e-5))
+            self.assertTrue(numpy.allclose(frame.box, numpy.diag(self.boxes[i])))
+            self.assertEqual(frame.time, 2.0 * i)
+        self.assertIsNone(traj.read())
+
+        traj = mt.Trajectory(self.fileName, format='NETCDF', units='nm')
+        self.assertTrue(numpy.allclose(traj[-1]['coordinates'], self.frames[-1] * 10))
+        self.assertTrue(numpy.allclose(traj[2]['coordinates'], self.frames[2] * 10))
+        self.assertTrue(numpy.allclose(traj.read()['coordinates'], self.frames[3] * 10))
+        self.assertRaises(IndexError, traj.__getitem__, 6)
+        self.assertTrue(numpy.allclose(traj.scan()['time'], 2.0 * numpy.arange(6)))
+
+
+    def test_view(self):
+
+        traj = mt.Trajectory(self.fileName)
+        crd = traj.view()
+        self.assertEqual(crd.shape, (6, self.nAtoms, 3))
+        self.assertEqual(crd.dtype, numpy.dtype('>f4'))
+        self.assertFalse(crd.flags.writeable)
+        # Records of the other variables are in between
+        self.assertGreater(crd.strides[0], self.nAtoms * 12)
+        self.assertTrue(numpy.array_equal(crd, self.frames))
+        self.assertEqual(traj.view('spatial').tobytes(), b'xyz')
+        self.assertRaises(KeyError, traj.view, 'forces')
+
+        # The mapping outlives the trajectory
+        del traj
+        self.assertTrue(numpy.array_equal(crd[4], self.frames[4]))
+
+
+    def test_segments(self):
+
+        names = []
+        for k in range(2):
+            names.append("%s/part%d.nc" % (self.tmpDir, k))
+            with open(names[-1], 'wb') as f:
+                f.write(netcdf(self.frames[3*k:3*k+3], self.boxes[3*k:3*k+3]))
+        traj = mt.Trajectory(names)
+        self.assertTrue(numpy.allclose(traj[4]['coordinates'], self.frames[4]))
+        self.assertTrue(numpy.allclose(traj[1]['coordinates'], self.frames[1]))
+        self.assertFalse('velocities' in traj[0])
+        self.assertEqual(len(traj), 6)
+        self.assertRaises(ValueError, traj.view)
+
+
+    def test_incomplete(self):
+
+        # A file still being written: unknown number of records and a
+        # partial one at the end
+        data = netcdf(self.frames, self.boxes, numrecs=0xFFFFFFFF)
+        with open(self.fileName, 'wb') as f:
+            f.write(data[:-30])
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(len(traj), 5)
+        self.assertTrue(numpy.allclose(traj[4]['coordinates'], self.frames[4]))
+
+
+    def test_errors(self):
+
+        with open(self.fileName, 'wb') as f:
+            f.write(b'\x89HDF\r\n\x1a\n' + b'\0' * 100)
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+        with open(self.fileName, 'wb') as f:
+            f.write(b'CDF\x01' + b'\xff' * 100)
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+        xyz = "%s/test.xyz" % self.tmpDir
+        with open(xyz, 'w') as f:
+            f.write("1\n\nC 0 0 0\n")
+        self.assertRaises(ValueError, mt.Trajectory(xyz).view)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,181 @@
+import unittest
+import tempfile
+import os
+import numpy
+import mdarray as mt
+
+DATA = """HEADER    TEST
+TITLE     Water and ammonia t= 0.50000 step= 10
+CRYST1   20.000   25.000   30.000  90.00  90.00  90.00 P 1           1
+MODEL        1
+ATOM      1  OW  SOL A   1       1.000   2.000   3.000  1.00  0.00           O
+ATOM      2  HW1 SOL A   1       1.500   2.500   3.500  1.00  0.00           H
+ATOM      3  HW2 SOL A   1       0.500   1.500   2.500  1.00  0.00           H
+HETATM    4  N   NH3 B   2      10.000  11.000  12.000  1.00  0.00           N
+TER
+ENDMDL
+MODEL        2
+ATOM      1  OW  SOL A   1       1.100   2.100   3.100  1.00  0.00           O
+ATOM      2  HW1 SOL A   1       1.600   2.600   3.600  1.00  0.00           H
+ATOM      3  HW2 SOL A   1       0.600   1.600   2.600  1.00  0.00           H
+HETATM    4  N   NH3 B   2      10.100  11.100  12.100  1.00  0.00           N
+ENDMDL
+MODEL        3
+CRYST1   21.000   25.000   30.000  90.00  90.00  60.00 P 1           1
+ATOM      1  OW  SOL A   1       1.200   2.200   3.200  1.00  0.00           O
+ATOM      2  HW1 SOL A   1       1.700   2.700   3.700  1.00  0.00           H
+ATOM      3  HW2 SOL A   1       0.700   1.700   2.700  1.00  0.00           H
+HETATM    4  N   NH3 B   2      10.200  11.200  12.200  1.00  0.00           N
+ENDMDL
+END
+"""
+
+
+class TestTrajectoryPDB(unittest.TestCase):
+
+    def setUp(self):
+
+        self.tmpDir = tempfile.mkdtemp()
+        self.fileName = "%s/read.pdb" % self.tmpDir
+        with open(self.fileName, 'w') as f:
+            f.write(DATA)
+
+
+    def tearDown(self):
+
+        for f in os.listdir(self.tmpDir):
+            if not f.startswith("."): os.remove(self.tmpDir+"/"+f)
+        os.rmdir(self.tmpDir)
+
+
+    def test_topology(self):
+
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(traj.nAtoms, 4)
+        self.assertEqual(traj.symbols, ['OW', 'HW1', 'HW2', 'N'])
+        self.assertEqual(traj.resNames, ['SOL', 'SOL', 'SOL', 'NH3'])
+        self.assertEqual(list(traj.resids), [1, 1, 1, 2])
+        self.assertEqual(traj.chains, ['A', 'A', 'A', 'B'])
+        self.assertEqual(traj.chainTable, ('A', 'B'))
+        self.assertEqual(list(traj.aNumbers), [8, 1, 1, 7])
+        self.assertTrue(numpy.allclose(traj.masses, [15.999, 1.008, 1.008, 14.007], atol=0.01))
+
+
+    def test_read(self):
+
+        traj = mt.Trajectory(self.fileName)
+        frames = [ traj.read() for i in range(3) ]
+        self.assertIsNone(traj.read())
+
+        self.assertEqual(frames[0]['comment'], 'Water and ammonia t= 0.50000 step= 10')
+        self.assertEqual(frames[0]['time'], 0.5)
+        self.assertEqual(frames[0]['step'], 10)
+        self.assertTrue(numpy.allclose(frames[0]['coordinates'][3], [10.0, 11.0, 12.0]))
+        self.assertTrue(numpy.allclose(frames[1]['coordinates'][0], [1.1, 2.1, 3.1]))
+
+        # The box given before the first model applies to those without CRYST1
+        box = numpy.diag([20.0, 25.0, 30.0])
+        self.assertTrue(numpy.allclose(frames[0]['box'], box))
+        self.assertTrue(numpy.allclose(frames[1]['box'], box))
+        tric = [[21.0, 0.0, 0.0], [12.5, 25.0 * numpy.sqrt(0.75), 0.0], [0.0, 0.0, 30.0]]
+        self.assertTrue(numpy.allclose(frames[2]['box'], tric))
+
+        # Random access and units
+        self.assertTrue(numpy.allclose(traj[1]['coordinates'], frames[1]['coordinates']))
+        self.assertEqual(len(traj), 3)
+        traj = mt.Trajectory(self.fileName, units='nm')
+        self.assertTrue(numpy.allclose(traj[2]['coordinates'], frames[2]['coordinates'] * 10))
+
+
+    def test_readErrors(self):
+
+        with open(self.fileName, 'w') as f:
+            f.write(DATA.replace("HETATM    4", "REMARK    4", 1))
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(traj.nAtoms, 3)
+        traj.read()
+        self.assertRaises(RuntimeError, traj.read)
+
+        with open(self.fileName, 'w') as f:
+            f.write("HEADER    EMPTY\nEND\n")
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+
+
+    def test_write(self):
+
+        src = mt.Trajectory(self.fileName)
+        frames = [ src.read() for i in range(3) ]
+        full = "%s/out.pdb" % self.tmpDir
+        out = mt.Trajectory(full, "w", src.symbols, src.resids, src.resNames,
+                            chains=src.chains)
+        for frame in frames:
+            out.write(frame['coordinates'], box=frame['box'], comment=frame.get('comment', ''))
+        out.close()
+
+        with open(full) as f: lines = f.read().splitlines()
+        self.assertEqual(lines[3], "ATOM      1  OW  SOL A   1       "
+                                   "1.000   2.000   3.000  1.00  0.00           O")
+        self.assertEqual(lines[6], "ATOM      4  N   NH3 B   2      "
+                                   "10.000  11.000  12.000  1.00  0.00           N")
+
+        traj = mt.Trajectory(full)
+        self.assertEqual(traj.symbols, src.symbols)
+        self.assertEqual(traj.resNames, src.resNames)
+        self.assertEqual(traj.chains, src.chains)
+        for frame in frames:
+            copy = traj.read()
+            self.assertEqual(copy.get('comment'), frame.get('comment'))
+            self.assertTrue(numpy.allclose(copy['coordinates'], frame['coordinates']))
+            self.assertTrue(numpy.allclose(copy['box'], frame['box'], atol=0.001))
+        self.assertIsNone(traj.read())
+
+        # writeFrames numbers the models on
+        crd = numpy.array([ f['coordinates'] for f in frames ])
+        out = mt.Trajectory("%s/frames.pdb" % self.tmpDir, "w", src.symbols)
+        out.writeFrames(crd)
+        out.close()
+        traj = mt.Trajectory("%s/frames.pdb" % self.tmpDir)
+        self.assertTrue(numpy.allclose(traj[2]['coordinates'], crd[2]))
+        with open("%s/frames.pdb" % self.tmpDir) as f:
+            self.assertIn("MODEL        3\n", f.read())
+
+
+    def test_elements(self):
+
+        # Two-letter elements start in column 13 and are given in 77-78
+        symbols = [ 'Na', 'Cl', 'Fe', 'C', 'CA' ]
+        name = "%s/ions.pdb" % self.tmpDir
+        out = mt.Trajectory(name, "w", symbols)
+        out.write(numpy.arange(15.0).reshape(5, 3))
+        out.close()
+
+        with open(name) as f: lines = [ l for l in f if l.startswith("ATOM") ]
+        self.assertEqual(lines[0][12:16], "Na  ")
+        self.assertEqual(lines[0][76:78], "NA")
+        self.assertEqual(lines[3][12:16], " C  ")
+        self.assertEqual(lines[4][12:16], " CA ")
+        self.assertEqual(lines[4][76:78], " C")
+
+        traj = mt.Trajectory(name)
+        self.assertEqual(traj.symbols, symbols)
+        self.assertEqual(list(traj.aNumbers), [ 11, 17, 26, 6, 6 ])
+
+        xyz = "%s/ions.xyz" % self.tmpDir
+        with open(xyz, 'w') as f:
+            f.write("3\n\nNa 0 0 0\nCl 1 1 1\nFe 2 2 2\n")
+        mt.convert(xyz, "%s/conv.pdb" % self.tmpDir)
+        traj = mt.Trajectory("%s/conv.pdb" % self.tmpDir)
+        self.assertEqual(list(traj.aNumbers), [ 11, 17, 26 ])
+
+
+    def test_convert(self):
+
+        dst = "%s/conv.pdb" % self.tmpDir
+        self.assertEqual(mt.convert(self.fileName, dst, atoms=[0, 3]), 3)
+        traj = mt.Trajectory(dst)
+        self.assertEqual(traj.chains, ['A', 'B'])
+        self.assertTrue(numpy.allclose(traj[1]['coordinates'][1], [10.1, 11.1, 12.1]))
+
+
+if __name__ == '__main__':
+    unittest.main()
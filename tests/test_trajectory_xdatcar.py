@@ -0,0 +1,148 @@
+import unittest
+import tempfile
+import os
+import numpy
+import mdarray as mt
+
+
+def xdatcar(fractional, cells, names="Si O", counts="2 3", variable=False,
+            scale=1.0, steps=None):
+    """XDATCAR text, with the header repeated if the cell is variable"""
+    def header(cell):
+        text = "system\n%.10f\n" % scale
+        text += "".join("  %.10f %.10f %.10f\n" % tuple(row / abs(scale)) for row in cell)
+        if names: text += "  %s\n" % names
+        return text + "  %s\n" % counts
+
+    text = header(cells[0]) if not variable else ""
+    for i, frac in enumerate(fractional):
+        if variable: text += header(cells[i])
+        text += "Direct configuration= %6d\n" % (steps[i] if steps else i + 1)
+        text += "".join("  %.8f %.8f %.8f\n" % tuple(row) for row in frac)
+    return text
+
+
+class TestTrajectoryXDATCAR(unittest.TestCase):
+
+    def setUp(self):
+
+        self.tmpDir = tempfile.mkdtemp()
+        self.nAtoms = 5
+        rng = numpy.random.RandomState(5)
+        self.fractional = rng.uniform(0, 1, (4, self.nAtoms, 3))
+        base = numpy.array([[10.0, 0.0, 0.0], [2.0, 9.0, 0.0], [-1.5, 1.0, 11.0]])
+        self.cells = numpy.array([ base * (1 + 0.01 * i) for i in range(4) ])
+        self.fileName = "%s/XDATCAR" % self.tmpDir
+
+
+    def tearDown(self):
+
+        for f in os.listdir(self.tmpDir):
+            if not f.startswith("."): os.remove(self.tmpDir+"/"+f)
+        os.rmdir(self.tmpDir)
+
+
+    def write(self, text, fileName=None):
+
+        with open(fileName or self.fileName, 'w') as f:
+            f.write(text)
+
+
+    def test_fixedCell(self):
+
+        self.write(xdatcar(self.fractional, self.cells, steps=[10, 20, 30, 40]))
+        traj = mt.Trajectory(self.fileName)
+        self.assertIn("XDATCAR", repr(traj))
+        self.assertEqual(traj.nAtoms, self.nAtoms)
+        self.assertEqual(traj.symbols, [ 'Si', 'Si', 'O', 'O', 'O' ])
+        self.assertEqual(list(traj.aNumbers), [14, 14, 8, 8, 8])
+        self.assertTrue(numpy.allclose(traj.masses, [28.086, 28.086, 15.999, 15.999, 15.999],
+                                       atol=0.01))
+        for i in range(4):
+            frame = traj.read()
+            self.assertTrue(numpy.allclose(frame.coordinates,
+                                           numpy.dot(self.fractional[i], self.cells[0])))
+            self.assertTrue(numpy.allclose(frame.box, self.cells[0]))
+            self.assertEqual(frame.step, 10 * (i + 1))
+        self.assertIsNone(traj.read())
+        self.assertTrue(numpy.array_equal(traj.scan()['step'], [10, 20, 30, 40]))
+
+        traj = mt.Trajectory(self.fileName, units='nm')
+        self.assertTrue(numpy.allclose(traj[2]['box'], self.cells[0] * 10))
+
+
+    def test_variableCell(self):
+
+        self.write(xdatcar(self.fractional, self.cells, variable=True) + "\n")
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(len(traj), 4)
+        for i in [ 3, 1, 2, 0 ]:
+            frame = traj[i]
+            self.assertTrue(numpy.allclose(frame.coordinates,
+                                           numpy.dot(self.fractional[i], self.cells[i])))
+            self.assertTrue(numpy.allclose(frame.box, self.cells[i]))
+            self.assertEqual(frame.step, i + 1)
+
+        # The last header is of other atoms
+        text = xdatcar(self.fractional, self.cells, variable=True)
+        last = text.rindex("2 3")
+        self.write(text[:last] + "2 4" + text[last+3:])
+        traj = mt.Trajectory(self.fileName)
+        traj[2]
+        self.assertRaises(RuntimeError, traj.read)
+
+
+    def test_wrap(self):
+
+        # Atoms outside of the triclinic cell
+        shifts = numpy.array([[-1, 0, 2], [0, 1, 0], [3, -2, 0], [0, 0, -1], [1, 1, 1]])
+        self.write(xdatcar(self.fractional[:1] + shifts, self.cells))
+        traj = mt.Trajectory(self.fileName)
+        frame = traj.read(wrap=True)
+        self.assertTrue(numpy.allclose(frame.coordinates,
+                                       numpy.dot(self.fractional[0], self.cells[0])))
+        traj = mt.Trajectory(self.fileName)
+        frame = traj.read(wrap=True, box=numpy.diag([4.0, 5.0, 6.0]))
+        self.assertTrue(numpy.all(frame.coordinates >= 0))
+        self.assertTrue(numpy.all(frame.coordinates < [4.0, 5.0, 6.0]))
+
+
+    def test_variants(self):
+
+        # Negative scale is the volume of the cell
+        volume = abs(numpy.linalg.det(self.cells[0]))
+        self.write(xdatcar(self.fractional, self.cells[:1] / 2, scale=-volume))
+        frame = mt.Trajectory(self.fileName).read()
+        self.assertTrue(numpy.allclose(frame.box, self.cells[0]))
+
+        # Cartesian configurations, scaled
+        text = "system\n2.0\n"
+        text += "".join("  %f %f %f\n" % tuple(row / 2) for row in self.cells[0])
+        text += "  Si_pv\n  1\nCartesian configuration=     1\n  1.0 2.0 3.0\n"
+        self.write(text)
+        traj = mt.Trajectory(self.fileName)
+        self.assertEqual(traj.symbols, [ 'Si' ])
+        self.assertEqual(list(traj.aNumbers), [14])
+        self.assertTrue(numpy.allclose(traj.read().coordinates, [[2.0, 4.0, 6.0]]))
+
+        # VASP 4 files have no names
+        self.write(xdatcar(self.fractional, self.cells, names=None))
+        traj = mt.Trajectory(self.fileName)
+        self.assertIsNone(traj.symbols)
+        self.assertIsNone(traj.aNumbers)
+        self.assertEqual(len(traj), 4)
+
+
+    def test_errors(self):
+
+        text = xdatcar(self.fractional, self.cells)
+        self.write(text.replace("Si O", "Si O N"))
+        self.assertRaises(IOError, mt.Trajectory, self.fileName)
+        self.write("\n".join(text.split("\n")[:-3]))
+        traj = mt.Trajectory(self.fileName)
+        traj[2]
+        self.assertRaises(IOError, traj.__getitem__, 3)
+
+
+if __name__ == '__main__':
+    unittest.main()
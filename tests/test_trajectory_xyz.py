@@ -3,6 +3,7 @@ import tempfile
 import random
 import os
 import stat
+import subprocess
 import numpy
 import mdarray as mt
 
@@ -239,6 +240,302 @@ class TestTrajectoryXYZ(unittest.TestCase):
         self.assertRaises(RuntimeError, traj.read)
         del traj
 
+    def test_writeFormat(self):
+
+        sym = [ random.choice(list(atomicMasses.keys())) for i in range(100) ]
+        x = (numpy.random.random((100, 3)) - 0.5) * 10.0**numpy.random.randint(-6, 8, (100, 3))
+        x[0,:] = [0.0, -0.0, -1e-10]
+        x[1,:] = [1e16, -0.125, 0.5e-8]
+        xyz = self.tmpDir+"/out.xyz"
+        traj = mt.Trajectory(xyz, 'w', sym, format='XYZ')
+        traj.write(x, comment='format')
+        del traj
+
+        # Text must be the same as the one produced by printf
+        expected = "100\nformat\n"
+        for s, row in zip(sym, x):
+            expected += "%s % 12.8f % 12.8f % 12.8f\n" % (s, row[0], row[1], row[2])
+        with open(xyz) as f:
+            self.assertEqual(f.read(), expected)
+        os.remove(xyz)
+
+    def test_writeFrames(self):
+
+        nFrames = 10
+        sym = ['C', 'O', 'H']
+        x = numpy.random.random((nFrames, 3, 3)) * 10
+        single = self.tmpDir+"/single.xyz"
+        traj = mt.Trajectory(single, 'w', sym, format='XYZ')
+        for i in range(nFrames):
+            traj.write(x[i], comment=str(i))
+        del traj
+        batch = self.tmpDir+"/batch.xyz"
+        traj = mt.Trajectory(batch, 'w', sym, format='XYZ')
+        traj.writeFrames(x.astype(numpy.float32).astype(numpy.float64),
+                         comments=[ str(i) for i in range(nFrames) ])
+        traj.writeFrames(x[:0])
+        del traj
+
+        traj = mt.Trajectory(batch)
+        for i in range(nFrames):
+            frame = traj.read()
+            self.assertEqual(frame['comment'], str(i))
+            self.assertTrue(numpy.allclose(frame['coordinates'], x[i], atol=1e-5))
+        self.assertIsNone(traj.read())
+        del traj
+
+        os.remove(batch)
+        traj = mt.Trajectory(batch, 'w', sym, format='XYZ')
+        traj.writeFrames(x, comments=[ str(i) for i in range(nFrames) ])
+        del traj
+        with open(single) as f: expected = f.read()
+        with open(batch) as f: saved = f.read()
+        self.assertEqual(saved, expected)
+        os.remove(single)
+        os.remove(batch)
+
+    def test_asyncWrite(self):
+
+        nFrames = 50
+        sym = ['C', 'O', 'H']
+        x = numpy.random.random((nFrames, 3, 3)) * 10
+        single = self.tmpDir+"/single.xyz"
+        traj = mt.Trajectory(single, 'w', sym, format='XYZ')
+        for i in range(nFrames):
+            traj.write(x[i], comment=str(i))
+        traj.close()
+        # Closing twice is fine, writing to a closed file is not
+        traj.close()
+        self.assertRaises(ValueError, traj.write, x[0])
+
+        async_ = self.tmpDir+"/async.xyz"
+        traj = mt.Trajectory(async_, 'w', sym, format='XYZ', asyncWrite=True)
+        buf = numpy.empty((3, 3))
+        for i in range(nFrames):
+            # Buffer is reused, so it has to be copied
+            buf[:] = x[i]
+            traj.write(buf, comment=str(i))
+        traj.flush()
+        with open(single) as f: expected = f.read()
+        with open(async_) as f: saved = f.read()
+        self.assertEqual(saved, expected)
+        # Arrays borrowed without copying
+        for i in range(nFrames):
+            traj.write(x[i], comment=str(i), copy=False)
+        traj.writeFrames(x, comments=[ str(i) for i in range(nFrames) ])
+        self.assertEqual(traj.lastFrame, 3*nFrames-1)
+        traj.close()
+        with open(async_) as f: saved = f.read()
+        self.assertEqual(saved, 3*expected)
+
+        self.assertRaises(ValueError, mt.Trajectory, single, asyncWrite=True)
+        os.remove(single)
+        os.remove(async_)
+
+    def test_randomAccess(self):
+
+        nFrames = 20
+        sym = ['C', 'O']
+        xyz = self.tmpDir+"/random.xyz"
+        traj = mt.Trajectory(xyz, 'w', sym, format='XYZ')
+        for i in range(nFrames):
+            traj.write(numpy.full((2, 3), float(i)), comment=str(i))
+        del traj
+
+        traj = mt.Trajectory(xyz)
+        self.assertEqual(traj[5]['comment'], '5')
+        # Sequential reading continues after the frame
+        self.assertEqual(traj.read()['comment'], '6')
+        self.assertEqual(traj[2]['comment'], '2')
+        self.assertEqual(traj[-1]['comment'], str(nFrames-1))
+        self.assertEqual(traj[-nFrames]['comment'], '0')
+        self.assertRaises(IndexError, traj.__getitem__, nFrames)
+        self.assertRaises(IndexError, traj.__getitem__, -nFrames-1)
+
+        traj = mt.Trajectory(xyz)
+        self.assertIsNone(traj.cacheInfo())
+        traj.setCache(maxFrames=3)
+        for i in [0, 1, 2, 0, 3, 1, 0]:
+            frame = traj[i]
+            self.assertEqual(frame['comment'], str(i))
+            self.assertTrue(numpy.all(frame['coordinates'] == i))
+        info = traj.cacheInfo()
+        # 1 is dropped when 3 is added, and 2 when 1 comes back
+        self.assertEqual(info['hits'], 2)
+        self.assertEqual(info['misses'], 5)
+        self.assertEqual(info['frames'], 3)
+        self.assertEqual(info['bytes'], 3*6*8)
+        # Cached arrays are shared and read-only
+        self.assertIs(traj[0]['coordinates'], frame['coordinates'])
+        self.assertRaises(ValueError, frame['coordinates'].__setitem__, 0, 1.0)
+        traj.setCache(maxBytes=2*6*8)
+        traj[4]; traj[5]; traj[6]
+        self.assertEqual(traj.cacheInfo()['frames'], 2)
+        traj.setCache()
+        self.assertIsNone(traj.cacheInfo())
+        os.remove(xyz)
+
+    def test_scan(self):
+
+        nFrames = 12
+        xyz = self.tmpDir+"/scan.xyz"
+        traj = mt.Trajectory(xyz, 'w', ['C', 'O'], format='XYZ')
+        for i in range(nFrames):
+            traj.write(numpy.full((2, 3), float(i)), comment="frame %d" % i)
+        self.assertEqual(len(traj), nFrames)
+        del traj
+
+        traj = mt.Trajectory(xyz)
+        self.assertEqual(traj.read()['comment'], "frame 0")
+        info = traj.scan()
+        self.assertEqual(info['frames'], nFrames)
+        self.assertEqual(info['comment'], tuple("frame %d" % i for i in range(nFrames)))
+        self.assertIsNone(info['time'])
+        self.assertIsNone(info['box'])
+        self.assertIs(traj.scan(), info)
+        self.assertEqual(len(traj), nFrames)
+        # Reading continues after the frame read before
+        self.assertEqual(traj.read()['comment'], "frame 1")
+        self.assertEqual(traj[-1]['comment'], "frame %d" % (nFrames-1))
+
+        # Last line without the end of line
+        with open(xyz) as f: text = f.read()
+        with open(xyz, 'w') as f: f.write(text.rstrip('\n'))
+        self.assertEqual(len(mt.Trajectory(xyz)), nFrames)
+        with open(xyz, "w") as f: f.write(text[:-70])
+        self.assertRaises(IOError, mt.Trajectory(xyz).scan)
+        os.remove(xyz)
+
+    def test_readPipe(self):
+
+        nFrames = 50
+        xyz = self.tmpDir+"/pipe.xyz"
+        traj = mt.Trajectory(xyz, 'w', ['C', 'O'] * 50, format='XYZ')
+        for i in range(nFrames):
+            traj.write(numpy.full((100, 3), float(i)), comment="frame %d" % i)
+        del traj
+
+        self.assertRaises(ValueError, mt.Trajectory, '-')
+        self.assertRaises(ValueError, mt.Trajectory, '-', format='MOLDEN')
+
+        # Standard input is replaced with the output of another process
+        feeder = subprocess.Popen(['cat', xyz], stdout=subprocess.PIPE)
+        savedStdin = os.dup(0)
+        os.dup2(feeder.stdout.fileno(), 0)
+        try:
+            traj = mt.Trajectory('-', format='XYZ')
+        finally:
+            os.dup2(savedStdin, 0)
+            os.close(savedStdin)
+            feeder.stdout.close()
+        self.assertEqual(traj.nAtoms, 100)
+        for i in range(nFrames):
+            frame = traj.read()
+            self.assertEqual(frame['comment'], "frame %d" % i)
+            self.assertTrue((frame['coordinates'] == float(i)).all())
+        self.assertIsNone(traj.read())
+        feeder.wait()
+        os.remove(xyz)
+
+    def test_extendedXYZ(self):
+
+        xyz = self.tmpDir+"/ext.xyz"
+        header = 'Lattice="10 0 0 0 11 0 0 0 %.1f" ' \
+            'Properties=species:S:1:pos:R:3:forces:R:3:tag:I:1:fixed:L:1 '
+        with open(xyz, 'w') as f:
+            f.write('2\n' + header % 12 + 'energy=-1.5 pbc="T T F" time=0.5 name="a b" free\n')
+            f.write('O 0.0 0.0 0.0 0.1 0.2 0.3 1 T\n')
+            f.write('H 1.0 0.0 0.0 -0.1 0.0 0.0 2 F\n')
+            f.write('2\n' + header % 13 + 'energy=-1.0\n')
+            f.write('O 0.5 0.0 0.0 0.0 0.0 0.0 1 T\n')
+            f.write('H 1.5 0.0 0.0 0.0 0.0 0.0 2 F\n')
+
+        traj = mt.Trajectory(xyz)
+        self.assertEqual(traj.symbols, ['O', 'H'])
+        frame = traj.read()
+        self.assertEqual(frame.coordinates[1,0], 1.0)
+        self.assertEqual(frame.box[2,2], 12.0)
+        self.assertEqual(frame.time, 0.5)
+        self.assertEqual(frame['energy'], -1.5)
+        self.assertEqual(list(frame.pbc), [True, True, False])
+        self.assertEqual(frame.info['name'], 'a b')
+        self.assertIs(frame.info['free'], True)
+        self.assertEqual(frame.forces.shape, (2, 3))
+        self.assertEqual(frame.forces[0,2], 0.3)
+        self.assertEqual(list(frame.tag), [1, 2])
+        self.assertEqual(list(frame.fixed), [True, False])
+        self.assertTrue('forces' in frame.keys())
+        frame = traj.read()
+        self.assertEqual(frame.energy, -1.0)
+        self.assertEqual(frame.box[2,2], 13.0)
+        self.assertEqual(list(traj.scan()['box'][:,2,2]), [12.0, 13.0])
+
+        # Plain comments are left alone
+        self.assertIsNone(mt.Trajectory(self.tmpDir+"/angs.xyz").read().info)
+        os.remove(xyz)
+
+    def test_frame(self):
+
+        xyz = self.tmpDir+"/frame.xyz"
+        traj = mt.Trajectory(xyz, 'w', ['C', 'O'], format='XYZ')
+        traj.write(numpy.array([[0., 1., 2.], [3., 4., 5.]]), comment='CO')
+        del traj
+
+        frame = mt.Trajectory(xyz).read()
+        self.assertIsInstance(frame, mt.Frame)
+        self.assertEqual(frame.nAtoms, 2)
+        self.assertEqual(len(frame), 2)
+        self.assertEqual(frame.keys(), ['comment', 'coordinates'])
+        self.assertEqual(list(frame), frame.keys())
+        self.assertTrue('coordinates' in frame)
+        self.assertFalse('box' in frame)
+        self.assertIsNone(frame.box)
+        self.assertIsNone(frame.get('box'))
+        self.assertEqual(frame.get('time', 0.0), 0.0)
+        self.assertRaises(KeyError, frame.__getitem__, 'box')
+        self.assertRaises(KeyError, frame.__getitem__, 'nothing')
+        # Arrays are created once, then shared
+        self.assertIs(frame.coordinates, frame['coordinates'])
+        self.assertEqual(frame.coordinates[1,2], 5.0)
+        frame['coordinates'] += 1.0
+        self.assertEqual(frame.coordinates[1,2], 6.0)
+        frame['box'] = numpy.eye(3)
+        self.assertTrue('box' in frame)
+        del frame['box']
+        self.assertIsNone(frame.box)
+        self.assertRaises(KeyError, frame.__setitem__, 'nothing', 1)
+        d = frame.toDict()
+        self.assertEqual(sorted(d.keys()), ['comment', 'coordinates'])
+        self.assertEqual(dict(frame.items())['comment'], 'CO')
+        self.assertTrue(repr(frame).startswith("Frame({'comment': 'CO'"))
+        os.remove(xyz)
+
+    def test_bufferPool(self):
+
+        xyz = self.tmpDir+"/pool.xyz"
+        traj = mt.Trajectory(xyz, 'w', ['C', 'O', 'N'], format='XYZ')
+        for i in range(3):
+            traj.write(numpy.full((3, 3), float(i)))
+        del traj
+
+        traj = mt.Trajectory(xyz)
+        crd = traj.read()['coordinates']
+        address = crd.__array_interface__['data'][0]
+        self.assertFalse(crd.flags.owndata)
+        self.assertIsNotNone(crd.base)
+        # The buffer is reused, once the previous array is gone
+        del crd
+        crd = traj.read()['coordinates']
+        self.assertEqual(crd.__array_interface__['data'][0], address)
+        self.assertTrue(numpy.all(crd == 1.0))
+        # ...but never while it is still in use
+        other = traj.read()['coordinates']
+        self.assertNotEqual(other.__array_interface__['data'][0], address)
+        self.assertTrue(numpy.all(crd == 1.0))
+        self.assertTrue(numpy.all(other == 2.0))
+        self.assertEqual(traj.masses.base.__class__.__name__, 'PyCapsule')
+        os.remove(xyz)
+
     def test_writeMultiple(self):
 
         nFrames = 10
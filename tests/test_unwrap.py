@@ -0,0 +1,116 @@
+import unittest
+import tempfile
+import os
+import sys
+import numpy
+import mdarray as mt
+
+sys.path.insert(0, os.path.dirname(os.path.realpath(__file__)))
+from test_trajectory_xdatcar import xdatcar
+
+
+class TestUnwrap(unittest.TestCase):
+
+    def setUp(self):
+
+        # Random walk, long enough to cross the box several times
+        rng = numpy.random.RandomState(4)
+        self.nAtoms = 13
+        steps = rng.normal(0, 0.4, (100, self.nAtoms, 3))
+        self.walk = numpy.cumsum(steps, axis=0) + rng.uniform(0, 6, (self.nAtoms, 3))
+        self.box = numpy.array([[6.0, 0.0, 0.0], [1.5, 5.5, 0.0], [-1.0, 2.0, 7.0]])
+
+
+    def assertUnwrapped(self, coords, reference, box):
+
+        # Equal up to a lattice vector of each atom, constant in time;
+        # text files keep 8 decimals
+        shift = coords - reference
+        self.assertTrue(numpy.allclose(shift, shift[0], atol=1e-6))
+        frac = numpy.dot(shift[0], numpy.linalg.inv(box))
+        self.assertTrue(numpy.allclose(frac, numpy.round(frac), atol=1e-6))
+
+
+    def test_apply(self):
+
+        frames = self.walk.copy()
+        mt.wrap(frames, self.box)
+        unwrapper = mt.Unwrapper()
+        for frame in frames:
+            self.assertIs(unwrapper.apply(frame, self.box), frame)
+        self.assertEqual(unwrapper.nAtoms, self.nAtoms)
+        self.assertEqual(unwrapper.nFrames, len(frames))
+        self.assertUnwrapped(frames, self.walk, self.box)
+        self.assertGreater(numpy.abs(frames - self.walk).max(), 5.0)
+        self.assertLess(numpy.abs(frames[0] - self.walk[0] - (frames[-1] - self.walk[-1])).max(), 1e-9)
+
+        # All frames at once, with a box for each, after a reset
+        frames = self.walk.copy()
+        boxes = numpy.array([ self.box ] * len(frames))
+        mt.wrap(frames, self.box)
+        unwrapper.reset()
+        unwrapper.apply(frames, boxes)
+        self.assertUnwrapped(frames, self.walk, self.box)
+
+        # For three frames, a 3x3 box is a shared matrix; lengths of each
+        # frame are given as matrices, or as (frames, 3) for other counts
+        frames = self.walk[:3].copy()
+        mt.wrap(frames, self.box)
+        mt.Unwrapper().apply(frames, self.box)
+        self.assertUnwrapped(frames, self.walk[:3], self.box)
+        frames = numpy.array([[[9.5, 1.0, 1.0]], [[0.5, 1.0, 1.0]], [[19.0, 1.0, 1.0]]])
+        mt.Unwrapper().apply(frames, [numpy.diag([10.0, 10.0, 10.0])] * 3)
+        self.assertTrue(numpy.allclose(frames[:, 0, 0], [9.5, 10.5, 9.0]))
+        frames = numpy.array([[[9.5, 1.0, 1.0]], [[0.5, 1.0, 1.0]]])
+        mt.Unwrapper().apply(frames, [[10.0, 10.0, 10.0]] * 2)
+        self.assertTrue(numpy.allclose(frames[:, 0, 0], [9.5, 10.5]))
+
+        # Orthorhombic box, as lengths
+        frames = self.walk.copy()
+        mt.wrap(frames, [6.0, 5.5, 7.0])
+        unwrapper.reset()
+        unwrapper.apply(frames[:20], [6.0, 5.5, 7.0])
+        unwrapper.apply(frames[20:], [6.0, 5.5, 7.0])
+        self.assertUnwrapped(frames, self.walk, numpy.diag([6.0, 5.5, 7.0]))
+
+
+    def test_read(self):
+
+        tmpDir = tempfile.mkdtemp()
+        fileName = "%s/XDATCAR" % tmpDir
+        try:
+            fractional = numpy.dot(self.walk, numpy.linalg.inv(self.box)) % 1.0
+            with open(fileName, 'w') as f:
+                f.write(xdatcar(fractional, [ self.box ], names="C", counts=str(self.nAtoms)))
+            traj = mt.Trajectory(fileName)
+            unwrapper = mt.Unwrapper()
+            frames = numpy.array([ traj.read(unwrap=unwrapper).coordinates
+                                   for i in range(len(self.walk)) ])
+            self.assertUnwrapped(frames, self.walk, self.box)
+        finally:
+            os.remove(fileName)
+            os.rmdir(tmpDir)
+
+
+    def test_errors(self):
+
+        unwrapper = mt.Unwrapper()
+        unwrapper.apply(self.walk[0].copy(), self.box)
+        self.assertRaises(ValueError, unwrapper.apply, self.walk[0, :5].copy(), self.box)
+        self.assertRaises(ValueError, unwrapper.apply, self.walk[1].copy(), numpy.zeros((3, 3)))
+        self.assertRaises(ValueError, unwrapper.apply, self.walk[:3].copy(), numpy.ones((2, 3)))
+        self.assertRaises(ValueError, unwrapper.apply, self.walk[:3].copy(), numpy.ones(9))
+
+        # A bad box of a later frame leaves frames and state unchanged
+        frames = self.walk[1:5].copy()
+        boxes = numpy.array([ self.box ] * 4)
+        boxes[2] = 0.0
+        self.assertRaises(ValueError, unwrapper.apply, frames, boxes)
+        self.assertTrue(numpy.array_equal(frames, self.walk[1:5]))
+        self.assertEqual(unwrapper.nFrames, 1)
+        self.assertRaises(TypeError, mt.Trajectory(os.path.dirname(os.path.realpath(__file__))
+                                                   + '/3wat.xyz').read, unwrap=1)
+
+
+if __name__ == '__main__':
+    unittest.main()
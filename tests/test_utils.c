@@ -11,6 +11,7 @@
 
 #include "mdarray.h"
 #include "utils.h"
+#include "tokenizer.h"
 
 static FILE* tmpFile = NULL;
 
@@ -105,19 +106,143 @@ void testSTRPARTFLOAT(void) {
 	}
 }
 
+void testPARSEFLOAT(void) {
+	const struct {
+		const char *str;
+		int len;
+		double val;
+		int consumed;
+	} data[] = {
+		{ "  -12.345678", 12, -12.345678, 12 },
+		{ "1.5 2.5", 7, 1.5, 3 },
+		{ "1.52.5", 3, 1.5, 3 },
+		{ "\t+0.001e3x", 10, 1.0, 9 },
+		{ "1.0D+02", 7, 100.0, 7 },
+		{ "6.02214076e23", 13, 6.02214076e23, 13 },
+		{ "0.1000000000000000055511151231257827", 36, 0.1, 36 },
+		{ "12345678901234567890123", 23, 12345678901234567890123.0, 23 },
+		{ "abc", 3, 0.0, 0 },
+		{ "1e", 2, 1.0, 1 } };
+	char buffer[64];
+	const char *stop;
+	double result, expected;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		result = parseFloat(data[i].str, data[i].str + data[i].len, &stop);
+		CU_ASSERT(result == data[i].val);
+		CU_ASSERT(stop - data[i].str == data[i].consumed);
+	}
+
+	// Must be correctly rounded, like strtod
+	for (i = 0; i < 10000; i++) {
+		expected = ((double)rand()/RAND_MAX - 0.5) * pow(10.0, rand() % 12 - 4);
+		sprintf(buffer, i % 2 ? "%.8f" : "%.15e", expected);
+		CU_ASSERT(parseFloat(buffer, NULL, NULL) == strtod(buffer, NULL));
+	}
+}
+
+void testFORMATFIXED(void) {
+	const double data[] = { 0.0, -0.0, 1.0, -1.1111111111, 0.125, 2.5e-9,
+		-4.9e-9, 123456.123456789, 1e15, -1e300, 0.5e-8, 1.0/3.0 };
+	char buffer[400], expected[400];
+	double val;
+	int i, n;
+
+	// Must give exactly the same text as printf
+	for (i = 0; i < 12; i++) {
+		n = formatFixed(buffer, data[i], 12, 8, ' ');
+		buffer[n] = '\0';
+		sprintf(expected, "% 12.8f", data[i]);
+		CU_ASSERT_STRING_EQUAL(buffer, expected);
+	}
+	for (i = 0; i < 10000; i++) {
+		val = ((double)rand()/RAND_MAX - 0.5) * pow(10.0, rand() % 14 - 6);
+		n = formatFixed(buffer, val, 12, 8, ' ');
+		buffer[n] = '\0';
+		sprintf(expected, "% 12.8f", val);
+		CU_ASSERT_STRING_EQUAL(buffer, expected);
+		n = formatFixed(buffer, val, 8, 3, 0);
+		buffer[n] = '\0';
+		sprintf(expected, "%8.3f", val);
+		CU_ASSERT_STRING_EQUAL(buffer, expected);
+	}
+}
+
+void testTOKENIZE(void) {
+	const char *block = "C  1.0 2.0\t3.0\n\n  H 4 5 6 7\r\n"
+	                    "O 7.0 8.0 9.0 xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\n"
+	                    "N 1 2 3";
+	const int fields[] = { 4, 0, 5, 5, 4 };
+	char *buffer;
+	long len, used;
+	Tokens tok;
+	int i, j, n;
+
+	tokensInit(&tok);
+	len = strlen(block);
+
+	// All lines, including the last one without newline
+	used = tokenizeBlock(block, len, 10, 1, &tok);
+	CU_ASSERT(used == len);
+	CU_ASSERT(tok.nLines == 5);
+	for (i = 0; i < 5; i++) CU_ASSERT(tok.lineFields[i] == fields[i]);
+	CU_ASSERT(tok.fieldEnd[0] - tok.fieldBegin[0] == 1);
+	CU_ASSERT(!strncmp(block + tok.fieldBegin[3], "3.0", 3));
+	CU_ASSERT(!strncmp(block + tok.fieldBegin[tok.lineFirst[2]+4], "7", 1));
+	CU_ASSERT(tok.fieldEnd[tok.lineFirst[2]+4] == tok.fieldBegin[tok.lineFirst[2]+4] + 1);
+	CU_ASSERT(!strncmp(block + tok.fieldBegin[tok.nFields-1], "3", 1));
+
+	// Stop after the requested number of lines
+	used = tokenizeBlock(block, len, 2, 1, &tok);
+	CU_ASSERT(tok.nLines == 2);
+	CU_ASSERT(block[used-1] == '\n' && block[used] == ' ');
+
+	// More data expected - the last line is incomplete
+	used = tokenizeBlock(block, len, 10, 0, &tok);
+	CU_ASSERT(tok.nLines == 4);
+	CU_ASSERT(block[used] == 'N');
+
+	// Compare with a simple scan on random data, spanning many chunks
+	len = 5000;
+	buffer = (char*) malloc(len + 1);
+	for (i = 0; i < len; i++) buffer[i] = " \t\nab"[rand() % 5];
+	buffer[len] = '\0';
+	tokenizeBlock(buffer, len, len, 1, &tok);
+	for (i = 0, j = 0, n = 0; i < len; i++) {
+		if (buffer[i] == '\n') n++;
+		if (buffer[i] != ' ' && buffer[i] != '\t' && buffer[i] != '\n' &&
+		    (i == 0 || buffer[i-1] == ' ' || buffer[i-1] == '\t' || buffer[i-1] == '\n')) {
+			CU_ASSERT(tok.fieldBegin[j] == i);
+			j++;
+		}
+	}
+	CU_ASSERT(tok.nFields == j);
+	CU_ASSERT(tok.nLines == n + (buffer[len-1] != '\n'));
+	free(buffer);
+
+	tokensFree(&tok);
+}
+
 void testBYSYMBOL(void) {
 	const struct {
 		const char *sym;
 		int id;
 	} symbols[] = {
 		{ "H", 0 }, { "He", 1 }, { "C", 5 }, { "Zn", 29 },
-		{ "Ts", 116 }, { "Og", 117 }, { "", -1 }, { "Xyz", -1 }};
+		{ "Ts", 116 }, { "Og", 117 }, { "", -1 }, { "Xyz", -1 },
+		{ "he", -1 }, { "HE", -1 }, { "Q", -1 }, { "C1", -1 }};
 	int i, result;
 	
-	for (i = 0; i < 8; i++) {
+	for (i = 0; i < 12; i++) {
 		result = getElementIndexBySymbol(symbols[i].sym);
 		CU_ASSERT(result == symbols[i].id);
 	}
+
+	// Spans do not have to be terminated
+	CU_ASSERT(getElementIndexBySpan("Clx", 2) == 16);
+	CU_ASSERT(getElementIndexBySpan("Clx", 1) == 5);
+	CU_ASSERT(getElementIndexBySpan("Clx", 3) == -1);
 }
 
 /*void testGETFROM2D(void) {
@@ -237,6 +362,21 @@ int main() {
       return CU_get_error();
    }
 
+   if (CU_add_test(pSuite, "test of parseFloat()", testPARSEFLOAT) == NULL) {
+      CU_cleanup_registry();
+      return CU_get_error();
+   }
+
+   if (CU_add_test(pSuite, "test of formatFixed()", testFORMATFIXED) == NULL) {
+      CU_cleanup_registry();
+      return CU_get_error();
+   }
+
+   if (CU_add_test(pSuite, "test of tokenizeBlock()", testTOKENIZE) == NULL) {
+      CU_cleanup_registry();
+      return CU_get_error();
+   }
+
    if (CU_add_test(pSuite, "test of getElementIndexBySymbol()", testBYSYMBOL) == NULL) {
       CU_cleanup_registry();
       return CU_get_error();
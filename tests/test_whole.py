@@ -0,0 +1,107 @@
+import unittest
+import os
+import numpy
+import mdarray as mt
+
+
+class TestWhole(unittest.TestCase):
+
+    def setUp(self):
+
+        self.testDir = os.path.dirname(os.path.realpath(__file__))
+        # Chain of 20 atoms, 1.2 A apart: longer than the box
+        self.nChain = 20
+        self.chain = numpy.zeros((self.nChain, 3))
+        self.chain[:, 0] = 1.2 * numpy.arange(self.nChain)
+        self.chain[:, 1] = 0.3 * numpy.sin(numpy.arange(self.nChain))
+        self.bonds = [ (i, i + 1) for i in range(self.nChain - 1) ]
+        self.box = numpy.array([[8.0, 0.0, 0.0], [2.0, 7.0, 0.0], [1.0, -1.5, 9.0]])
+
+
+    def assertWhole(self, coords, reference, box):
+
+        # Whole again, up to a translation of the entire molecule by a
+        # lattice vector
+        shift = coords - reference
+        self.assertTrue(numpy.allclose(shift, shift[0]))
+        frac = numpy.dot(shift[0], numpy.linalg.inv(box))
+        self.assertTrue(numpy.allclose(frac, numpy.round(frac)))
+
+
+    def test_makeWhole(self):
+
+        frames = numpy.array([ self.chain + [0.5 * i, 0.0, 1.0] for i in range(3) ])
+        mt.wrap(frames, self.box)
+        result = mt.makeWhole(frames, self.box, self.bonds)
+        self.assertIs(result, frames)
+        for i in range(3):
+            self.assertWhole(frames[i], self.chain + [0.5 * i, 0.0, 1.0], self.box)
+
+        # Bonds in any order, as a numpy array
+        coords = self.chain.copy()
+        mt.wrap(coords, self.box)
+        mt.makeWhole(coords, self.box, numpy.array(self.bonds[::-1])[:, ::-1])
+        self.assertWhole(coords, self.chain, self.box)
+
+
+    def test_molecules(self):
+
+        # Small molecules, given as sets of atoms
+        rng = numpy.random.RandomState(9)
+        water = numpy.array([[0.0, 0.0, 0.0], [0.96, 0.0, 0.0], [-0.24, 0.93, 0.0]])
+        centers = rng.uniform(0, 8, (5, 3))
+        coords = numpy.concatenate([ water + c for c in centers ])
+        reference = coords.copy()
+        mt.wrap(coords, numpy.diag(self.box))
+        molecules = [ {3*i + 2, 3*i, 3*i + 1} for i in range(5) ]
+        mt.makeWhole(coords, numpy.diag(self.box), molecules)
+        for i in range(5):
+            self.assertWhole(coords[3*i:3*i+3], reference[3*i:3*i+3], numpy.diag(numpy.diag(self.box)))
+
+
+    def test_read(self):
+
+        traj = mt.Trajectory(self.testDir + '/3wat.xyz')
+        bonds = mt.findBonds(traj.symbols, traj.read().coordinates)
+
+        # Molecules are whole, but far out of the box
+        traj = mt.Trajectory(self.testDir + '/wrap_atoms.xyz')
+        reference = traj.read().coordinates
+        traj = mt.Trajectory(self.testDir + '/wrap_atoms.xyz')
+        box = numpy.array([5.0, 5.0, 5.0])
+        self.assertRaises(RuntimeError, traj.read, whole=bonds)
+        frame = traj.read(wrap=True, box=box, whole=bonds)
+        for i in range(3):
+            self.assertWhole(frame.coordinates[3*i:3*i+3], reference[3*i:3*i+3], numpy.diag(box))
+
+        # Bonds added to the same list are taken into account
+        traj = mt.Trajectory([self.testDir + '/wrap_atoms.xyz'] * 2)
+        partial = bonds[:2]
+        traj.read(wrap=True, box=box, whole=partial)
+        partial.extend(bonds[2:])
+        frame = traj.read(wrap=True, box=box, whole=partial)
+        for i in range(3):
+            self.assertWhole(frame.coordinates[3*i:3*i+3], reference[3*i:3*i+3], numpy.diag(box))
+
+        # And so are bonds replaced in place, in a list or an array
+        for changed in (list(bonds), numpy.array(bonds)):
+            traj = mt.Trajectory([self.testDir + '/wrap_atoms.xyz'] * 2)
+            changed[4:] = [(0, 1), (0, 2)]
+            traj.read(wrap=True, box=box, whole=changed)
+            changed[4:] = bonds[4:]
+            frame = traj.read(wrap=True, box=box, whole=changed)
+            for i in range(3):
+                self.assertWhole(frame.coordinates[3*i:3*i+3], reference[3*i:3*i+3], numpy.diag(box))
+
+
+    def test_errors(self):
+
+        coords = self.chain.copy()
+        self.assertRaises(IndexError, mt.makeWhole, coords, self.box, [(0, self.nChain)])
+        self.assertRaises(TypeError, mt.makeWhole, coords, self.box, [0, 1])
+        self.assertRaises(ValueError, mt.makeWhole, coords[:, :2].copy(), self.box, self.bonds)
+        self.assertRaises(ValueError, mt.makeWhole, coords, numpy.zeros(3), self.bonds)
+
+
+if __name__ == '__main__':
+    unittest.main()